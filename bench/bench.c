@@ -0,0 +1,328 @@
+/*
+ * The bench target's harness: compile times per phase and peak memory
+ * for each file, and wall time and peak memory of compiled workloads.
+ *
+ *   tiger_bench [-n RUNS] [-O LEVEL] [-o OUT] [-t TIGERC]
+ *               [-r PROG.tig[:INPUT]]... file.tig...
+ *
+ * Each file is compiled RUNS times (default 3) in a child process, the
+ * whole pipeline through emit_program() with the output discarded; the
+ * best time of each phase is reported, with the bytes it allocated and
+ * the child's peak RSS.  Each -r program is compiled by TIGERC and run
+ * RUNS times with stdin from INPUT, or from /dev/null, under an
+ * unlimited stack: the best wall time and the largest peak RSS are
+ * reported.  Results are written as JSON
+ * to OUT (default stdout) and summed up as a table on stderr.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "closure.h"
+#include "diag.h"
+#include "emit.h"
+#include "escape.h"
+#include "lexer.h"
+#include "opt.h"
+#include "parser.h"
+#include "phase.h"
+#include "semant.h"
+#include "source.h"
+
+typedef struct Result {
+    int ok;                 /* 0: could not open, 1: diagnostics, 2: compiled */
+    uint32_t bytes, tokens;
+    PhaseStats st[PHASE_COUNT];
+} Result;
+
+typedef struct Job {
+    const char *path;
+    int opt, runs;
+    Result r;
+} Job;
+
+static double now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+/* One compile of `path`; diagnostics are discarded. */
+static void compile_once(const char *path, int opt, Result *r, FILE *null)
+{
+    Source src;
+    if (!source_open(&src, path)) {
+        r->ok = 0;
+        return;
+    }
+    r->ok = 1;
+    r->bytes = src.len;
+    phase_reset();
+    int errors = diag_errors;
+    phase_enter(PHASE_LEX);
+    TokenVec toks = {0};
+    lex_all(&src, &toks);
+    r->tokens = toks.len;
+    phase_enter(PHASE_PARSE);
+    Ast ast;
+    ast_init(&ast, &src, toks.len);
+    if (diag_errors == errors && parse_program(&ast, &toks, PARSE_AUTO)) {
+        phase_enter(PHASE_SEMANT);
+        Sema sema;
+        if (sema_check(&sema, &ast, ENV_UNDO)) {
+            phase_enter(PHASE_ESCAPE);
+            escape_find(&sema);
+            closure_convert(&sema, NULL);
+            phase_enter(PHASE_IR);
+            Program prog;
+            InlineParams inl = INLINE_DEFAULTS;
+            temp_reset();
+            translate_program(&prog, &sema, false, NULL);
+            opt_program(&prog, opt, &inl, NULL);
+            emit_program(&prog, opt >= 2 ? RA_IRC : RA_LINEAR, NULL, null);
+            phase_enter(PHASE_OTHER);
+            program_free(&prog);
+            r->ok = 2;
+        }
+        phase_enter(PHASE_OTHER);
+        sema_free(&sema);
+    }
+    phase_enter(PHASE_OTHER);
+    phase_stats(r->st);
+    diag_flush(null);
+    ast_free(&ast);
+    vec_free(&toks);
+    source_close(&src);
+}
+
+/* The runs of a job, keeping the best time of each phase.  Deep
+   declaration batches recurse deeply, so this runs on a thread with a
+   large stack. */
+static void *compile_runs(void *arg)
+{
+    Job *j = arg;
+    FILE *null = fopen("/dev/null", "w");
+    if (!null)
+        fatal("cannot open /dev/null");
+    symtab_init();
+    for (int k = 0; k < j->runs; k++) {
+        Result r;
+        compile_once(j->path, j->opt, &r, null);
+        if (k == 0 || r.ok < j->r.ok) {
+            j->r = r;
+            continue;
+        }
+        for (int p = 0; p < PHASE_COUNT; p++)
+            if (r.st[p].ns < j->r.st[p].ns)
+                j->r.st[p].ns = r.st[p].ns;
+    }
+    fclose(null);
+    return NULL;
+}
+
+/* Compile `path` in a child; fills `r` and returns the child's peak RSS
+   in KiB, or -1 if it did not finish. */
+static long bench_compile(const char *path, int opt, int runs, Result *r)
+{
+    int fds[2];
+    if (pipe(fds) != 0)
+        fatal("pipe: %s", strerror(errno));
+    pid_t pid = fork();
+    if (pid < 0)
+        fatal("fork: %s", strerror(errno));
+    if (pid == 0) {
+        close(fds[0]);
+        Job j = { path, opt, runs, { 0 } };
+        pthread_attr_t attr;
+        pthread_t t;
+        pthread_attr_init(&attr);
+        pthread_attr_setstacksize(&attr, (size_t)1 << 30);
+        if (pthread_create(&t, &attr, compile_runs, &j) != 0)
+            _exit(3);
+        pthread_join(t, NULL);
+        _exit(write(fds[1], &j.r, sizeof j.r) == sizeof j.r ? 0 : 3);
+    }
+    close(fds[1]);
+    ssize_t n = read(fds[0], r, sizeof *r);
+    close(fds[0]);
+    int status;
+    struct rusage ru;
+    if (wait4(pid, &status, 0, &ru) < 0 || n != sizeof *r || !WIFEXITED(status) ||
+        WEXITSTATUS(status))
+        return -1;
+    return ru.ru_maxrss;
+}
+
+/* Run argv with stdin from `input`; returns its exit status (or -1 if
+   it could not run, 128 + N for signal N) and sets *ms and *rss. */
+static int run(char *const *argv, const char *input, bool quiet, double *ms, long *rss)
+{
+    double t0 = now_ms();
+    pid_t pid = fork();
+    if (pid < 0)
+        fatal("fork: %s", strerror(errno));
+    if (pid == 0) {
+        int in = open(input ? input : "/dev/null", O_RDONLY);
+        int null = open("/dev/null", O_WRONLY);
+        if (in < 0 || null < 0)
+            _exit(127);
+        dup2(in, 0);
+        if (quiet)
+            dup2(null, 1);
+        struct rlimit rl = { RLIM_INFINITY, RLIM_INFINITY };
+        setrlimit(RLIMIT_STACK, &rl);
+        execvp(argv[0], argv);
+        _exit(127);
+    }
+    int status;
+    struct rusage ru;
+    if (wait4(pid, &status, 0, &ru) < 0)
+        return -1;
+    *ms = now_ms() - t0;
+    *rss = ru.ru_maxrss;
+    if (WIFSIGNALED(status))
+        return 128 + WTERMSIG(status);
+    return WEXITSTATUS(status) == 127 ? -1 : WEXITSTATUS(status);
+}
+
+static void json_string(FILE *out, const char *s)
+{
+    fputc('"', out);
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\')
+            fprintf(out, "\\%c", *s);
+        else if ((unsigned char)*s < 32)
+            fprintf(out, "\\u%04x", *s);
+        else
+            fputc(*s, out);
+    }
+    fputc('"', out);
+}
+
+static noreturn void usage(void)
+{
+    fprintf(stderr, "usage: tiger_bench [-n RUNS] [-O LEVEL] [-o OUT] [-t TIGERC]\n"
+                    "                   [-r PROG.tig[:INPUT]]... file.tig...\n");
+    exit(2);
+}
+
+int main(int argc, char **argv)
+{
+    int runs = 3, opt = 2;
+    const char *out_path = NULL, *tigerc = "tigerc";
+    VEC(char *) progs = {0};
+    VEC(const char *) files = {0};
+    for (int i = 1; i < argc; i++) {
+        const char *a = argv[i];
+        if (a[0] != '-') {
+            vec_push(&files, a);
+            continue;
+        }
+        if (!a[1] || a[2] || i + 1 == argc)
+            usage();
+        const char *v = argv[++i];
+        switch (a[1]) {
+        case 'n': runs = atoi(v); break;
+        case 'O': opt = atoi(v); break;
+        case 'o': out_path = v; break;
+        case 't': tigerc = v; break;
+        case 'r': vec_push(&progs, xstrdup(v)); break;
+        default: usage();
+        }
+    }
+    if (runs < 1 || opt < 0 || opt > 2 || (!files.len && !progs.len))
+        usage();
+    FILE *out = out_path ? fopen(out_path, "w") : stdout;
+    if (!out) {
+        fprintf(stderr, "tiger_bench: cannot write '%s': %s\n", out_path, strerror(errno));
+        return 2;
+    }
+
+    fprintf(out, "{\n  \"opt\": %d,\n  \"runs\": %d,\n  \"compile\": [", opt, runs);
+    fprintf(stderr, "%-36s", "file");
+    for (int p = PHASE_LEX; p < PHASE_COUNT; p++)
+        fprintf(stderr, " %8s", phase_names[p]);
+    fprintf(stderr, " %9s %9s\n", "total ms", "rss KiB");
+    for (uint32_t i = 0; i < files.len; i++) {
+        Result r;
+        long rss = bench_compile(files.data[i], opt, runs, &r);
+        fprintf(out, "%s\n    {\"file\": ", i ? "," : "");
+        json_string(out, files.data[i]);
+        const char *name = strrchr(files.data[i], '/');
+        fprintf(stderr, "%-36s", name ? name + 1 : files.data[i]);
+        if (rss < 0 || !r.ok) {
+            fputs(", \"status\": \"failed\"}", out);
+            fputs(" failed\n", stderr);
+            continue;
+        }
+        fprintf(out, ", \"status\": \"%s\", \"bytes\": %u, \"tokens\": %u, \"ms\": {",
+                r.ok == 2 ? "ok" : "diagnostics", r.bytes, r.tokens);
+        double total = 0;
+        for (int p = PHASE_LEX; p < PHASE_COUNT; p++) {
+            double ms = r.st[p].ns / 1e6;
+            total += ms;
+            fprintf(out, "%s\"%s\": %.3f", p > PHASE_LEX ? ", " : "", phase_names[p], ms);
+            fprintf(stderr, " %8.3f", ms);
+        }
+        fputs("}, \"alloc_bytes\": {", out);
+        for (int p = PHASE_LEX; p < PHASE_COUNT; p++)
+            fprintf(out, "%s\"%s\": %" PRIu64, p > PHASE_LEX ? ", " : "", phase_names[p],
+                    r.st[p].bytes);
+        fprintf(out, "}, \"total_ms\": %.3f, \"peak_rss_kb\": %ld}", total, rss);
+        fprintf(stderr, " %9.3f %9ld\n", total, rss);
+    }
+    fputs(files.len ? "\n  ],\n  \"run\": [" : "],\n  \"run\": [", out);
+
+    char exe[] = "/tmp/tiger_benchXXXXXX";
+    int fd = mkstemp(exe);
+    if (fd < 0)
+        fatal("mkstemp: %s", strerror(errno));
+    close(fd);
+    for (uint32_t i = 0; i < progs.len; i++) {
+        char *prog = progs.data[i], *input = strchr(prog, ':');
+        if (input)
+            *input++ = '\0';
+        char level[4];
+        snprintf(level, sizeof level, "-O%d", opt);
+        char *cc[] = { (char *)tigerc, level, "-o", exe, prog, NULL };
+        char *ex[] = { exe, NULL };
+        double ms, best = 0;
+        long rss, peak = 0;
+        int status = run(cc, NULL, false, &ms, &rss);
+        for (int k = 0; status == 0 && k < runs; k++) {
+            status = run(ex, input, true, &ms, &rss);
+            if (k == 0 || ms < best)
+                best = ms;
+            if (rss > peak)
+                peak = rss;
+        }
+        fprintf(out, "%s\n    {\"program\": ", i ? "," : "");
+        json_string(out, prog);
+        fputs(", \"input\": ", out);
+        if (input)
+            json_string(out, input);
+        else
+            fputs("null", out);
+        fprintf(out, ", \"exit\": %d, \"ms\": %.3f, \"peak_rss_kb\": %ld}", status, best, peak);
+        const char *name = strrchr(prog, '/');
+        fprintf(stderr, "run %-32s %9.3f ms %9ld KiB%s\n", name ? name + 1 : prog, best, peak,
+                status ? " (failed)" : "");
+        free(prog);
+    }
+    unlink(exe);
+    fputs(progs.len ? "\n  ]\n}\n" : "]\n}\n", out);
+    if (out != stdout)
+        fclose(out);
+    vec_free(&progs);
+    vec_free(&files);
+    return 0;
+}
@@ -0,0 +1,85 @@
+/*
+ * Times the type checker with each scope environment representation.
+ *
+ *   bench_env [-n RUNS] file.tig...
+ *
+ * Every file is lexed and parsed once, then checked RUNS times per
+ * environment kind; the best run is reported.  Semantic errors are
+ * reported once per run and do not stop the benchmark.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "diag.h"
+#include "lexer.h"
+#include "parser.h"
+#include "semant.h"
+#include "source.h"
+
+static double now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+int main(int argc, char **argv)
+{
+    int runs = 20;
+    int first = 1;
+    if (argc > 2 && strcmp(argv[1], "-n") == 0) {
+        runs = atoi(argv[2]);
+        first = 3;
+    }
+    if (first >= argc || runs < 1) {
+        fprintf(stderr, "usage: bench_env [-n RUNS] file.tig...\n");
+        return 2;
+    }
+
+    static const struct { EnvKind kind; const char *name; } kinds[] = {
+        { ENV_UNDO, "undo" },
+        { ENV_HAMT, "hamt" },
+    };
+
+    symtab_init();
+    printf("%-32s %10s %10s\n", "file", kinds[0].name, kinds[1].name);
+    for (int i = first; i < argc; i++) {
+        Source src;
+        if (!source_open(&src, argv[i])) {
+            perror(argv[i]);
+            return 2;
+        }
+        int errors = diag_errors;
+        TokenVec toks = {0};
+        lex_all(&src, &toks);
+        Ast ast;
+        ast_init(&ast, &src, toks.len);
+        if (diag_errors != errors || !parse_program(&ast, &toks, PARSE_AUTO)) {
+            diag_flush(stderr);
+            return 1;
+        }
+
+        printf("%-32s", argv[i]);
+        for (size_t k = 0; k < ARRAY_LEN(kinds); k++) {
+            double best = 1e300;
+            for (int r = 0; r < runs; r++) {
+                Sema sema;
+                double t0 = now_ms();
+                sema_check(&sema, &ast, kinds[k].kind);
+                double t = now_ms() - t0;
+                sema_free(&sema);
+                if (t < best)
+                    best = t;
+            }
+            printf(" %8.3fms", best);
+        }
+        putchar('\n');
+        diag_flush(stderr);
+        ast_free(&ast);
+        vec_free(&toks);
+        source_close(&src);
+    }
+    return 0;
+}
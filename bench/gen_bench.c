@@ -0,0 +1,97 @@
+/*
+ * Writes the scaled workloads of the bench target:
+ *
+ *   gen_bench queens N > out.tig        count the solutions of N-queens
+ *   gen_bench merge-input N > out.in    N integers for test/merge.tig
+ *   gen_bench let N > out.tig           one let of N declarations
+ *
+ * The merge input is two sorted lists, the odd and the even numbers,
+ * in the format test/merge.in uses.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static void queens(long n)
+{
+    printf("let\n"
+           "    var N := %ld\n"
+           "    type intArray = array of int\n"
+           "    var row := intArray [N] of 0\n"
+           "    var col := intArray [N] of 0\n"
+           "    var diag1 := intArray [N+N-1] of 0\n"
+           "    var diag2 := intArray [N+N-1] of 0\n"
+           "    var count := 0\n"
+           "\n"
+           "    function printint(i: int) =\n"
+           "        if i > 9 then (printint(i / 10); print(chr(i - i / 10 * 10 + ord(\"0\"))))\n"
+           "        else print(chr(i + ord(\"0\")))\n"
+           "\n"
+           "    function try(c: int) =\n"
+           "        if c = N then count := count + 1\n"
+           "        else for r := 0 to N-1\n"
+           "            do if row[r]=0 & diag1[r+c]=0 & diag2[r+N-1-c]=0\n"
+           "                then (row[r]:=1; diag1[r+c]:=1; diag2[r+N-1-c]:=1;\n"
+           "                      col[c]:=r;\n"
+           "                      try(c+1);\n"
+           "                      row[r]:=0; diag1[r+c]:=0; diag2[r+N-1-c]:=0)\n"
+           "in try(0); printint(count); print(\"\\n\")\n"
+           "end\n",
+           n);
+}
+
+static void merge_input(long n)
+{
+    for (int odd = 1; odd >= 0; odd--) {
+        for (long i = 0; i < n; i++)
+            if ((i & 1) == odd)
+                printf("%ld ", i);
+        printf(";\n");
+    }
+}
+
+/* Arrays types, variables of them, functions over the variables and
+   variables set from the functions, in turn. */
+static void let_block(long n)
+{
+    printf("let\n");
+    for (long i = 0; i < n; i++) {
+        switch (i % 4) {
+        case 0:
+            printf("type t%ld = array of int\n", i);
+            break;
+        case 1:
+            printf("var v%ld := t%ld[4] of %ld\n", i, i - 1, i % 100);
+            break;
+        case 2:
+            printf("function f%ld(x: int): int = if x > 0 then v%ld[x - x / 4 * 4] + x else %ld\n",
+                   i, i - 1, i % 10);
+            break;
+        case 3:
+            printf("var w%ld := f%ld(%ld)\n", i, i - 1, i % 7);
+            break;
+        }
+    }
+    printf("in print(\"ok\\n\") end\n");
+}
+
+int main(int argc, char **argv)
+{
+    if (argc != 3) {
+        fprintf(stderr, "usage: gen_bench queens|merge-input|let N\n");
+        return 2;
+    }
+    const char *kind = argv[1];
+    long n = strtol(argv[2], NULL, 10);
+    if (strcmp(kind, "queens") == 0)
+        queens(n);
+    else if (strcmp(kind, "merge-input") == 0)
+        merge_input(n);
+    else if (strcmp(kind, "let") == 0)
+        let_block(n);
+    else {
+        fprintf(stderr, "gen_bench: unknown kind '%s'\n", kind);
+        return 2;
+    }
+    return 0;
+}
@@ -0,0 +1,822 @@
+#include "gc.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#ifdef __x86_64__
+#include <immintrin.h>
+#endif
+
+#include "runtime.h"
+
+/* Written by the compiler; see emit_gc_tables(). */
+extern const uint64_t tiger_frametable[];
+extern const uint64_t tiger_roots[];
+
+uintptr_t tiger_card_bias;
+
+enum {
+    HDR_TAG = 1,            /* in every header; clear once forwarded */
+    HDR_MARK = 2,
+    HDR_PIN = 4,
+    HDR_REMEMBER = 8,       /* an old record every minor collection scans */
+    HDR_KIND_SHIFT = 4,
+    HDR_NPTRS_SHIFT = 8,
+    HDR_WORDS_SHIFT = 32,
+};
+
+#define WORD 8
+#define CARD ((size_t)1 << GC_CARD_SHIFT)
+#define NCLASS 32           /* exact free lists up to this many words */
+#define NOINLINE __attribute__((noinline))
+
+typedef struct Span {
+    char *lo, *hi;
+} Span;
+
+typedef struct PtrVec {
+    uint64_t **data;
+    size_t len, cap;
+} PtrVec;
+
+static struct {
+    char *base, *end;       /* the reservation: nursery, then old space */
+    char *nursery_end;
+    size_t nursery_size;
+    char *alloc, *limit;    /* the nursery fragment being bumped */
+    Span *frags;            /* free stretches between pinned objects */
+    size_t nfrags, frag;
+    char *old_cur, *old_lim;        /* the old chunk being bumped */
+    char *old_hw;           /* end of the highest old object so far */
+    uint64_t *small[NCLASS + 1];    /* free chunks by size in words */
+    uint64_t *large;        /* larger free chunks, in address order */
+    size_t old_used, old_threshold;
+    uint64_t *starts;       /* a bit per word: an object starts there */
+    uint64_t *cards;        /* a word per card: it may hold a young pointer */
+    char *stack_base;
+    void *const *extra_lo;  /* a second stack: from *extra_lo to extra_hi */
+    char *extra_hi;
+    PtrVec precise;         /* frame slots holding pointers, in address order */
+    PtrVec pinned, work, remembered;
+
+    bool stats;
+    unsigned minors, majors;
+    uint64_t allocated, promoted;
+    uint64_t pause_ns, max_pause_ns, start_ns;
+} gc;
+
+static void oom(void)
+{
+    tiger_flush();
+    fputs("tiger: out of memory\n", stderr);
+    exit(1);
+}
+
+static void push(PtrVec *v, uint64_t *p)
+{
+    if (v->len == v->cap) {
+        v->cap = v->cap ? 2 * v->cap : 256;
+        v->data = realloc(v->data, v->cap * sizeof *v->data);
+        if (!v->data)
+            oom();
+    }
+    v->data[v->len++] = p;
+}
+
+static int by_address(const void *a, const void *b)
+{
+    uintptr_t x = (uintptr_t)*(uint64_t *const *)a, y = (uintptr_t)*(uint64_t *const *)b;
+    return x < y ? -1 : x > y;
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+/* ---- Headers and the start bitmap --------------------------------------- */
+
+static uint64_t hdr(ObjKind k, size_t words, size_t nptrs)
+{
+    return HDR_TAG | (uint64_t)k << HDR_KIND_SHIFT | (uint64_t)nptrs << HDR_NPTRS_SHIFT |
+           (uint64_t)words << HDR_WORDS_SHIFT;
+}
+
+static ObjKind kind_of(uint64_t h) { return (ObjKind)(h >> HDR_KIND_SHIFT & 7); }
+static size_t words_of(uint64_t h) { return h >> HDR_WORDS_SHIFT; }
+static size_t nptrs_of(uint64_t h) { return h >> HDR_NPTRS_SHIFT & 0xffffff; }
+static size_t size_of(const uint64_t *h) { return (words_of(*h) + 1) * WORD; }
+
+/* The header an object has now: its copy's, once it is forwarded. */
+static uint64_t header(const uint64_t *h)
+{
+    return *h & HDR_TAG ? *h : *(const uint64_t *)*h;
+}
+
+static size_t widx(const void *p)
+{
+    return (size_t)((const char *)p - gc.base) / WORD;
+}
+
+static void set_start(const void *p)
+{
+    size_t i = widx(p);
+    gc.starts[i / 64] |= 1ull << i % 64;
+}
+
+static void clear_start(const void *p)
+{
+    size_t i = widx(p);
+    gc.starts[i / 64] &= ~(1ull << i % 64);
+}
+
+static bool has_start(const void *p)
+{
+    size_t i = widx(p);
+    return gc.starts[i / 64] >> i % 64 & 1;
+}
+
+/* The last object starting at or before `p`, but not before `lo`. */
+static uint64_t *find_start(const char *p, const char *lo)
+{
+    size_t i = widx(p), stop = widx(lo), w = i / 64;
+    uint64_t bits = gc.starts[w] & (~0ull >> (63 - i % 64));
+    while (!bits) {
+        if (w * 64 <= stop)
+            return NULL;
+        bits = gc.starts[--w];
+    }
+    size_t j = w * 64 + 63 - (size_t)__builtin_clzll(bits);
+    return j < stop ? NULL : (uint64_t *)(gc.base + j * WORD);
+}
+
+/* The object that `p`, a pointer as compiled code holds it, points to:
+   just past the header, or past the length word of a string or array.  NULL if
+   `p` is no such pointer into [lo, hi]. */
+static uint64_t *object_at(const char *p, const char *lo, const char *hi)
+{
+    if (p < lo + WORD || p > hi || (uintptr_t)p % WORD)
+        return NULL;
+    uint64_t *h = (uint64_t *)p - 1;
+    if (has_start(h)) {
+        ObjKind k = kind_of(header(h));
+        return k == OBJ_RECORD ? h : NULL;
+    }
+    h--;
+    if ((char *)h >= lo && has_start(h)) {
+        ObjKind k = kind_of(header(h));
+        return k == OBJ_DATA || k == OBJ_ARRAY || k == OBJ_PTR_ARRAY ? h : NULL;
+    }
+    return NULL;
+}
+
+/* The pointer fields of `h`: [*lo, *hi). */
+static void fields(uint64_t *h, uint64_t **lo, uint64_t **hi)
+{
+    switch (kind_of(*h)) {
+    case OBJ_RECORD:
+        *lo = h + 1;
+        *hi = h + 1 + nptrs_of(*h);
+        return;
+    case OBJ_PTR_ARRAY:
+        *lo = h + 2;
+        *hi = h + 1 + words_of(*h);
+        return;
+    default:
+        *lo = *hi = h + 1;
+        return;
+    }
+}
+
+static bool young(uint64_t v)
+{
+    return (char *)v > gc.base && (char *)v <= gc.nursery_end;
+}
+
+static size_t card_of(const void *p)
+{
+    return (size_t)((const char *)p - gc.base) >> GC_CARD_SHIFT;
+}
+
+void gc_write(void *lo, void *hi)
+{
+    if (lo < hi)
+        for (size_t c = card_of(lo); c <= card_of((char *)hi - 1); c++)
+            gc.cards[c] = 1;
+}
+
+/* ---- Old space ------------------------------------------------------------ */
+
+static void free_chunk(char *lo, char *hi)
+{
+    uint64_t *h = (uint64_t *)lo;
+    size_t words = (size_t)(hi - lo) / WORD;
+    *h = hdr(OBJ_FREE, words - 1, 0);
+    set_start(h);
+}
+
+static void push_free(uint64_t *h)
+{
+    size_t words = words_of(*h) + 1;
+    if (words < 2)
+        return;             /* too small to link; a sweep merges it */
+    if (words <= NCLASS) {
+        h[1] = (uint64_t)gc.small[words];
+        gc.small[words] = h;
+    } else {
+        h[1] = (uint64_t)gc.large;
+        gc.large = h;
+    }
+}
+
+/* Give up the rest of the chunk being bumped and take the first large
+   free chunk that holds `bytes`. */
+static void refill(size_t bytes)
+{
+    if (gc.old_cur < gc.old_lim)
+        push_free((uint64_t *)gc.old_cur);
+    for (uint64_t **l = &gc.large; *l; l = (uint64_t **)&(*l)[1]) {
+        uint64_t *h = *l;
+        if (size_of(h) >= bytes) {
+            *l = (uint64_t *)h[1];
+            gc.old_cur = (char *)h;
+            gc.old_lim = (char *)h + size_of(h);
+            return;
+        }
+    }
+    oom();
+}
+
+/* `bytes` of old space, with the start bit set and no header yet. */
+static uint64_t *old_alloc(size_t bytes)
+{
+    size_t words = bytes / WORD;
+    uint64_t *h;
+    if (words <= NCLASS && gc.small[words]) {
+        h = gc.small[words];
+        gc.small[words] = (uint64_t *)h[1];
+    } else {
+        if ((size_t)(gc.old_lim - gc.old_cur) < bytes)
+            refill(bytes);
+        h = (uint64_t *)gc.old_cur;
+        gc.old_cur += bytes;
+        if (gc.old_cur < gc.old_lim)
+            free_chunk(gc.old_cur, gc.old_lim);
+        if (gc.old_cur > gc.old_hw)
+            gc.old_hw = gc.old_cur;
+    }
+    set_start(h);
+    gc.old_used += bytes;
+    return h;
+}
+
+/* ---- Roots ---------------------------------------------------------------- */
+
+/* The frame table entry {start, end, slots, nslots} of the function
+   holding return address `ra`, or NULL. */
+static const uint64_t *frame_desc(uintptr_t ra)
+{
+    size_t lo = 0, hi = tiger_frametable[0];
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        const uint64_t *d = &tiger_frametable[1 + 4 * mid];
+        if (ra < d[0])
+            hi = mid;
+        else if (ra >= d[1])
+            lo = mid + 1;
+        else
+            return d;
+    }
+    return NULL;
+}
+
+/* Walk the %rbp chain up to the stack base and collect the frame slots
+   the compiler knows hold pointers.  The runtime keeps frame pointers,
+   so the chain is unbroken from here into compiled code. */
+static NOINLINE void find_frames(void)
+{
+    gc.precise.len = 0;
+    if (!tiger_frametable[0])
+        return;             /* no compiled code: the chain may not exist */
+    void **fp = __builtin_frame_address(0);
+    while ((char *)fp < gc.stack_base) {
+        void **next = fp[0];
+        const uint64_t *d = frame_desc((uintptr_t)fp[1]);
+        if (d)
+            for (uint64_t k = 0; k < d[3]; k++)
+                push(&gc.precise, (uint64_t *)((char *)next + (int64_t)((const uint64_t *)d[2])[k]));
+        if (next <= fp)
+            break;
+        fp = next;
+    }
+    qsort(gc.precise.data, gc.precise.len, sizeof *gc.precise.data, by_address);
+}
+
+/* Pass every word of the stack from `sp` up that is not a precise slot
+   to `visit`, and then every word of the second stack. */
+static void scan_conservative(char *sp, void (*visit)(uint64_t))
+{
+    size_t j = 0;
+    for (uint64_t *w = (uint64_t *)((uintptr_t)sp & ~(uintptr_t)(WORD - 1));
+         (char *)w < gc.stack_base; w++) {
+        while (j < gc.precise.len && gc.precise.data[j] < w)
+            j++;
+        if (j < gc.precise.len && gc.precise.data[j] == w)
+            continue;
+        visit(*w);
+    }
+    if (gc.extra_lo)
+        for (uint64_t *w = *gc.extra_lo; (char *)w < gc.extra_hi; w++)
+            visit(*w);
+}
+
+void gc_add_stack(void *const *lo, void *hi)
+{
+    gc.extra_lo = lo;
+    gc.extra_hi = hi;
+}
+
+static void each_precise(uint64_t (*f)(uint64_t))
+{
+    for (uint64_t i = 0; i < tiger_roots[0]; i++) {
+        uint64_t *g = (uint64_t *)tiger_roots[1 + i];
+        *g = f(*g);
+    }
+    for (size_t i = 0; i < gc.precise.len; i++)
+        *gc.precise.data[i] = f(*gc.precise.data[i]);
+}
+
+/* ---- Minor collection ----------------------------------------------------- */
+
+/* Pin the nursery object that `v` points into or just past. */
+static void pin_word(uint64_t v)
+{
+    char *p = (char *)v;
+    if (p <= gc.base || p > gc.nursery_end)
+        return;
+    uint64_t *h = find_start(p - 1, gc.base);
+    if (h && p <= (char *)h + size_of(h) && !(*h & HDR_PIN)) {
+        *h |= HDR_PIN;
+        push(&gc.pinned, h);
+    }
+}
+
+/* Where the object `v` points to lives after this collection, copying
+   it to the old space unless it is pinned or has moved already. */
+static uint64_t forward(uint64_t v)
+{
+    char *p = (char *)v;
+    uint64_t *h = object_at(p, gc.base, gc.nursery_end);
+    if (!h)
+        return v;
+    if (!(*h & HDR_TAG))
+        return *h + (uint64_t)(p - (char *)h);
+    if (*h & HDR_PIN)
+        return v;
+    size_t bytes = size_of(h);
+    uint64_t *n = old_alloc(bytes);
+    memcpy(n, h, bytes);
+    *h = (uint64_t)n;
+    push(&gc.work, n);
+    gc.promoted += bytes;
+    return (uint64_t)n + (uint64_t)(p - (char *)h);
+}
+
+/* Forward the fields of `h`, or of those in [lo, hi) only, and say
+   whether any still points into the nursery (at a pinned object). */
+static bool scan_range(uint64_t *h, const char *lo, const char *hi)
+{
+    uint64_t *a, *b;
+    bool left = false;
+    fields(h, &a, &b);
+    if ((char *)a < lo)
+        a = (uint64_t *)lo;
+    if ((char *)b > hi)
+        b = (uint64_t *)hi;
+    for (; a < b; a++) {
+        *a = forward(*a);
+        left |= young(*a);
+    }
+    return left;
+}
+
+/* Forward the fields of old object `h`, keeping the cards of those that
+   still point into the nursery dirty. */
+static void scan_old(uint64_t *h)
+{
+    uint64_t *a, *b;
+    fields(h, &a, &b);
+    for (; a < b; a++) {
+        *a = forward(*a);
+        if (young(*a))
+            gc.cards[card_of(a)] = 1;
+    }
+}
+
+static void scan_cards(void)
+{
+    if (gc.old_hw <= gc.nursery_end)
+        return;
+    size_t c1 = card_of(gc.old_hw - 1) + 1;
+    uint64_t *h = NULL;
+    char *hend = NULL;
+    for (size_t c = card_of(gc.nursery_end); c < c1; c++) {
+        if (!gc.cards[c])
+            continue;
+        gc.cards[c] = 0;
+        char *cs = gc.base + c * CARD, *ce = cs + CARD;
+        if (!h || (char *)h > cs || hend <= cs)
+            h = find_start(cs, gc.nursery_end);
+        while ((char *)h < ce) {
+            hend = (char *)h + size_of(h);
+            if (scan_range(h, cs, ce))
+                gc.cards[c] = 1;
+            if (hend > ce)
+                break;
+            h = (uint64_t *)hend;
+        }
+    }
+}
+
+static void add_frag(char *lo, char *hi, size_t *cap)
+{
+    if (hi - lo < 4 * WORD)
+        return;
+    if (gc.nfrags == *cap) {
+        *cap = *cap ? 2 * *cap : 16;
+        gc.frags = realloc(gc.frags, *cap * sizeof *gc.frags);
+        if (!gc.frags)
+            oom();
+    }
+    memset(lo, 0, (size_t)(hi - lo));
+    gc.frags[gc.nfrags++] = (Span){ lo, hi };
+}
+
+/* Empty the nursery around the pinned objects. */
+static void reset_nursery(void)
+{
+    static size_t cap;
+    memset(gc.starts, 0, gc.nursery_size / (64 * WORD) * sizeof *gc.starts);
+    memset(gc.cards, 0, (gc.nursery_size >> GC_CARD_SHIFT) * sizeof *gc.cards);
+    qsort(gc.pinned.data, gc.pinned.len, sizeof *gc.pinned.data, by_address);
+    gc.nfrags = 0;
+    char *lo = gc.base;
+    for (size_t i = 0; i < gc.pinned.len; i++) {
+        uint64_t *h = gc.pinned.data[i];
+        *h &= ~(uint64_t)HDR_PIN;
+        set_start(h);
+        add_frag(lo, (char *)h, &cap);
+        lo = (char *)h + size_of(h);
+    }
+    add_frag(lo, gc.nursery_end, &cap);
+    gc.frag = 0;
+    gc.alloc = gc.nfrags ? gc.frags[0].lo : NULL;
+    gc.limit = gc.nfrags ? gc.frags[0].hi : NULL;
+}
+
+static void minor(char *sp)
+{
+    gc.pinned.len = gc.work.len = 0;
+    scan_conservative(sp, pin_word);
+    each_precise(forward);
+    for (size_t i = 0; i < gc.remembered.len; i++)
+        scan_old(gc.remembered.data[i]);
+    scan_cards();
+    for (size_t i = 0; i < gc.pinned.len; i++)
+        scan_range(gc.pinned.data[i], gc.base, gc.nursery_end + WORD);
+    while (gc.work.len)
+        scan_old(gc.work.data[--gc.work.len]);
+    reset_nursery();
+    gc.minors++;
+}
+
+/* ---- Major collection ----------------------------------------------------- */
+
+static void mark(uint64_t *h)
+{
+    if (!(*h & HDR_MARK)) {
+        *h |= HDR_MARK;
+        push(&gc.work, h);
+    }
+}
+
+static uint64_t mark_value(uint64_t v)
+{
+    uint64_t *h = object_at((char *)v, gc.nursery_end, gc.old_hw);
+    if (h)
+        mark(h);
+    return v;
+}
+
+static void mark_word(uint64_t v)
+{
+    char *p = (char *)v;
+    if (p <= gc.nursery_end || p > gc.old_hw)
+        return;
+    uint64_t *h = find_start(p - 1, gc.nursery_end);
+    if (h && kind_of(*h) != OBJ_FREE && p <= (char *)h + size_of(h))
+        mark(h);
+}
+
+static void mark_fields(uint64_t *h)
+{
+    uint64_t *a, *b;
+    fields(h, &a, &b);
+    for (; a < b; a++)
+        mark_value(*a);
+}
+
+/* Free every unmarked old object, merging neighbouring free space, and
+   rebuild the free lists in address order. */
+static void sweep(void)
+{
+    size_t j = 0;
+    for (size_t i = 0; i < gc.remembered.len; i++)
+        if (*gc.remembered.data[i] & HDR_MARK)
+            gc.remembered.data[j++] = gc.remembered.data[i];
+    gc.remembered.len = j;
+
+    memset(gc.small, 0, sizeof gc.small);
+    uint64_t **tail = &gc.large;
+    gc.old_cur = gc.old_lim = NULL;
+    size_t live = 0;
+    char *p = gc.nursery_end, *run = NULL;
+    while (p < gc.end) {
+        uint64_t *h = (uint64_t *)p;
+        size_t n = size_of(h);
+        if (kind_of(*h) != OBJ_FREE && *h & HDR_MARK) {
+            *h &= ~(uint64_t)HDR_MARK;
+            live += n;
+            if (run) {
+                free_chunk(run, p);
+                if (words_of(*(uint64_t *)run) + 1 > NCLASS) {
+                    *tail = (uint64_t *)run;
+                    tail = (uint64_t **)&((uint64_t *)run)[1];
+                } else {
+                    push_free((uint64_t *)run);
+                }
+                run = NULL;
+            }
+        } else if (run) {
+            clear_start(h);
+        } else {
+            run = p;
+        }
+        p += n;
+    }
+    if (run) {
+        free_chunk(run, gc.end);
+        *tail = (uint64_t *)run;
+        tail = (uint64_t **)&((uint64_t *)run)[1];
+    }
+    *tail = NULL;
+    gc.old_used = live;
+    gc.old_threshold = 2 * live > 8 * gc.nursery_size ? 2 * live : 8 * gc.nursery_size;
+}
+
+static void major(char *sp)
+{
+    gc.work.len = 0;
+    scan_conservative(sp, mark_word);
+    each_precise(mark_value);
+    for (size_t i = 0; i < gc.pinned.len; i++)
+        mark_fields(gc.pinned.data[i]);
+    while (gc.work.len)
+        mark_fields(gc.work.data[--gc.work.len]);
+    sweep();
+    gc.majors++;
+}
+
+/* ---- Collection ----------------------------------------------------------- */
+
+static NOINLINE void collect_above(void)
+{
+    uint64_t t0 = now_ns();
+    char *sp = __builtin_frame_address(0);
+    find_frames();
+    minor(sp);
+    if (gc.old_used > gc.old_threshold)
+        major(sp);
+    uint64_t t = now_ns() - t0;
+    gc.pause_ns += t;
+    if (t > gc.max_pause_ns)
+        gc.max_pause_ns = t;
+}
+
+/* Spill the callee-saved registers, which may hold the only copies of
+   some pointers, to the stack, where the scan will see them. */
+static NOINLINE void collect(void)
+{
+    __builtin_unwind_init();
+    collect_above();
+}
+
+/* A nursery block of `bytes`, collecting if none is left; NULL if the
+   object should go to the old space instead. */
+static uint64_t *alloc_slow(size_t bytes)
+{
+    if (bytes > gc.nursery_size / 4)
+        return NULL;
+    for (int round = 0; round < 2; round++) {
+        while ((size_t)(gc.limit - gc.alloc) < bytes) {
+            if (++gc.frag >= gc.nfrags)
+                break;
+            gc.alloc = gc.frags[gc.frag].lo;
+            gc.limit = gc.frags[gc.frag].hi;
+        }
+        if ((size_t)(gc.limit - gc.alloc) >= bytes) {
+            uint64_t *h = (uint64_t *)gc.alloc;
+            gc.alloc += bytes;
+            return h;
+        }
+        if (!round)
+            collect();
+    }
+    return NULL;
+}
+
+/* An object with its payload zeroed, or left as it is if the caller
+   fills all of it before anything can collect.  Old space above the
+   high-water mark has never been written but for a free chunk's header
+   and link at the mark itself, so the fresh pages it comes from need no
+   clearing. */
+static inline uint64_t *alloc(ObjKind kind, size_t words, size_t nptrs, bool zero)
+{
+    if (words >= (1ull << 32) - 1)
+        oom();
+    size_t bytes = (words + 1) * WORD;
+    uint64_t flags = 0, *h;
+    gc.allocated += bytes;
+    if (__builtin_expect((size_t)(gc.limit - gc.alloc) >= bytes, 1)) {
+        h = (uint64_t *)gc.alloc;
+        gc.alloc += bytes;
+    } else if (!(h = alloc_slow(bytes))) {
+        if (gc.old_used + bytes > gc.old_threshold)
+            collect();
+        char *clean = gc.old_hw + 2 * WORD;
+        h = old_alloc(bytes);
+        if (zero && (char *)h < clean)
+            memset(h, 0, (size_t)(clean - (char *)h) < bytes ? (size_t)(clean - (char *)h) : bytes);
+        if (kind == OBJ_RECORD) {
+            /* Its fields are stored without card marks. */
+            flags = HDR_REMEMBER;
+            push(&gc.remembered, h);
+        }
+    }
+    set_start(h);
+    *h = hdr(kind, words, nptrs) | flags;
+    return h + 1;
+}
+
+uint64_t *gc_alloc(ObjKind kind, size_t words, size_t nptrs)
+{
+    return alloc(kind, words, nptrs, true);
+}
+
+/* Store `v` into the `n` words at `p`, as wide as the CPU goes. */
+static void fill_words(uint64_t *p, size_t n, uint64_t v)
+{
+    for (size_t i = 0; i < n; i++)
+        p[i] = v;
+}
+
+#ifdef __x86_64__
+static void fill_sse2(uint64_t *p, size_t n, uint64_t v)
+{
+    __m128i w = _mm_set1_epi64x((long long)v);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        _mm_storeu_si128((__m128i *)(p + i), w);
+        _mm_storeu_si128((__m128i *)(p + i + 2), w);
+        _mm_storeu_si128((__m128i *)(p + i + 4), w);
+        _mm_storeu_si128((__m128i *)(p + i + 6), w);
+    }
+    fill_words(p + i, n - i, v);
+}
+
+__attribute__((target("avx2"))) static void fill_avx2(uint64_t *p, size_t n, uint64_t v)
+{
+    __m256i w = _mm256_set1_epi64x((long long)v);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        _mm256_storeu_si256((__m256i *)(p + i), w);
+        _mm256_storeu_si256((__m256i *)(p + i + 4), w);
+    }
+    fill_words(p + i, n - i, v);
+}
+
+__attribute__((target("avx512f"))) static void fill_avx512(uint64_t *p, size_t n, uint64_t v)
+{
+    __m512i w = _mm512_set1_epi64((long long)v);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+        _mm512_storeu_si512(p + i, w);
+    fill_words(p + i, n - i, v);
+}
+#endif
+
+static void (*fill)(uint64_t *, size_t, uint64_t) = fill_words;
+
+uint64_t *gc_alloc_array(ObjKind kind, size_t n, uint64_t init)
+{
+    uint64_t *a = alloc(kind, n + 1, 0, init == 0);
+    a[0] = n;
+    if (init) {
+        fill(a + 1, n, init);
+        /* A new array in the nursery needs no cards; one in the old
+           space does if it now points into the nursery. */
+        if (kind == OBJ_PTR_ARRAY && (char *)a >= gc.nursery_end && young(init))
+            gc_write(a + 1, a + 1 + n);
+    }
+    return a + 1;
+}
+
+/* ---- Setup ---------------------------------------------------------------- */
+
+static void *reserve(size_t n)
+{
+    void *p = mmap(NULL, n, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+                   -1, 0);
+    return p == MAP_FAILED ? NULL : p;
+}
+
+static void report(void)
+{
+    double run = (double)(now_ns() - gc.start_ns) / 1e6, pause = (double)gc.pause_ns / 1e6;
+    unsigned n = gc.minors + gc.majors;
+    fprintf(stderr, "tiger: gc: %u minor and %u major collections, nursery %zu KiB\n",
+            gc.minors, gc.majors, gc.nursery_size / 1024);
+    fprintf(stderr, "tiger: gc: %.1f MiB allocated, %.1f MiB promoted, %.1f MiB old\n",
+            (double)gc.allocated / 1048576, (double)gc.promoted / 1048576,
+            (double)gc.old_used / 1048576);
+    fprintf(stderr, "tiger: gc: pauses %.3f ms total, %.3f ms max, %.3f ms mean\n", pause,
+            (double)gc.max_pause_ns / 1e6, n ? pause / n : 0.0);
+    fprintf(stderr, "tiger: gc: %.3f ms run, %.1f%% collecting, %.1f MiB/s allocated\n", run,
+            run > 0 ? 100 * pause / run : 0.0,
+            run > 0 ? (double)gc.allocated / 1048576 / (run / 1e3) : 0.0);
+}
+
+static size_t nursery_size(void)
+{
+    const char *s = getenv("TIGER_GC_NURSERY");
+    size_t n = (size_t)4 << 20;
+    if (s && *s) {
+        char *end;
+        n = strtoull(s, &end, 10);
+        if (*end == 'k' || *end == 'K')
+            n <<= 10;
+        else if (*end == 'm' || *end == 'M')
+            n <<= 20;
+    }
+    if (n < 4096)
+        n = 4096;
+    return (n + 4095) & ~(size_t)4095;
+}
+
+void gc_init(void *stack_base)
+{
+    gc.stack_base = stack_base;
+    gc.nursery_size = nursery_size();
+#ifdef __x86_64__
+    __builtin_cpu_init();
+    fill = __builtin_cpu_supports("avx512f") ? fill_avx512
+         : __builtin_cpu_supports("avx2")    ? fill_avx2
+                                             : fill_sse2;
+#endif
+    /* A free chunk's size must fit the header's 32-bit word count. */
+    size_t n = (size_t)16 << 30;
+    for (; n >= gc.nursery_size * 16; n /= 2) {
+        gc.base = reserve(n);
+        gc.starts = gc.base ? reserve(n / (64 * WORD) * sizeof *gc.starts) : NULL;
+        gc.cards = gc.starts ? reserve((n >> GC_CARD_SHIFT) * sizeof *gc.cards) : NULL;
+        if (gc.cards)
+            break;
+        if (gc.starts)
+            munmap(gc.starts, n / (64 * WORD) * sizeof *gc.starts);
+        if (gc.base)
+            munmap(gc.base, n);
+    }
+    if (!gc.cards)
+        oom();
+    gc.end = gc.base + n;
+    gc.nursery_end = gc.base + gc.nursery_size;
+    tiger_card_bias = (uintptr_t)gc.cards - ((uintptr_t)gc.base >> GC_CARD_SHIFT) * sizeof *gc.cards;
+
+    free_chunk(gc.nursery_end, gc.end);
+    gc.old_cur = gc.old_hw = gc.nursery_end;
+    gc.old_lim = gc.end;
+    gc.old_threshold = 8 * gc.nursery_size;
+    reset_nursery();
+
+    const char *s = getenv("TIGER_GC_STATS");
+    if (s && *s && strcmp(s, "0") != 0) {
+        gc.stats = true;
+        gc.start_ns = now_ns();
+        atexit(report);
+    }
+}
@@ -0,0 +1,67 @@
+#ifndef TIGER_GC_H
+#define TIGER_GC_H
+
+/*
+ * A generational collector for the runtime.  New objects are bumped
+ * out of a nursery; a minor collection copies the ones still reachable
+ * into the old space, which a mark-sweep major collection reclaims once
+ * it has grown past twice what was live after the last one.
+ *
+ * Every object is a header word followed by its payload.  Records point
+ * at their first field and keep their pointer fields first; strings and
+ * arrays point at element 0, with the length in the word before it.  Roots are
+ * found precisely where the compiler says: the global words and frame
+ * slots its tables list as holding pointers.  Everything else on the
+ * stack, temps the register allocator spilled and callee-saved
+ * registers among it, is scanned conservatively: a word that points
+ * into or just past a nursery object pins that object where it is for
+ * the collection.  Compiled code marks a card for every pointer it
+ * stores into the heap, so that a minor collection reads only the cards
+ * of old objects that may point into the nursery.
+ *
+ * TIGER_GC_STATS, if set, prints collection counts, pause times and
+ * allocation throughput at exit.  TIGER_GC_NURSERY sets the nursery
+ * size in bytes (with an optional k or m suffix); the default is 4m.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* log2 of the card size.  Must match src/translate.c. */
+enum { GC_CARD_SHIFT = 10 };
+
+/* The write barrier marks the card word at this plus (x >> 10) * 8 for
+   a store to address x. */
+extern uintptr_t tiger_card_bias;
+
+typedef enum ObjKind {
+    OBJ_FREE,               /* old-space free chunk */
+    OBJ_DATA,               /* length word, then bytes: strings */
+    OBJ_RECORD,             /* the first `nptrs` words are pointers */
+    OBJ_ARRAY,              /* length word, then ints */
+    OBJ_PTR_ARRAY,          /* length word, then pointers */
+} ObjKind;
+
+/* Set up the heap; `stack_base` lies above every frame of compiled
+   code. */
+void gc_init(void *stack_base);
+
+/* A zeroed object of `words` payload words (counting an array's length
+   word), of which the first `nptrs` are pointers if it is a record.
+   Returns the address of the payload. */
+uint64_t *gc_alloc(ObjKind kind, size_t words, size_t nptrs);
+
+/* An array of `n` elements, OBJ_ARRAY or OBJ_PTR_ARRAY, each `init`;
+   returns the address of element 0, with `n` in the word before it.
+   Zero costs nothing: fresh memory already is. */
+uint64_t *gc_alloc_array(ObjKind kind, size_t n, uint64_t init);
+
+/* Scan the words from *lo (read at each collection) up to `hi` as
+   conservatively as the stack: the bytecode VM's stack and globals. */
+void gc_add_stack(void *const *lo, void *hi);
+
+/* Dirty the cards of heap words [lo, hi), which the runtime stored
+   pointers into. */
+void gc_write(void *lo, void *hi);
+
+#endif
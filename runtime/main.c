@@ -0,0 +1,11 @@
+#include "runtime.h"
+
+extern void tigermain(void);
+
+int main(void)
+{
+    tiger_init(__builtin_frame_address(0));
+    tigermain();
+    tiger_flush();
+    return 0;
+}
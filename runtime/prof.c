@@ -0,0 +1,205 @@
+#define _GNU_SOURCE         /* REG_RIP */
+#include "prof.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <ucontext.h>
+
+/* The layout emit_profile() writes. */
+typedef struct ProfFunc {
+    const char *name;
+    uintptr_t start, end;
+} ProfFunc;
+
+typedef struct ProfLine {
+    uintptr_t addr;
+    uint64_t line;
+} ProfLine;
+
+typedef struct ProfBranch {
+    uint64_t line, col;
+} ProfBranch;
+
+typedef struct ProfTable {
+    uint64_t nfuncs, nlines, nbranches;
+    uint64_t *counts;
+    uint64_t *branch_counts;    /* held, failed for each branch */
+    const char *path;
+    ProfFunc funcs[];       /* then the ProfLines, then the ProfBranches */
+} ProfTable;
+
+extern const ProfTable tiger_profile;
+
+static struct {
+    const ProfFunc *funcs;
+    const ProfLine *lines;
+    const ProfBranch *branches;
+    uint64_t nfuncs, nlines, nbranches;
+    uintptr_t lo, hi;       /* of every function's code */
+    uintptr_t stack_base;
+    uint64_t *samples;      /* [nlines], then ones outside any line */
+    uint64_t total;
+} prof;
+
+/* The line whose code holds `pc`, or nlines. */
+static uint64_t line_of(uintptr_t pc)
+{
+    uint64_t lo = 0, hi = prof.nlines;
+    while (lo < hi) {
+        uint64_t mid = lo + (hi - lo) / 2;
+        if (prof.lines[mid].addr <= pc)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo ? lo - 1 : prof.nlines;
+}
+
+static void on_sample(int sig, siginfo_t *info, void *ctx)
+{
+    (void)sig, (void)info;
+    const mcontext_t *m = &((const ucontext_t *)ctx)->uc_mcontext;
+    uintptr_t pc = (uintptr_t)m->gregs[REG_RIP];
+    uintptr_t fp = (uintptr_t)m->gregs[REG_RBP];
+    uintptr_t sp = (uintptr_t)m->gregs[REG_RSP];
+    /* Outside compiled code, the first return address into it along the
+       %rbp chain; compiled code and the runtime keep frame pointers. */
+    for (int depth = 0; (pc < prof.lo || pc >= prof.hi) && depth < 64; depth++) {
+        if (fp < sp || fp + 16 > prof.stack_base || fp & 7) {
+            pc = 0;
+            break;
+        }
+        pc = ((const uintptr_t *)fp)[1] - 1;
+        sp = fp;
+        fp = ((const uintptr_t *)fp)[0];
+    }
+    prof.samples[pc >= prof.lo && pc < prof.hi ? line_of(pc) : prof.nlines]++;
+    prof.total++;
+}
+
+static const ProfTable *table;
+
+typedef struct Row {
+    uint64_t n;
+    uint64_t i;
+} Row;
+
+static int by_count(const void *a, const void *b)
+{
+    const Row *x = a, *y = b;
+    if (x->n != y->n)
+        return x->n < y->n ? 1 : -1;
+    return x->i < y->i ? -1 : x->i > y->i;
+}
+
+static int by_line(const void *a, const void *b)
+{
+    const Row *x = a, *y = b;
+    return x->i < y->i ? -1 : x->i > y->i;
+}
+
+static void report(void)
+{
+    struct itimerval off = { { 0, 0 }, { 0, 0 } };
+    setitimer(ITIMER_PROF, &off, NULL);
+    const char *path = getenv("TIGER_PROF");
+    if (!path || !*path)
+        path = "tiger.prof";
+    FILE *out = fopen(path, "w");
+    if (!out) {
+        fprintf(stderr, "tiger: cannot write '%s': %s\n", path, strerror(errno));
+        return;
+    }
+    uint64_t n = prof.nfuncs > prof.nlines ? prof.nfuncs : prof.nlines;
+    if (prof.nbranches > n)
+        n = prof.nbranches;
+    Row *rows = malloc((n ? n : 1) * sizeof *rows);
+    if (!rows) {
+        fclose(out);
+        return;
+    }
+    for (uint64_t i = 0; i < prof.nfuncs; i++)
+        rows[i] = (Row){ table->counts[i], i };
+    qsort(rows, prof.nfuncs, sizeof *rows, by_count);
+    fprintf(out, "%12s  function\n", "calls");
+    for (uint64_t i = 0; i < prof.nfuncs && rows[i].n; i++)
+        fprintf(out, "%12llu  %s\n", (unsigned long long)rows[i].n, prof.funcs[rows[i].i].name);
+
+    /* Branches by how often they ran; the ones that never did are left
+       out. */
+    const uint64_t *bc = table->branch_counts;
+    for (uint64_t i = 0; i < prof.nbranches; i++)
+        rows[i] = (Row){ bc[2 * i] + bc[2 * i + 1], i };
+    qsort(rows, prof.nbranches, sizeof *rows, by_count);
+    fprintf(out, "\n%12s  %12s  branch\n", "taken", "not taken");
+    for (uint64_t i = 0; i < prof.nbranches && rows[i].n; i++) {
+        const ProfBranch *b = &prof.branches[rows[i].i];
+        fprintf(out, "%12llu  %12llu  %s:%llu:%llu\n", (unsigned long long)bc[2 * rows[i].i],
+                (unsigned long long)bc[2 * rows[i].i + 1], table->path,
+                (unsigned long long)b->line, (unsigned long long)b->col);
+    }
+
+    if (prof.samples) {
+        /* A line may start in several places: sum them. */
+        for (uint64_t i = 0; i < prof.nlines; i++)
+            rows[i] = (Row){ prof.samples[i], prof.lines[i].line };
+        qsort(rows, prof.nlines, sizeof *rows, by_line);
+        uint64_t m = 0;
+        for (uint64_t i = 0; i < prof.nlines; i++)
+            if (m && rows[m - 1].i == rows[i].i)
+                rows[m - 1].n += rows[i].n;
+            else
+                rows[m++] = rows[i];
+        qsort(rows, m, sizeof *rows, by_count);
+        fprintf(out, "\n%12s  %6s  line (%llu samples", "samples", "%",
+                (unsigned long long)prof.total);
+        if (prof.samples[prof.nlines])
+            fprintf(out, ", %llu elsewhere", (unsigned long long)prof.samples[prof.nlines]);
+        fputs(")\n", out);
+        for (uint64_t i = 0; i < m && rows[i].n; i++)
+            fprintf(out, "%12llu  %5.1f%%  %s:%llu\n", (unsigned long long)rows[i].n,
+                    100.0 * rows[i].n / prof.total, table->path,
+                    (unsigned long long)rows[i].i);
+    }
+    free(rows);
+    fclose(out);
+}
+
+void prof_init(void *stack_base)
+{
+    table = &tiger_profile;
+    if (!table->nfuncs)
+        return;
+    prof.funcs = table->funcs;
+    prof.nfuncs = table->nfuncs;
+    prof.lines = (const ProfLine *)(table->funcs + table->nfuncs);
+    prof.nlines = table->nlines;
+    prof.branches = (const ProfBranch *)(prof.lines + prof.nlines);
+    prof.nbranches = table->nbranches;
+    prof.lo = prof.funcs[0].start;
+    prof.hi = prof.funcs[prof.nfuncs - 1].end;
+    prof.stack_base = (uintptr_t)stack_base;
+    atexit(report);
+
+    const char *s = getenv("TIGER_PROF_HZ");
+    long hz = s && *s ? strtol(s, NULL, 10) : 1000;
+    if (hz <= 0 || !prof.nlines)
+        return;
+    prof.samples = calloc(prof.nlines + 1, sizeof *prof.samples);
+    if (!prof.samples)
+        return;
+    struct sigaction sa;
+    memset(&sa, 0, sizeof sa);
+    sa.sa_sigaction = on_sample;
+    sa.sa_flags = SA_SIGINFO | SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGPROF, &sa, NULL);
+    long us = hz >= 1000000 ? 1 : 1000000 / hz;
+    struct itimerval it = { { us / 1000000, us % 1000000 }, { us / 1000000, us % 1000000 } };
+    setitimer(ITIMER_PROF, &it, NULL);
+}
@@ -0,0 +1,23 @@
+#ifndef TIGER_PROF_H
+#define TIGER_PROF_H
+
+/*
+ * The profiler of programs compiled with tigerc -pg.  The compiler
+ * counts each function's calls and which way each if and while went,
+ * and leaves a table of where the code of each source line starts
+ * (src/emit.c, tiger_profile); while the program runs, SIGPROF samples
+ * its program counter TIGER_PROF_HZ times a second of CPU time
+ * (default 1000, 0 for none) and charges each sample to a line.  A
+ * sample that lands in the runtime or libc is charged to the line of
+ * Tiger code that called it.  At exit the calls, the branches and the
+ * samples are written to TIGER_PROF (default tiger.prof), most first;
+ * tigerc -fprofile-use reads the calls and the branches back
+ * (src/profile.c).  Without -pg the table is empty and this does
+ * nothing.
+ */
+
+/* Start profiling if the program was compiled with -pg;
+   `stack_base` lies above every frame of compiled code. */
+void prof_init(void *stack_base);
+
+#endif
@@ -0,0 +1,247 @@
+/*
+ * The Tiger runtime: the builtin functions and the allocation and error
+ * entry points that compiled code calls, under the System V ABI.  Ints
+ * are 64-bit.  A string is an immutable byte array and an array a block
+ * of words; both are pointers to their first element, with the length in
+ * the word before it.  A record is a block of words.  All three live in
+ * the collected heap of gc.c, except for string literals and the strings
+ * of up to one character, which are static.
+ */
+#include "runtime.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "gc.h"
+#include "prof.h"
+
+/* Standard input and output go through these buffers and straight to
+   read and write, a buffer at a time.  Output to a terminal is also
+   written at the end of every print that contains a newline. */
+enum { IO_BUF = 64 * 1024 };
+
+static struct {
+    char buf[IO_BUF];
+    size_t len;
+    bool tty;
+} out;
+
+static struct {
+    unsigned char buf[IO_BUF];
+    size_t pos, len;
+} in;
+
+static void out_write(const char *p, size_t n)
+{
+    while (n) {
+        ssize_t k = write(1, p, n);
+        if (k < 0)
+            return;
+        p += k;
+        n -= (size_t)k;
+    }
+}
+
+static void out_flush(void)
+{
+    out_write(out.buf, out.len);
+    out.len = 0;
+}
+
+static void fail(const char *msg)
+{
+    out_flush();
+    fprintf(stderr, "tiger: %s\n", msg);
+    exit(1);
+}
+
+/* The length of string `s`, from the word before its first byte. */
+static int64_t len(const char *s)
+{
+    return ((const int64_t *)s)[-1];
+}
+
+typedef struct Str1 {
+    int64_t len;
+    char c[8];
+} Str1;
+
+/* The empty string and every one-character string, so that chr,
+   getchar and one-character substrings never allocate. */
+static const Str1 empty;
+static Str1 chars[256];
+
+static char *new_string(size_t n)
+{
+    int64_t *w = (int64_t *)gc_alloc(OBJ_DATA, (n + 7) / 8 + 1, 0);
+    w[0] = (int64_t)n;
+    return (char *)(w + 1);
+}
+
+void tiger_print(const char *s)
+{
+    size_t n = (size_t)len(s);
+    if (n > IO_BUF - out.len) {
+        out_flush();
+        if (n >= IO_BUF) {
+            out_write(s, n);
+            return;
+        }
+    }
+    memcpy(out.buf + out.len, s, n);
+    out.len += n;
+    if (out.tty && memchr(s, '\n', n))
+        out_flush();
+}
+
+void tiger_flush(void)
+{
+    out_flush();
+}
+
+const char *tiger_getchar(void)
+{
+    if (in.pos == in.len) {
+        /* Whatever is pending goes out first, for prompts. */
+        if (out.tty)
+            out_flush();
+        ssize_t k = read(0, in.buf, sizeof in.buf);
+        if (k <= 0)
+            return empty.c;
+        in.pos = 0;
+        in.len = (size_t)k;
+    }
+    return chars[in.buf[in.pos++]].c;
+}
+
+int64_t tiger_ord(const char *s)
+{
+    return len(s) ? (unsigned char)s[0] : -1;
+}
+
+const char *tiger_chr(int64_t i)
+{
+    if (i < 0 || i > 255)
+        fail("chr: argument out of range");
+    return chars[i].c;
+}
+
+int64_t tiger_size(const char *s)
+{
+    return len(s);
+}
+
+const char *tiger_substring(const char *s, int64_t first, int64_t n)
+{
+    int64_t m = len(s);
+    if (first < 0 || n < 0 || first > m || n > m - first)
+        fail("substring: out of range");
+    if (n == m)
+        return s;
+    if (n <= 1)
+        return n ? chars[(unsigned char)s[first]].c : empty.c;
+    char *r = new_string((size_t)n);
+    memcpy(r, s + first, (size_t)n);
+    return r;
+}
+
+const char *tiger_concat(const char *a, const char *b)
+{
+    size_t m = (size_t)len(a), n = (size_t)len(b);
+    if (!m)
+        return b;
+    if (!n)
+        return a;
+    char *r = new_string(m + n);
+    memcpy(r, a, m);
+    memcpy(r + m, b, n);
+    return r;
+}
+
+int64_t tiger_not(int64_t i)
+{
+    return i == 0;
+}
+
+void tiger_exit(int64_t code)
+{
+    out_flush();
+    exit((int)code);
+}
+
+/* Whether the `n` bytes at a and b are the same, 16 at a time. */
+static bool same_bytes(const char *a, const char *b, size_t n)
+{
+    size_t i = 0;
+#ifdef __SSE2__
+    for (; i + 16 <= n; i += 16) {
+        __m128i x = _mm_loadu_si128((const __m128i *)(a + i));
+        __m128i y = _mm_loadu_si128((const __m128i *)(b + i));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(x, y)) != 0xffff)
+            return false;
+    }
+#endif
+    return memcmp(a + i, b + i, n - i) == 0;
+}
+
+int64_t tiger_string_equal(const char *a, const char *b)
+{
+    return a == b || (len(a) == len(b) && same_bytes(a, b, (size_t)len(a)));
+}
+
+int64_t tiger_string_compare(const char *a, const char *b)
+{
+    int64_t m = len(a), n = len(b);
+    int c = memcmp(a, b, (size_t)(m < n ? m : n));
+    return c ? c : (m > n) - (m < n);
+}
+
+static int64_t *new_array(ObjKind kind, int64_t n, int64_t init)
+{
+    if (n < 0)
+        fail("negative array size");
+    return (int64_t *)gc_alloc_array(kind, (size_t)n, (uint64_t)init);
+}
+
+int64_t *tiger_init_array(int64_t n, int64_t init)
+{
+    return new_array(OBJ_ARRAY, n, init);
+}
+
+/* An array whose elements are pointers the collector must trace. */
+int64_t *tiger_init_ptr_array(int64_t n, int64_t init)
+{
+    return new_array(OBJ_PTR_ARRAY, n, init);
+}
+
+/* A record of `bytes`, whose first `nptrs` words are pointers. */
+void *tiger_alloc_record(int64_t bytes, int64_t nptrs)
+{
+    return gc_alloc(OBJ_RECORD, (size_t)bytes / 8, (size_t)nptrs);
+}
+
+void tiger_bounds_error(void)
+{
+    fail("array index out of bounds");
+}
+
+void tiger_nil_error(void)
+{
+    fail("nil record dereferenced");
+}
+
+void tiger_init(void *stack_base)
+{
+    out.tty = isatty(1);
+    gc_init(stack_base);
+    prof_init(stack_base);
+    for (int c = 0; c < 256; c++)
+        chars[c] = (Str1){ 1, { (char)c } };
+}
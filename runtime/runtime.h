@@ -0,0 +1,35 @@
+#ifndef TIGER_RUNTIME_H
+#define TIGER_RUNTIME_H
+
+/*
+ * The entry points of runtime.c.  Compiled programs call them by name
+ * from tigermain(), which main.c runs; the bytecode VM of tigerc --run
+ * calls them directly.
+ */
+
+#include <stdint.h>
+
+/* Set up the heap and the I/O buffers; `stack_base` lies above every
+   frame that may hold heap pointers. */
+void tiger_init(void *stack_base);
+
+void tiger_print(const char *s);
+void tiger_flush(void);
+const char *tiger_getchar(void);
+int64_t tiger_ord(const char *s);
+const char *tiger_chr(int64_t i);
+int64_t tiger_size(const char *s);
+const char *tiger_substring(const char *s, int64_t first, int64_t n);
+const char *tiger_concat(const char *a, const char *b);
+int64_t tiger_not(int64_t i);
+void tiger_exit(int64_t code);
+
+int64_t tiger_string_equal(const char *a, const char *b);
+int64_t tiger_string_compare(const char *a, const char *b);
+int64_t *tiger_init_array(int64_t n, int64_t init);
+int64_t *tiger_init_ptr_array(int64_t n, int64_t init);
+void *tiger_alloc_record(int64_t bytes, int64_t nptrs);
+void tiger_bounds_error(void);
+void tiger_nil_error(void);
+
+#endif
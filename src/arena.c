@@ -0,0 +1,89 @@
+#include "arena.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+struct ArenaBlock {
+    ArenaBlock *prev;
+    size_t size;
+    max_align_t data[];
+};
+
+enum {
+    ARENA_ALIGN = 16,
+    ARENA_MIN_BLOCK = 64 * 1024,
+    ARENA_MAX_BLOCK = 16 * 1024 * 1024,
+};
+
+static size_t align_up(size_t n)
+{
+    return (n + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+}
+
+void arena_init(Arena *a)
+{
+    memset(a, 0, sizeof *a);
+}
+
+void arena_free(Arena *a)
+{
+    ArenaBlock *b = a->block;
+    while (b) {
+        ArenaBlock *prev = b->prev;
+        free(b);
+        b = prev;
+    }
+    memset(a, 0, sizeof *a);
+}
+
+static void new_block(Arena *a, size_t need)
+{
+    /* Blocks double with the arena's size, so a big compilation unit
+       takes O(log n) mallocs. */
+    size_t size = a->reserved < ARENA_MIN_BLOCK ? ARENA_MIN_BLOCK : a->reserved;
+    if (size > ARENA_MAX_BLOCK)
+        size = ARENA_MAX_BLOCK;
+    if (size < need)
+        size = need;
+    ArenaBlock *b = xmalloc(sizeof *b + size);
+    b->prev = a->block;
+    b->size = size;
+    a->block = b;
+    a->ptr = (char *)b->data;
+    a->end = a->ptr + size;
+    a->reserved += size;
+}
+
+void *arena_alloc(Arena *a, size_t n)
+{
+    n = align_up(n ? n : 1);
+    if ((size_t)(a->end - a->ptr) < n)
+        new_block(a, n);
+    void *p = a->ptr;
+    a->ptr += n;
+    a->used += n;
+    return p;
+}
+
+void *arena_realloc(Arena *a, void *p, size_t old, size_t n)
+{
+    if (!p)
+        return arena_alloc(a, n);
+    size_t o = align_up(old), m = align_up(n);
+    if ((char *)p + o == a->ptr && (size_t)(a->end - (char *)p) >= m) {
+        a->ptr = (char *)p + m;
+        a->used += m - o;
+        return p;
+    }
+    void *q = arena_alloc(a, n);
+    memcpy(q, p, old < n ? old : n);
+    return q;
+}
+
+char *arena_strndup(Arena *a, const char *s, size_t n)
+{
+    char *p = arena_alloc(a, n + 1);
+    memcpy(p, s, n);
+    p[n] = '\0';
+    return p;
+}
@@ -0,0 +1,34 @@
+#ifndef TIGER_ARENA_H
+#define TIGER_ARENA_H
+
+#include "util.h"
+
+/*
+ * Bump allocator.  Memory is carved out of large blocks and released all
+ * at once by arena_free(), whose cost depends only on the number of
+ * blocks.  Allocations are 16-byte aligned.
+ */
+typedef struct ArenaBlock ArenaBlock;
+
+typedef struct Arena {
+    ArenaBlock *block;
+    char *ptr;
+    char *end;
+    size_t used;        /* bytes handed out */
+    size_t reserved;    /* bytes obtained from malloc */
+} Arena;
+
+void arena_init(Arena *a);
+void arena_free(Arena *a);
+
+void *arena_alloc(Arena *a, size_t n);
+
+/* Resize `p` (of `old` bytes, from this arena) to `n` bytes.  Grows in
+   place when `p` is the most recent allocation and the block has room;
+   otherwise copies, leaving the old space to be reclaimed by
+   arena_free(). */
+void *arena_realloc(Arena *a, void *p, size_t old, size_t n);
+
+char *arena_strndup(Arena *a, const char *s, size_t n);
+
+#endif
@@ -0,0 +1,64 @@
+#include "assem.h"
+
+#include <stdarg.h>
+#include <stdlib.h>
+
+#include "frame.h"
+
+static void print_temp(Temp t, FILE *out)
+{
+    if (t < TEMP_NREGS)
+        fprintf(out, "%%%s", reg_names[t]);
+    else
+        fprintf(out, "t%u", t);
+}
+
+void instr_print(const Instr *in, FILE *out)
+{
+    if (in->kind == I_LABEL) {
+        label_print(in->label, out);
+        fputs(":\n", out);
+        return;
+    }
+    fputc('\t', out);
+    for (const char *p = in->fmt; *p; p++) {
+        if (*p != '`') {
+            fputc(*p, out);
+            continue;
+        }
+        char c = *++p;
+        if (c == '`') {
+            fputc('`', out);
+            continue;
+        }
+        unsigned i = (unsigned)(*++p - '0');
+        if (c == 'd' && i < in->ndst)
+            print_temp(in->dst[i], out);
+        else if (c == 's' && i < in->nsrc)
+            print_temp(in->src[i], out);
+        else if (c == 'j' && i < in->njump)
+            label_print(in->jump[i], out);
+        else
+            fatal("assem: bad operand `%c%u in \"%s\"", c, i, in->fmt);
+    }
+    fputc('\n', out);
+}
+
+void instr_list_print(const InstrList *l, FILE *out)
+{
+    for (uint32_t i = 0; i < l->len; i++)
+        instr_print(&l->data[i], out);
+}
+
+const char *instr_fmt(Arena *a, const char *fmt, ...)
+{
+    va_list ap, aq;
+    va_start(ap, fmt);
+    va_copy(aq, ap);
+    int n = vsnprintf(NULL, 0, fmt, ap);
+    va_end(ap);
+    char *s = arena_alloc(a, (size_t)n + 1);
+    vsnprintf(s, (size_t)n + 1, fmt, aq);
+    va_end(aq);
+    return s;
+}
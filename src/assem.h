@@ -0,0 +1,54 @@
+#ifndef TIGER_ASSEM_H
+#define TIGER_ASSEM_H
+
+#include <stdio.h>
+
+#include "arena.h"
+#include "temp.h"
+
+/*
+ * Target instructions with abstract registers, as produced by
+ * instruction selection and rewritten by register allocation.  The
+ * text of an instruction is a template in which `d0, `s1 and `j0 stand
+ * for its i-th destination temp, source temp and jump target, as in
+ * Appel's Assem module; "``" is a backquote.  Only the temps in `dst`
+ * and `src` matter to the allocator, so an instruction that reads its
+ * destination (two-address arithmetic) lists it in both.
+ */
+
+typedef enum InstrKind {
+    I_OPER,
+    I_LABEL,
+    I_MOVE,                 /* register to register: `d0 := `s0 */
+} InstrKind;
+
+/* Instr.flags */
+enum {
+    IF_JUMP = 1 << 0,       /* never falls through to the next instruction */
+    IF_CALL = 1 << 1,
+    IF_TAIL = 1 << 2,       /* a tail call's jmp: the epilogue goes first */
+};
+
+typedef struct Instr {
+    uint8_t kind;
+    uint8_t flags;
+    uint8_t ndst, nsrc;
+    uint8_t njump;
+    const char *fmt;
+    Temp *dst, *src;
+    Label *jump;
+    Label label;            /* I_LABEL */
+} Instr;
+
+typedef VEC(Instr) InstrList;
+
+/* Print the instruction, one line, with temps above the registers as
+   "t<n>". */
+void instr_print(const Instr *in, FILE *out);
+void instr_list_print(const InstrList *l, FILE *out);
+
+/* A printf-style template in `a`. */
+const char *instr_fmt(Arena *a, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+
+#endif
@@ -0,0 +1,467 @@
+#include "ast.h"
+
+#include <string.h>
+
+const char *const binop_names[OP_COUNT] = {
+    "+", "-", "*", "/", "=", "<>", "<", "<=", ">", ">=", "&", "|",
+};
+
+static const char *const exp_kind_names[] = {
+#define X(k) #k,
+    EXP_KINDS(X)
+#undef X
+};
+static const char *const var_kind_names[] = {
+#define X(k) #k,
+    VAR_KINDS(X)
+#undef X
+};
+static const char *const dec_kind_names[] = {
+#define X(k) #k,
+    DEC_KINDS(X)
+#undef X
+};
+static const char *const ty_kind_names[] = {
+#define X(k) #k,
+    TY_KINDS(X)
+#undef X
+};
+
+static void pool_reserve(Arena *a, void **data, uint32_t *cap, uint32_t need, size_t elem)
+{
+    if (need <= *cap)
+        return;
+    uint32_t ncap = *cap ? *cap : 16;
+    while (ncap < need) {
+        if (ncap > UINT32_MAX / 2)
+            fatal("AST pool overflow");
+        ncap *= 2;
+    }
+    *data = arena_realloc(a, *data, (size_t)*cap * elem, (size_t)ncap * elem);
+    *cap = ncap;
+}
+
+#define POOL_RESERVE(ast, pool, n) \
+    pool_reserve(&(ast)->arena, (void **)&(pool)->data, &(pool)->cap, (n), sizeof(*(pool)->data))
+
+/* Append one zeroed element and return its index. */
+#define POOL_NEW(ast, pool)                                                 \
+    (POOL_RESERVE(ast, pool, (pool)->len + 1),                              \
+     memset(&(pool)->data[(pool)->len], 0, sizeof(*(pool)->data)),          \
+     (pool)->len++)
+
+void ast_init(Ast *ast, Source *src, uint32_t size_hint)
+{
+    memset(ast, 0, sizeof *ast);
+    arena_init(&ast->arena);
+    ast->src = src;
+
+    /* Rough shape of Tiger programs: about one expression per two tokens,
+       one l-value per eight. */
+    uint32_t h = size_hint < 64 ? 64 : size_hint;
+    POOL_RESERVE(ast, &ast->exps, h / 2);
+    POOL_RESERVE(ast, &ast->vars, h / 8);
+    POOL_RESERVE(ast, &ast->decs, h / 16);
+    POOL_RESERVE(ast, &ast->tys, h / 64);
+    POOL_RESERVE(ast, &ast->fields, h / 32);
+    POOL_RESERVE(ast, &ast->efields, h / 64);
+    POOL_RESERVE(ast, &ast->lists, h / 4);
+
+    /* Slot 0 of each node pool is the AST_NONE placeholder. */
+    POOL_NEW(ast, &ast->exps);
+    POOL_NEW(ast, &ast->vars);
+    POOL_NEW(ast, &ast->decs);
+    POOL_NEW(ast, &ast->tys);
+}
+
+void ast_free(Ast *ast)
+{
+    arena_free(&ast->arena);
+    memset(ast, 0, sizeof *ast);
+}
+
+ExpId ast_new_exp(Ast *ast, ExpKind kind, uint32_t pos)
+{
+    ExpId id = POOL_NEW(ast, &ast->exps);
+    ast->exps.data[id].kind = (uint8_t)kind;
+    ast->exps.data[id].pos = pos;
+    return id;
+}
+
+VarId ast_new_var(Ast *ast, VarKind kind, uint32_t pos)
+{
+    VarId id = POOL_NEW(ast, &ast->vars);
+    ast->vars.data[id].kind = (uint8_t)kind;
+    ast->vars.data[id].pos = pos;
+    return id;
+}
+
+DecId ast_new_dec(Ast *ast, DecKind kind, uint32_t pos, Symbol name)
+{
+    DecId id = POOL_NEW(ast, &ast->decs);
+    ast->decs.data[id].kind = (uint8_t)kind;
+    ast->decs.data[id].pos = pos;
+    ast->decs.data[id].name = name;
+    return id;
+}
+
+TyId ast_new_ty(Ast *ast, TyKind kind, uint32_t pos)
+{
+    TyId id = POOL_NEW(ast, &ast->tys);
+    ast->tys.data[id].kind = (uint8_t)kind;
+    ast->tys.data[id].pos = pos;
+    return id;
+}
+
+AstList ast_list(Ast *ast, const uint32_t *ids, uint32_t n)
+{
+    AstList l = { ast->lists.len, n };
+    POOL_RESERVE(ast, &ast->lists, ast->lists.len + n);
+    memcpy(ast->lists.data + l.start, ids, n * sizeof *ids);
+    ast->lists.len += n;
+    return l;
+}
+
+AstList ast_fields(Ast *ast, const Field *fields, uint32_t n)
+{
+    AstList l = { ast->fields.len, n };
+    POOL_RESERVE(ast, &ast->fields, ast->fields.len + n);
+    memcpy(ast->fields.data + l.start, fields, n * sizeof *fields);
+    ast->fields.len += n;
+    return l;
+}
+
+AstList ast_efields(Ast *ast, const EField *fields, uint32_t n)
+{
+    AstList l = { ast->efields.len, n };
+    POOL_RESERVE(ast, &ast->efields, ast->efields.len + n);
+    memcpy(ast->efields.data + l.start, fields, n * sizeof *fields);
+    ast->efields.len += n;
+    return l;
+}
+
+ExpId ast_int(Ast *ast, uint32_t pos, int32_t value)
+{
+    ExpId id = ast_new_exp(ast, EXP_INT, pos);
+    ast_exp(ast, id)->u.intv.value = value;
+    return id;
+}
+
+ExpId ast_op(Ast *ast, uint32_t pos, BinOp op, ExpId left, ExpId right)
+{
+    ExpId id = ast_new_exp(ast, EXP_OP, pos);
+    Exp *e = ast_exp(ast, id);
+    e->op = (uint16_t)op;
+    e->u.op.left = left;
+    e->u.op.right = right;
+    return id;
+}
+
+ExpId ast_var_exp(Ast *ast, uint32_t pos, VarId var)
+{
+    ExpId id = ast_new_exp(ast, EXP_VAR, pos);
+    ast_exp(ast, id)->u.var.var = var;
+    return id;
+}
+
+/* ---- Printing ---------------------------------------------------------- */
+
+static void dump_exp(const Ast *ast, ExpId id, FILE *out);
+
+static void dump_sym(Symbol s, FILE *out)
+{
+    fputs(s ? sym_name(s) : "_", out);
+}
+
+static void dump_string(Symbol s, FILE *out)
+{
+    fputc('"', out);
+    const char *p = sym_name(s);
+    for (uint32_t i = 0, n = sym_len(s); i < n; i++) {
+        unsigned char c = (unsigned char)p[i];
+        if (c == '"' || c == '\\')
+            fprintf(out, "\\%c", c);
+        else if (c == '\n')
+            fputs("\\n", out);
+        else if (c == '\t')
+            fputs("\\t", out);
+        else if (c < 32 || c >= 127)
+            fprintf(out, "\\%03u", c);
+        else
+            fputc(c, out);
+    }
+    fputc('"', out);
+}
+
+static void dump_var(const Ast *ast, VarId id, FILE *out)
+{
+    const Var *v = ast_var(ast, id);
+    switch ((VarKind)v->kind) {
+    case VAR_SIMPLE:
+        dump_sym(v->u.simple.sym, out);
+        break;
+    case VAR_FIELD:
+        fputs("(. ", out);
+        dump_var(ast, v->u.field.var, out);
+        fputc(' ', out);
+        dump_sym(v->u.field.sym, out);
+        fputc(')', out);
+        break;
+    case VAR_SUBSCRIPT:
+        fputs("([] ", out);
+        dump_var(ast, v->u.subscript.var, out);
+        fputc(' ', out);
+        dump_exp(ast, v->u.subscript.index, out);
+        fputc(')', out);
+        break;
+    default:
+        fputs("?var", out);
+    }
+}
+
+static void dump_fields(const Ast *ast, AstList l, FILE *out)
+{
+    fputc('(', out);
+    for (uint32_t i = 0; i < l.count; i++) {
+        const Field *f = ast_field(ast, l, i);
+        fprintf(out, "%s(", i ? " " : "");
+        dump_sym(f->name, out);
+        fputc(' ', out);
+        dump_sym(f->type, out);
+        fputc(')', out);
+    }
+    fputc(')', out);
+}
+
+static void dump_ty(const Ast *ast, TyId id, FILE *out)
+{
+    const Ty *t = ast_ty(ast, id);
+    switch ((TyKind)t->kind) {
+    case TY_NAME:
+        dump_sym(t->u.name.sym, out);
+        break;
+    case TY_RECORD:
+        fputs("(record ", out);
+        dump_fields(ast, t->u.record.fields, out);
+        fputc(')', out);
+        break;
+    case TY_ARRAY:
+        fputs("(array ", out);
+        dump_sym(t->u.array.sym, out);
+        fputc(')', out);
+        break;
+    default:
+        fputs("?ty", out);
+    }
+}
+
+static void dump_dec(const Ast *ast, DecId id, FILE *out)
+{
+    const Dec *d = ast_dec(ast, id);
+    switch ((DecKind)d->kind) {
+    case DEC_FUNCTION:
+        fputs("(function ", out);
+        dump_sym(d->name, out);
+        fputc(' ', out);
+        dump_fields(ast, d->u.function.params, out);
+        fputc(' ', out);
+        dump_sym(d->u.function.result, out);
+        fputc(' ', out);
+        dump_exp(ast, d->u.function.body, out);
+        fputc(')', out);
+        break;
+    case DEC_VAR:
+        fputs("(var ", out);
+        dump_sym(d->name, out);
+        fputc(' ', out);
+        dump_sym(d->u.var.type, out);
+        fputc(' ', out);
+        dump_exp(ast, d->u.var.init, out);
+        fputc(')', out);
+        break;
+    case DEC_TYPE:
+        fputs("(type ", out);
+        dump_sym(d->name, out);
+        fputc(' ', out);
+        dump_ty(ast, d->u.type.ty, out);
+        fputc(')', out);
+        break;
+    case DEC_TYPES:
+    case DEC_FUNCTIONS:
+        fputs(d->kind == DEC_TYPES ? "(types" : "(functions", out);
+        for (uint32_t i = 0; i < d->u.batch.decs.count; i++) {
+            fputc(' ', out);
+            dump_dec(ast, ast_list_at(ast, d->u.batch.decs, i), out);
+        }
+        fputc(')', out);
+        break;
+    default:
+        fputs("?dec", out);
+    }
+}
+
+static void dump_exps(const Ast *ast, AstList l, FILE *out)
+{
+    for (uint32_t i = 0; i < l.count; i++) {
+        fputc(' ', out);
+        dump_exp(ast, ast_list_at(ast, l, i), out);
+    }
+}
+
+static void dump_exp(const Ast *ast, ExpId id, FILE *out)
+{
+    if (id == AST_NONE) {
+        fputc('_', out);
+        return;
+    }
+    const Exp *e = ast_exp(ast, id);
+    switch ((ExpKind)e->kind) {
+    case EXP_VAR:
+        dump_var(ast, e->u.var.var, out);
+        break;
+    case EXP_NIL:
+        fputs("nil", out);
+        break;
+    case EXP_INT:
+        fprintf(out, "%d", e->u.intv.value);
+        break;
+    case EXP_STRING:
+        dump_string(e->u.str.sym, out);
+        break;
+    case EXP_CALL:
+        fputs("(call ", out);
+        dump_sym(e->u.call.func, out);
+        dump_exps(ast, e->u.call.args, out);
+        fputc(')', out);
+        break;
+    case EXP_OP:
+        fprintf(out, "(%s ", binop_names[e->op]);
+        dump_exp(ast, e->u.op.left, out);
+        fputc(' ', out);
+        dump_exp(ast, e->u.op.right, out);
+        fputc(')', out);
+        break;
+    case EXP_RECORD:
+        fputs("(record ", out);
+        dump_sym(e->u.record.type, out);
+        for (uint32_t i = 0; i < e->u.record.fields.count; i++) {
+            const EField *f = ast_efield(ast, e->u.record.fields, i);
+            fputs(" (", out);
+            dump_sym(f->name, out);
+            fputc(' ', out);
+            dump_exp(ast, f->exp, out);
+            fputc(')', out);
+        }
+        fputc(')', out);
+        break;
+    case EXP_SEQ:
+        fputs("(seq", out);
+        dump_exps(ast, e->u.seq.exps, out);
+        fputc(')', out);
+        break;
+    case EXP_ASSIGN:
+        fputs("(:= ", out);
+        dump_var(ast, e->u.assign.var, out);
+        fputc(' ', out);
+        dump_exp(ast, e->u.assign.exp, out);
+        fputc(')', out);
+        break;
+    case EXP_IF:
+        fputs("(if ", out);
+        dump_exp(ast, e->u.if_.test, out);
+        fputc(' ', out);
+        dump_exp(ast, e->u.if_.then, out);
+        if (e->u.if_.els) {
+            fputc(' ', out);
+            dump_exp(ast, e->u.if_.els, out);
+        }
+        fputc(')', out);
+        break;
+    case EXP_WHILE:
+        fputs("(while ", out);
+        dump_exp(ast, e->u.while_.test, out);
+        fputc(' ', out);
+        dump_exp(ast, e->u.while_.body, out);
+        fputc(')', out);
+        break;
+    case EXP_FOR:
+        fputs("(for ", out);
+        dump_sym(e->u.for_.var, out);
+        fputc(' ', out);
+        dump_exp(ast, e->u.for_.lo, out);
+        fputc(' ', out);
+        dump_exp(ast, e->u.for_.hi, out);
+        fputc(' ', out);
+        dump_exp(ast, e->u.for_.body, out);
+        fputc(')', out);
+        break;
+    case EXP_BREAK:
+        fputs("break", out);
+        break;
+    case EXP_LET:
+        fputs("(let (", out);
+        for (uint32_t i = 0; i < e->u.let.decs.count; i++) {
+            if (i)
+                fputc(' ', out);
+            dump_dec(ast, ast_list_at(ast, e->u.let.decs, i), out);
+        }
+        fputs(") ", out);
+        dump_exp(ast, e->u.let.body, out);
+        fputc(')', out);
+        break;
+    case EXP_ARRAY:
+        fputs("(array ", out);
+        dump_sym(e->u.array.type, out);
+        fputc(' ', out);
+        dump_exp(ast, e->u.array.size, out);
+        fputc(' ', out);
+        dump_exp(ast, e->u.array.init, out);
+        fputc(')', out);
+        break;
+    default:
+        fputs("?exp", out);
+    }
+}
+
+void ast_dump(const Ast *ast, FILE *out)
+{
+    dump_exp(ast, ast->root, out);
+    fputc('\n', out);
+}
+
+/* ---- Memory report ----------------------------------------------------- */
+
+static void report_line(FILE *out, const char *pool, const char *kind, uint32_t n, size_t elem)
+{
+    if (n)
+        fprintf(out, "  %-8s %-10s %10u nodes %12zu bytes\n", pool, kind, n, (size_t)n * elem);
+}
+
+void ast_mem_report(const Ast *ast, FILE *out)
+{
+    uint32_t exps[EXP_KIND_COUNT] = {0}, vars[VAR_KIND_COUNT] = {0};
+    uint32_t decs[DEC_KIND_COUNT] = {0}, tys[TY_KIND_COUNT] = {0};
+    for (uint32_t i = 1; i < ast->exps.len; i++)
+        exps[ast->exps.data[i].kind]++;
+    for (uint32_t i = 1; i < ast->vars.len; i++)
+        vars[ast->vars.data[i].kind]++;
+    for (uint32_t i = 1; i < ast->decs.len; i++)
+        decs[ast->decs.data[i].kind]++;
+    for (uint32_t i = 1; i < ast->tys.len; i++)
+        tys[ast->tys.data[i].kind]++;
+
+    fputs("AST memory:\n", out);
+    for (int k = 0; k < EXP_KIND_COUNT; k++)
+        report_line(out, "exp", exp_kind_names[k], exps[k], sizeof(Exp));
+    for (int k = 0; k < VAR_KIND_COUNT; k++)
+        report_line(out, "var", var_kind_names[k], vars[k], sizeof(Var));
+    for (int k = 0; k < DEC_KIND_COUNT; k++)
+        report_line(out, "dec", dec_kind_names[k], decs[k], sizeof(Dec));
+    for (int k = 0; k < TY_KIND_COUNT; k++)
+        report_line(out, "ty", ty_kind_names[k], tys[k], sizeof(Ty));
+    report_line(out, "field", "", ast->fields.len, sizeof(Field));
+    report_line(out, "efield", "", ast->efields.len, sizeof(EField));
+    report_line(out, "list", "", ast->lists.len, sizeof(uint32_t));
+    fprintf(out, "  arena: %zu bytes used, %zu reserved\n",
+            ast->arena.used, ast->arena.reserved);
+}
@@ -0,0 +1,218 @@
+#ifndef TIGER_AST_H
+#define TIGER_AST_H
+
+#include <stdio.h>
+
+#include "arena.h"
+#include "source.h"
+#include "symbol.h"
+
+/*
+ * Abstract syntax.  Nodes live in typed pools (expressions, l-values,
+ * declarations, type expressions, fields) and refer to one another by
+ * 32-bit index; index 0 of every pool is a placeholder so that 0 means
+ * "absent".  Variable-length children are AstList ranges: expression and
+ * declaration lists index into the shared `lists` pool, field lists are
+ * contiguous runs of their own pool.  All pools are carved out of the
+ * unit's arena, so ast_free() releases the whole tree at once.
+ *
+ * Pool storage moves when a pool grows: hold ids, not pointers, across
+ * any call that creates nodes.
+ */
+
+typedef uint32_t ExpId;
+typedef uint32_t VarId;
+typedef uint32_t DecId;
+typedef uint32_t TyId;
+
+enum { AST_NONE = 0 };
+
+typedef struct AstList {
+    uint32_t start;
+    uint32_t count;
+} AstList;
+
+typedef enum BinOp {
+    OP_PLUS, OP_MINUS, OP_TIMES, OP_DIVIDE,
+    OP_EQ, OP_NEQ, OP_LT, OP_LE, OP_GT, OP_GE,
+    OP_AND, OP_OR,
+    OP_COUNT
+} BinOp;
+
+#define EXP_KINDS(X) \
+    X(VAR) X(NIL) X(INT) X(STRING) X(CALL) X(OP) X(RECORD) X(SEQ) \
+    X(ASSIGN) X(IF) X(WHILE) X(FOR) X(BREAK) X(LET) X(ARRAY)
+
+typedef enum ExpKind {
+#define X(k) EXP_##k,
+    EXP_KINDS(X)
+#undef X
+    EXP_KIND_COUNT
+} ExpKind;
+
+/* Exp.flags */
+enum {
+    EF_ESCAPE = 1 << 0,     /* EXP_FOR: loop variable escapes */
+};
+
+typedef struct Exp {
+    uint8_t kind;
+    uint8_t flags;
+    uint16_t op;            /* BinOp for EXP_OP */
+    uint32_t pos;           /* source offset */
+    union {
+        struct { VarId var; } var;
+        struct { int32_t value; } intv;
+        struct { Symbol sym; } str;
+        struct { Symbol func; AstList args; } call;
+        struct { ExpId left, right; } op;
+        struct { Symbol type; AstList fields; } record;   /* EField run */
+        struct { AstList exps; } seq;
+        struct { VarId var; ExpId exp; } assign;
+        struct { ExpId test, then, els; } if_;
+        struct { ExpId test, body; } while_;
+        struct { Symbol var; ExpId lo, hi, body; } for_;
+        struct { AstList decs; ExpId body; } let;
+        struct { Symbol type; ExpId size, init; } array;
+    } u;
+} Exp;
+
+#define VAR_KINDS(X) X(SIMPLE) X(FIELD) X(SUBSCRIPT)
+
+typedef enum VarKind {
+#define X(k) VAR_##k,
+    VAR_KINDS(X)
+#undef X
+    VAR_KIND_COUNT
+} VarKind;
+
+typedef struct Var {
+    uint8_t kind;
+    uint8_t pad[3];
+    uint32_t pos;
+    union {
+        struct { Symbol sym; } simple;
+        struct { VarId var; Symbol sym; } field;
+        struct { VarId var; ExpId index; } subscript;
+    } u;
+} Var;
+
+/* A let's declaration list holds VAR declarations and TYPES / FUNCTIONS
+   batches: maximal runs of consecutive type or function declarations,
+   which are mutually recursive. */
+#define DEC_KINDS(X) X(FUNCTION) X(VAR) X(TYPE) X(TYPES) X(FUNCTIONS)
+
+typedef enum DecKind {
+#define X(k) DEC_##k,
+    DEC_KINDS(X)
+#undef X
+    DEC_KIND_COUNT
+} DecKind;
+
+/* Dec.flags */
+enum {
+    DF_ESCAPE = 1 << 0,     /* DEC_VAR: variable escapes */
+};
+
+typedef struct Dec {
+    uint8_t kind;
+    uint8_t flags;
+    uint16_t pad;
+    uint32_t pos;
+    Symbol name;
+    union {
+        struct { AstList params; Symbol result; ExpId body; } function;  /* Field run */
+        struct { Symbol type; ExpId init; } var;
+        struct { TyId ty; } type;
+        struct { AstList decs; } batch;
+    } u;
+} Dec;
+
+#define TY_KINDS(X) X(NAME) X(RECORD) X(ARRAY)
+
+typedef enum TyKind {
+#define X(k) TY_##k,
+    TY_KINDS(X)
+#undef X
+    TY_KIND_COUNT
+} TyKind;
+
+typedef struct Ty {
+    uint8_t kind;
+    uint8_t pad[3];
+    uint32_t pos;
+    union {
+        struct { Symbol sym; } name;
+        struct { AstList fields; } record;    /* Field run */
+        struct { Symbol sym; } array;
+    } u;
+} Ty;
+
+/* Record type field or function formal. */
+typedef struct Field {
+    Symbol name;
+    Symbol type;
+    uint32_t pos;
+    uint8_t flags;          /* DF_ESCAPE for formals */
+    uint8_t pad[3];
+} Field;
+
+/* `name = exp` in a record creation expression. */
+typedef struct EField {
+    Symbol name;
+    ExpId exp;
+    uint32_t pos;
+} EField;
+
+#define AST_POOL(T) struct { T *data; uint32_t len, cap; }
+
+typedef struct Ast {
+    Arena arena;
+    Source *src;
+    ExpId root;
+
+    AST_POOL(Exp) exps;
+    AST_POOL(Var) vars;
+    AST_POOL(Dec) decs;
+    AST_POOL(Ty) tys;
+    AST_POOL(Field) fields;
+    AST_POOL(EField) efields;
+    AST_POOL(uint32_t) lists;
+} Ast;
+
+/* `size_hint` (e.g. the token count) pre-sizes the pools. */
+void ast_init(Ast *ast, Source *src, uint32_t size_hint);
+void ast_free(Ast *ast);
+
+static inline Exp *ast_exp(const Ast *ast, ExpId id) { return &ast->exps.data[id]; }
+static inline Var *ast_var(const Ast *ast, VarId id) { return &ast->vars.data[id]; }
+static inline Dec *ast_dec(const Ast *ast, DecId id) { return &ast->decs.data[id]; }
+static inline Ty *ast_ty(const Ast *ast, TyId id) { return &ast->tys.data[id]; }
+static inline Field *ast_field(const Ast *ast, AstList l, uint32_t i) { return &ast->fields.data[l.start + i]; }
+static inline EField *ast_efield(const Ast *ast, AstList l, uint32_t i) { return &ast->efields.data[l.start + i]; }
+static inline uint32_t ast_list_at(const Ast *ast, AstList l, uint32_t i) { return ast->lists.data[l.start + i]; }
+
+/* Allocate a zeroed node; the caller fills in the payload. */
+ExpId ast_new_exp(Ast *ast, ExpKind kind, uint32_t pos);
+VarId ast_new_var(Ast *ast, VarKind kind, uint32_t pos);
+DecId ast_new_dec(Ast *ast, DecKind kind, uint32_t pos, Symbol name);
+TyId ast_new_ty(Ast *ast, TyKind kind, uint32_t pos);
+
+/* Copy a run of ids / fields into the tree and return its range. */
+AstList ast_list(Ast *ast, const uint32_t *ids, uint32_t n);
+AstList ast_fields(Ast *ast, const Field *fields, uint32_t n);
+AstList ast_efields(Ast *ast, const EField *fields, uint32_t n);
+
+ExpId ast_int(Ast *ast, uint32_t pos, int32_t value);
+ExpId ast_op(Ast *ast, uint32_t pos, BinOp op, ExpId left, ExpId right);
+ExpId ast_var_exp(Ast *ast, uint32_t pos, VarId var);
+
+extern const char *const binop_names[OP_COUNT];
+
+/* Print the tree as an S-expression. */
+void ast_dump(const Ast *ast, FILE *out);
+
+/* Bytes used by each node kind, and by the arena overall. */
+void ast_mem_report(const Ast *ast, FILE *out);
+
+#endif
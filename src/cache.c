@@ -0,0 +1,472 @@
+#include "cache.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+enum { CACHE_VERSION = 2 };
+
+static const char cache_magic[8] = "TIGCACHE";
+
+typedef struct CacheHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t count;
+    uint64_t build;         /* identifies the tigerc that wrote the file */
+} CacheHeader;
+
+/* Sorted by key; `off` is from the start of the file.  `npriv` is the
+   number of labels private to the text and `check` a hash of it, so
+   that a damaged entry is a miss rather than bad code. */
+typedef struct CacheEntry {
+    CacheKey key;
+    uint64_t off;
+    uint32_t len, npriv;
+    uint64_t check;
+} CacheEntry;
+
+typedef struct CacheNew {
+    CacheKey key;
+    const char *text;
+    uint32_t len, npriv;
+} CacheNew;
+
+struct Cache {
+    char *path;
+    const char *map;
+    size_t map_len;
+    const CacheEntry *entries;
+    uint32_t count;
+    uint64_t build;
+    pthread_mutex_t lock;
+    VEC(CacheNew) added;    /* texts malloc'd */
+};
+
+/* The executable's size and modification time, so that a rebuilt
+   compiler does not reuse code its predecessor generated. */
+static uint64_t build_id(void)
+{
+    struct stat st;
+    if (stat("/proc/self/exe", &st) != 0)
+        return 0;
+    return (uint64_t)st.st_size * 0x9e3779b97f4a7c15ull ^ (uint64_t)st.st_mtim.tv_sec << 20 ^
+           (uint64_t)st.st_mtim.tv_nsec;
+}
+
+Cache *cache_open(const char *path)
+{
+    Cache *c = xcalloc(1, sizeof *c);
+    c->path = xstrdup(path);
+    c->build = build_id();
+    pthread_mutex_init(&c->lock, NULL);
+
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(CacheHeader)) {
+        if (fd >= 0)
+            close(fd);
+        return c;
+    }
+    void *m = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (m == MAP_FAILED)
+        return c;
+    const CacheHeader *h = m;
+    if (memcmp(h->magic, cache_magic, sizeof cache_magic) != 0 ||
+        h->version != CACHE_VERSION || h->build != c->build ||
+        (size_t)h->count > ((size_t)st.st_size - sizeof *h) / sizeof(CacheEntry)) {
+        munmap(m, (size_t)st.st_size);
+        return c;
+    }
+    c->map = m;
+    c->map_len = (size_t)st.st_size;
+    c->entries = (const CacheEntry *)(h + 1);
+    c->count = h->count;
+    return c;
+}
+
+static int key_cmp(const CacheKey *a, const CacheKey *b)
+{
+    for (int i = 0; i < 2; i++)
+        if (a->h[i] != b->h[i])
+            return a->h[i] < b->h[i] ? -1 : 1;
+    return 0;
+}
+
+static int new_cmp(const void *a, const void *b)
+{
+    return key_cmp(&((const CacheNew *)a)->key, &((const CacheNew *)b)->key);
+}
+
+/* A label in a cached text is \1, its index among the function's labels
+   (or past them, for a private label) in decimal, and ';'. */
+enum { PLACEHOLDER = 1 };
+
+/* Whether every placeholder in `text` is well formed and names one of
+   `nlabels` labels. */
+static bool placeholders_ok(const char *text, uint32_t len, uint32_t nlabels)
+{
+    const char *p = text, *end = text + len;
+    while ((p = memchr(p, PLACEHOLDER, (size_t)(end - p))) != NULL) {
+        uint64_t idx = 0;
+        const char *q = ++p;
+        for (; q < end && *q >= '0' && *q <= '9' && idx < nlabels; q++)
+            idx = idx * 10 + (uint64_t)(*q - '0');
+        if (q == p || q == end || *q != ';' || idx >= nlabels)
+            return false;
+        p = q + 1;
+    }
+    return true;
+}
+
+const char *cache_find(Cache *c, const CacheKey *k, uint32_t nlabels, uint32_t *len)
+{
+    uint32_t lo = 0, hi = c->count;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        int d = key_cmp(&c->entries[mid].key, k);
+        if (d == 0) {
+            const CacheEntry *e = &c->entries[mid];
+            if (e->off > c->map_len || e->len > c->map_len - e->off)
+                return NULL;
+            const char *text = c->map + e->off;
+            if (sym_hash(text, e->len) != e->check || e->npriv > UINT32_MAX - nlabels ||
+                !placeholders_ok(text, e->len, nlabels + e->npriv))
+                return NULL;
+            *len = e->len;
+            return text;
+        }
+        if (d < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return NULL;
+}
+
+static bool write_file(Cache *c, const CacheNew *all, uint32_t n)
+{
+    size_t tmp_len = strlen(c->path) + 32;
+    char *tmp = xmalloc(tmp_len);
+    snprintf(tmp, tmp_len, "%s.tmp.%ld", c->path, (long)getpid());
+    FILE *f = fopen(tmp, "wb");
+    bool ok = f != NULL;
+    if (ok) {
+        CacheHeader h = { .version = CACHE_VERSION, .count = n, .build = c->build };
+        memcpy(h.magic, cache_magic, sizeof cache_magic);
+        ok = fwrite(&h, sizeof h, 1, f) == 1;
+        uint64_t off = sizeof h + (uint64_t)n * sizeof(CacheEntry);
+        for (uint32_t i = 0; ok && i < n; i++) {
+            CacheEntry e = { all[i].key, off, all[i].len, all[i].npriv,
+                             sym_hash(all[i].text, all[i].len) };
+            ok = fwrite(&e, sizeof e, 1, f) == 1;
+            off += all[i].len;
+        }
+        for (uint32_t i = 0; ok && i < n; i++)
+            ok = fwrite(all[i].text, 1, all[i].len, f) == all[i].len;
+        ok = fclose(f) == 0 && ok;
+    }
+    if (ok)
+        ok = rename(tmp, c->path) == 0;
+    if (!ok) {
+        fprintf(stderr, "tigerc: cannot write cache '%s': %s\n", c->path, strerror(errno));
+        unlink(tmp);
+    }
+    free(tmp);
+    return ok;
+}
+
+bool cache_close(Cache *c)
+{
+    bool ok = true;
+    if (c->added.len) {
+        /* The new entries, then the old ones: the first of equal keys
+           stays. */
+        uint32_t n = 0;
+        CacheNew *all = xmalloc(((size_t)c->added.len + c->count) * sizeof *all);
+        for (uint32_t i = 0; i < c->added.len; i++)
+            all[n++] = c->added.data[i];
+        for (uint32_t i = 0; i < c->count; i++) {
+            const CacheEntry *e = &c->entries[i];
+            /* Damaged entries are dropped, not given a new check. */
+            if (e->off <= c->map_len && e->len <= c->map_len - e->off &&
+                sym_hash(c->map + e->off, e->len) == e->check)
+                all[n++] = (CacheNew){ e->key, c->map + e->off, e->len, e->npriv };
+        }
+        qsort(all, n, sizeof *all, new_cmp);
+        uint32_t m = 0;
+        for (uint32_t i = 0; i < n; i++)
+            if (!m || key_cmp(&all[m - 1].key, &all[i].key) != 0)
+                all[m++] = all[i];
+        ok = write_file(c, all, m);
+        free(all);
+    }
+    for (uint32_t i = 0; i < c->added.len; i++)
+        free((char *)c->added.data[i].text);
+    vec_free(&c->added);
+    if (c->map)
+        munmap((void *)c->map, c->map_len);
+    pthread_mutex_destroy(&c->lock);
+    free(c->path);
+    free(c);
+    return ok;
+}
+
+/* ---- Keys ---------------------------------------------------------------- */
+
+typedef struct KeyBuilder {
+    uint64_t h[2];
+    IdMap temps, labels;
+    uint32_t ntemps;
+    CacheLabels *out;
+} KeyBuilder;
+
+static void put(KeyBuilder *b, uint64_t w)
+{
+    b->h[0] = (b->h[0] ^ w) * 0x9e3779b97f4a7c15ull;
+    b->h[0] ^= b->h[0] >> 29;
+    b->h[1] = (b->h[1] ^ w) * 0xc2b2ae3d27d4eb4full;
+    b->h[1] ^= b->h[1] >> 31;
+}
+
+static void put_temp(KeyBuilder *b, Temp t)
+{
+    if (t < TEMP_NREGS) {
+        put(b, t);
+        return;
+    }
+    uint32_t i = idmap_get(&b->temps, t, UINT32_MAX);
+    if (i == UINT32_MAX)
+        idmap_put(&b->temps, t, i = b->ntemps++);
+    put(b, TEMP_NREGS + (uint64_t)i);
+}
+
+static void put_label(KeyBuilder *b, Label l)
+{
+    uint32_t i = idmap_get(&b->labels, l, UINT32_MAX);
+    if (i == UINT32_MAX) {
+        idmap_put(&b->labels, l, i = b->out->len);
+        vec_push(b->out, l);
+    }
+    put(b, i);
+}
+
+static void put_exp(KeyBuilder *b, const TExp *e)
+{
+    put(b, e->kind | (uint32_t)e->op << 8 | (uint32_t)e->flags << 16);
+    switch (e->kind) {
+    case TE_CONST:
+        put(b, (uint64_t)e->u.value);
+        break;
+    case TE_NAME:
+        put_label(b, e->u.name);
+        break;
+    case TE_TEMP:
+        put_temp(b, e->u.temp);
+        break;
+    case TE_BINOP:
+        put_exp(b, e->u.bin.left);
+        put_exp(b, e->u.bin.right);
+        break;
+    case TE_MEM:
+        put_exp(b, e->u.mem);
+        break;
+    case TE_CALL:
+        put(b, e->u.call.nargs);
+        put_exp(b, e->u.call.func);
+        for (uint32_t i = 0; i < e->u.call.nargs; i++)
+            put_exp(b, e->u.call.args[i]);
+        break;
+    case TE_ESEQ:
+        fatal("cache: tree is not canonical");
+    }
+}
+
+static void put_stm(KeyBuilder *b, const TStm *s)
+{
+    for (; s && s->kind == TS_SEQ; s = s->u.seq.second)
+        put_stm(b, s->u.seq.first);
+    if (!s)
+        return;
+    put(b, s->kind | (uint32_t)s->op << 8);
+    switch (s->kind) {
+    case TS_MOVE:
+        put_exp(b, s->u.move.dst);
+        put_exp(b, s->u.move.src);
+        break;
+    case TS_EXP:
+        put_exp(b, s->u.exp);
+        break;
+    case TS_JUMP:
+        put(b, s->u.jump.nlabels);
+        put_exp(b, s->u.jump.target);
+        for (uint32_t i = 0; i < s->u.jump.nlabels; i++)
+            put_label(b, s->u.jump.labels[i]);
+        break;
+    case TS_CJUMP:
+        put_exp(b, s->u.cjump.left);
+        put_exp(b, s->u.cjump.right);
+        put_label(b, s->u.cjump.t);
+        put_label(b, s->u.cjump.f);
+        break;
+    case TS_LABEL:
+        put_label(b, s->u.label);
+        break;
+    case TS_LINE:
+        put(b, s->u.line);
+        break;
+    }
+}
+
+void cache_proc_key(const TStm *body, const Frame *f, uint64_t salt, CacheKey *k,
+                    CacheLabels *labels)
+{
+    KeyBuilder b = { .h = { CACHE_VERSION, ~(uint64_t)CACHE_VERSION }, .out = labels };
+    labels->len = 0;
+    put(&b, salt);
+    put(&b, (uint64_t)(uint32_t)f->locals << 32 | f->nformals);
+    put_label(&b, f->name);
+    put_stm(&b, body);
+    k->h[0] = b.h[0] ^ b.h[0] >> 32;
+    k->h[1] = b.h[1] ^ b.h[1] >> 32;
+    idmap_free(&b.temps);
+    idmap_free(&b.labels);
+}
+
+static void put_bytes(KeyBuilder *b, const char *p, uint32_t len)
+{
+    put(b, len);
+    uint32_t i = 0;
+    for (; i + 8 <= len; i += 8) {
+        uint64_t w;
+        memcpy(&w, p + i, 8);
+        put(b, w);
+    }
+    for (; i < len; i++)
+        put(b, (uint8_t)p[i]);
+}
+
+void cache_file_key(const char *path, const char *text, uint32_t len, uint64_t salt,
+                    CacheKey *k)
+{
+    /* Seeded apart from the function keys. */
+    KeyBuilder b = { .h = { ~(uint64_t)CACHE_VERSION, CACHE_VERSION } };
+    put(&b, salt);
+    put_bytes(&b, path, (uint32_t)strlen(path));
+    put_bytes(&b, text, len);
+    k->h[0] = b.h[0] ^ b.h[0] >> 32;
+    k->h[1] = b.h[1] ^ b.h[1] >> 32;
+}
+
+/* ---- Texts ---------------------------------------------------------------- */
+
+static bool word_char(char ch)
+{
+    return (ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z') || (ch >= '0' && ch <= '9') ||
+           ch == '_' || ch == '.';
+}
+
+void cache_add(Cache *c, const CacheKey *k, const char *text, size_t len,
+               const CacheLabels *labels)
+{
+    /* Named labels are found by the hash of their name.  Should two
+       names collide, a renamed label could stay behind in the text:
+       leave the function out of the cache. */
+    IdMap anon = {0}, named = {0}, priv = {0};
+    uint32_t npriv = 0;
+    bool ok = true;
+    for (uint32_t i = 0; i < labels->len && ok; i++) {
+        Symbol s = label_sym(labels->data[i]);
+        if (!s) {
+            idmap_put(&anon, labels->data[i], i);
+            continue;
+        }
+        uint32_t h = (uint32_t)sym_hash(sym_name(s), sym_len(s));
+        uint32_t m = idmap_get(&named, h, UINT32_MAX);
+        if (m == UINT32_MAX)
+            idmap_put(&named, h, i);
+        else
+            ok = label_sym(labels->data[m]) == s;
+    }
+    if (!ok) {
+        idmap_free(&anon);
+        idmap_free(&named);
+        return;
+    }
+
+    VEC(char) out = {0};
+    vec_reserve(&out, (uint32_t)len + 1);
+    for (size_t i = 0; i < len;) {
+        if (!word_char(text[i]) || (i && word_char(text[i - 1]))) {
+            vec_push(&out, text[i++]);
+            continue;
+        }
+        size_t j = i;
+        while (j < len && word_char(text[j]))
+            j++;
+        uint32_t n = (uint32_t)(j - i), idx = UINT32_MAX;
+        if (n > 2 && text[i] == '.' && text[i + 1] == 'L') {
+            Label l = (Label)strtoul(text + i + 2, NULL, 10);
+            idx = idmap_get(&anon, l, UINT32_MAX);
+            if (idx == UINT32_MAX) {
+                idx = idmap_get(&priv, l, UINT32_MAX);
+                if (idx == UINT32_MAX)
+                    idmap_put(&priv, l, idx = labels->len + npriv++);
+            }
+        } else if (named.used) {
+            uint32_t m = idmap_get(&named, (uint32_t)sym_hash(text + i, n), UINT32_MAX);
+            Symbol s = m == UINT32_MAX ? SYM_NONE : label_sym(labels->data[m]);
+            if (s && sym_len(s) == n && memcmp(sym_name(s), text + i, n) == 0)
+                idx = m;
+        }
+        if (idx == UINT32_MAX) {
+            for (; i < j; i++)
+                vec_push(&out, text[i]);
+            continue;
+        }
+        char num[16];
+        int w = snprintf(num, sizeof num, "%c%u;", PLACEHOLDER, idx);
+        for (int q = 0; q < w; q++)
+            vec_push(&out, num[q]);
+        i = j;
+    }
+    idmap_free(&anon);
+    idmap_free(&named);
+    idmap_free(&priv);
+
+    pthread_mutex_lock(&c->lock);
+    vec_push(&c->added, ((CacheNew){ *k, out.data, out.len, npriv }));
+    pthread_mutex_unlock(&c->lock);
+}
+
+void cache_print(const char *text, uint32_t len, const CacheLabels *labels, FILE *out)
+{
+    VEC(Label) priv = {0};
+    const char *p = text, *end = text + len;
+    while (p < end) {
+        const char *q = memchr(p, PLACEHOLDER, (size_t)(end - p));
+        if (!q) {
+            fwrite(p, 1, (size_t)(end - p), out);
+            break;
+        }
+        fwrite(p, 1, (size_t)(q - p), out);
+        uint32_t idx = 0;
+        for (q++; q < end && *q != ';'; q++)
+            idx = idx * 10 + (uint32_t)(*q - '0');
+        p = q + 1;
+        if (idx < labels->len) {
+            label_print(labels->data[idx], out);
+            continue;
+        }
+        idx -= labels->len;
+        while (priv.len <= idx)
+            vec_push(&priv, label_new());
+        label_print(priv.data[idx], out);
+    }
+    vec_free(&priv);
+}
@@ -0,0 +1,70 @@
+#ifndef TIGER_CACHE_H
+#define TIGER_CACHE_H
+
+#include <stdio.h>
+
+#include "frame.h"
+
+/*
+ * An on-disk cache of generated code, at two grains.  A whole source
+ * file is keyed by its path, its text and the code generation settings,
+ * and an unchanged one skips every phase.  An edited file is checked
+ * and optimized again, since inlining and constant globals let any
+ * function's code depend on the rest of the file; then each function is
+ * keyed by a 128-bit hash of its lowered trees and those settings, and
+ * one whose trees are unchanged skips the back end.  Temps and labels
+ * enter that hash by order of first appearance rather than by id, and
+ * label names are left out of the stored assembly, so a function hits
+ * even when every label around it has been renumbered.
+ *
+ * The file is a sorted table of keys followed by the assembly texts,
+ * read through mmap; a file written by another build of tigerc, or of
+ * another format version, counts as empty.  New entries are collected
+ * under a lock, so one Cache serves every thread, and are merged into
+ * the file by cache_close().
+ */
+
+typedef struct Cache Cache;
+
+typedef struct CacheKey {
+    uint64_t h[2];
+} CacheKey;
+
+/* The labels a function's trees mention, in order of first appearance:
+   the meaning of the label placeholders in its cached text. */
+typedef VEC(Label) CacheLabels;
+
+/* Open (or start) the cache at `path`. */
+Cache *cache_open(const char *path);
+
+/* Write the new entries back to the file, if any, and free `c`.
+   Returns false, with a message on stderr, if the file cannot be
+   written. */
+bool cache_close(Cache *c);
+
+/* The key of function `f` with canonical body `body`; `salt` covers any
+   other setting the generated code depends on.  Fills `labels`. */
+void cache_proc_key(const TStm *body, const Frame *f, uint64_t salt, CacheKey *k,
+                    CacheLabels *labels);
+
+/* The key of the source file `path` with contents `text`, compiled by
+   itself with the settings in `salt`.  Its whole assembly is cached
+   under it, so that an unchanged file skips every phase. */
+void cache_file_key(const char *path, const char *text, uint32_t len, uint64_t salt,
+                    CacheKey *k);
+
+/* The cached text for `k`, whose key named `nlabels` labels, or NULL.
+   A text that fails its check, or whose placeholders name labels it
+   cannot have, counts as missing. */
+const char *cache_find(Cache *c, const CacheKey *k, uint32_t nlabels, uint32_t *len);
+
+/* Add assembly `text` under `k`, with the labels in `labels` (and any
+   other .L label, as one private to the text) replaced by placeholders. */
+void cache_add(Cache *c, const CacheKey *k, const char *text, size_t len,
+               const CacheLabels *labels);
+
+/* Write cached `text` with its placeholders replaced by `labels` and by
+   new labels for the private ones. */
+void cache_print(const char *text, uint32_t len, const CacheLabels *labels, FILE *out);
+
+#endif
@@ -0,0 +1,380 @@
+#include "canon.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* ---- Linearization ---------------------------------------------------- */
+
+typedef struct Lin {
+    Arena *a;
+    StmList *out;
+    Temp first;             /* temps from here on were made here */
+} Lin;
+
+static void lin_stm(Lin *c, TStm *s);
+static TExp *lin_exp(Lin *c, TExp *e);
+
+/* Whether no statement can change the value of `e`: constants,
+   addresses, and the temps introduced here, each assigned once. */
+static bool commutes(const Lin *c, const TExp *e)
+{
+    return e->kind == TE_CONST || e->kind == TE_NAME ||
+           (e->kind == TE_TEMP && e->u.temp >= c->first);
+}
+
+static void emit(Lin *c, TStm *s)
+{
+    vec_push(c->out, s);
+}
+
+static void insert(Lin *c, uint32_t at, TStm *s)
+{
+    vec_push(c->out, s);
+    memmove(&c->out->data[at + 1], &c->out->data[at],
+            (c->out->len - 1 - at) * sizeof *c->out->data);
+    c->out->data[at] = s;
+}
+
+/* Linearize `n` expressions evaluated left to right into res[].  When
+   one of them needs statements, the values before it are saved in
+   fresh temps ahead of those statements. */
+static void lin_list(Lin *c, TExp **in, TExp **res, uint32_t n)
+{
+    for (uint32_t i = 0; i < n; i++) {
+        uint32_t mark = c->out->len;
+        res[i] = lin_exp(c, in[i]);
+        if (c->out->len == mark)
+            continue;
+        for (uint32_t j = 0; j < i; j++) {
+            if (commutes(c, res[j]))
+                continue;
+            Temp t = temp_new();
+            insert(c, mark++, t_move(c->a, t_temp(c->a, t), res[j]));
+            res[j] = t_temp(c->a, t);
+        }
+    }
+}
+
+static TExp *lin_call(Lin *c, TExp *e)
+{
+    uint32_t n = e->u.call.nargs;
+    TExp **args = arena_alloc(c->a, n * sizeof *args);
+    lin_list(c, e->u.call.args, args, n);
+    TExp *call = t_call(c->a, e->u.call.func, args, n);
+    call->flags = e->flags;
+    return call;
+}
+
+static TExp *lin_exp(Lin *c, TExp *e)
+{
+    switch ((TExpKind)e->kind) {
+    case TE_CONST:
+    case TE_NAME:
+    case TE_TEMP:
+        return e;
+    case TE_BINOP: {
+        TExp *in[2] = { e->u.bin.left, e->u.bin.right }, *res[2];
+        lin_list(c, in, res, 2);
+        return t_binop(c->a, (TBinOp)e->op, res[0], res[1]);
+    }
+    case TE_MEM:
+        return t_mem(c->a, lin_exp(c, e->u.mem));
+    case TE_CALL: {
+        Temp t = temp_new();
+        emit(c, t_move(c->a, t_temp(c->a, t), lin_call(c, e)));
+        return t_temp(c->a, t);
+    }
+    case TE_ESEQ:
+        lin_stm(c, e->u.eseq.stm);
+        return lin_exp(c, e->u.eseq.exp);
+    }
+    fatal("canon: bad expression");
+}
+
+static void lin_move(Lin *c, TExp *dst, TExp *src)
+{
+    Arena *a = c->a;
+    switch ((TExpKind)dst->kind) {
+    case TE_TEMP:
+        if (src->kind == TE_CALL)
+            emit(c, t_move(a, dst, lin_call(c, src)));
+        else
+            emit(c, t_move(a, dst, lin_exp(c, src)));
+        return;
+    case TE_MEM: {
+        TExp *in[2] = { dst->u.mem, src }, *res[2];
+        lin_list(c, in, res, 2);
+        emit(c, t_move(a, t_mem(a, res[0]), res[1]));
+        return;
+    }
+    case TE_ESEQ:
+        lin_stm(c, dst->u.eseq.stm);
+        lin_move(c, dst->u.eseq.exp, src);
+        return;
+    default:
+        fatal("canon: bad move destination");
+    }
+}
+
+static void lin_one(Lin *c, TStm *s)
+{
+    Arena *a = c->a;
+    switch ((TStmKind)s->kind) {
+    case TS_MOVE:
+        lin_move(c, s->u.move.dst, s->u.move.src);
+        break;
+    case TS_EXP:
+        /* The value of anything but a call is dropped. */
+        if (s->u.exp->kind == TE_CALL)
+            emit(c, t_exp(a, lin_call(c, s->u.exp)));
+        else
+            lin_exp(c, s->u.exp);
+        break;
+    case TS_CJUMP: {
+        TExp *in[2] = { s->u.cjump.left, s->u.cjump.right }, *res[2];
+        lin_list(c, in, res, 2);
+        emit(c, t_cjump(a, (TRelOp)s->op, res[0], res[1], s->u.cjump.t, s->u.cjump.f));
+        break;
+    }
+    case TS_JUMP:
+    case TS_LABEL:
+    case TS_LINE:
+        emit(c, s);
+        break;
+    case TS_SEQ:
+        lin_stm(c, s);
+        break;
+    }
+}
+
+static void lin_stm(Lin *c, TStm *s)
+{
+    /* Translation nests SEQs to the left, as deep as the function is
+       long: walk them with a stack. */
+    VEC(TStm *) stack = {0};
+    vec_push(&stack, s);
+    while (stack.len) {
+        TStm *x = stack.data[--stack.len];
+        if (x->kind == TS_SEQ) {
+            vec_push(&stack, x->u.seq.second);
+            vec_push(&stack, x->u.seq.first);
+        } else {
+            lin_one(c, x);
+        }
+    }
+    vec_free(&stack);
+}
+
+void canon_linearize(Arena *a, TStm *s, StmList *out)
+{
+    Lin c = { .a = a, .out = out, .first = temp_count() };
+    lin_stm(&c, s);
+}
+
+/* ---- Basic blocks ----------------------------------------------------- */
+
+void canon_blocks(Arena *a, StmList *stms, BlockList *out)
+{
+    memset(out, 0, sizeof *out);
+    out->done = label_new();
+    StmList cur = {0};
+    bool open = false;
+    for (uint32_t i = 0; i < stms->len; i++) {
+        TStm *s = stms->data[i];
+        if (s->kind == TS_LABEL) {
+            if (open) {
+                vec_push(&cur, t_jump(a, s->u.label));
+                vec_push(&out->blocks, cur);
+            }
+            cur = (StmList){0};
+            vec_push(&cur, s);
+            open = true;
+            continue;
+        }
+        if (!open) {
+            /* Code after a jump and before the next label can only be
+               reached by falling in, which it cannot; it still gets a
+               block, which tracing drops. */
+            cur = (StmList){0};
+            vec_push(&cur, t_label(a, label_new()));
+            open = true;
+        }
+        vec_push(&cur, s);
+        if (s->kind == TS_JUMP || s->kind == TS_CJUMP) {
+            vec_push(&out->blocks, cur);
+            open = false;
+        }
+    }
+    if (!open && !out->blocks.len) {
+        cur = (StmList){0};
+        vec_push(&cur, t_label(a, label_new()));
+        open = true;
+    }
+    if (open) {
+        vec_push(&cur, t_jump(a, out->done));
+        vec_push(&out->blocks, cur);
+    }
+}
+
+void block_list_free(BlockList *b)
+{
+    for (uint32_t i = 0; i < b->blocks.len; i++)
+        vec_free(&b->blocks.data[i]);
+    vec_free(&b->blocks);
+}
+
+/* ---- Traces ------------------------------------------------------------ */
+
+static TStm *block_last(const StmList *b)
+{
+    return b->data[b->len - 1];
+}
+
+/* A branch is unlikely to go where it went less than a quarter as often
+   as the other way. */
+enum { RARE_RATIO = 4 };
+
+static uint32_t freq_of(const IdMap *freq, Label l)
+{
+    return freq ? idmap_get(freq, l, UINT32_MAX) : UINT32_MAX;
+}
+
+/* The label CJUMP `j` is unlikely to go to, or 0: one with a weight
+   under a quarter of the other's, or one of weight 0, never expected,
+   whatever is known of the other. */
+static Label rare_side(const IdMap *freq, const TStm *j)
+{
+    uint32_t wt = freq_of(freq, j->u.cjump.t), wf = freq_of(freq, j->u.cjump.f);
+    if (!wt != !wf)
+        return wt ? j->u.cjump.f : j->u.cjump.t;
+    if (wt == UINT32_MAX || wf == UINT32_MAX)
+        return 0;
+    return (uint64_t)wt * RARE_RATIO < wf ? j->u.cjump.t
+         : (uint64_t)wf * RARE_RATIO < wt ? j->u.cjump.f
+                                          : 0;
+}
+
+/* Whether CJUMP `j` had better fall into its true label. */
+static bool likely_true(const IdMap *freq, const TStm *j)
+{
+    uint32_t wt = freq_of(freq, j->u.cjump.t), wf = freq_of(freq, j->u.cjump.f);
+    if (rare_side(freq, j) == j->u.cjump.f)
+        return true;
+    return wt != UINT32_MAX && wf != UINT32_MAX && wt > wf;
+}
+
+void canon_trace(Arena *a, BlockList *b, const IdMap *freq, StmList *out)
+{
+    uint32_t n = b->blocks.len;
+    IdMap at = {0};
+    for (uint32_t i = 0; i < n; i++)
+        idmap_put(&at, b->blocks.data[i].data[0]->u.label, i);
+
+    /* Only blocks reachable from the first are laid out. */
+    bool *live = xcalloc(n, sizeof *live);
+    uint32_t *stack = xmalloc(n * sizeof *stack), sp = 0;
+    live[0] = true;
+    stack[sp++] = 0;
+    while (sp) {
+        TStm *last = block_last(&b->blocks.data[stack[--sp]]);
+        Label targets[2];
+        uint32_t nt = 0;
+        if (last->kind == TS_JUMP) {
+            targets[nt++] = last->u.jump.labels[0];
+        } else {
+            targets[nt++] = last->u.cjump.t;
+            targets[nt++] = last->u.cjump.f;
+        }
+        for (uint32_t k = 0; k < nt; k++) {
+            uint32_t j = idmap_get(&at, targets[k], UINT32_MAX);
+            if (j != UINT32_MAX && !live[j]) {
+                live[j] = true;
+                stack[sp++] = j;
+            }
+        }
+    }
+
+    /* The rare side of every branch with weights. */
+    bool *cold = xcalloc(n, sizeof *cold);
+    for (uint32_t i = 0; freq && i < n; i++) {
+        TStm *last = block_last(&b->blocks.data[i]);
+        if (last->kind != TS_CJUMP)
+            continue;
+        Label rare = rare_side(freq, last);
+        uint32_t j = rare ? idmap_get(&at, rare, UINT32_MAX) : UINT32_MAX;
+        if (j != UINT32_MAX && j)
+            cold[j] = true;
+    }
+
+    bool *mark = xcalloc(n, sizeof *mark);
+    StmList raw = {0};
+    /* Traces start from each block in turn, from the rare ones last. */
+    for (uint32_t pass = 0; pass < 2; pass++)
+        for (uint32_t i = 0; i < n; i++) {
+            if (!pass && cold[i])
+                continue;
+            for (uint32_t j = i; live[j] && !mark[j];) {
+                mark[j] = true;
+                StmList *blk = &b->blocks.data[j];
+                for (uint32_t k = 0; k + 1 < blk->len; k++)
+                    vec_push(&raw, blk->data[k]);
+                TStm *last = block_last(blk);
+                if (last->kind == TS_JUMP) {
+                    uint32_t next = idmap_get(&at, last->u.jump.labels[0], UINT32_MAX);
+                    if (next != UINT32_MAX && !mark[next]) {
+                        j = next;
+                        continue;
+                    }
+                    vec_push(&raw, last);
+                    break;
+                }
+                uint32_t tf = idmap_get(&at, last->u.cjump.f, UINT32_MAX);
+                uint32_t tt = idmap_get(&at, last->u.cjump.t, UINT32_MAX);
+                bool hot_t = likely_true(freq, last);
+                if (tf != UINT32_MAX && !mark[tf] && !(hot_t && tt != UINT32_MAX && !mark[tt])) {
+                    vec_push(&raw, last);
+                    j = tf;
+                } else if (tt != UINT32_MAX && !mark[tt]) {
+                    vec_push(&raw, t_cjump(a, t_not_rel((TRelOp)last->op), last->u.cjump.left,
+                                           last->u.cjump.right, last->u.cjump.f, last->u.cjump.t));
+                    j = tt;
+                } else {
+                    /* Both successors are placed already: fall into a new
+                       false label that jumps on. */
+                    Label f = label_new();
+                    vec_push(&raw, t_cjump(a, (TRelOp)last->op, last->u.cjump.left,
+                                           last->u.cjump.right, last->u.cjump.t, f));
+                    vec_push(&raw, t_label(a, f));
+                    vec_push(&raw, t_jump(a, last->u.cjump.f));
+                    break;
+                }
+            }
+        }
+    vec_push(&raw, t_label(a, b->done));
+
+    /* Drop jumps to the label right after them. */
+    for (uint32_t i = 0; i < raw.len; i++) {
+        TStm *s = raw.data[i];
+        if (s->kind == TS_JUMP && i + 1 < raw.len && raw.data[i + 1]->kind == TS_LABEL &&
+            raw.data[i + 1]->u.label == s->u.jump.labels[0])
+            continue;
+        vec_push(out, s);
+    }
+
+    vec_free(&raw);
+    free(live);
+    free(stack);
+    free(mark);
+    free(cold);
+    idmap_free(&at);
+}
+
+TStm *stm_list_seq(Arena *a, const StmList *stms)
+{
+    if (!stms->len)
+        return t_exp(a, t_const(a, 0));
+    TStm *s = stms->data[stms->len - 1];
+    for (uint32_t i = stms->len - 1; i-- > 0;)
+        s = t_seq(a, stms->data[i], s);
+    return s;
+}
@@ -0,0 +1,36 @@
+#ifndef TIGER_CANON_H
+#define TIGER_CANON_H
+
+#include "tree.h"
+
+/*
+ * Canonical trees.  canon_linearize() removes every ESEQ and leaves
+ * each CALL as the whole source of a MOVE to a temp or of an EXP, so
+ * that a function body becomes a list of statements evaluated in
+ * order.  canon_blocks() cuts such a list into basic blocks that start
+ * with a LABEL and end with a JUMP or CJUMP and nothing else inside.
+ * canon_trace() orders the reachable blocks so that every CJUMP is
+ * followed by its false label and jumps to the next statement vanish;
+ * its result ends with LABEL done.  With `freq` (label -> weight: times
+ * run, from a profile, or a static hint; may be NULL), a CJUMP falls
+ * into whichever of its two labels weighs more, and blocks that a CJUMP
+ * rarely goes to, or never (weight 0), go after all the others.
+ */
+
+typedef VEC(TStm *) StmList;
+
+typedef struct BlockList {
+    VEC(StmList) blocks;
+    Label done;             /* the epilogue, which the last block jumps to */
+} BlockList;
+
+void canon_linearize(Arena *a, TStm *s, StmList *out);
+void canon_blocks(Arena *a, StmList *stms, BlockList *out);
+void canon_trace(Arena *a, BlockList *b, const IdMap *freq, StmList *out);
+
+void block_list_free(BlockList *b);
+
+/* `stms` as one statement: a right-nested SEQ chain. */
+TStm *stm_list_seq(Arena *a, const StmList *stms);
+
+#endif
@@ -0,0 +1,280 @@
+#include "closure.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * The static link of f points at its parent's frame, so a function
+ * that must reach an ancestor at depth d needs a link, and so does
+ * every function between it and that ancestor.  reach[f] is the
+ * shallowest depth f must reach, depth[f] when it needs nothing; it can
+ * only decrease, constrained by
+ *
+ *   - each free variable of f: its owner's depth;
+ *   - each call from f to a g that has a link and whose parent is not f
+ *     itself: the depth of g's parent, whose frame f must supply;
+ *   - each child h of f: reach[h], if that is shallower than f.
+ *
+ * The constraints are iterated to a fixpoint.  Variables of the main
+ * program do not count: it is never re-entered, so translate keeps its
+ * escaping variables in static storage rather than in its frame.
+ */
+
+typedef struct Edge {
+    uint32_t caller, callee;
+} Edge;
+
+typedef struct Analysis {
+    Sema *s;
+    Ast *ast;
+    uint32_t *depth;        /* [fun] nesting depth; main is 0 */
+    uint32_t *reach;        /* [fun] */
+    uint32_t cur;           /* function being walked */
+    VEC(Edge) calls;
+
+    /* Free variables of each function, as (fun, var) pairs; a small
+       open-addressing set keeps the lists duplicate-free. */
+    VEC(Edge) fv;
+    uint64_t *set;
+    uint32_t set_mask, set_used;
+} Analysis;
+
+static bool set_add(Analysis *an, uint32_t fun, uint32_t var)
+{
+    uint64_t key = ((uint64_t)fun << 32 | var) + 1;
+    if ((an->set_used + 1) * 2 > an->set_mask + 1) {
+        uint64_t *old = an->set;
+        uint32_t old_mask = an->set_mask;
+        an->set_mask = old_mask ? old_mask * 2 + 1 : 255;
+        an->set = xcalloc(an->set_mask + 1, sizeof *an->set);
+        for (uint32_t i = 0; old && i <= old_mask; i++) {
+            if (!old[i])
+                continue;
+            uint32_t j = (uint32_t)(old[i] * 0x9e3779b97f4a7c15ull >> 32) & an->set_mask;
+            while (an->set[j])
+                j = (j + 1) & an->set_mask;
+            an->set[j] = old[i];
+        }
+        free(old);
+    }
+    uint32_t j = (uint32_t)(key * 0x9e3779b97f4a7c15ull >> 32) & an->set_mask;
+    while (an->set[j]) {
+        if (an->set[j] == key)
+            return false;
+        j = (j + 1) & an->set_mask;
+    }
+    an->set[j] = key;
+    an->set_used++;
+    return true;
+}
+
+static void walk_exp(Analysis *an, ExpId id);
+
+static void use_var(Analysis *an, VarEntry *ve)
+{
+    /* A variable used in f is free in f and in every function between
+       f and its owner; stop early once an enclosing function already
+       has it. */
+    uint32_t owner = ve->owner->index;
+    for (FunEntry *f = an->s->funs.data[an->cur]; f->index != owner; f = f->parent) {
+        if (!set_add(an, f->index, ve->index))
+            break;
+        vec_push(&an->fv, ((Edge){ f->index, ve->index }));
+    }
+}
+
+static void walk_var(Analysis *an, VarId id)
+{
+    const Var *v = ast_var(an->ast, id);
+    switch ((VarKind)v->kind) {
+    case VAR_SIMPLE:
+        use_var(an, an->s->var_entry[id]);
+        break;
+    case VAR_FIELD:
+        walk_var(an, v->u.field.var);
+        break;
+    case VAR_SUBSCRIPT:
+        walk_var(an, v->u.subscript.var);
+        walk_exp(an, v->u.subscript.index);
+        break;
+    default:
+        break;
+    }
+}
+
+static void walk_list(Analysis *an, AstList l)
+{
+    for (uint32_t i = 0; i < l.count; i++)
+        walk_exp(an, ast_list_at(an->ast, l, i));
+}
+
+static void walk_exp(Analysis *an, ExpId id)
+{
+    const Exp *e = ast_exp(an->ast, id);
+    switch ((ExpKind)e->kind) {
+    case EXP_VAR:
+        walk_var(an, e->u.var.var);
+        break;
+    case EXP_CALL: {
+        FunEntry *g = an->s->call_fun[id];
+        if (!g->builtin)
+            vec_push(&an->calls, ((Edge){ an->cur, g->index }));
+        walk_list(an, e->u.call.args);
+        break;
+    }
+    case EXP_OP:
+        walk_exp(an, e->u.op.left);
+        walk_exp(an, e->u.op.right);
+        break;
+    case EXP_RECORD:
+        for (uint32_t i = 0; i < e->u.record.fields.count; i++)
+            walk_exp(an, ast_efield(an->ast, e->u.record.fields, i)->exp);
+        break;
+    case EXP_SEQ:
+        walk_list(an, e->u.seq.exps);
+        break;
+    case EXP_ASSIGN:
+        walk_var(an, e->u.assign.var);
+        walk_exp(an, e->u.assign.exp);
+        break;
+    case EXP_IF:
+        walk_exp(an, e->u.if_.test);
+        walk_exp(an, e->u.if_.then);
+        if (e->u.if_.els)
+            walk_exp(an, e->u.if_.els);
+        break;
+    case EXP_WHILE:
+        walk_exp(an, e->u.while_.test);
+        walk_exp(an, e->u.while_.body);
+        break;
+    case EXP_FOR:
+        walk_exp(an, e->u.for_.lo);
+        walk_exp(an, e->u.for_.hi);
+        walk_exp(an, e->u.for_.body);
+        break;
+    case EXP_LET: {
+        AstList decs = e->u.let.decs;
+        for (uint32_t i = 0; i < decs.count; i++) {
+            const Dec *d = ast_dec(an->ast, ast_list_at(an->ast, decs, i));
+            if (d->kind == DEC_VAR) {
+                walk_exp(an, d->u.var.init);
+            } else if (d->kind == DEC_FUNCTIONS) {
+                AstList fl = d->u.batch.decs;
+                for (uint32_t k = 0; k < fl.count; k++) {
+                    DecId fid = ast_list_at(an->ast, fl, k);
+                    FunEntry *f = (FunEntry *)an->s->dec_entry[fid];
+                    uint32_t saved = an->cur;
+                    an->depth[f->index] = an->depth[saved] + 1;
+                    an->cur = f->index;
+                    walk_exp(an, ast_dec(an->ast, fid)->u.function.body);
+                    an->cur = saved;
+                }
+            }
+        }
+        walk_exp(an, e->u.let.body);
+        break;
+    }
+    case EXP_ARRAY:
+        walk_exp(an, e->u.array.size);
+        walk_exp(an, e->u.array.init);
+        break;
+    default:
+        break;
+    }
+}
+
+static bool lower(uint32_t *r, uint32_t v)
+{
+    if (v >= *r)
+        return false;
+    *r = v;
+    return true;
+}
+
+void closure_convert(Sema *s, FILE *dump)
+{
+    uint32_t n = s->funs.len;
+    Analysis an = { .s = s, .ast = s->ast };
+    an.depth = xcalloc(n, sizeof *an.depth);
+    an.reach = xcalloc(n, sizeof *an.reach);
+    walk_exp(&an, s->ast->root);
+
+    for (uint32_t f = 0; f < n; f++)
+        an.reach[f] = an.depth[f];
+    /* The main program's variables are static data (it runs once), so
+       using them needs no link. */
+    for (uint32_t i = 0; i < an.fv.len; i++) {
+        Edge e = an.fv.data[i];
+        uint32_t owner = s->vars.data[e.callee]->owner->index;
+        if (owner)
+            lower(&an.reach[e.caller], an.depth[owner]);
+    }
+
+    /* Functions are numbered in source order, so children come after
+       their parents: one backward sweep settles the nesting rule, and
+       only calls can force another round. */
+    for (bool changed = true; changed;) {
+        changed = false;
+        for (uint32_t i = 0; i < an.calls.len; i++) {
+            Edge e = an.calls.data[i];
+            FunEntry *g = s->funs.data[e.callee];
+            if (an.reach[e.callee] < an.depth[e.callee] && g->parent->index != e.caller)
+                changed |= lower(&an.reach[e.caller], an.depth[g->parent->index]);
+        }
+        for (uint32_t f = n; f-- > 1;) {
+            uint32_t p = s->funs.data[f]->parent->index;
+            if (an.reach[f] < an.depth[p])
+                changed |= lower(&an.reach[p], an.reach[f]);
+        }
+    }
+
+    for (uint32_t f = 1; f < n; f++) {
+        FunEntry *fe = s->funs.data[f];
+        fe->flags &= (uint8_t)~(FE_LINK | FE_LINK_ESCAPES);
+        if (an.reach[f] < an.depth[f])
+            fe->flags |= FE_LINK;
+    }
+    /* A link must be in memory when an inner function reads it to go
+       further out. */
+    for (uint32_t f = 1; f < n; f++) {
+        FunEntry *p = s->funs.data[f]->parent;
+        if (p->index && an.reach[f] < an.depth[p->index])
+            p->flags |= FE_LINK_ESCAPES;
+    }
+
+    if (dump) {
+        /* fv pairs were recorded grouped by first use; list them per
+           function in source order. */
+        uint32_t *count = xcalloc(n + 1, sizeof *count);
+        for (uint32_t i = 0; i < an.fv.len; i++)
+            count[an.fv.data[i].caller + 1]++;
+        for (uint32_t f = 0; f < n; f++)
+            count[f + 1] += count[f];
+        uint32_t *vars = xmalloc((an.fv.len + 1) * sizeof *vars);
+        uint32_t *fill = xmalloc((n + 1) * sizeof *fill);
+        memcpy(fill, count, (n + 1) * sizeof *fill);
+        for (uint32_t i = 0; i < an.fv.len; i++)
+            vars[fill[an.fv.data[i].caller]++] = an.fv.data[i].callee;
+
+        for (uint32_t f = 1; f < n; f++) {
+            const FunEntry *fe = s->funs.data[f];
+            fprintf(dump, "%s:", sym_name(fe->name));
+            for (uint32_t i = count[f]; i < count[f + 1]; i++)
+                fprintf(dump, " %s", sym_name(s->vars.data[vars[i]]->name));
+            if (!(fe->flags & FE_LINK))
+                fputs(" -> lifted\n", dump);
+            else
+                fprintf(dump, " -> link to depth %u%s\n", an.reach[f],
+                        fe->flags & FE_LINK_ESCAPES ? ", in frame" : "");
+        }
+        free(count);
+        free(vars);
+        free(fill);
+    }
+
+    free(an.depth);
+    free(an.reach);
+    free(an.set);
+    vec_free(&an.calls);
+    vec_free(&an.fv);
+}
@@ -0,0 +1,22 @@
+#ifndef TIGER_CLOSURE_H
+#define TIGER_CLOSURE_H
+
+#include <stdio.h>
+
+#include "semant.h"
+
+/*
+ * Closure conversion.  Computes the free-variable set of every function
+ * (the variables of enclosing functions it, or a function nested in it,
+ * refers to) and from those decides which functions need a static link
+ * at all.  A function with no free variables that calls nothing needing
+ * its enclosing frames is lifted: it takes no link and its callers pass
+ * none.  The others get FE_LINK, and FE_LINK_ESCAPES when an inner
+ * function reads the link out of the frame to reach further out.
+ *
+ * If `dump` is not NULL, prints one line per function:
+ * "name: free-vars -> lifted" or "... -> link to depth D".
+ */
+void closure_convert(Sema *s, FILE *dump);
+
+#endif
@@ -0,0 +1,638 @@
+#include "codegen.h"
+
+#include <inttypes.h>
+#include <stdarg.h>
+#include <string.h>
+
+enum { NO_TEMP = UINT32_MAX };
+
+typedef struct Gen {
+    Arena *a;
+    Frame *frame;
+    InstrList *out;
+} Gen;
+
+static const char *const jcc[T_RELOP_COUNT] = {
+    [T_EQ] = "je", [T_NE] = "jne", [T_LT] = "jl", [T_GT] = "jg",
+    [T_LE] = "jle", [T_GE] = "jge", [T_ULT] = "jb", [T_ULE] = "jbe",
+    [T_UGT] = "ja", [T_UGE] = "jae",
+};
+
+/* Two-address arithmetic, for the operators that have it. */
+static const char *const arith[T_BINOP_COUNT] = {
+    [T_PLUS] = "addq", [T_MINUS] = "subq", [T_MUL] = "imulq",
+    [T_AND] = "andq", [T_OR] = "orq", [T_XOR] = "xorq",
+    [T_LSHIFT] = "salq", [T_RSHIFT] = "shrq", [T_ARSHIFT] = "sarq",
+};
+
+static Temp *temps(Gen *g, uint32_t n, const Temp *t)
+{
+    if (!n)
+        return NULL;
+    Temp *r = arena_alloc(g->a, n * sizeof *r);
+    memcpy(r, t, n * sizeof *r);
+    return r;
+}
+
+/* Emit an operation; `dst` and `src` are copied. */
+static Instr *oper(Gen *g, const char *fmt, uint32_t ndst, const Temp *dst, uint32_t nsrc,
+                   const Temp *src)
+{
+    Instr in = { .kind = I_OPER, .fmt = fmt, .ndst = (uint8_t)ndst, .nsrc = (uint8_t)nsrc,
+                 .dst = temps(g, ndst, dst), .src = temps(g, nsrc, src) };
+    vec_push(g->out, in);
+    return &g->out->data[g->out->len - 1];
+}
+
+static void move(Gen *g, Temp dst, Temp src)
+{
+    Instr in = { .kind = I_MOVE, .fmt = "movq `s0, `d0", .ndst = 1, .nsrc = 1,
+                 .dst = temps(g, 1, &dst), .src = temps(g, 1, &src) };
+    vec_push(g->out, in);
+}
+
+static void label(Gen *g, Label l)
+{
+    vec_push(g->out, ((Instr){ .kind = I_LABEL, .label = l }));
+}
+
+static void jump(Gen *g, const char *fmt, Label target, uint8_t flags)
+{
+    Instr in = { .kind = I_OPER, .flags = flags, .fmt = fmt, .njump = 1 };
+    in.jump = arena_alloc(g->a, sizeof *in.jump);
+    in.jump[0] = target;
+    vec_push(g->out, in);
+}
+
+static const char *label_text(Gen *g, Label l)
+{
+    Symbol s = label_sym(l);
+    return s ? sym_name(s) : instr_fmt(g->a, ".L%u", l);
+}
+
+static bool is_imm32(const TExp *e)
+{
+    return e->kind == TE_CONST && e->u.value >= INT32_MIN && e->u.value <= INT32_MAX;
+}
+
+static Temp munch_exp(Gen *g, TExp *e);
+
+/* ---- Addressing modes ------------------------------------------------- */
+
+/* A memory operand disp(base, index, scale), or sym+disp(%rip). */
+typedef struct Mem {
+    int64_t disp;
+    Temp base, index;
+    uint8_t scale;
+    bool rip;
+    Label sym;
+} Mem;
+
+static bool add_disp(Mem *m, int64_t k, int64_t scale)
+{
+    int64_t d;
+    if (__builtin_mul_overflow(k, scale, &d) || __builtin_add_overflow(m->disp, d, &d) ||
+        d < INT32_MIN || d > INT32_MAX)
+        return false;
+    m->disp = d;
+    return true;
+}
+
+/* The factor when `e` is x * 1, 2, 4 or 8 (or a shift by up to 3),
+   with x in *x; 0 otherwise. */
+static int64_t scale_of(TExp *e, TExp **x)
+{
+    if (e->kind != TE_BINOP)
+        return 0;
+    TExp *l = e->u.bin.left, *r = e->u.bin.right;
+    if (e->op == T_MUL) {
+        if (r->kind != TE_CONST) {
+            TExp *t = l;
+            l = r;
+            r = t;
+        }
+        if (r->kind == TE_CONST &&
+            (r->u.value == 1 || r->u.value == 2 || r->u.value == 4 || r->u.value == 8)) {
+            *x = l;
+            return r->u.value;
+        }
+    } else if (e->op == T_LSHIFT && r->kind == TE_CONST && r->u.value >= 0 && r->u.value <= 3) {
+        *x = l;
+        return (int64_t)1 << r->u.value;
+    }
+    return 0;
+}
+
+/* `e` without the constants added at its top: e = result + *k. */
+static TExp *pull_const(TExp *e, int64_t *k)
+{
+    for (;;) {
+        if (e->kind != TE_BINOP || e->op != T_PLUS)
+            return e;
+        TExp *l = e->u.bin.left, *r = e->u.bin.right;
+        if (r->kind == TE_CONST && !__builtin_add_overflow(*k, r->u.value, k))
+            e = l;
+        else if (l->kind == TE_CONST && !__builtin_add_overflow(*k, l->u.value, k))
+            e = r;
+        else
+            return e;
+    }
+}
+
+static const char *mem_text(Gen *g, const Mem *m, Temp *src, uint32_t *nsrc);
+
+static Temp lea(Gen *g, const Mem *m)
+{
+    Temp src[2], d = temp_new();
+    uint32_t n = 0;
+    const char *mt = mem_text(g, m, src, &n);
+    oper(g, instr_fmt(g->a, "leaq %s, `d0", mt), 1, &d, n, src);
+    return d;
+}
+
+static void add_reg(Gen *g, Mem *m, Temp t, int64_t scale)
+{
+    if (scale == 1 && m->base == NO_TEMP) {
+        m->base = t;
+        return;
+    }
+    if (m->index == NO_TEMP) {
+        m->index = t;
+        m->scale = (uint8_t)scale;
+        return;
+    }
+    /* Both taken: sum base and index into one register first. */
+    Mem sum = { .base = m->base, .index = m->index, .scale = m->scale };
+    m->base = lea(g, &sum);
+    m->index = NO_TEMP;
+    add_reg(g, m, t, scale);
+}
+
+static void add_term(Gen *g, Mem *m, TExp *e, int64_t scale)
+{
+    TExp *x;
+    int64_t k;
+    if (e->kind == TE_CONST && add_disp(m, e->u.value, scale))
+        return;
+    if (e->kind == TE_BINOP && e->op == T_PLUS) {
+        add_term(g, m, e->u.bin.left, scale);
+        add_term(g, m, e->u.bin.right, scale);
+        return;
+    }
+    if (e->kind == TE_BINOP && e->op == T_MINUS && e->u.bin.right->kind == TE_CONST &&
+        add_disp(m, e->u.bin.right->u.value, -scale)) {
+        add_term(g, m, e->u.bin.left, scale);
+        return;
+    }
+    if ((k = scale_of(e, &x)) && k * scale <= 8) {
+        add_term(g, m, x, k * scale);
+        return;
+    }
+    /* (a + k) - b: the constant still goes to the displacement. */
+    if (e->kind == TE_BINOP && e->op == T_MINUS) {
+        int64_t c = 0;
+        TExp *l = pull_const(e->u.bin.left, &c);
+        if (c && add_disp(m, c, scale))
+            e = t_binop(g->a, T_MINUS, l, e->u.bin.right);
+    }
+    add_reg(g, m, munch_exp(g, e), scale);
+}
+
+/* Fold as much of the address `e` as x86 addressing allows. */
+static void munch_addr(Gen *g, TExp *e, Mem *m)
+{
+    *m = (Mem){ .base = NO_TEMP, .index = NO_TEMP, .scale = 1 };
+    TExp *n = e;
+    if (e->kind == TE_BINOP && e->op == T_PLUS) {
+        if (e->u.bin.left->kind == TE_NAME && is_imm32(e->u.bin.right))
+            n = e->u.bin.left, m->disp = e->u.bin.right->u.value;
+        else if (e->u.bin.right->kind == TE_NAME && is_imm32(e->u.bin.left))
+            n = e->u.bin.right, m->disp = e->u.bin.left->u.value;
+    }
+    if (n->kind == TE_NAME) {
+        m->rip = true;
+        m->sym = n->u.name;
+        return;
+    }
+    m->disp = 0;
+    add_term(g, m, e, 1);
+}
+
+/* The operand text for `m`, appending its registers to `src`. */
+static const char *mem_text(Gen *g, const Mem *m, Temp *src, uint32_t *nsrc)
+{
+    if (m->rip)
+        return m->disp ? instr_fmt(g->a, "%s%+" PRId64 "(%%rip)", label_text(g, m->sym), m->disp)
+                       : instr_fmt(g->a, "%s(%%rip)", label_text(g, m->sym));
+    char buf[64];
+    int n = 0;
+    if (m->disp || (m->base == NO_TEMP && m->index == NO_TEMP))
+        n += snprintf(buf + n, sizeof buf - n, "%" PRId64, m->disp);
+    if (m->base != NO_TEMP || m->index != NO_TEMP) {
+        n += snprintf(buf + n, sizeof buf - n, "(");
+        if (m->base != NO_TEMP) {
+            n += snprintf(buf + n, sizeof buf - n, "`s%u", *nsrc);
+            src[(*nsrc)++] = m->base;
+        }
+        if (m->index != NO_TEMP) {
+            n += snprintf(buf + n, sizeof buf - n, ",`s%u,%u", *nsrc, m->scale);
+            src[(*nsrc)++] = m->index;
+        }
+        snprintf(buf + n, sizeof buf - n, ")");
+    }
+    return instr_fmt(g->a, "%s", buf);
+}
+
+/* ---- Expressions ----------------------------------------------------------- */
+
+static void load_const(Gen *g, Temp d, int64_t k)
+{
+    const char *fmt = k >= INT32_MIN && k <= INT32_MAX ? "movq $%" PRId64 ", `d0"
+                                                        : "movabsq $%" PRId64 ", `d0";
+    oper(g, instr_fmt(g->a, fmt, k), 1, &d, 0, NULL);
+}
+
+/* Evaluate every argument before loading any argument register, since
+   computing one may need a register another is passed in.  An argument
+   that is itself in an argument register (a parameter of ours passed
+   on) is copied first, as loading the others could overwrite it. */
+static Temp *munch_args(Gen *g, const TExp *call)
+{
+    uint32_t n = call->u.call.nargs;
+    Temp *args = arena_alloc(g->a, (n ? n : 1) * sizeof *args);
+    for (uint32_t i = 0; i < n; i++) {
+        args[i] = munch_exp(g, call->u.call.args[i]);
+        for (uint32_t k = 0; k < FRAME_NARG_REGS; k++)
+            if (args[i] == arg_regs[k]) {
+                Temp t = temp_new();
+                move(g, t, args[i]);
+                args[i] = t;
+                break;
+            }
+    }
+    return args;
+}
+
+static uint32_t load_arg_regs(Gen *g, const Temp *args, uint32_t n, Temp *src)
+{
+    uint32_t nreg = n < FRAME_NARG_REGS ? n : FRAME_NARG_REGS;
+    for (uint32_t i = 0; i < nreg; i++)
+        move(g, arg_regs[i], args[i]);
+    memcpy(src, arg_regs, nreg * sizeof *src);
+    return nreg;
+}
+
+static void munch_call(Gen *g, const TExp *call)
+{
+    uint32_t n = call->u.call.nargs;
+    Temp *args = munch_args(g, call);
+
+    uint32_t nstack = n > FRAME_NARG_REGS ? n - FRAME_NARG_REGS : 0;
+    uint32_t pad = nstack % 2 ? FRAME_WORD : 0;
+    if (pad)
+        oper(g, "subq $8, %rsp", 0, NULL, 0, NULL);
+    for (uint32_t i = n; i-- > FRAME_NARG_REGS;)
+        oper(g, "pushq `s0", 0, NULL, 1, &args[i]);
+    Temp src[FRAME_NARG_REGS + 1];
+    uint32_t nsrc = load_arg_regs(g, args, n, src);
+
+    TExp *fn = call->u.call.func;
+    const char *fmt;
+    if (fn->kind == TE_NAME) {
+        fmt = instr_fmt(g->a, "call %s", label_text(g, fn->u.name));
+    } else {
+        src[nsrc] = munch_exp(g, fn);
+        fmt = instr_fmt(g->a, "call *`s%u", nsrc++);
+    }
+    Instr *in = oper(g, fmt, FRAME_NCALLER_SAVES, caller_saves, nsrc, src);
+    in->flags |= IF_CALL;
+    if (call->flags & TC_NORETURN)
+        in->flags |= IF_JUMP;
+    if (nstack)
+        oper(g, instr_fmt(g->a, "addq $%u, %%rsp", nstack * FRAME_WORD + pad), 0, NULL, 0,
+             NULL);
+}
+
+/* A call marked TC_TAIL: its stack arguments overwrite ours, and the
+   epilogue goes before a `jmp`.  The arguments arrive in registers the
+   epilogue does not restore; so does the target of an indirect call,
+   in %r11. */
+static void munch_tail_call(Gen *g, const TExp *call)
+{
+    uint32_t n = call->u.call.nargs;
+    Temp *args = munch_args(g, call);
+    Temp src[FRAME_NARG_REGS + 1];
+    TExp *fn = call->u.call.func;
+    Temp target = fn->kind == TE_NAME ? NO_TEMP : munch_exp(g, fn);
+    for (uint32_t i = FRAME_NARG_REGS; i < n; i++)
+        oper(g, instr_fmt(g->a, "movq `s0, %u(%%rbp)",
+                          2 * FRAME_WORD + (i - FRAME_NARG_REGS) * FRAME_WORD),
+             0, NULL, 1, &args[i]);
+    uint32_t nsrc = load_arg_regs(g, args, n, src);
+    const char *fmt;
+    if (target == NO_TEMP) {
+        fmt = instr_fmt(g->a, "jmp %s", label_text(g, fn->u.name));
+    } else {
+        move(g, REG_R11, target);
+        src[nsrc++] = REG_R11;
+        fmt = "jmp *%r11";
+    }
+    Instr *in = oper(g, fmt, 0, NULL, nsrc, src);
+    in->flags |= IF_JUMP | IF_TAIL;
+}
+
+/* `d` op= e, with e as an immediate or a memory operand when it can be. */
+static void arith_into(Gen *g, TBinOp op, Temp d, TExp *e)
+{
+    if (is_imm32(e)) {
+        oper(g, instr_fmt(g->a, "%s $%" PRId64 ", `d0", arith[op], e->u.value), 1, &d, 1, &d);
+        return;
+    }
+    if (e->kind == TE_MEM && op != T_LSHIFT && op != T_RSHIFT && op != T_ARSHIFT) {
+        Mem m;
+        munch_addr(g, e->u.mem, &m);
+        Temp src[3] = { d };
+        uint32_t n = 1;
+        const char *mt = mem_text(g, &m, src, &n);
+        oper(g, instr_fmt(g->a, "%s %s, `d0", arith[op], mt), 1, &d, n, src);
+        return;
+    }
+    Temp r = munch_exp(g, e);
+    if (op == T_LSHIFT || op == T_RSHIFT || op == T_ARSHIFT) {
+        move(g, REG_RCX, r);
+        oper(g, instr_fmt(g->a, "%s %%cl, `d0", arith[op]), 1, &d, 2, (Temp[]){ d, REG_RCX });
+        return;
+    }
+    oper(g, instr_fmt(g->a, "%s `s0, `d0", arith[op]), 1, &d, 2, (Temp[]){ r, d });
+}
+
+static int shift_of(int64_t k)
+{
+    return k > 0 && !(k & (k - 1)) ? __builtin_ctzll((uint64_t)k) : -1;
+}
+
+static Temp munch_binop(Gen *g, TExp *e)
+{
+    TBinOp op = (TBinOp)e->op;
+    TExp *l = e->u.bin.left, *r = e->u.bin.right;
+    Temp d;
+
+    if (op == T_DIV) {
+        Temp x = munch_exp(g, l), y = munch_exp(g, r);
+        Temp rax = REG_RAX, rdx = REG_RDX;
+        if (y == REG_RAX || y == REG_RDX) {
+            /* Not to be overwritten by x or by cqto. */
+            Temp t = temp_new();
+            move(g, t, y);
+            y = t;
+        }
+        d = temp_new();
+        move(g, REG_RAX, x);
+        oper(g, "cqto", 1, &rdx, 1, &rax);
+        oper(g, "idivq `s0", 2, (Temp[]){ REG_RAX, REG_RDX }, 3, (Temp[]){ y, REG_RAX, REG_RDX });
+        move(g, d, REG_RAX);
+        return d;
+    }
+    /* Sums of registers and constants, and scaled indices under them,
+       are one leaq. */
+    if (op == T_PLUS || (op == T_MINUS && is_imm32(r))) {
+        Mem m = { .base = NO_TEMP, .index = NO_TEMP, .scale = 1 };
+        add_term(g, &m, e, 1);
+        if (m.base == NO_TEMP && m.index == NO_TEMP) {
+            d = temp_new();
+            load_const(g, d, m.disp);
+            return d;
+        }
+        if (m.index == NO_TEMP && !m.disp)
+            return m.base;
+        return lea(g, &m);
+    }
+    if (op == T_MUL) {
+        if (l->kind == TE_CONST) {
+            TExp *t = l;
+            l = r;
+            r = t;
+        }
+        if (r->kind == TE_CONST && shift_of(r->u.value) >= 0) {
+            d = temp_new();
+            move(g, d, munch_exp(g, l));
+            if (shift_of(r->u.value))
+                oper(g, instr_fmt(g->a, "salq $%d, `d0", shift_of(r->u.value)), 1, &d, 1, &d);
+            return d;
+        }
+        if (is_imm32(r)) {
+            Temp x = munch_exp(g, l);
+            d = temp_new();
+            oper(g, instr_fmt(g->a, "imulq $%" PRId64 ", `s0, `d0", r->u.value), 1, &d, 1, &x);
+            return d;
+        }
+    }
+    d = temp_new();
+    move(g, d, munch_exp(g, l));
+    arith_into(g, op, d, r);
+    return d;
+}
+
+static Temp munch_exp(Gen *g, TExp *e)
+{
+    Temp d;
+    switch ((TExpKind)e->kind) {
+    case TE_CONST:
+        d = temp_new();
+        load_const(g, d, e->u.value);
+        return d;
+    case TE_NAME:
+        d = temp_new();
+        oper(g, instr_fmt(g->a, "leaq %s(%%rip), `d0", label_text(g, e->u.name)), 1, &d, 0,
+             NULL);
+        return d;
+    case TE_TEMP:
+        /* Every division overwrites %rax and %rdx, so an operand read
+           from them is taken while it still holds the value: a later
+           sibling may divide. */
+        if (e->u.temp == REG_RAX || e->u.temp == REG_RDX) {
+            d = temp_new();
+            move(g, d, e->u.temp);
+            return d;
+        }
+        return e->u.temp;
+    case TE_BINOP:
+        return munch_binop(g, e);
+    case TE_MEM: {
+        Mem m;
+        Temp src[2];
+        uint32_t n = 0;
+        munch_addr(g, e->u.mem, &m);
+        const char *mt = mem_text(g, &m, src, &n);
+        d = temp_new();
+        oper(g, instr_fmt(g->a, "movq %s, `d0", mt), 1, &d, n, src);
+        return d;
+    }
+    case TE_CALL:
+        munch_call(g, e);
+        d = temp_new();
+        move(g, d, REG_RAX);
+        return d;
+    case TE_ESEQ:
+        break;
+    }
+    fatal("codegen: expression not canonical");
+}
+
+/* ---- Statements -------------------------------------------------------- */
+
+static void munch_store(Gen *g, TExp *addr, TExp *src)
+{
+    Temp v = is_imm32(src) ? NO_TEMP : munch_exp(g, src);
+    Mem m;
+    Temp s[3];
+    uint32_t n = v == NO_TEMP ? 0 : 1;
+    s[0] = v;
+    munch_addr(g, addr, &m);
+    const char *mt = mem_text(g, &m, s, &n);
+    if (v == NO_TEMP)
+        oper(g, instr_fmt(g->a, "movq $%" PRId64 ", %s", src->u.value, mt), 0, NULL, n, s);
+    else
+        oper(g, instr_fmt(g->a, "movq `s0, %s", mt), 0, NULL, n, s);
+}
+
+static void munch_move_temp(Gen *g, Temp t, TExp *src)
+{
+    switch ((TExpKind)src->kind) {
+    case TE_CALL:
+        if (src->flags & TC_TAIL) {
+            munch_tail_call(g, src);
+            return;
+        }
+        munch_call(g, src);
+        if (t != REG_RAX)
+            move(g, t, REG_RAX);
+        return;
+    case TE_CONST:
+        load_const(g, t, src->u.value);
+        return;
+    case TE_MEM: {
+        Mem m;
+        Temp s[2];
+        uint32_t n = 0;
+        munch_addr(g, src->u.mem, &m);
+        const char *mt = mem_text(g, &m, s, &n);
+        oper(g, instr_fmt(g->a, "movq %s, `d0", mt), 1, &t, n, s);
+        return;
+    }
+    case TE_BINOP: {
+        /* t := t op e updates t in place. */
+        TBinOp op = (TBinOp)src->op;
+        TExp *l = src->u.bin.left;
+        if (op != T_DIV && l->kind == TE_TEMP && l->u.temp == t && t != REG_RCX) {
+            arith_into(g, op, t, src->u.bin.right);
+            return;
+        }
+        break;
+    }
+    default:
+        break;
+    }
+    move(g, t, munch_exp(g, src));
+}
+
+static void munch_cjump(Gen *g, const TStm *s)
+{
+    TRelOp op = (TRelOp)s->op;
+    TExp *l = s->u.cjump.left, *r = s->u.cjump.right;
+    if (l->kind == TE_CONST && r->kind != TE_CONST) {
+        TExp *t = l;
+        l = r;
+        r = t;
+        op = t_commute_rel(op);
+    }
+    Temp src[4];
+    uint32_t n = 0;
+    if (l->kind == TE_MEM && is_imm32(r)) {
+        Mem m;
+        munch_addr(g, l->u.mem, &m);
+        const char *mt = mem_text(g, &m, src, &n);
+        oper(g, instr_fmt(g->a, "cmpq $%" PRId64 ", %s", r->u.value, mt), 0, NULL, n, src);
+    } else if (is_imm32(r)) {
+        src[0] = munch_exp(g, l);
+        if (r->u.value == 0 && (op == T_EQ || op == T_NE))
+            oper(g, "testq `s0, `s0", 0, NULL, 1, src);
+        else
+            oper(g, instr_fmt(g->a, "cmpq $%" PRId64 ", `s0", r->u.value), 0, NULL, 1, src);
+    } else if (r->kind == TE_MEM) {
+        src[n++] = munch_exp(g, l);
+        Mem m;
+        munch_addr(g, r->u.mem, &m);
+        const char *mt = mem_text(g, &m, src, &n);
+        oper(g, instr_fmt(g->a, "cmpq %s, `s0", mt), 0, NULL, n, src);
+    } else if (l->kind == TE_MEM) {
+        src[n++] = munch_exp(g, r);
+        Mem m;
+        munch_addr(g, l->u.mem, &m);
+        const char *mt = mem_text(g, &m, src, &n);
+        oper(g, instr_fmt(g->a, "cmpq `s0, %s", mt), 0, NULL, n, src);
+    } else {
+        src[0] = munch_exp(g, l);
+        src[1] = munch_exp(g, r);
+        oper(g, "cmpq `s1, `s0", 0, NULL, 2, src);
+    }
+    /* The false label follows. */
+    jump(g, instr_fmt(g->a, "%s `j0", jcc[op]), s->u.cjump.t, 0);
+}
+
+static void munch_stm(Gen *g, const TStm *s)
+{
+    switch ((TStmKind)s->kind) {
+    case TS_MOVE: {
+        TExp *dst = s->u.move.dst, *src = s->u.move.src;
+        if (dst->kind == TE_MEM) {
+            munch_store(g, dst->u.mem, src);
+            return;
+        }
+        if (dst->kind != TE_TEMP)
+            break;
+        munch_move_temp(g, dst->u.temp, src);
+        return;
+    }
+    case TS_EXP:
+        if (s->u.exp->kind == TE_CALL && (s->u.exp->flags & TC_TAIL))
+            munch_tail_call(g, s->u.exp);
+        else if (s->u.exp->kind == TE_CALL)
+            munch_call(g, s->u.exp);
+        else
+            munch_exp(g, s->u.exp);
+        return;
+    case TS_JUMP:
+        jump(g, "jmp `j0", s->u.jump.labels[0], IF_JUMP);
+        return;
+    case TS_CJUMP:
+        munch_cjump(g, s);
+        return;
+    case TS_LABEL:
+        label(g, s->u.label);
+        return;
+    case TS_LINE: {
+        Label l = label_new();
+        label(g, l);
+        vec_push(&g->frame->lines, ((LineMark){ l, s->u.line }));
+        return;
+    }
+    case TS_SEQ:
+        munch_stm(g, s->u.seq.first);
+        munch_stm(g, s->u.seq.second);
+        return;
+    }
+    fatal("codegen: statement not canonical");
+}
+
+void codegen(Arena *a, Frame *f, TStm *body, InstrList *out)
+{
+    Gen g = { .a = a, .frame = f, .out = out };
+    f->lines.len = 0;
+    /* The traced body is a right-nested SEQ chain. */
+    while (body->kind == TS_SEQ) {
+        munch_stm(&g, body->u.seq.first);
+        body = body->u.seq.second;
+    }
+    munch_stm(&g, body);
+}
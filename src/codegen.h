@@ -0,0 +1,16 @@
+#ifndef TIGER_CODEGEN_H
+#define TIGER_CODEGEN_H
+
+#include "assem.h"
+#include "frame.h"
+
+/*
+ * Instruction selection for x86-64 (AT&T syntax) by maximal munch over
+ * canonical, traced trees: the body of a function as canon_trace()
+ * leaves it.  Calls follow the System V convention: the first six
+ * arguments in registers, the rest pushed right to left, and a call
+ * clobbers every caller-saved register.
+ */
+void codegen(Arena *a, Frame *f, TStm *body, InstrList *out);
+
+#endif
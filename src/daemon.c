@@ -0,0 +1,258 @@
+#include "daemon.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "ast.h"
+#include "diag.h"
+#include "lexer.h"
+#include "semant.h"
+#include "source.h"
+#include "symbol.h"
+
+/* What is held for one file: its text when last checked and what
+   checking it printed. */
+typedef struct Resident {
+    char *path;
+    Source src;
+    char *diags;
+    size_t diags_len;
+    int status;
+} Resident;
+
+typedef struct Daemon {
+    ParseMode parse_mode;
+    SemaBase base;
+    VEC(Resident *) files;
+} Daemon;
+
+static Resident *find(Daemon *d, const char *path)
+{
+    for (uint32_t i = 0; i < d->files.len; i++)
+        if (strcmp(d->files.data[i]->path, path) == 0)
+            return d->files.data[i];
+    return NULL;
+}
+
+static void forget(Daemon *d, const char *path)
+{
+    for (uint32_t i = 0; i < d->files.len; i++) {
+        Resident *r = d->files.data[i];
+        if (strcmp(r->path, path) != 0)
+            continue;
+        source_close(&r->src);
+        free(r->diags);
+        free(r->path);
+        free(r);
+        d->files.data[i] = d->files.data[--d->files.len];
+        return;
+    }
+}
+
+/* Lex, parse and type-check `src`, writing the errors to `*text`.
+   Returns the exit status `tigerc --check` would have. */
+static int check_source(Daemon *d, Source *src, char **text, size_t *len)
+{
+    FILE *f = open_memstream(text, len);
+    if (!f)
+        fatal("cannot buffer output: %s", strerror(errno));
+    int errors = diag_errors;
+    TokenVec toks = {0};
+    lex_all(src, &toks);
+    if (diag_errors == errors) {
+        Ast ast;
+        ast_init(&ast, src, toks.len);
+        if (parse_program(&ast, &toks, d->parse_mode)) {
+            Sema sema;
+            sema_check_in(&sema, &ast, &d->base);
+            sema_free(&sema);
+        }
+        ast_free(&ast);
+    }
+    diag_flush(f);
+    fclose(f);
+    vec_free(&toks);
+    return diag_errors > errors ? 1 : 0;
+}
+
+/* Answer for `path`, whose text is now `src`; takes `src` over.  A text
+   that is the one last checked gets the answer it got then. */
+static void check(Daemon *d, const char *path, Source *src, FILE *out)
+{
+    Resident *r = find(d, path);
+    if (r && r->src.len == src->len && memcmp(r->src.data, src->data, src->len) == 0) {
+        source_close(src);
+    } else {
+        if (r) {
+            source_close(&r->src);
+            free(r->diags);
+        } else {
+            r = xcalloc(1, sizeof *r);
+            r->path = xstrdup(path);
+            vec_push(&d->files, r);
+        }
+        r->src = *src;
+        r->src.path = r->path;
+        r->status = check_source(d, &r->src, &r->diags, &r->diags_len);
+    }
+    fwrite(r->diags, 1, r->diags_len, out);
+    fprintf(out, "end %d\n", r->status);
+}
+
+/* Answer one request line.  Returns false if the connection should
+   close: after a quit, or when the bytes of a text request are cut
+   short. */
+static bool request(Daemon *d, char *line, FILE *in, FILE *out, bool *quit)
+{
+    char *arg = strchr(line, ' ');
+    if (arg)
+        *arg++ = '\0';
+
+    if (strcmp(line, "check") == 0 && arg && *arg) {
+        Source src;
+        if (source_read(&src, arg))
+            check(d, arg, &src, out);
+        else
+            fprintf(out, "tigerc: cannot open '%s': %s\nend 2\n", arg, strerror(errno));
+    } else if (strcmp(line, "text") == 0 && arg) {
+        char *path;
+        unsigned long n = strtoul(arg, &path, 10);
+        if (path == arg || *path != ' ' || !path[1] || n >= UINT32_MAX) {
+            fputs("error: expected 'text N PATH'\nend 2\n", out);
+            return true;
+        }
+        path++;
+        char *buf = xmalloc(n + 1);
+        if (fread(buf, 1, n, in) != n) {
+            free(buf);
+            fputs("error: text cut short\nend 2\n", out);
+            return false;
+        }
+        Source src;
+        source_adopt(&src, path, buf, (uint32_t)n);
+        check(d, path, &src, out);
+    } else if (strcmp(line, "forget") == 0 && arg && *arg) {
+        forget(d, arg);
+        fputs("end 0\n", out);
+    } else if (strcmp(line, "quit") == 0 && !arg) {
+        *quit = true;
+        return false;
+    } else {
+        fprintf(out, "error: unknown request '%s'\nend 2\n", line);
+    }
+    return true;
+}
+
+/* Answer requests from `in` until it ends, a request closes it or the
+   other side goes away. */
+static void serve(Daemon *d, FILE *in, FILE *out, bool *quit)
+{
+    char *line = NULL;
+    size_t cap = 0;
+    ssize_t n;
+    bool more = true;
+    while (more && (n = getline(&line, &cap, in)) > 0) {
+        if (line[n - 1] == '\n')
+            line[--n] = '\0';
+        if (!n)
+            continue;
+        more = request(d, line, in, out, quit);
+        if (fflush(out) != 0)
+            break;
+    }
+    free(line);
+}
+
+/* A listening socket at `path`.  A socket file nobody answers on is
+   left from a daemon that died, and is replaced. */
+static int listen_on(const char *path)
+{
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if (strlen(path) >= sizeof addr.sun_path) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return -1;
+    struct stat st;
+    if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+        if (connect(fd, (struct sockaddr *)&addr, sizeof addr) == 0) {
+            close(fd);
+            errno = EADDRINUSE;
+            return -1;
+        }
+        unlink(path);
+    }
+    if (bind(fd, (struct sockaddr *)&addr, sizeof addr) < 0 || listen(fd, 16) < 0) {
+        int e = errno;
+        close(fd);
+        errno = e;
+        return -1;
+    }
+    return fd;
+}
+
+static int serve_socket(Daemon *d, const char *path)
+{
+    int lfd = listen_on(path);
+    if (lfd < 0) {
+        fprintf(stderr, "tigerc: cannot listen on '%s': %s\n", path, strerror(errno));
+        return 2;
+    }
+    /* A client that hangs up mid-answer costs its answer, not the daemon. */
+    signal(SIGPIPE, SIG_IGN);
+
+    int status = 0;
+    bool quit = false;
+    while (!quit) {
+        int fd = accept(lfd, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            fprintf(stderr, "tigerc: accept on '%s': %s\n", path, strerror(errno));
+            status = 2;
+            break;
+        }
+        int wfd = dup(fd);
+        FILE *in = fdopen(fd, "r");
+        FILE *out = wfd < 0 ? NULL : fdopen(wfd, "w");
+        if (!in || !out)
+            fatal("cannot open connection: %s", strerror(errno));
+        serve(d, in, out, &quit);
+        fclose(in);
+        fclose(out);
+    }
+    close(lfd);
+    unlink(path);
+    return status;
+}
+
+int daemon_run(const char *socket_path, ParseMode parse_mode, EnvKind env_kind)
+{
+    Daemon d = { .parse_mode = parse_mode };
+    symtab_init();
+    sema_base_init(&d.base, env_kind);
+
+    int status = 0;
+    if (socket_path) {
+        status = serve_socket(&d, socket_path);
+    } else {
+        bool quit = false;
+        serve(&d, stdin, stdout, &quit);
+    }
+
+    while (d.files.len)
+        forget(&d, d.files.data[0]->path);
+    vec_free(&d.files);
+    sema_base_free(&d.base);
+    return status;
+}
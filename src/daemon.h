@@ -0,0 +1,33 @@
+#ifndef TIGER_DAEMON_H
+#define TIGER_DAEMON_H
+
+#include <stdio.h>
+
+#include "env.h"
+#include "parser.h"
+
+/*
+ * `tigerc --daemon`: a long-lived type checker for editors and build
+ * scripts.  The symbol table and the builtin environments are built
+ * once, and the text and diagnostics of every file checked stay
+ * resident, so asking again about a file that has not changed costs a
+ * comparison.  Requests are lines:
+ *
+ *   check PATH          check the file PATH as it is on disk
+ *   text N PATH         check the N bytes after the newline, say an
+ *                       unsaved buffer, as the text of PATH
+ *   forget PATH         drop what is held for PATH
+ *   quit                stop the daemon
+ *
+ * A check is answered with the errors `tigerc --check` would print,
+ * then a line "end S" with the exit status it would have; forget
+ * answers "end 0".  Anything else gets an "error: ..." line and
+ * "end 2".
+ */
+
+/* Serve requests on the Unix socket at `socket_path`, one connection
+   at a time, or on stdin and stdout if it is NULL, until a quit
+   request (or, on stdin, end of input).  Returns the exit status. */
+int daemon_run(const char *socket_path, ParseMode parse_mode, EnvKind env_kind);
+
+#endif
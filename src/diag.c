@@ -0,0 +1,92 @@
+#include "diag.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+_Thread_local int diag_errors;
+uint32_t diag_limit = DIAG_DEFAULT_LIMIT;
+
+typedef struct DiagRecord {
+    uint32_t offset;        /* source offset the error is reported at */
+    uint32_t seq;           /* raise order, to keep the sort stable */
+    uint32_t text;          /* start of the NUL-terminated message in text */
+} DiagRecord;
+
+static _Thread_local Source *cur_src;
+static _Thread_local VEC(DiagRecord) records;
+static _Thread_local VEC(char) text;
+static _Thread_local uint32_t suppressed;
+
+uint32_t diag_pending(void)
+{
+    return records.len;
+}
+
+static int record_cmp(const void *a, const void *b)
+{
+    const DiagRecord *x = a, *y = b;
+    if (x->offset != y->offset)
+        return x->offset < y->offset ? -1 : 1;
+    return x->seq < y->seq ? -1 : x->seq > y->seq;
+}
+
+void diag_flush(FILE *out)
+{
+    /* Checkers mostly raise errors in source order already. */
+    bool sorted = true;
+    for (uint32_t i = 1; i < records.len && sorted; i++)
+        sorted = record_cmp(&records.data[i - 1], &records.data[i]) <= 0;
+    if (!sorted)
+        qsort(records.data, records.len, sizeof *records.data, record_cmp);
+
+    for (uint32_t i = 0; i < records.len; i++) {
+        uint32_t line, col;
+        source_position(cur_src, records.data[i].offset, &line, &col);
+        fprintf(out, "%s:%u:%u: error: %s\n", cur_src->path, line, col,
+                text.data + records.data[i].text);
+    }
+    if (suppressed)
+        fprintf(out, "%s: %u more error%s not shown (limit is %u)\n",
+                cur_src->path, suppressed, suppressed == 1 ? "" : "s", diag_limit);
+
+    records.len = 0;
+    text.len = 0;
+    suppressed = 0;
+    cur_src = NULL;
+}
+
+void diag_verror(Source *src, uint32_t offset, const char *fmt, va_list ap)
+{
+    if (src != cur_src) {
+        if (cur_src)
+            diag_flush(stderr);
+        cur_src = src;
+    }
+    diag_errors++;
+    if (diag_limit && records.len >= diag_limit) {
+        suppressed++;
+        return;
+    }
+
+    va_list ap2;
+    va_copy(ap2, ap);
+    int n = vsnprintf(NULL, 0, fmt, ap2);
+    va_end(ap2);
+    if (n < 0)
+        n = 0;
+    vec_reserve(&text, text.len + (uint32_t)n + 1);
+    vsnprintf(text.data + text.len, (size_t)n + 1, fmt, ap);
+
+    DiagRecord r = { offset, records.len, text.len };
+    vec_push(&records, r);
+    text.len += (uint32_t)n + 1;
+}
+
+void diag_error(Source *src, uint32_t offset, const char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    diag_verror(src, offset, fmt, ap);
+    va_end(ap);
+}
@@ -0,0 +1,39 @@
+#ifndef TIGER_DIAG_H
+#define TIGER_DIAG_H
+
+#include <stdarg.h>
+#include <stdio.h>
+
+#include "source.h"
+
+/*
+ * Diagnostics are not printed as they are raised but collected in a
+ * side buffer of (source offset, message) records, one file at a time,
+ * and written out sorted by position by diag_flush().  Once a file has
+ * diag_limit errors, further ones are only counted: they cost neither
+ * formatting nor memory.  The buffer belongs to the calling thread.
+ */
+
+/* Number of errors reported so far on this thread, including suppressed
+   ones. */
+extern _Thread_local int diag_errors;
+
+/* Most errors kept per file; 0 means no limit. */
+extern uint32_t diag_limit;
+
+#define DIAG_DEFAULT_LIMIT 100
+
+/* Report an error at byte `offset` of `src` as "path:line:col: error: ...". */
+void diag_error(Source *src, uint32_t offset, const char *fmt, ...)
+    __attribute__((format(printf, 3, 4)));
+void diag_verror(Source *src, uint32_t offset, const char *fmt, va_list ap);
+
+/* Errors buffered for the current file. */
+uint32_t diag_pending(void);
+
+/* Print the buffered errors in source order to `out` and empty the
+   buffer.  Raising an error against a different Source flushes the
+   previous file's errors to stderr first. */
+void diag_flush(FILE *out);
+
+#endif
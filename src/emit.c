@@ -0,0 +1,349 @@
+#include "emit.h"
+
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "codegen.h"
+#include "phase.h"
+
+/* A string literal is laid out like a runtime string: its length in the
+   word before its first byte. */
+static void print_string(Label l, Symbol sym, FILE *out)
+{
+    const unsigned char *s = (const unsigned char *)sym_name(sym);
+    uint32_t n = sym_len(sym);
+    fprintf(out, "\t.p2align 3\n\t.quad %u\n", n);
+    label_print(l, out);
+    fputs(":\n\t.ascii \"", out);
+    for (uint32_t i = 0; i < n; i++) {
+        if (s[i] == '"' || s[i] == '\\')
+            fprintf(out, "\\%c", s[i]);
+        else if (s[i] < 32 || s[i] >= 127)
+            fprintf(out, "\\%03o", s[i]);
+        else
+            fputc(s[i], out);
+    }
+    fputs("\"\n", out);
+}
+
+static void epilogue(const Frame *f, const int32_t *slot, FILE *out)
+{
+    for (uint32_t j = 0; j < FRAME_NCALLEE_SAVES; j++)
+        if (f->saved & 1u << callee_saves[j])
+            fprintf(out, "\tmovq %d(%%rbp), %%%s\n", slot[j], reg_names[callee_saves[j]]);
+    fputs("\tleave\n", out);
+}
+
+static void print_asciz(const char *s, FILE *out)
+{
+    fputs("\t.asciz \"", out);
+    for (; *s; s++) {
+        unsigned char c = (unsigned char)*s;
+        if (c == '"' || c == '\\')
+            fprintf(out, "\\%c", c);
+        else if (c < 32 || c >= 127)
+            fprintf(out, "\\%03o", c);
+        else
+            fputc(c, out);
+    }
+    fputs("\"\n", out);
+}
+
+/* The code of a function from its prologue to its ret.  Under -pg the
+   prologue bumps the function's word of the counts at `counts`. */
+static void emit_code(Program *p, Frag *fr, RegAllocKind ra, bool value, Label counts,
+                      uint32_t index, FILE *out)
+{
+    Frame *f = fr->u.proc.frame;
+    InstrList code = {0};
+    phase_enter(PHASE_ISEL);
+    codegen(&p->arena, f, fr->u.proc.body, &code);
+    phase_enter(PHASE_REGALLOC);
+    regalloc(&p->arena, f, &code, ra, value);
+    phase_enter(PHASE_EMIT);
+
+    /* The callee-saved registers in use get slots below the spills. */
+    int32_t slot[FRAME_NCALLEE_SAVES] = {0};
+    for (uint32_t j = 0; j < FRAME_NCALLEE_SAVES; j++)
+        if (f->saved & 1u << callee_saves[j])
+            slot[j] = frame_alloc_local(f, true, false).offset;
+    int32_t size = (f->locals + 15) & ~15;
+
+    fputs("\tpushq %rbp\n\tmovq %rsp, %rbp\n", out);
+    if (size)
+        fprintf(out, "\tsubq $%d, %%rsp\n", size);
+    for (uint32_t j = 0; j < FRAME_NCALLEE_SAVES; j++)
+        if (f->saved & 1u << callee_saves[j])
+            fprintf(out, "\tmovq %%%s, %d(%%rbp)\n", reg_names[callee_saves[j]], slot[j]);
+    if (p->profile) {
+        fputs("\tincq ", out);
+        label_print(counts, out);
+        fprintf(out, "+%u(%%rip)\n", 8 * index);
+    }
+    for (uint32_t i = 0; i < code.len; i++) {
+        if (code.data[i].flags & IF_TAIL)
+            epilogue(f, slot, out);
+        instr_print(&code.data[i], out);
+    }
+    epilogue(f, slot, out);
+    fputs("\tret\n", out);
+    vec_free(&code);
+}
+
+/* `end` labels the end of the function's code, for the frame table.
+   With a cache, code generation is skipped for a function whose trees
+   it has seen. */
+static void emit_proc(Program *p, Frag *fr, RegAllocKind ra, Cache *cache, Label end,
+                      Label counts, uint32_t index, FILE *out)
+{
+    const FunEntry *fun = fr->u.proc.fun;
+    bool value = fun && type_actual(fun->result)->kind != TK_UNIT;
+    fputs("\t.p2align 4\n", out);
+    if (strcmp(sym_name(label_sym(fr->label)), "tigermain") == 0)
+        fputs("\t.globl tigermain\n", out);
+    label_print(fr->label, out);
+    fputs(":\n", out);
+
+    if (!cache) {
+        emit_code(p, fr, ra, value, counts, index, out);
+    } else {
+        CacheKey key;
+        CacheLabels labels = {0};
+        uint32_t len;
+        cache_proc_key(fr->u.proc.body, fr->u.proc.frame, ra | (uint64_t)value << 8, &key,
+                       &labels);
+        const char *text = cache_find(cache, &key, labels.len, &len);
+        if (text) {
+            cache_print(text, len, &labels, out);
+        } else {
+            char *buf;
+            size_t n;
+            FILE *mem = open_memstream(&buf, &n);
+            if (!mem)
+                fatal("out of memory");
+            emit_code(p, fr, ra, value, counts, index, mem);
+            fclose(mem);
+            fwrite(buf, 1, n, out);
+            cache_add(cache, &key, buf, n, &labels);
+            free(buf);
+        }
+        vec_free(&labels);
+    }
+    label_print(end, out);
+    fputs(":\n", out);
+}
+
+/*
+ * The collector's view of the program.  tiger_frametable lists, in
+ * address order, each function's code range and the %rbp offsets of its
+ * frame slots that hold heap pointers: its escaping variables of
+ * record, array or string type.  A return address inside a range tells
+ * the collector whose frame the saved %rbp above it belongs to.
+ * tiger_roots lists the global words that hold heap pointers.
+ */
+static void emit_gc_tables(Program *p, const uint32_t *procs, uint32_t nproc,
+                           const Label *ends, FILE *out)
+{
+    Label *slots = xcalloc(nproc ? nproc : 1, sizeof *slots);
+    fprintf(out, "\t.globl tiger_frametable\ntiger_frametable:\n\t.quad %u\n", nproc);
+    for (uint32_t k = 0; k < nproc; k++) {
+        const Frag *fr = &p->frags.data[procs[k]];
+        const Frame *f = fr->u.proc.frame;
+        uint32_t n = 0;
+        for (uint32_t j = 0; j < f->slots.len; j++)
+            n += f->slots.data[j].ptr;
+        slots[k] = n ? label_new() : 0;
+        fputs("\t.quad ", out);
+        label_print(fr->label, out);
+        fputs(", ", out);
+        label_print(ends[procs[k]], out);
+        fputs(", ", out);
+        if (n)
+            label_print(slots[k], out);
+        else
+            fputc('0', out);
+        fprintf(out, ", %u\n", n);
+    }
+    for (uint32_t k = 0; k < nproc; k++) {
+        if (!slots[k])
+            continue;
+        label_print(slots[k], out);
+        fputs(":\n", out);
+        const Frame *f = p->frags.data[procs[k]].u.proc.frame;
+        for (uint32_t j = 0; j < f->slots.len; j++)
+            if (f->slots.data[j].ptr)
+                fprintf(out, "\t.quad %d\n", f->slots.data[j].offset);
+    }
+    free(slots);
+
+    uint32_t nroots = 0;
+    for (uint32_t i = 0; i < p->frags.len; i++)
+        nroots += p->frags.data[i].kind == FRAG_GLOBAL && p->frags.data[i].u.global.ptr;
+    fprintf(out, "\t.globl tiger_roots\ntiger_roots:\n\t.quad %u\n", nroots);
+    for (uint32_t i = 0; i < p->frags.len; i++) {
+        const Frag *f = &p->frags.data[i];
+        if (f->kind != FRAG_GLOBAL || !f->u.global.ptr)
+            continue;
+        fputs("\t.quad ", out);
+        label_print(f->label, out);
+        fputc('\n', out);
+    }
+}
+
+/*
+ * What -pg leaves for the profiler in the runtime (runtime/prof.c).
+ * tiger_profile holds the number of functions, of line entries and of
+ * branches, the addresses of the call counts, of the branch counts and
+ * of the source's name; then each function's name and code range, in
+ * address order; then, in address order too, the address where the
+ * code of each source line starts, with the line; then the line and
+ * column of each branch, whose two words of counts say how often its
+ * test held and failed.  Without -pg the numbers are 0.
+ */
+static void emit_profile(Program *p, const uint32_t *procs, uint32_t nproc, const Label *ends,
+                         Label counts, FILE *out)
+{
+    uint32_t nlines = 0;
+    for (uint32_t k = 0; p->profile && k < nproc; k++) {
+        const Frame *f = p->frags.data[procs[k]].u.proc.frame;
+        for (uint32_t j = 0; j < f->lines.len; j++)
+            nlines += !j || f->lines.data[j].line != f->lines.data[j - 1].line;
+    }
+    if (!p->profile) {
+        fputs("\t.globl tiger_profile\ntiger_profile:\n\t.quad 0, 0, 0, 0, 0, 0\n", out);
+        return;
+    }
+    fprintf(out, "\t.globl tiger_profile\ntiger_profile:\n\t.quad %u, %u, %u\n", nproc, nlines,
+            p->branches.len);
+    Label path = label_new();
+    fputs("\t.quad ", out);
+    label_print(counts, out);
+    fputs(", ", out);
+    label_print(p->branch_counts, out);
+    fputs(", ", out);
+    label_print(path, out);
+    fputc('\n', out);
+    Label *names = xcalloc(nproc ? nproc : 1, sizeof *names);
+    for (uint32_t k = 0; k < nproc; k++) {
+        const Frag *fr = &p->frags.data[procs[k]];
+        names[k] = label_new();
+        fputs("\t.quad ", out);
+        label_print(names[k], out);
+        fputs(", ", out);
+        label_print(fr->label, out);
+        fputs(", ", out);
+        label_print(ends[procs[k]], out);
+        fputc('\n', out);
+    }
+    for (uint32_t k = 0; k < nproc; k++) {
+        const Frag *fr = &p->frags.data[procs[k]];
+        const Frame *f = fr->u.proc.frame;
+        for (uint32_t j = 0; j < f->lines.len; j++) {
+            const LineMark *m = &f->lines.data[j];
+            if (j && m->line == f->lines.data[j - 1].line)
+                continue;
+            /* The prologue counts as the first line. */
+            fputs("\t.quad ", out);
+            label_print(j ? m->label : fr->label, out);
+            fprintf(out, ", %u\n", m->line);
+        }
+    }
+    for (uint32_t i = 0; i < p->branches.len; i++)
+        fprintf(out, "\t.quad %u, %u\n", p->branches.data[i].line, p->branches.data[i].col);
+    label_print(counts, out);
+    fprintf(out, ":\n\t.zero %u\n", 8 * nproc);
+    label_print(p->branch_counts, out);
+    fputs(":\n", out);
+    if (p->branches.len)
+        fprintf(out, "\t.zero %u\n", 16 * p->branches.len);
+
+    /* The names as the assembly spells them. */
+    for (uint32_t k = 0; k < nproc; k++) {
+        char *buf;
+        size_t n;
+        FILE *mem = open_memstream(&buf, &n);
+        if (!mem)
+            fatal("out of memory");
+        label_print(p->frags.data[procs[k]].label, mem);
+        fclose(mem);
+        label_print(names[k], out);
+        fputs(":\n", out);
+        print_asciz(buf, out);
+        free(buf);
+    }
+    label_print(path, out);
+    fputs(":\n", out);
+    print_asciz(p->path ? p->path : "", out);
+    free(names);
+}
+
+typedef struct Hot {
+    uint64_t calls;
+    uint32_t frag;
+} Hot;
+
+static int by_heat(const void *a, const void *b)
+{
+    const Hot *x = a, *y = b;
+    if (x->calls != y->calls)
+        return x->calls > y->calls ? -1 : 1;
+    return x->frag < y->frag ? -1 : x->frag > y->frag;
+}
+
+void emit_program(Program *p, RegAllocKind ra, Cache *cache, FILE *out)
+{
+    Phase prev = phase_enter(PHASE_EMIT);
+    Label *ends = xcalloc(p->frags.len ? p->frags.len : 1, sizeof *ends);
+    /* The line marks are labels private to a function's code, which
+       cached code would not define, and code laid out after a profile
+       depends on more than its trees. */
+    if (p->profile || p->use)
+        cache = NULL;
+    Label counts = p->profile ? label_new() : 0;
+    /* With a profile, the functions called most come first, together,
+       and the ones never called last. */
+    uint32_t *procs = xmalloc((p->frags.len ? p->frags.len : 1) * sizeof *procs), nproc = 0;
+    for (uint32_t i = 0; i < p->frags.len; i++)
+        if (p->frags.data[i].kind == FRAG_PROC)
+            procs[nproc++] = i;
+    if (p->use) {
+        Hot *hot = xmalloc((nproc ? nproc : 1) * sizeof *hot);
+        for (uint32_t k = 0; k < nproc; k++)
+            hot[k] = (Hot){ p->frags.data[procs[k]].u.proc.frame->calls, procs[k] };
+        qsort(hot, nproc, sizeof *hot, by_heat);
+        for (uint32_t k = 0; k < nproc; k++)
+            procs[k] = hot[k].frag;
+        free(hot);
+    }
+    fputs("\t.text\n", out);
+    for (uint32_t k = 0; k < nproc; k++) {
+        uint32_t i = procs[k];
+        ends[i] = label_new();
+        uint64_t t = trace_open();
+        emit_proc(p, &p->frags.data[i], ra, cache, ends[i], counts, k, out);
+        trace_close(sym_name(label_sym(p->frags.data[i].label)), t);
+    }
+
+    fputs("\t.data\n\t.p2align 3\n", out);
+    for (uint32_t i = 0; i < p->frags.len; i++) {
+        const Frag *f = &p->frags.data[i];
+        if (f->kind != FRAG_GLOBAL)
+            continue;
+        label_print(f->label, out);
+        fprintf(out, ":\n\t.quad %" PRId64 "\n", f->u.global.constant ? f->u.global.value : 0);
+    }
+    emit_gc_tables(p, procs, nproc, ends, out);
+    emit_profile(p, procs, nproc, ends, counts, out);
+    free(procs);
+    free(ends);
+    fputs("\t.section .rodata\n", out);
+    for (uint32_t i = 0; i < p->frags.len; i++) {
+        const Frag *f = &p->frags.data[i];
+        if (f->kind != FRAG_STRING)
+            continue;
+        print_string(f->label, f->u.string.str, out);
+    }
+    fputs("\t.section .note.GNU-stack,\"\",@progbits\n", out);
+    phase_enter(prev);
+}
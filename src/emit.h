@@ -0,0 +1,20 @@
+#ifndef TIGER_EMIT_H
+#define TIGER_EMIT_H
+
+#include <stdio.h>
+
+#include "cache.h"
+#include "regalloc.h"
+#include "translate.h"
+
+/*
+ * GNU assembler output for a lowered program: instruction selection and
+ * register allocation for every function, wrapped in a prologue and
+ * epilogue that set up %rbp, reserve the frame and save the callee-saved
+ * registers the allocator used; then the globals and string literals.
+ * The result links with the C runtime, which calls tigermain().
+ * `cache` (may be NULL) supplies and collects the code of functions.
+ */
+void emit_program(Program *p, RegAllocKind ra, Cache *cache, FILE *out);
+
+#endif
@@ -0,0 +1,285 @@
+#include "env.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+
+/* A slot stays claimed once a symbol has been bound in it; undoing the
+   outermost binding leaves value NULL.  Only names that are actually
+   bound occupy slots, so the table stays small. */
+typedef struct Slot {
+    Symbol sym;             /* SYM_NONE marks an empty slot */
+    void *value;
+} Slot;
+
+typedef struct Undo {
+    Slot *slot;
+    void *old;
+} Undo;
+
+/*
+ * HAMT node in the CHAMP layout: `datamap` marks the 5-bit hash chunks
+ * that hold a binding directly, `nodemap` those that hold a subtrie.
+ * The bindings come first in `data`, in chunk order, followed by the
+ * child pointers.  The hash is a multiplication by an odd constant, a
+ * bijection on 32 bits, so two symbols always part ways by the last
+ * level and no collision buckets are needed.
+ */
+typedef struct HamtEntry {
+    Symbol sym;
+    void *value;
+} HamtEntry;
+
+struct HamtNode {
+    uint32_t datamap;
+    uint32_t nodemap;
+    HamtEntry data[];
+};
+
+typedef struct HamtNode HamtNode;
+
+struct Env {
+    EnvKind kind;
+
+    /* ENV_UNDO */
+    Slot *slots;            /* innermost binding of each name */
+    uint32_t mask;
+    uint32_t used;
+    VEC(Undo) log;
+    VEC(uint32_t) marks;    /* log length at each open scope */
+
+    /* ENV_HAMT */
+    Arena arena;            /* every node ever built; freed with the Env */
+    const HamtNode *root;
+    VEC(const HamtNode *) saved;
+};
+
+Env *env_new(EnvKind kind)
+{
+    Env *env = xcalloc(1, sizeof *env);
+    env->kind = kind;
+    if (kind == ENV_UNDO) {
+        env->mask = 255;
+        env->slots = xcalloc(env->mask + 1, sizeof *env->slots);
+    } else {
+        arena_init(&env->arena);
+    }
+    return env;
+}
+
+void env_free(Env *env)
+{
+    free(env->slots);
+    vec_free(&env->log);
+    vec_free(&env->marks);
+    if (env->kind == ENV_HAMT)
+        arena_free(&env->arena);
+    vec_free(&env->saved);
+    free(env);
+}
+
+void env_begin_scope(Env *env)
+{
+    if (env->kind == ENV_UNDO)
+        vec_push(&env->marks, env->log.len);
+    else
+        vec_push(&env->saved, env->root);
+}
+
+void env_end_scope(Env *env)
+{
+    if (env->kind == ENV_HAMT) {
+        env->root = env->saved.data[--env->saved.len];
+        return;
+    }
+    uint32_t mark = env->marks.data[--env->marks.len];
+    while (env->log.len > mark) {
+        Undo u = env->log.data[--env->log.len];
+        u.slot->value = u.old;
+    }
+}
+
+/* ---- Flat table ------------------------------------------------------ */
+
+static inline uint32_t slot_hash(Symbol sym)
+{
+    return sym * 0x9e3779b1u;
+}
+
+static Slot *slot_find(const Env *env, Symbol sym)
+{
+    uint32_t i = slot_hash(sym) & env->mask;
+    while (env->slots[i].sym && env->slots[i].sym != sym)
+        i = (i + 1) & env->mask;
+    return &env->slots[i];
+}
+
+/* Doubling moves slots, so the undo log is rewritten to match. */
+static void table_grow(Env *env)
+{
+    Slot *old = env->slots;
+    uint32_t old_mask = env->mask;
+    env->mask = old_mask * 2 + 1;
+    env->slots = xcalloc(env->mask + 1, sizeof *env->slots);
+    for (uint32_t i = 0; i <= old_mask; i++)
+        if (old[i].sym)
+            *slot_find(env, old[i].sym) = old[i];
+    for (uint32_t i = 0; i < env->log.len; i++)
+        env->log.data[i].slot = slot_find(env, env->log.data[i].slot->sym);
+    free(old);
+}
+
+/* ---- HAMT -------------------------------------------------------------- */
+
+#define HAMT_BITS 5
+#define HAMT_MASK 31u
+
+static inline uint32_t hamt_hash(Symbol sym)
+{
+    return sym * 0x9e3779b1u;
+}
+
+static inline uint32_t popcount(uint32_t x)
+{
+    return (uint32_t)__builtin_popcount(x);
+}
+
+static inline HamtNode **hamt_children(const HamtNode *n)
+{
+    return (HamtNode **)(n->data + popcount(n->datamap));
+}
+
+static HamtNode *hamt_alloc(Env *env, uint32_t ndata, uint32_t nkids)
+{
+    return arena_alloc(&env->arena, sizeof(HamtNode) + ndata * sizeof(HamtEntry)
+                                    + nkids * sizeof(HamtNode *));
+}
+
+/* A subtrie holding two entries whose hashes agree below `shift`. */
+static HamtNode *hamt_pair(Env *env, HamtEntry a, uint32_t ha, HamtEntry b, uint32_t hb,
+                           uint32_t shift)
+{
+    uint32_t ca = (ha >> shift) & HAMT_MASK;
+    uint32_t cb = (hb >> shift) & HAMT_MASK;
+    if (ca == cb) {
+        HamtNode *n = hamt_alloc(env, 0, 1);
+        n->datamap = 0;
+        n->nodemap = 1u << ca;
+        hamt_children(n)[0] = hamt_pair(env, a, ha, b, hb, shift + HAMT_BITS);
+        return n;
+    }
+    HamtNode *n = hamt_alloc(env, 2, 0);
+    n->datamap = (1u << ca) | (1u << cb);
+    n->nodemap = 0;
+    n->data[ca < cb ? 0 : 1] = a;
+    n->data[ca < cb ? 1 : 0] = b;
+    return n;
+}
+
+static HamtNode *hamt_insert(Env *env, const HamtNode *n, uint32_t hash, uint32_t shift,
+                             HamtEntry e)
+{
+    uint32_t bit = 1u << ((hash >> shift) & HAMT_MASK);
+    uint32_t nd = n ? popcount(n->datamap) : 0;
+    uint32_t nk = n ? popcount(n->nodemap) : 0;
+    HamtNode *m;
+
+    if (n && (n->datamap & bit)) {
+        uint32_t i = popcount(n->datamap & (bit - 1));
+        if (n->data[i].sym == e.sym) {
+            /* Rebinding in place: same shape, one entry replaced. */
+            m = hamt_alloc(env, nd, nk);
+            memcpy(m, n, sizeof *n + nd * sizeof(HamtEntry) + nk * sizeof(HamtNode *));
+            m->data[i].value = e.value;
+            return m;
+        }
+        /* Push the resident entry and the new one down a level. */
+        HamtNode *sub = hamt_pair(env, n->data[i], hamt_hash(n->data[i].sym), e, hash,
+                                  shift + HAMT_BITS);
+        uint32_t k = popcount(n->nodemap & (bit - 1));
+        m = hamt_alloc(env, nd - 1, nk + 1);
+        m->datamap = n->datamap & ~bit;
+        m->nodemap = n->nodemap | bit;
+        memcpy(m->data, n->data, i * sizeof(HamtEntry));
+        memcpy(m->data + i, n->data + i + 1, (nd - i - 1) * sizeof(HamtEntry));
+        HamtNode **src = hamt_children(n), **dst = hamt_children(m);
+        memcpy(dst, src, k * sizeof *dst);
+        dst[k] = sub;
+        memcpy(dst + k + 1, src + k, (nk - k) * sizeof *dst);
+        return m;
+    }
+
+    if (n && (n->nodemap & bit)) {
+        uint32_t k = popcount(n->nodemap & (bit - 1));
+        m = hamt_alloc(env, nd, nk);
+        memcpy(m, n, sizeof *n + nd * sizeof(HamtEntry) + nk * sizeof(HamtNode *));
+        hamt_children(m)[k] = hamt_insert(env, hamt_children(n)[k], hash, shift + HAMT_BITS, e);
+        return m;
+    }
+
+    /* Empty chunk: add the entry at this level. */
+    uint32_t i = n ? popcount(n->datamap & (bit - 1)) : 0;
+    m = hamt_alloc(env, nd + 1, nk);
+    m->datamap = (n ? n->datamap : 0) | bit;
+    m->nodemap = n ? n->nodemap : 0;
+    if (n) {
+        memcpy(m->data, n->data, i * sizeof(HamtEntry));
+        memcpy(m->data + i + 1, n->data + i, (nd - i) * sizeof(HamtEntry));
+        memcpy(hamt_children(m), hamt_children(n), nk * sizeof(HamtNode *));
+    }
+    m->data[i] = e;
+    return m;
+}
+
+void *env_snapshot_lookup(EnvSnapshot n, Symbol sym)
+{
+    uint32_t hash = hamt_hash(sym);
+    for (uint32_t shift = 0; n; shift += HAMT_BITS) {
+        uint32_t bit = 1u << ((hash >> shift) & HAMT_MASK);
+        if (n->datamap & bit) {
+            const HamtEntry *e = &n->data[popcount(n->datamap & (bit - 1))];
+            return e->sym == sym ? e->value : NULL;
+        }
+        if (!(n->nodemap & bit))
+            return NULL;
+        n = hamt_children(n)[popcount(n->nodemap & (bit - 1))];
+    }
+    return NULL;
+}
+
+EnvSnapshot env_snapshot(const Env *env)
+{
+    return env->root;
+}
+
+/* ---- Interface --------------------------------------------------------- */
+
+void env_enter(Env *env, Symbol sym, void *binding)
+{
+    if (env->kind == ENV_HAMT) {
+        env->root = hamt_insert(env, env->root, hamt_hash(sym), 0,
+                                (HamtEntry){ sym, binding });
+        return;
+    }
+    Slot *slot = slot_find(env, sym);
+    if (!slot->sym) {
+        if ((env->used + 1) * 2 > env->mask + 1) {
+            table_grow(env);
+            slot = slot_find(env, sym);
+        }
+        slot->sym = sym;
+        env->used++;
+    }
+    /* Bindings made at top level are never undone, so need no log. */
+    if (env->marks.len)
+        vec_push(&env->log, ((Undo){ slot, slot->value }));
+    slot->value = binding;
+}
+
+void *env_lookup(const Env *env, Symbol sym)
+{
+    if (env->kind == ENV_HAMT)
+        return env_snapshot_lookup(env->root, sym);
+    return slot_find(env, sym)->value;
+}
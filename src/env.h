@@ -0,0 +1,50 @@
+#ifndef TIGER_ENV_H
+#define TIGER_ENV_H
+
+#include "symbol.h"
+
+/*
+ * Symbol -> binding map with nested scopes.  Two representations share
+ * one interface:
+ *
+ *   ENV_UNDO  One flat open-addressing table holding the innermost
+ *             binding of every name, plus an undo log of the bindings
+ *             each scope replaced.  Entering a scope pushes a log mark;
+ *             leaving it restores just the bindings that scope made.
+ *             Lookup is one probe, however deep the nesting.
+ *
+ *   ENV_HAMT  A persistent hash array mapped trie.  Binding a name
+ *             path-copies at most seven 32-way nodes; leaving a scope
+ *             restores the saved root.  Any root can be kept as an
+ *             EnvSnapshot and consulted later without copying.
+ *
+ * Both cost O(bindings made) to leave a scope, independent of nesting.
+ */
+typedef enum EnvKind {
+    ENV_UNDO,
+    ENV_HAMT,
+} EnvKind;
+
+typedef struct Env Env;
+
+/* An immutable view of a HAMT environment at one point in time; valid
+   until the Env is freed.  NULL is the empty environment. */
+typedef const struct HamtNode *EnvSnapshot;
+
+Env *env_new(EnvKind kind);
+void env_free(Env *env);
+
+void env_begin_scope(Env *env);
+void env_end_scope(Env *env);
+
+/* Bind `sym` in the innermost scope, hiding any outer binding. */
+void env_enter(Env *env, Symbol sym, void *binding);
+
+/* Innermost binding of `sym`, or NULL. */
+void *env_lookup(const Env *env, Symbol sym);
+
+/* The current HAMT root (ENV_HAMT only). */
+EnvSnapshot env_snapshot(const Env *env);
+void *env_snapshot_lookup(EnvSnapshot snap, Symbol sym);
+
+#endif
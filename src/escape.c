@@ -0,0 +1,149 @@
+#include "escape.h"
+
+typedef struct Walker {
+    Sema *s;
+    Ast *ast;
+    FunEntry *fun;          /* function whose body is being walked */
+} Walker;
+
+static void walk_exp(Walker *w, ExpId id);
+
+static void walk_var(Walker *w, VarId id)
+{
+    const Var *v = ast_var(w->ast, id);
+    switch ((VarKind)v->kind) {
+    case VAR_SIMPLE: {
+        VarEntry *ve = w->s->var_entry[id];
+        if (ve && ve->owner != w->fun)
+            ve->flags |= VE_ESCAPE;
+        break;
+    }
+    case VAR_FIELD:
+        walk_var(w, v->u.field.var);
+        break;
+    case VAR_SUBSCRIPT:
+        walk_var(w, v->u.subscript.var);
+        walk_exp(w, v->u.subscript.index);
+        break;
+    default:
+        break;
+    }
+}
+
+static void walk_list(Walker *w, AstList l)
+{
+    for (uint32_t i = 0; i < l.count; i++)
+        walk_exp(w, ast_list_at(w->ast, l, i));
+}
+
+static void walk_decs(Walker *w, AstList decs)
+{
+    for (uint32_t i = 0; i < decs.count; i++) {
+        const Dec *d = ast_dec(w->ast, ast_list_at(w->ast, decs, i));
+        if (d->kind == DEC_VAR) {
+            walk_exp(w, d->u.var.init);
+        } else if (d->kind == DEC_FUNCTIONS) {
+            AstList fl = d->u.batch.decs;
+            for (uint32_t k = 0; k < fl.count; k++) {
+                DecId fid = ast_list_at(w->ast, fl, k);
+                FunEntry *saved = w->fun;
+                w->fun = (FunEntry *)w->s->dec_entry[fid];
+                walk_exp(w, ast_dec(w->ast, fid)->u.function.body);
+                w->fun = saved;
+            }
+        }
+    }
+}
+
+static void walk_exp(Walker *w, ExpId id)
+{
+    const Exp *e = ast_exp(w->ast, id);
+    switch ((ExpKind)e->kind) {
+    case EXP_VAR:
+        walk_var(w, e->u.var.var);
+        break;
+    case EXP_CALL:
+        walk_list(w, e->u.call.args);
+        break;
+    case EXP_OP:
+        walk_exp(w, e->u.op.left);
+        walk_exp(w, e->u.op.right);
+        break;
+    case EXP_RECORD:
+        for (uint32_t i = 0; i < e->u.record.fields.count; i++)
+            walk_exp(w, ast_efield(w->ast, e->u.record.fields, i)->exp);
+        break;
+    case EXP_SEQ:
+        walk_list(w, e->u.seq.exps);
+        break;
+    case EXP_ASSIGN: {
+        const Var *v = ast_var(w->ast, e->u.assign.var);
+        if (v->kind == VAR_SIMPLE && w->s->var_entry[e->u.assign.var])
+            w->s->var_entry[e->u.assign.var]->flags |= VE_ASSIGNED;
+        walk_var(w, e->u.assign.var);
+        walk_exp(w, e->u.assign.exp);
+        break;
+    }
+    case EXP_IF:
+        walk_exp(w, e->u.if_.test);
+        walk_exp(w, e->u.if_.then);
+        if (e->u.if_.els)
+            walk_exp(w, e->u.if_.els);
+        break;
+    case EXP_WHILE:
+        walk_exp(w, e->u.while_.test);
+        walk_exp(w, e->u.while_.body);
+        break;
+    case EXP_FOR:
+        walk_exp(w, e->u.for_.lo);
+        walk_exp(w, e->u.for_.hi);
+        walk_exp(w, e->u.for_.body);
+        break;
+    case EXP_LET:
+        walk_decs(w, e->u.let.decs);
+        walk_exp(w, e->u.let.body);
+        break;
+    case EXP_ARRAY:
+        walk_exp(w, e->u.array.size);
+        walk_exp(w, e->u.array.init);
+        break;
+    default:
+        break;
+    }
+}
+
+void escape_find(Sema *s)
+{
+    Walker w = { .s = s, .ast = s->ast, .fun = s->funs.data[0] };
+    walk_exp(&w, s->ast->root);
+
+    /* Copy the verdicts onto the declaring nodes. */
+    Ast *ast = s->ast;
+    for (uint32_t i = 1; i < ast->decs.len; i++) {
+        Dec *d = ast_dec(ast, i);
+        VarEntry *ve = (VarEntry *)s->dec_entry[i];
+        if (d->kind == DEC_VAR && ve && (ve->flags & VE_ESCAPE))
+            d->flags |= DF_ESCAPE;
+    }
+    for (uint32_t i = 1; i < ast->fields.len; i++) {
+        VarEntry *ve = s->param_entry[i];
+        if (ve && (ve->flags & VE_ESCAPE))
+            ast->fields.data[i].flags |= DF_ESCAPE;
+    }
+    for (uint32_t i = 1; i < ast->exps.len; i++) {
+        VarEntry *ve = s->for_var[i];
+        if (ve && (ve->flags & VE_ESCAPE))
+            ast_exp(ast, i)->flags |= EF_ESCAPE;
+    }
+}
+
+void escape_dump(const Sema *s, FILE *out)
+{
+    for (uint32_t i = 0; i < s->vars.len; i++) {
+        const VarEntry *ve = s->vars.data[i];
+        uint32_t line, col;
+        source_position(s->ast->src, ve->pos, &line, &col);
+        fprintf(out, "%u:%u %s %s\n", line, col, sym_name(ve->name),
+                ve->flags & VE_ESCAPE ? "escapes" : "register");
+    }
+}
@@ -0,0 +1,23 @@
+#ifndef TIGER_ESCAPE_H
+#define TIGER_ESCAPE_H
+
+#include <stdio.h>
+
+#include "semant.h"
+
+/*
+ * Escape analysis.  A variable, formal or loop counter escapes when a
+ * function nested inside the one that declares it refers to it: only
+ * then must it live in the declaring function's frame, where the inner
+ * function can reach it through static links.  Everything else can stay
+ * in a register.
+ *
+ * Runs on a successfully checked tree.  Sets VE_ESCAPE on the entries
+ * and the matching DF_ESCAPE / EF_ESCAPE flags on the AST.
+ */
+void escape_find(Sema *s);
+
+/* One line per variable: "line:col name escapes|register". */
+void escape_dump(const Sema *s, FILE *out);
+
+#endif
@@ -0,0 +1,84 @@
+#include "frame.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+const char *const reg_names[TEMP_NREGS] = {
+    "rax", "rbx", "rcx", "rdx", "rsi", "rdi", "rbp", "rsp",
+    "r8", "r9", "r10", "r11", "r12", "r13", "r14", "r15",
+};
+
+const Temp arg_regs[FRAME_NARG_REGS] = {
+    REG_RDI, REG_RSI, REG_RDX, REG_RCX, REG_R8, REG_R9,
+};
+
+const Temp caller_saves[FRAME_NCALLER_SAVES] = {
+    REG_RAX, REG_RCX, REG_RDX, REG_RSI, REG_RDI, REG_R8, REG_R9, REG_R10, REG_R11,
+};
+
+const Temp callee_saves[FRAME_NCALLEE_SAVES] = {
+    REG_RBX, REG_R12, REG_R13, REG_R14, REG_R15,
+};
+
+Frame *frame_new(Arena *a, Label name, uint32_t nformals, const bool *escapes,
+                 const bool *ptrs)
+{
+    Frame *f = arena_alloc(a, sizeof *f);
+    memset(f, 0, sizeof *f);
+    f->name = name;
+    f->nformals = nformals;
+    f->formals = arena_alloc(a, nformals * sizeof *f->formals);
+    for (uint32_t i = 0; i < nformals; i++) {
+        bool ptr = ptrs && ptrs[i];
+        if (i >= FRAME_NARG_REGS) {
+            /* Already in memory, in the caller's outgoing argument area. */
+            int32_t off = 2 * FRAME_WORD + (int32_t)(i - FRAME_NARG_REGS) * FRAME_WORD;
+            f->formals[i] = (Access){ .kind = AC_FRAME, .ptr = ptr, .offset = off };
+        } else {
+            f->formals[i] = frame_alloc_local(f, escapes[i], ptr);
+        }
+    }
+    return f;
+}
+
+void frame_free(Frame *f)
+{
+    vec_free(&f->slots);
+    vec_free(&f->lines);
+    idmap_free(&f->freq);
+}
+
+Access frame_alloc_local(Frame *f, bool escape, bool ptr)
+{
+    if (!escape)
+        return (Access){ .kind = AC_REG, .ptr = ptr, .temp = temp_new() };
+    f->locals += FRAME_WORD;
+    Access acc = { .kind = AC_FRAME, .ptr = ptr, .offset = -f->locals };
+    vec_push(&f->slots, acc);
+    return acc;
+}
+
+TExp *frame_exp(Arena *a, Access acc, TExp *frame_ptr)
+{
+    if (acc.kind == AC_REG)
+        return t_temp(a, acc.temp);
+    if (acc.kind == AC_GLOBAL)
+        return t_mem(a, t_name(a, acc.label));
+    return t_mem(a, t_binop(a, T_PLUS, frame_ptr, t_const(a, acc.offset)));
+}
+
+TExp *frame_external_call(Arena *a, const char *name, TExp **args, uint32_t nargs)
+{
+    return t_call(a, t_name(a, label_named(sym_intern(name))), args, nargs);
+}
+
+TStm *frame_view_shift(Arena *a, Frame *f, TStm *body)
+{
+    TStm *moves = NULL;
+    uint32_t n = f->nformals < FRAME_NARG_REGS ? f->nformals : FRAME_NARG_REGS;
+    for (uint32_t i = 0; i < n; i++) {
+        TExp *home = frame_exp(a, f->formals[i], t_temp(a, REG_FP));
+        moves = t_seq(a, moves, t_move(a, home, t_temp(a, arg_regs[i])));
+    }
+    return t_seq(a, moves, body);
+}
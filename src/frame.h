@@ -0,0 +1,106 @@
+#ifndef TIGER_FRAME_H
+#define TIGER_FRAME_H
+
+#include "tree.h"
+
+/*
+ * x86-64 stack frames under the System V calling convention.  Every
+ * word is 8 bytes.  The frame pointer %rbp points at the saved %rbp;
+ * the return address is above it, incoming stack arguments above that,
+ * and locals at negative offsets below it.
+ *
+ *        16+8k(%rbp)   stack argument 6+k
+ *          8(%rbp)     return address
+ *          0(%rbp)     caller's %rbp
+ *         -8(%rbp)     first frame slot
+ *
+ * A formal or local that escapes gets a frame slot; any other lives in
+ * a temp until register allocation.  The first six arguments arrive in
+ * registers and are moved to their homes by frame_view_shift().
+ */
+
+/* Machine registers, numbered as the first TEMP_NREGS temps. */
+enum {
+    REG_RAX, REG_RBX, REG_RCX, REG_RDX, REG_RSI, REG_RDI, REG_RBP, REG_RSP,
+    REG_R8, REG_R9, REG_R10, REG_R11, REG_R12, REG_R13, REG_R14, REG_R15,
+};
+
+enum {
+    FRAME_WORD = 8,
+    FRAME_NARG_REGS = 6,
+};
+
+#define REG_FP REG_RBP
+#define REG_RV REG_RAX
+
+enum {
+    FRAME_NCALLER_SAVES = 9,
+    FRAME_NCALLEE_SAVES = 5,
+};
+
+extern const char *const reg_names[TEMP_NREGS];
+extern const Temp arg_regs[FRAME_NARG_REGS];
+/* Registers a call may change, and those it must preserve. */
+extern const Temp caller_saves[FRAME_NCALLER_SAVES];
+extern const Temp callee_saves[FRAME_NCALLEE_SAVES];
+
+typedef enum AccessKind {
+    AC_FRAME,               /* word at `offset` from the frame pointer */
+    AC_REG,                 /* temp `temp` */
+    AC_GLOBAL,              /* static word at `label` */
+} AccessKind;
+
+typedef struct Access {
+    uint8_t kind;
+    uint8_t ptr;            /* holds a heap pointer */
+    int32_t offset;
+    union {
+        Temp temp;
+        Label label;
+    };
+} Access;
+
+/* Where source line `line` starts in the code, from a TS_LINE mark. */
+typedef struct LineMark {
+    Label label;
+    uint32_t line;
+} LineMark;
+
+typedef struct Frame {
+    Label name;
+    uint32_t nformals;
+    Access *formals;
+    int32_t locals;         /* bytes of frame slots below %rbp */
+    VEC(Access) slots;      /* every AC_FRAME slot below %rbp, for stack maps */
+    uint32_t saved;         /* callee-saved registers in use (bit r for
+                               register r), set by register allocation */
+    VEC(LineMark) lines;    /* in code order, set by codegen under -pg */
+    /* From -fprofile-use, if `profiled`: */
+    bool profiled;
+    uint64_t calls;         /* times the function was entered */
+    IdMap freq;             /* label -> times its code ran, the arms of
+                               branches the profile has counts for; and
+                               static weights, only 0 if `profiled` */
+} Frame;
+
+/* A frame for a function with `nformals` formals; escapes[i] says
+   whether formal i must live in memory.  `ptrs` (may be NULL) marks the
+   formals that hold heap pointers. */
+Frame *frame_new(Arena *a, Label name, uint32_t nformals, const bool *escapes,
+                 const bool *ptrs);
+void frame_free(Frame *f);
+
+Access frame_alloc_local(Frame *f, bool escape, bool ptr);
+
+/* The location of `acc`, given the address of its frame (unused for
+   AC_GLOBAL). */
+TExp *frame_exp(Arena *a, Access acc, TExp *frame_ptr);
+
+/* Call an external (runtime) routine. */
+TExp *frame_external_call(Arena *a, const char *name, TExp **args, uint32_t nargs);
+
+/* Prefix `body` with moves of the incoming register arguments into the
+   formals' homes. */
+TStm *frame_view_shift(Arena *a, Frame *f, TStm *body);
+
+#endif
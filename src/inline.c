@@ -0,0 +1,371 @@
+#include "opt.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "frame.h"
+
+/* What the inliner needs to know about a function body. */
+typedef struct Body {
+    uint32_t size;          /* instructions */
+    uint32_t nregs;         /* argument registers read */
+    bool leaf;              /* calls no function of the program */
+    bool ok;                /* may be inlined at all */
+} Body;
+
+typedef struct Inliner {
+    IrFunc *funcs;
+    uint32_t nfuncs;
+    const InlineParams *p;
+    const OptGlobals *globals;
+    IdMap index;            /* Label -> position in `funcs` */
+    Body *body;
+    uint8_t *state;         /* 0 new, 1 on the DFS stack, 2 done */
+    int64_t budget;         /* instructions the program may still grow */
+    uint64_t max_calls;     /* of any profiled function */
+} Inliner;
+
+/* With a profile, a function called at least 1/HOT_SHARE as often as
+   the one called most may be inlined at HOT_LIMIT times the limit. */
+enum { HOT_SHARE = 16, HOT_LIMIT = 4 };
+
+static uint32_t func_of(const Inliner *in, Label l)
+{
+    return idmap_get(&in->index, l, IR_NONE);
+}
+
+static int arg_reg(Value v)
+{
+    for (int k = 0; k < FRAME_NARG_REGS; k++)
+        if (arg_regs[k] == v)
+            return k;
+    return -1;
+}
+
+/* A body can move into its caller when it keeps nothing in its frame,
+   so that it reads no %rbp and nobody takes that frame as a static
+   link, and touches no machine register but the argument registers it
+   reads and %rax, which it writes. */
+static Body body_of(const Inliner *in, const IrFunc *f)
+{
+    Body b = { .leaf = true, .ok = true };
+    for (uint32_t i = 0; i < f->blocks.len; i++) {
+        const IrBlock *blk = &f->blocks.data[i];
+        for (uint32_t j = 0; j < blk->ins.len; j++) {
+            const IrIns *ins = &blk->ins.data[j];
+            if (ins->op == IR_NOP || ins->op == IR_LINE)
+                continue;
+            b.size++;
+            if (ins->op == IR_CALL && func_of(in, ins->u.label) != IR_NONE)
+                b.leaf = false;
+            if (ins->dst < TEMP_NREGS && ins->dst != REG_RV)
+                b.ok = false;
+            for (uint32_t k = 0; k < ins->nargs; k++) {
+                Value v = ins->args[k];
+                if (v >= TEMP_NREGS)
+                    continue;
+                int r = arg_reg(v);
+                if (r < 0)
+                    b.ok = false;
+                else if ((uint32_t)r >= b.nregs)
+                    b.nregs = (uint32_t)r + 1;
+            }
+        }
+    }
+    if (f->blocks.len && f->blocks.data[0].preds.len)
+        b.ok = false;
+    return b;
+}
+
+/* A copy of `f`'s blocks, for inlining a function into itself. */
+static IrFunc snapshot(const IrFunc *f)
+{
+    IrFunc s = *f;
+    memset(&s.blocks, 0, sizeof s.blocks);
+    for (uint32_t i = 0; i < f->blocks.len; i++) {
+        const IrBlock *blk = &f->blocks.data[i];
+        IrBlock c = *blk;
+        memset(&c.ins, 0, sizeof c.ins);
+        memset(&c.preds, 0, sizeof c.preds);
+        for (uint32_t j = 0; j < blk->ins.len; j++)
+            vec_push(&c.ins, blk->ins.data[j]);
+        for (uint32_t j = 0; j < blk->preds.len; j++)
+            vec_push(&c.preds, blk->preds.data[j]);
+        vec_push(&s.blocks, c);
+    }
+    return s;
+}
+
+/* Copying one body into one call site. */
+typedef struct Copy {
+    IrFunc *f;
+    uint32_t base;          /* index of the copy's entry block */
+    Value *vmap;            /* callee value -> caller value */
+    Value *rv_out;          /* per copied block: last %rax written, or IR_NONE */
+    Value *rv_in;           /* per copied block: %rax on entry, once known */
+    Value undef;
+} Copy;
+
+static Value map_value(Copy *c, Value v)
+{
+    if (c->vmap[v] == IR_NONE)
+        c->vmap[v] = ir_new_value(c->f);
+    return c->vmap[v];
+}
+
+static Value rv_at_end(Copy *c, uint32_t b);
+
+/* %rax on entry to copied block `b`, reading it the way Braun et al.
+   build SSA: through the only predecessor, or through a phi, placed
+   before its arguments are looked up so that loops end. */
+static Value rv_at_entry(Copy *c, uint32_t b)
+{
+    uint32_t k = b - c->base;
+    if (c->rv_in[k] != IR_NONE)
+        return c->rv_in[k];
+    IrBlock *blk = &c->f->blocks.data[b];
+    if (b == c->base || blk->preds.len == 0)
+        return c->rv_in[k] = c->undef;
+    if (blk->preds.len == 1)
+        return c->rv_in[k] = rv_at_end(c, blk->preds.data[0]);
+    uint32_t n = blk->preds.len;
+    Value d = ir_new_value(c->f);
+    c->rv_in[k] = d;
+    Value *av = arena_alloc(c->f->arena, n * sizeof *av);
+    for (uint32_t j = 0; j < n; j++)
+        av[j] = rv_at_end(c, c->f->blocks.data[b].preds.data[j]);
+    blk = &c->f->blocks.data[b];
+    IrIns phi = { .op = IR_PHI, .dst = d, .nargs = n, .args = av };
+    vec_push(&blk->ins, phi);
+    memmove(&blk->ins.data[1], &blk->ins.data[0], (blk->ins.len - 1) * sizeof *blk->ins.data);
+    blk->ins.data[0] = phi;
+    return d;
+}
+
+static Value rv_at_end(Copy *c, uint32_t b)
+{
+    Value v = c->rv_out[b - c->base];
+    return v != IR_NONE ? v : rv_at_entry(c, b);
+}
+
+/* Replace the call at instruction `at` of block `b` by a copy of `g`.
+   A call in tail position keeps the callee's %rax and its returns,
+   and the callee's own tail calls stay tail calls unless they would
+   take this frame as their static link; anywhere else the returns
+   jump to the rest of the block and the call's value is the %rax they
+   leave. */
+static void inline_call(IrFunc *f, uint32_t b, uint32_t at, const IrFunc *g)
+{
+    IrIns call = f->blocks.data[b].ins.data[at];
+    bool tail = (call.flags & TC_TAIL) && (call.dst == REG_RV || call.dst == IR_NONE);
+    uint32_t ng = g->blocks.len;
+
+    /* The rest of the block goes to a block of its own. */
+    uint32_t rest = f->blocks.len;
+    vec_push(&f->blocks, ((IrBlock){ .label = label_new() }));
+    IrBlock *blk = &f->blocks.data[b], *rb = &f->blocks.data[rest];
+    for (uint32_t i = at + 1; i < blk->ins.len; i++)
+        vec_push(&rb->ins, blk->ins.data[i]);
+    rb->nsucc = blk->nsucc;
+    for (uint32_t s = 0; s < blk->nsucc; s++) {
+        rb->succ[s] = blk->succ[s];
+        IrBlock *sb = &f->blocks.data[blk->succ[s]];
+        for (uint32_t k = 0; k < sb->preds.len; k++)
+            if (sb->preds.data[k] == b)
+                sb->preds.data[k] = rest;
+    }
+    uint32_t base = f->blocks.len;
+    blk->ins.len = at;
+    vec_push(&blk->ins, ((IrIns){ .op = IR_JUMP, .dst = IR_NONE }));
+    blk->succ[0] = base;
+    blk->nsucc = 1;
+
+    Copy c = { .f = f, .base = base };
+    c.vmap = xmalloc(g->nvalues * sizeof *c.vmap);
+    memset(c.vmap, 0xff, g->nvalues * sizeof *c.vmap);
+    for (uint32_t k = 0; k < call.nargs && k < FRAME_NARG_REGS; k++)
+        c.vmap[arg_regs[k]] = call.args[k];
+    c.vmap[REG_RV] = REG_RV;
+    c.rv_out = xmalloc(ng * sizeof *c.rv_out);
+    c.rv_in = xmalloc(ng * sizeof *c.rv_in);
+    memset(c.rv_out, 0xff, ng * sizeof *c.rv_out);
+    memset(c.rv_in, 0xff, ng * sizeof *c.rv_in);
+
+    VEC(uint32_t) rets = {0};
+    for (uint32_t i = 0; i < ng; i++) {
+        const IrBlock *src = &g->blocks.data[i];
+        vec_push(&f->blocks, ((IrBlock){ .label = label_new() }));
+        IrBlock *nb = &f->blocks.data[base + i];
+        nb->nsucc = src->nsucc;
+        for (uint32_t s = 0; s < src->nsucc; s++)
+            nb->succ[s] = base + src->succ[s];
+        for (uint32_t k = 0; k < src->preds.len; k++)
+            vec_push(&nb->preds, base + src->preds.data[k]);
+        if (i == 0)
+            vec_push(&nb->preds, b);
+        for (uint32_t j = 0; j < src->ins.len; j++) {
+            IrIns ins = src->ins.data[j];
+            if (ins.op == IR_NOP)
+                continue;
+            if (ins.op == IR_RET && !tail) {
+                ins.op = IR_JUMP;
+                nb->nsucc = 1;
+                nb->succ[0] = rest;
+                vec_push(&rets, base + i);
+            }
+            Value *av = ins.nargs ? arena_alloc(f->arena, ins.nargs * sizeof *av) : NULL;
+            for (uint32_t k = 0; k < ins.nargs; k++)
+                av[k] = map_value(&c, ins.args[k]);
+            ins.args = av;
+            if (ins.op == IR_CALL) {
+                unsigned d = call.depth + 1u + ins.depth;
+                ins.depth = d > UINT8_MAX ? UINT8_MAX : (uint8_t)d;
+                bool frame_link = false;
+                for (uint32_t k = 0; k < ins.nargs; k++)
+                    frame_link |= av[k] == REG_FP;
+                if (!tail || frame_link)
+                    ins.flags &= (uint8_t)~TC_TAIL;
+            }
+            if (ins.dst == REG_RV && !tail) {
+                ins.dst = ir_new_value(f);
+                c.rv_out[i] = ins.dst;
+            } else if (ins.dst != IR_NONE) {
+                ins.dst = map_value(&c, ins.dst);
+            }
+            vec_push(&nb->ins, ins);
+        }
+    }
+
+    for (uint32_t k = 0; k < rets.len; k++)
+        vec_push(&f->blocks.data[rest].preds, rets.data[k]);
+    if (!tail && call.dst != IR_NONE && rets.len) {
+        c.undef = ir_new_value(f);
+        IrBlock *eb = &f->blocks.data[b];
+        eb->ins.len--;
+        vec_push(&eb->ins, ((IrIns){ .op = IR_CONST, .dst = c.undef }));
+        vec_push(&eb->ins, ((IrIns){ .op = IR_JUMP, .dst = IR_NONE }));
+        Value v;
+        uint32_t n = rets.len;
+        IrIns res = { .op = IR_COPY, .dst = call.dst, .nargs = 1 };
+        if (n == 1) {
+            v = rv_at_end(&c, rets.data[0]);
+            res.args = arena_alloc(f->arena, sizeof *res.args);
+            res.args[0] = v;
+        } else {
+            res.op = IR_PHI;
+            res.nargs = n;
+            res.args = arena_alloc(f->arena, n * sizeof *res.args);
+            for (uint32_t k = 0; k < n; k++)
+                res.args[k] = rv_at_end(&c, rets.data[k]);
+        }
+        IrBlock *r = &f->blocks.data[rest];
+        vec_push(&r->ins, res);
+        memmove(&r->ins.data[1], &r->ins.data[0], (r->ins.len - 1) * sizeof *r->ins.data);
+        r->ins.data[0] = res;
+    }
+    vec_free(&rets);
+    free(c.vmap);
+    free(c.rv_out);
+    free(c.rv_in);
+}
+
+static void inline_into(Inliner *in, uint32_t fi, FILE *dump);
+
+static void visit(Inliner *in, uint32_t fi, FILE *dump)
+{
+    in->state[fi] = 1;
+    const IrFunc *f = &in->funcs[fi];
+    for (uint32_t b = 0; b < f->blocks.len; b++)
+        for (uint32_t i = 0; i < f->blocks.data[b].ins.len; i++) {
+            const IrIns *ins = &f->blocks.data[b].ins.data[i];
+            if (ins->op != IR_CALL)
+                continue;
+            uint32_t g = func_of(in, ins->u.label);
+            if (g != IR_NONE && in->state[g] == 0)
+                visit(in, g, dump);
+        }
+    inline_into(in, fi, dump);
+    in->state[fi] = 2;
+}
+
+/* Inline the calls in function `fi` that are worth it, callees first so
+   that their own calls are already gone, and rerun the scalar passes if
+   anything changed. */
+static void inline_into(Inliner *in, uint32_t fi, FILE *dump)
+{
+    IrFunc *f = &in->funcs[fi];
+    const InlineParams *p = in->p;
+    IrFunc self = {0};
+    Body self_body = in->body[fi];
+    bool have_self = false, changed = false;
+    /* Code that never ran has nothing to gain. */
+    if (f->profiled && !f->calls)
+        return;
+
+    /* Each block is scanned from its end, so that the part of it that
+       inline_call() moves to a block of its own holds no other call and
+       a block of many calls splits in linear time. */
+    for (uint32_t b = 0; b < f->blocks.len; b++)
+        for (uint32_t i = f->blocks.data[b].ins.len; i-- > 0;) {
+            const IrIns *ins = &f->blocks.data[b].ins.data[i];
+            if (ins->op != IR_CALL || ins->depth >= p->depth)
+                continue;
+            uint32_t gi = func_of(in, ins->u.label);
+            if (gi == IR_NONE)
+                continue;
+            const Body *gb = gi == fi ? &self_body : &in->body[gi];
+            const IrFunc *g = &in->funcs[gi];
+            uint32_t limit = gb->leaf ? p->limit : p->limit / 2;
+            if (g->profiled && !g->calls)
+                continue;
+            if (g->profiled && g->calls * HOT_SHARE >= in->max_calls)
+                limit *= HOT_LIMIT;
+            if (!gb->ok || gb->size > limit || gb->size > in->budget ||
+                gb->nregs > ins->nargs)
+                continue;
+            if (gi == fi && !have_self) {
+                self = snapshot(f);
+                have_self = true;
+            }
+            inline_call(f, b, i, gi == fi ? &self : &in->funcs[gi]);
+            in->budget -= gb->size;
+            changed = true;
+        }
+    if (have_self)
+        ir_free(&self);
+    if (!changed)
+        return;
+    ir_compact(f);
+    if (dump) {
+        fputs("# inline\n", dump);
+        ir_dump(f, dump);
+    }
+    opt_function(f, in->globals, dump);
+    in->body[fi] = body_of(in, f);
+}
+
+void opt_inline(IrFunc *funcs, uint32_t n, const InlineParams *p, const OptGlobals *g,
+                FILE *dump)
+{
+    Inliner in = { .funcs = funcs, .nfuncs = n, .p = p, .globals = g };
+    for (uint32_t i = 0; i < n; i++)
+        idmap_put(&in.index, funcs[i].name, i);
+    in.body = xmalloc((n ? n : 1) * sizeof *in.body);
+    in.state = xcalloc(n ? n : 1, 1);
+    int64_t total = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        in.body[i] = body_of(&in, &funcs[i]);
+        total += in.body[i].size;
+        if (funcs[i].profiled && funcs[i].calls > in.max_calls)
+            in.max_calls = funcs[i].calls;
+    }
+    in.budget = total * p->growth / 100;
+    if (in.budget < p->limit)
+        in.budget = p->limit;
+    for (uint32_t i = 0; i < n; i++)
+        if (!in.state[i])
+            visit(&in, i, dump);
+    idmap_free(&in.index);
+    free(in.body);
+    free(in.state);
+}
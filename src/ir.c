@@ -0,0 +1,1111 @@
+#include "ir.h"
+
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "frame.h"
+
+Value ir_new_value(IrFunc *f)
+{
+    return f->nvalues++;
+}
+
+static Value *args_new(IrFunc *f, uint32_t n)
+{
+    return n ? arena_alloc(f->arena, n * sizeof(Value)) : NULL;
+}
+
+static IrIns *last_ins(IrBlock *b)
+{
+    return &b->ins.data[b->ins.len - 1];
+}
+
+bool ir_is_pure(const IrIns *ins)
+{
+    switch ((IrOp)ins->op) {
+    case IR_CONST:
+    case IR_NAME:
+    case IR_COPY:
+    case IR_BINOP:
+    case IR_LOAD:
+    case IR_PHI:
+        return true;
+    default:
+        return false;
+    }
+}
+
+/* ---- CFG maintenance --------------------------------------------------- */
+
+void ir_remove_pred(IrFunc *f, uint32_t b, uint32_t p)
+{
+    IrBlock *blk = &f->blocks.data[b];
+    uint32_t k = 0;
+    while (k < blk->preds.len && blk->preds.data[k] != p)
+        k++;
+    if (k == blk->preds.len)
+        fatal("ir: %u is not a predecessor of %u", p, b);
+    memmove(&blk->preds.data[k], &blk->preds.data[k + 1],
+            (blk->preds.len - k - 1) * sizeof *blk->preds.data);
+    blk->preds.len--;
+    /* Passes rewrite phis in place, so the ones left need not all lead
+       the block until ir_compact() moves them back. */
+    for (uint32_t i = 0; i < blk->ins.len; i++) {
+        IrIns *phi = &blk->ins.data[i];
+        if (phi->op != IR_PHI)
+            continue;
+        memmove(&phi->args[k], &phi->args[k + 1], (phi->nargs - k - 1) * sizeof *phi->args);
+        phi->nargs--;
+    }
+}
+
+void ir_rpo(const IrFunc *f, IrOrder *out)
+{
+    /* Iterative depth-first search; a block is emitted once all its
+       successors are done. */
+    uint32_t n = f->blocks.len;
+    uint8_t *state = xcalloc(n, 1);
+    VEC(uint32_t) stack = {0};
+    out->len = 0;
+    vec_push(&stack, 0);
+    while (stack.len) {
+        uint32_t b = stack.data[stack.len - 1];
+        const IrBlock *blk = &f->blocks.data[b];
+        if (state[b] == 0) {
+            state[b] = 1;
+            for (uint32_t i = blk->nsucc; i-- > 0;)
+                if (!state[blk->succ[i]])
+                    vec_push(&stack, blk->succ[i]);
+        } else {
+            stack.len--;
+            if (state[b] == 1) {
+                state[b] = 2;
+                vec_push(out, b);
+            }
+        }
+    }
+    for (uint32_t i = 0, j = out->len; i < j / 2; i++) {
+        uint32_t t = out->data[i];
+        out->data[i] = out->data[j - 1 - i];
+        out->data[j - 1 - i] = t;
+    }
+    vec_free(&stack);
+    free(state);
+}
+
+/* Cooper, Harvey and Kennedy's iterative dominator algorithm. */
+static void compute_idom(IrFunc *f, const IrOrder *rpo)
+{
+    uint32_t n = f->blocks.len;
+    uint32_t *num = xmalloc(n * sizeof *num);
+    for (uint32_t i = 0; i < rpo->len; i++)
+        num[rpo->data[i]] = i;
+    for (uint32_t b = 0; b < n; b++)
+        f->blocks.data[b].idom = IR_NONE;
+    f->blocks.data[0].idom = 0;
+    for (bool changed = true; changed;) {
+        changed = false;
+        for (uint32_t i = 1; i < rpo->len; i++) {
+            IrBlock *blk = &f->blocks.data[rpo->data[i]];
+            uint32_t idom = IR_NONE;
+            for (uint32_t k = 0; k < blk->preds.len; k++) {
+                uint32_t p = blk->preds.data[k];
+                if (f->blocks.data[p].idom == IR_NONE)
+                    continue;
+                if (idom == IR_NONE) {
+                    idom = p;
+                    continue;
+                }
+                uint32_t x = p, y = idom;
+                while (x != y) {
+                    while (num[x] > num[y])
+                        x = f->blocks.data[x].idom;
+                    while (num[y] > num[x])
+                        y = f->blocks.data[y].idom;
+                }
+                idom = x;
+            }
+            if (blk->idom != idom) {
+                blk->idom = idom;
+                changed = true;
+            }
+        }
+    }
+    free(num);
+}
+
+void ir_compact(IrFunc *f)
+{
+    uint32_t n = f->blocks.len;
+    IrOrder rpo = {0};
+    ir_rpo(f, &rpo);
+    bool *reach = xcalloc(n, sizeof *reach);
+    for (uint32_t i = 0; i < rpo.len; i++)
+        reach[rpo.data[i]] = true;
+    for (uint32_t b = 0; b < n; b++)
+        if (!reach[b])
+            f->blocks.data[b].dead = true;
+
+    /* Forget edges from dead blocks, then renumber. */
+    for (uint32_t b = 0; b < n; b++) {
+        IrBlock *blk = &f->blocks.data[b];
+        if (blk->dead)
+            continue;
+        for (uint32_t k = blk->preds.len; k-- > 0;)
+            if (f->blocks.data[blk->preds.data[k]].dead)
+                ir_remove_pred(f, b, blk->preds.data[k]);
+    }
+    uint32_t *renum = xmalloc(n * sizeof *renum);
+    uint32_t m = 0;
+    for (uint32_t b = 0; b < n; b++) {
+        IrBlock *blk = &f->blocks.data[b];
+        if (blk->dead) {
+            vec_free(&blk->ins);
+            vec_free(&blk->preds);
+            continue;
+        }
+        /* Passes may turn a phi into something else in place; move the
+           phis that remain back to the head. */
+        uint32_t j = 0, nphi = 0;
+        for (uint32_t i = 0; i < blk->ins.len; i++)
+            if (blk->ins.data[i].op == IR_PHI)
+                nphi++;
+        IrIns *rest = xmalloc((blk->ins.len + 1) * sizeof *rest);
+        uint32_t nrest = 0;
+        for (uint32_t i = 0; i < blk->ins.len; i++) {
+            IrIns ins = blk->ins.data[i];
+            if (ins.op == IR_PHI)
+                blk->ins.data[j++] = ins;
+            else if (ins.op != IR_NOP)
+                rest[nrest++] = ins;
+        }
+        memcpy(&blk->ins.data[nphi], rest, nrest * sizeof *rest);
+        blk->ins.len = nphi + nrest;
+        free(rest);
+        renum[b] = m;
+        f->blocks.data[m++] = *blk;
+    }
+    f->blocks.len = m;
+    for (uint32_t b = 0; b < m; b++) {
+        IrBlock *blk = &f->blocks.data[b];
+        for (uint32_t i = 0; i < blk->nsucc; i++)
+            blk->succ[i] = renum[blk->succ[i]];
+        for (uint32_t k = 0; k < blk->preds.len; k++)
+            blk->preds.data[k] = renum[blk->preds.data[k]];
+    }
+    free(renum);
+    free(reach);
+
+    ir_rpo(f, &rpo);
+    compute_idom(f, &rpo);
+    vec_free(&rpo);
+}
+
+void ir_merge_blocks(IrFunc *f)
+{
+    for (uint32_t b = 0; b < f->blocks.len; b++) {
+        IrBlock *blk = &f->blocks.data[b];
+        if (blk->dead)
+            continue;
+        while (blk->nsucc == 1) {
+            uint32_t s = blk->succ[0];
+            IrBlock *sb = &f->blocks.data[s];
+            if (s == b || s == 0 || sb->preds.len != 1)
+                break;
+            /* A phi with one argument is a copy. */
+            blk->ins.len--;
+            for (uint32_t i = 0; i < sb->ins.len; i++) {
+                IrIns ins = sb->ins.data[i];
+                if (ins.op == IR_PHI)
+                    ins.op = IR_COPY;
+                vec_push(&blk->ins, ins);
+            }
+            blk->nsucc = sb->nsucc;
+            for (uint32_t i = 0; i < sb->nsucc; i++) {
+                blk->succ[i] = sb->succ[i];
+                IrBlock *nb = &f->blocks.data[sb->succ[i]];
+                for (uint32_t k = 0; k < nb->preds.len; k++)
+                    if (nb->preds.data[k] == s)
+                        nb->preds.data[k] = b;
+            }
+            sb->dead = true;
+            sb->nsucc = 0;
+            sb->preds.len = 0;
+        }
+    }
+    ir_compact(f);
+}
+
+void ir_dom_tree(const IrFunc *f, IrDomTree *t)
+{
+    uint32_t n = f->blocks.len;
+    t->kstart = xcalloc(n + 1, sizeof *t->kstart);
+    t->kids = xmalloc((n ? n : 1) * sizeof *t->kids);
+    for (uint32_t b = 1; b < n; b++)
+        t->kstart[f->blocks.data[b].idom + 1]++;
+    for (uint32_t b = 0; b < n; b++)
+        t->kstart[b + 1] += t->kstart[b];
+    uint32_t *fill = xmalloc((n + 1) * sizeof *fill);
+    memcpy(fill, t->kstart, (n + 1) * sizeof *fill);
+    for (uint32_t b = 1; b < n; b++)
+        t->kids[fill[f->blocks.data[b].idom]++] = b;
+    free(fill);
+}
+
+void ir_dom_tree_free(IrDomTree *t)
+{
+    free(t->kstart);
+    free(t->kids);
+}
+
+/* ---- Construction ------------------------------------------------------- */
+
+typedef struct Builder {
+    IrFunc *f;
+    IdMap vars;             /* Temp -> variable */
+    IdMap at;               /* Label -> block */
+    uint32_t cur;
+} Builder;
+
+/* Before renaming, values name variables: the machine registers, one
+   per temp of the trees, and one per intermediate result. */
+static Value var_of(Builder *b, Temp t)
+{
+    if (t < TEMP_NREGS)
+        return t;
+    Value v = idmap_get(&b->vars, t, IR_NONE);
+    if (v == IR_NONE) {
+        v = ir_new_value(b->f);
+        idmap_put(&b->vars, t, v);
+    }
+    return v;
+}
+
+static IrIns *emit(Builder *b, IrOp op, Value dst, uint32_t nargs)
+{
+    IrBlock *blk = &b->f->blocks.data[b->cur];
+    vec_push(&blk->ins, ((IrIns){ .op = (uint8_t)op, .dst = dst, .nargs = nargs,
+                                  .args = args_new(b->f, nargs) }));
+    return &blk->ins.data[blk->ins.len - 1];
+}
+
+static uint32_t block_of(Builder *b, Label l)
+{
+    uint32_t i = idmap_get(&b->at, l, IR_NONE);
+    if (i == IR_NONE)
+        fatal("ir: jump to unknown label");
+    return i;
+}
+
+static Value build_exp(Builder *b, const TExp *e)
+{
+    IrFunc *f = b->f;
+    switch ((TExpKind)e->kind) {
+    case TE_CONST:
+        emit(b, IR_CONST, ir_new_value(f), 0)->u.value = e->u.value;
+        break;
+    case TE_NAME:
+        emit(b, IR_NAME, ir_new_value(f), 0)->u.label = e->u.name;
+        break;
+    case TE_TEMP:
+        return var_of(b, e->u.temp);
+    case TE_BINOP: {
+        Value l = build_exp(b, e->u.bin.left);
+        Value r = build_exp(b, e->u.bin.right);
+        IrIns *ins = emit(b, IR_BINOP, ir_new_value(f), 2);
+        ins->sub = e->op;
+        ins->args[0] = l;
+        ins->args[1] = r;
+        break;
+    }
+    case TE_MEM: {
+        Value a = build_exp(b, e->u.mem);
+        emit(b, IR_LOAD, ir_new_value(f), 1)->args[0] = a;
+        break;
+    }
+    default:
+        fatal("ir: tree is not canonical");
+    }
+    IrBlock *blk = &f->blocks.data[b->cur];
+    return last_ins(blk)->dst;
+}
+
+static void build_call(Builder *b, const TExp *call, Value dst)
+{
+    if (call->u.call.func->kind != TE_NAME)
+        fatal("ir: indirect call");
+    uint32_t n = call->u.call.nargs;
+    Value *av = xmalloc((n + 1) * sizeof *av);
+    for (uint32_t i = 0; i < n; i++)
+        av[i] = build_exp(b, call->u.call.args[i]);
+    IrIns *ins = emit(b, IR_CALL, dst, n);
+    ins->flags = call->flags;
+    ins->u.label = call->u.call.func->u.name;
+    memcpy(ins->args, av, n * sizeof *av);
+    free(av);
+}
+
+static void build_stm(Builder *b, const TStm *s, uint32_t exit)
+{
+    IrBlock *blk;
+    switch ((TStmKind)s->kind) {
+    case TS_MOVE: {
+        TExp *dst = s->u.move.dst, *src = s->u.move.src;
+        if (dst->kind == TE_TEMP) {
+            Value d = var_of(b, dst->u.temp);
+            if (src->kind == TE_CALL) {
+                build_call(b, src, d);
+            } else if (src->kind == TE_TEMP) {
+                emit(b, IR_COPY, d, 1)->args[0] = var_of(b, src->u.temp);
+            } else {
+                /* Let the instruction computing the value define the
+                   variable directly. */
+                build_exp(b, src);
+                last_ins(&b->f->blocks.data[b->cur])->dst = d;
+            }
+        } else if (dst->kind == TE_MEM) {
+            Value a = build_exp(b, dst->u.mem);
+            Value v = build_exp(b, src);
+            IrIns *ins = emit(b, IR_STORE, IR_NONE, 2);
+            ins->args[0] = a;
+            ins->args[1] = v;
+        } else {
+            fatal("ir: tree is not canonical");
+        }
+        break;
+    }
+    case TS_EXP:
+        if (s->u.exp->kind == TE_CALL)
+            build_call(b, s->u.exp, IR_NONE);
+        break;
+    case TS_JUMP: {
+        Label l = s->u.jump.labels[0];
+        uint32_t to = l == b->f->done ? exit : block_of(b, l);
+        emit(b, IR_JUMP, IR_NONE, 0);
+        blk = &b->f->blocks.data[b->cur];
+        blk->succ[0] = to;
+        blk->nsucc = 1;
+        break;
+    }
+    case TS_CJUMP: {
+        Value l = build_exp(b, s->u.cjump.left);
+        Value r = build_exp(b, s->u.cjump.right);
+        IrIns *ins = emit(b, IR_CJUMP, IR_NONE, 2);
+        ins->sub = s->op;
+        ins->args[0] = l;
+        ins->args[1] = r;
+        blk = &b->f->blocks.data[b->cur];
+        blk->succ[0] = block_of(b, s->u.cjump.t);
+        blk->succ[1] = block_of(b, s->u.cjump.f);
+        blk->nsucc = 2;
+        break;
+    }
+    case TS_LABEL:
+        break;
+    case TS_LINE:
+        emit(b, IR_LINE, IR_NONE, 0)->u.value = s->u.line;
+        break;
+    default:
+        fatal("ir: tree is not canonical");
+    }
+}
+
+static IrBlock *add_block(IrFunc *f, Label l)
+{
+    vec_push(&f->blocks, ((IrBlock){ .label = l }));
+    return &f->blocks.data[f->blocks.len - 1];
+}
+
+/* The minimal SSA construction of Cytron et al., semi-pruned: phis only
+   for variables read in some block before being written there. */
+static void to_ssa(IrFunc *f, uint32_t nvars)
+{
+    uint32_t n = f->blocks.len;
+
+    /* Dominance frontiers. */
+    VEC(uint32_t) *df = xcalloc(n, sizeof *df);
+    for (uint32_t b = 0; b < n; b++) {
+        IrBlock *blk = &f->blocks.data[b];
+        if (blk->preds.len < 2)
+            continue;
+        for (uint32_t k = 0; k < blk->preds.len; k++) {
+            for (uint32_t r = blk->preds.data[k]; r != blk->idom; r = f->blocks.data[r].idom) {
+                if (df[r].len && df[r].data[df[r].len - 1] == b)
+                    break;
+                vec_push(&df[r], b);
+            }
+        }
+    }
+
+    /* Defining blocks of every variable, and which are read across
+       blocks. */
+    uint32_t *count = xcalloc(nvars + 1, sizeof *count);
+    uint32_t *seen = xmalloc(nvars * sizeof *seen);
+    bool *global = xcalloc(nvars, sizeof *global);
+    memset(seen, 0xff, nvars * sizeof *seen);
+    for (uint32_t b = 0; b < n; b++) {
+        IrBlock *blk = &f->blocks.data[b];
+        for (uint32_t i = 0; i < blk->ins.len; i++) {
+            IrIns *ins = &blk->ins.data[i];
+            for (uint32_t k = 0; k < ins->nargs; k++)
+                if (ins->args[k] >= TEMP_NREGS && seen[ins->args[k]] != b)
+                    global[ins->args[k]] = true;
+            if (ins->dst != IR_NONE && ins->dst >= TEMP_NREGS && seen[ins->dst] != b) {
+                seen[ins->dst] = b;
+                count[ins->dst + 1]++;
+            }
+        }
+    }
+    for (uint32_t v = 0; v < nvars; v++)
+        count[v + 1] += count[v];
+    uint32_t *defs = xmalloc((count[nvars] + 1) * sizeof *defs);
+    uint32_t *fill = xmalloc((nvars + 1) * sizeof *fill);
+    memcpy(fill, count, (nvars + 1) * sizeof *fill);
+    memset(seen, 0xff, nvars * sizeof *seen);
+    for (uint32_t b = 0; b < n; b++) {
+        IrBlock *blk = &f->blocks.data[b];
+        for (uint32_t i = 0; i < blk->ins.len; i++) {
+            Value d = blk->ins.data[i].dst;
+            if (d != IR_NONE && d >= TEMP_NREGS && seen[d] != b) {
+                seen[d] = b;
+                defs[fill[d]++] = b;
+            }
+        }
+    }
+
+    /* Phi placement on the iterated dominance frontier. */
+    VEC(IrIns) *phis = xcalloc(n, sizeof *phis);
+    uint32_t *has_phi = xmalloc(n * sizeof *has_phi);
+    uint32_t *queued = xmalloc(n * sizeof *queued);
+    memset(has_phi, 0xff, n * sizeof *has_phi);
+    memset(queued, 0xff, n * sizeof *queued);
+    VEC(uint32_t) work = {0};
+    for (uint32_t v = TEMP_NREGS; v < nvars; v++) {
+        if (!global[v])
+            continue;
+        work.len = 0;
+        for (uint32_t i = count[v]; i < count[v + 1]; i++) {
+            queued[defs[i]] = v;
+            vec_push(&work, defs[i]);
+        }
+        while (work.len) {
+            uint32_t b = work.data[--work.len];
+            for (uint32_t i = 0; i < df[b].len; i++) {
+                uint32_t d = df[b].data[i];
+                if (has_phi[d] == v)
+                    continue;
+                has_phi[d] = v;
+                uint32_t np = f->blocks.data[d].preds.len;
+                IrIns phi = { .op = IR_PHI, .dst = v, .nargs = np, .args = args_new(f, np) };
+                phi.u.value = v;        /* the variable, for renaming */
+                vec_push(&phis[d], phi);
+                if (queued[d] != v) {
+                    queued[d] = v;
+                    vec_push(&work, d);
+                }
+            }
+        }
+    }
+    for (uint32_t b = 0; b < n; b++) {
+        if (!phis[b].len)
+            continue;
+        IrBlock *blk = &f->blocks.data[b];
+        for (uint32_t i = 0; i < blk->ins.len; i++)
+            vec_push(&phis[b], blk->ins.data[i]);
+        vec_free(&blk->ins);
+        blk->ins.data = phis[b].data;
+        blk->ins.len = phis[b].len;
+        blk->ins.cap = phis[b].cap;
+    }
+
+    /* Renaming, in a preorder walk of the dominator tree.  top[v] is the
+       value variable v has at this point; the log restores it when the
+       walk leaves a subtree. */
+    f->nvalues = TEMP_NREGS;
+    Value *top = xmalloc(nvars * sizeof *top);
+    for (uint32_t v = 0; v < nvars; v++)
+        top[v] = v < TEMP_NREGS ? v : IR_NONE;
+    typedef struct { Value var, old; } Saved;
+    VEC(Saved) log = {0};
+    VEC(IrIns) undefs = {0};
+
+    IrDomTree dt;
+    ir_dom_tree(f, &dt);
+    typedef struct { uint32_t block, mark; } Frame;
+    VEC(Frame) stack = {0};
+    vec_push(&stack, ((Frame){ 0, IR_NONE }));
+    while (stack.len) {
+        Frame fr = stack.data[--stack.len];
+        if (fr.mark != IR_NONE) {
+            while (log.len > fr.mark) {
+                Saved s = log.data[--log.len];
+                top[s.var] = s.old;
+            }
+            continue;
+        }
+        uint32_t b = fr.block;
+        vec_push(&stack, ((Frame){ b, log.len }));
+
+        IrBlock *blk = &f->blocks.data[b];
+        for (uint32_t i = 0; i < blk->ins.len; i++) {
+            IrIns *ins = &blk->ins.data[i];
+            if (ins->op != IR_PHI) {
+                for (uint32_t k = 0; k < ins->nargs; k++) {
+                    Value v = ins->args[k];
+                    if (top[v] == IR_NONE) {
+                        /* Read before any write on some path: any value
+                           will do. */
+                        Value u = ir_new_value(f);
+                        vec_push(&undefs, ((IrIns){ .op = IR_CONST, .dst = u }));
+                        top[v] = u;
+                    }
+                    ins->args[k] = top[v];
+                }
+            }
+            if (ins->dst != IR_NONE && ins->dst >= TEMP_NREGS) {
+                Value var = ins->dst;
+                vec_push(&log, ((Saved){ var, top[var] }));
+                top[var] = ir_new_value(f);
+                ins->dst = top[var];
+            }
+        }
+        for (uint32_t s = 0; s < blk->nsucc; s++) {
+            uint32_t to = blk->succ[s];
+            if (s == 1 && to == blk->succ[0])
+                break;
+            IrBlock *sb = &f->blocks.data[to];
+            for (uint32_t i = 0; i < sb->ins.len && sb->ins.data[i].op == IR_PHI; i++) {
+                IrIns *phi = &sb->ins.data[i];
+                Value v = (Value)phi->u.value;
+                if (top[v] == IR_NONE) {
+                    Value u = ir_new_value(f);
+                    vec_push(&undefs, ((IrIns){ .op = IR_CONST, .dst = u }));
+                    top[v] = u;
+                }
+                for (uint32_t k = 0; k < sb->preds.len; k++)
+                    if (sb->preds.data[k] == b)
+                        phi->args[k] = top[v];
+            }
+        }
+        for (uint32_t k = dt.kstart[b + 1]; k-- > dt.kstart[b];)
+            vec_push(&stack, ((Frame){ dt.kids[k], IR_NONE }));
+    }
+    for (uint32_t b = 0; b < n; b++)
+        for (uint32_t i = 0; i < f->blocks.data[b].ins.len; i++)
+            if (f->blocks.data[b].ins.data[i].op == IR_PHI)
+                f->blocks.data[b].ins.data[i].u.value = 0;
+
+    /* The undefined values are defined at the top of the entry block,
+       which has no phis. */
+    IrBlock *entry = &f->blocks.data[0];
+    for (uint32_t i = 0; i < entry->ins.len; i++)
+        vec_push(&undefs, entry->ins.data[i]);
+    vec_free(&entry->ins);
+    entry->ins.data = undefs.data;
+    entry->ins.len = undefs.len;
+    entry->ins.cap = undefs.cap;
+
+    ir_dom_tree_free(&dt);
+    vec_free(&stack);
+    vec_free(&log);
+    vec_free(&work);
+    for (uint32_t b = 0; b < n; b++)
+        vec_free(&df[b]);
+    free(df);
+    free(phis);
+    free(has_phi);
+    free(queued);
+    free(top);
+    free(count);
+    free(seen);
+    free(global);
+    free(defs);
+    free(fill);
+}
+
+void ir_build(IrFunc *f, Arena *a, Label name, BlockList *blocks)
+{
+    memset(f, 0, sizeof *f);
+    f->arena = a;
+    f->name = name;
+    f->done = blocks->done;
+    f->nvalues = TEMP_NREGS;
+
+    /* A fresh entry block, so that the entry has no predecessors; then
+       the program's blocks; then the exit. */
+    Builder b = { .f = f };
+    IrBlock *entry = add_block(f, label_new());
+    entry->succ[0] = 1;
+    entry->nsucc = 1;
+    uint32_t nb = blocks->blocks.len;
+    for (uint32_t i = 0; i < nb; i++) {
+        Label l = blocks->blocks.data[i].data[0]->u.label;
+        add_block(f, l);
+        idmap_put(&b.at, l, i + 1);
+    }
+    uint32_t exit = nb + 1;
+    add_block(f, f->done);
+    b.cur = 0;
+    emit(&b, IR_JUMP, IR_NONE, 0);
+    for (uint32_t i = 0; i < nb; i++) {
+        b.cur = i + 1;
+        const StmList *sl = &blocks->blocks.data[i];
+        for (uint32_t k = 0; k < sl->len; k++)
+            build_stm(&b, sl->data[k], exit);
+    }
+    b.cur = exit;
+    emit(&b, IR_RET, IR_NONE, 0);
+
+    for (uint32_t i = 0; i < f->blocks.len; i++) {
+        IrBlock *blk = &f->blocks.data[i];
+        for (uint32_t s = 0; s < blk->nsucc; s++)
+            vec_push(&f->blocks.data[blk->succ[s]].preds, i);
+    }
+    idmap_free(&b.vars);
+    idmap_free(&b.at);
+
+    ir_compact(f);
+    to_ssa(f, f->nvalues);
+}
+
+void ir_free(IrFunc *f)
+{
+    for (uint32_t b = 0; b < f->blocks.len; b++) {
+        vec_free(&f->blocks.data[b].ins);
+        vec_free(&f->blocks.data[b].preds);
+    }
+    vec_free(&f->blocks);
+}
+
+/* ---- Leaving SSA -------------------------------------------------------- */
+
+/* Give every edge into a block with phis from a block with two
+   successors a block of its own, to hold the phi copies. */
+static void split_critical_edges(IrFunc *f)
+{
+    uint32_t n = f->blocks.len;
+    for (uint32_t b = 0; b < n; b++) {
+        if (!f->blocks.data[b].ins.len || f->blocks.data[b].ins.data[0].op != IR_PHI)
+            continue;
+        for (uint32_t k = 0; k < f->blocks.data[b].preds.len; k++) {
+            uint32_t p = f->blocks.data[b].preds.data[k];
+            if (f->blocks.data[p].nsucc < 2)
+                continue;
+            uint32_t m = f->blocks.len;
+            IrBlock *nb = add_block(f, label_new());
+            nb->succ[0] = b;
+            nb->nsucc = 1;
+            vec_push(&nb->preds, p);
+            vec_push(&nb->ins, ((IrIns){ .op = IR_JUMP, .dst = IR_NONE }));
+            IrBlock *pb = &f->blocks.data[p];
+            /* With both edges to b, each slot takes one of them. */
+            uint32_t s = pb->succ[0] == b ? 0 : 1;
+            pb->succ[s] = m;
+            f->blocks.data[b].preds.data[k] = m;
+        }
+    }
+}
+
+static void insert_before_terminator(IrBlock *blk, IrIns ins)
+{
+    vec_push(&blk->ins, ins);
+    IrIns t = blk->ins.data[blk->ins.len - 2];
+    blk->ins.data[blk->ins.len - 2] = ins;
+    blk->ins.data[blk->ins.len - 1] = t;
+}
+
+/* Replace each phi by a copy from a fresh value that every predecessor
+   assigns just before its jump. */
+static void remove_phis(IrFunc *f)
+{
+    split_critical_edges(f);
+    for (uint32_t b = 0; b < f->blocks.len; b++) {
+        for (uint32_t i = 0; i < f->blocks.data[b].ins.len; i++) {
+            IrIns *phi = &f->blocks.data[b].ins.data[i];
+            if (phi->op != IR_PHI)
+                break;
+            Value mid = ir_new_value(f);
+            for (uint32_t k = 0; k < f->blocks.data[b].preds.len; k++) {
+                IrIns copy = { .op = IR_COPY, .dst = mid, .nargs = 1, .args = args_new(f, 1) };
+                copy.args[0] = f->blocks.data[b].ins.data[i].args[k];
+                insert_before_terminator(&f->blocks.data[f->blocks.data[b].preds.data[k]], copy);
+            }
+            phi = &f->blocks.data[b].ins.data[i];
+            phi->op = IR_COPY;
+            phi->nargs = 1;
+            phi->args[0] = mid;
+        }
+    }
+}
+
+typedef struct Lower {
+    IrFunc *f;
+    Arena *a;
+    Temp *temp;             /* [value] */
+    uint32_t *uses, *defs;  /* [value] */
+    /* Constants and addresses, rebuilt at each use instead of being held
+       in a temp: they would otherwise stay live across the function.
+       So are indices scaled by 2, 4 or 8, which an x86 address absorbs. */
+    const IrIns **remat;    /* [value] */
+    /* Pending single-use definitions of the current block, foldable
+       into their use: the expression and its statement's position. */
+    TExp **avail;           /* [value] */
+    uint32_t *slot;         /* [value] */
+    VEC(Value) pending;
+    uint8_t *what;          /* [value] PEND_* */
+} Lower;
+
+enum {
+    PEND_LOAD = 1 << 0,     /* reads memory */
+    PEND_MUTABLE = 1 << 1,  /* reads a temp assigned more than once */
+    /* Reads a machine register other than the frame and stack pointers:
+       an incoming argument, say, which any call, division or shift in
+       between may overwrite.  Never folded into a later use. */
+    PEND_FIXED = 1 << 2,
+};
+
+static Temp temp_of(Lower *l, Value v)
+{
+    if (v < TEMP_NREGS)
+        return v;
+    if (!l->temp[v])
+        l->temp[v] = temp_new();
+    return l->temp[v];
+}
+
+static bool single_def(const Lower *l, Value v)
+{
+    return v >= TEMP_NREGS && l->defs[v] == 1;
+}
+
+/* The expression for operand `v`, folding in its pending definition. */
+static TExp *operand(Lower *l, Value v, StmList *out, uint8_t *what)
+{
+    const IrIns *r = l->remat[v];
+    if (r && r->op == IR_BINOP)
+        return t_binop(l->a, (TBinOp)r->sub, t_temp(l->a, temp_of(l, r->args[0])),
+                       operand(l, r->args[1], out, what));
+    if (r)
+        return r->op == IR_CONST ? t_const(l->a, r->u.value) : t_name(l->a, r->u.label);
+    if (l->avail[v]) {
+        TExp *e = l->avail[v];
+        l->avail[v] = NULL;
+        out->data[l->slot[v]] = NULL;
+        *what |= l->what[v];
+        return e;
+    }
+    if (v < TEMP_NREGS && v != REG_FP && v != REG_RSP)
+        *what |= PEND_FIXED;
+    else if (!single_def(l, v))
+        *what |= PEND_MUTABLE;
+    return t_temp(l->a, temp_of(l, v));
+}
+
+/* Statements that write memory or call invalidate pending loads; writes
+   to a multiply assigned temp or a call invalidate pending reads of
+   such temps. */
+static void invalidate(Lower *l, uint8_t kill)
+{
+    uint32_t j = 0;
+    for (uint32_t i = 0; i < l->pending.len; i++) {
+        Value v = l->pending.data[i];
+        if (!l->avail[v])
+            continue;
+        if (l->what[v] & kill)
+            l->avail[v] = NULL;
+        else
+            l->pending.data[j++] = v;
+    }
+    l->pending.len = j;
+}
+
+static void lower_block(Lower *l, IrBlock *blk, StmList *out)
+{
+    Arena *a = l->a;
+    IrFunc *f = l->f;
+    vec_push(out, t_label(a, blk->label));
+    l->pending.len = 0;
+    for (uint32_t i = 0; i < blk->ins.len; i++) {
+        IrIns *ins = &blk->ins.data[i];
+        uint8_t what = 0;
+        TExp *e = NULL;
+        TStm *s = NULL;
+        switch ((IrOp)ins->op) {
+        case IR_NOP:
+        case IR_PHI:
+            continue;
+        case IR_CONST:
+            if (l->remat[ins->dst])
+                continue;
+            e = t_const(a, ins->u.value);
+            break;
+        case IR_NAME:
+            if (l->remat[ins->dst])
+                continue;
+            e = t_name(a, ins->u.label);
+            break;
+        case IR_COPY:
+            e = operand(l, ins->args[0], out, &what);
+            break;
+        case IR_BINOP: {
+            if (l->remat[ins->dst])
+                continue;
+            TExp *x = operand(l, ins->args[0], out, &what);
+            TExp *y = operand(l, ins->args[1], out, &what);
+            e = t_binop(a, (TBinOp)ins->sub, x, y);
+            break;
+        }
+        case IR_LOAD:
+            e = t_mem(a, operand(l, ins->args[0], out, &what));
+            what |= PEND_LOAD;
+            break;
+        case IR_STORE: {
+            TExp *addr = operand(l, ins->args[0], out, &what);
+            TExp *v = operand(l, ins->args[1], out, &what);
+            s = t_move(a, t_mem(a, addr), v);
+            invalidate(l, PEND_LOAD);
+            break;
+        }
+        case IR_CALL: {
+            TExp **av = arena_alloc(a, ins->nargs * sizeof *av);
+            for (uint32_t k = 0; k < ins->nargs; k++)
+                av[k] = operand(l, ins->args[k], out, &what);
+            TExp *c = t_call(a, t_name(a, ins->u.label), av, ins->nargs);
+            c->flags = ins->flags;
+            invalidate(l, PEND_LOAD | PEND_MUTABLE);
+            if (ins->dst == IR_NONE) {
+                s = t_exp(a, c);
+            } else {
+                /* A result used only by the next copy becomes that
+                   copy's source. */
+                Value d = ins->dst;
+                IrIns *next = i + 1 < blk->ins.len ? &blk->ins.data[i + 1] : NULL;
+                if (single_def(l, d) && l->uses[d] == 1 && next && next->op == IR_COPY &&
+                    next->args[0] == d) {
+                    s = t_move(a, t_temp(a, temp_of(l, next->dst)), c);
+                    if (!single_def(l, next->dst))
+                        invalidate(l, PEND_MUTABLE);
+                    i++;
+                } else {
+                    s = t_move(a, t_temp(a, temp_of(l, d)), c);
+                }
+            }
+            break;
+        }
+        case IR_JUMP:
+            s = t_jump(a, f->blocks.data[blk->succ[0]].label);
+            break;
+        case IR_CJUMP: {
+            TExp *x = operand(l, ins->args[0], out, &what);
+            TExp *y = operand(l, ins->args[1], out, &what);
+            s = t_cjump(a, (TRelOp)ins->sub, x, y, f->blocks.data[blk->succ[0]].label,
+                        f->blocks.data[blk->succ[1]].label);
+            break;
+        }
+        case IR_RET:
+            s = t_jump(a, f->done);
+            break;
+        case IR_LINE:
+            s = t_line(a, (uint32_t)ins->u.value);
+            break;
+        }
+        if (s) {
+            vec_push(out, s);
+            continue;
+        }
+        Value d = ins->dst;
+        if (!single_def(l, d))
+            invalidate(l, PEND_MUTABLE);
+        vec_push(out, t_move(a, t_temp(a, temp_of(l, d)), e));
+        if (single_def(l, d) && l->uses[d] == 1 && !(what & PEND_FIXED)) {
+            l->avail[d] = e;
+            l->slot[d] = out->len - 1;
+            l->what[d] = what;
+            vec_push(&l->pending, d);
+        }
+    }
+    for (uint32_t i = 0; i < l->pending.len; i++)
+        l->avail[l->pending.data[i]] = NULL;
+    uint32_t j = 0;
+    for (uint32_t i = 0; i < out->len; i++)
+        if (out->data[i])
+            out->data[j++] = out->data[i];
+    out->len = j;
+}
+
+void ir_lower(IrFunc *f, BlockList *out)
+{
+    remove_phis(f);
+
+    uint32_t nv = f->nvalues;
+    Lower l = { .f = f, .a = f->arena };
+    l.temp = xcalloc(nv, sizeof *l.temp);
+    l.uses = xcalloc(nv, sizeof *l.uses);
+    l.defs = xcalloc(nv, sizeof *l.defs);
+    l.remat = xcalloc(nv, sizeof *l.remat);
+    l.avail = xcalloc(nv, sizeof *l.avail);
+    l.slot = xcalloc(nv, sizeof *l.slot);
+    l.what = xcalloc(nv, sizeof *l.what);
+    for (uint32_t b = 0; b < f->blocks.len; b++) {
+        IrBlock *blk = &f->blocks.data[b];
+        for (uint32_t i = 0; i < blk->ins.len; i++) {
+            IrIns *ins = &blk->ins.data[i];
+            if (ins->op == IR_NOP)
+                continue;
+            for (uint32_t k = 0; k < ins->nargs; k++)
+                l.uses[ins->args[k]]++;
+            if (ins->dst != IR_NONE)
+                l.defs[ins->dst]++;
+        }
+    }
+    for (uint32_t b = 0; b < f->blocks.len; b++) {
+        IrBlock *blk = &f->blocks.data[b];
+        for (uint32_t i = 0; i < blk->ins.len; i++) {
+            const IrIns *ins = &blk->ins.data[i];
+            if ((ins->op == IR_CONST || ins->op == IR_NAME) && single_def(&l, ins->dst))
+                l.remat[ins->dst] = ins;
+        }
+    }
+    for (uint32_t b = 0; b < f->blocks.len; b++) {
+        IrBlock *blk = &f->blocks.data[b];
+        for (uint32_t i = 0; i < blk->ins.len; i++) {
+            const IrIns *ins = &blk->ins.data[i];
+            if (ins->op != IR_BINOP || ins->sub != T_MUL || !single_def(&l, ins->dst) ||
+                l.uses[ins->dst] < 2 || !single_def(&l, ins->args[0]) || l.remat[ins->args[0]])
+                continue;
+            const IrIns *k = l.remat[ins->args[1]];
+            if (k && k->op == IR_CONST && (k->u.value == 2 || k->u.value == 4 || k->u.value == 8)) {
+                l.remat[ins->dst] = ins;
+                /* Read at every use of the product: never folded away. */
+                l.uses[ins->args[0]] += 2;
+            }
+        }
+    }
+
+    memset(out, 0, sizeof *out);
+    out->done = f->done;
+    for (uint32_t b = 0; b < f->blocks.len; b++) {
+        IrBlock *blk = &f->blocks.data[b];
+        if (blk->label == f->done)
+            continue;           /* the exit: canon_trace() adds its label */
+        StmList sl = {0};
+        lower_block(&l, blk, &sl);
+        vec_push(&out->blocks, sl);
+    }
+
+    vec_free(&l.pending);
+    free(l.temp);
+    free(l.uses);
+    free(l.defs);
+    free(l.remat);
+    free(l.avail);
+    free(l.slot);
+    free(l.what);
+}
+
+/* ---- Dump -------------------------------------------------------------- */
+
+static void dump_value(Value v, FILE *out)
+{
+    if (v < TEMP_NREGS)
+        fprintf(out, "%%%s", reg_names[v]);
+    else
+        fprintf(out, "v%u", v);
+}
+
+void ir_dump(const IrFunc *f, FILE *out)
+{
+    fputs("proc ", out);
+    label_print(f->name, out);
+    fputc('\n', out);
+    for (uint32_t b = 0; b < f->blocks.len; b++) {
+        const IrBlock *blk = &f->blocks.data[b];
+        label_print(blk->label, out);
+        fputc(':', out);
+        if (blk->preds.len) {
+            fputs(" ; from", out);
+            for (uint32_t k = 0; k < blk->preds.len; k++) {
+                fputc(' ', out);
+                label_print(f->blocks.data[blk->preds.data[k]].label, out);
+            }
+        }
+        fputc('\n', out);
+        for (uint32_t i = 0; i < blk->ins.len; i++) {
+            const IrIns *ins = &blk->ins.data[i];
+            if (ins->op == IR_NOP)
+                continue;
+            fputs("    ", out);
+            if (ins->dst != IR_NONE) {
+                dump_value(ins->dst, out);
+                fputs(" = ", out);
+            }
+            switch ((IrOp)ins->op) {
+            case IR_NOP:
+                break;
+            case IR_CONST:
+                fprintf(out, "%" PRId64, ins->u.value);
+                break;
+            case IR_NAME:
+                label_print(ins->u.label, out);
+                break;
+            case IR_COPY:
+                dump_value(ins->args[0], out);
+                break;
+            case IR_BINOP:
+                dump_value(ins->args[0], out);
+                fprintf(out, " %s ", t_binop_names[ins->sub]);
+                dump_value(ins->args[1], out);
+                break;
+            case IR_LOAD:
+                fputs("M[", out);
+                dump_value(ins->args[0], out);
+                fputc(']', out);
+                break;
+            case IR_STORE:
+                fputs("M[", out);
+                dump_value(ins->args[0], out);
+                fputs("] = ", out);
+                dump_value(ins->args[1], out);
+                break;
+            case IR_CALL:
+            case IR_PHI:
+                if (ins->op == IR_CALL) {
+                    fputs(ins->flags & TC_TAIL ? "tailcall " : "call ", out);
+                    label_print(ins->u.label, out);
+                } else {
+                    fputs("phi", out);
+                }
+                fputc('(', out);
+                for (uint32_t k = 0; k < ins->nargs; k++) {
+                    if (k)
+                        fputs(", ", out);
+                    dump_value(ins->args[k], out);
+                }
+                fputc(')', out);
+                break;
+            case IR_JUMP:
+                fputs("jump ", out);
+                label_print(f->blocks.data[blk->succ[0]].label, out);
+                break;
+            case IR_CJUMP:
+                fputs("cjump ", out);
+                dump_value(ins->args[0], out);
+                fprintf(out, " %s ", t_relop_names[ins->sub]);
+                dump_value(ins->args[1], out);
+                fputc(' ', out);
+                label_print(f->blocks.data[blk->succ[0]].label, out);
+                fputc(' ', out);
+                label_print(f->blocks.data[blk->succ[1]].label, out);
+                break;
+            case IR_RET:
+                fputs("ret", out);
+                break;
+            case IR_LINE:
+                fprintf(out, "line %" PRId64, ins->u.value);
+                break;
+            }
+            fputc('\n', out);
+        }
+    }
+}
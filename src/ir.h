@@ -0,0 +1,108 @@
+#ifndef TIGER_IR_H
+#define TIGER_IR_H
+
+#include <stdio.h>
+
+#include "canon.h"
+
+/*
+ * Mid-level IR in SSA form, between canonical trees and instruction
+ * selection.  A function is a control-flow graph of blocks holding
+ * three-address instructions over values.  Values below TEMP_NREGS are
+ * the machine registers, used as in the trees and never renamed; every
+ * other value has exactly one definition, which dominates its uses.
+ * Phis at the head of a block take one argument per predecessor, in
+ * the order of `preds`.
+ *
+ * ir_build() puts canonical blocks (from canon_blocks) into SSA form.
+ * ir_lower() leaves it again, turning values back into temps and
+ * single-use values back into expression trees, and yields blocks for
+ * canon_trace().
+ */
+
+typedef enum IrOp {
+    IR_NOP,                 /* deleted */
+    IR_CONST,               /* dst = value */
+    IR_NAME,                /* dst = address of `label` */
+    IR_COPY,                /* dst = a0 */
+    IR_BINOP,               /* dst = a0 sub a1 (TBinOp) */
+    IR_LOAD,                /* dst = M[a0] */
+    IR_STORE,               /* M[a0] = a1 */
+    IR_CALL,                /* dst = label(a0, ...); dst may be IR_NONE */
+    IR_PHI,                 /* dst = phi(a0, ...) */
+    IR_LINE,                /* source line `value` starts here (TS_LINE) */
+    IR_JUMP,                /* goto succ[0] */
+    IR_CJUMP,               /* if a0 sub a1 (TRelOp) goto succ[0] else succ[1] */
+    IR_RET,                 /* leave through the epilogue */
+} IrOp;
+
+enum { IR_NONE = UINT32_MAX };
+
+typedef uint32_t Value;
+
+typedef struct IrIns {
+    uint8_t op;
+    uint8_t sub;
+    uint8_t flags;          /* TExp.flags of a call */
+    uint8_t depth;          /* of a call: inlined bodies it came through */
+    Value dst;
+    uint32_t nargs;
+    Value *args;
+    union {
+        int64_t value;
+        Label label;
+    } u;
+} IrIns;
+
+typedef struct IrBlock {
+    Label label;
+    VEC(IrIns) ins;         /* phis first, one terminator last */
+    uint32_t succ[2], nsucc;
+    VEC(uint32_t) preds;
+    uint32_t idom;          /* immediate dominator; the entry's is itself */
+    bool dead;              /* unreachable, to be dropped */
+} IrBlock;
+
+typedef struct IrFunc {
+    Arena *arena;           /* argument arrays */
+    Label name;
+    VEC(IrBlock) blocks;    /* blocks[0] is the entry */
+    Label done;             /* the epilogue, target of IR_RET */
+    uint32_t nvalues;
+    bool profiled;          /* `calls` is from -fprofile-use */
+    uint64_t calls;
+} IrFunc;
+
+void ir_build(IrFunc *f, Arena *a, Label name, BlockList *blocks);
+void ir_lower(IrFunc *f, BlockList *out);
+void ir_free(IrFunc *f);
+
+Value ir_new_value(IrFunc *f);
+
+/* Drop unreachable and dead blocks and deleted instructions, renumber
+   the blocks and recompute `idom`.  Every pass ends with this. */
+void ir_compact(IrFunc *f);
+
+/* Merge every block into its predecessor when it is that block's only
+   successor and the predecessor is its only one; then ir_compact(). */
+void ir_merge_blocks(IrFunc *f);
+
+/* Remove predecessor `p` of block `b`, with its phi arguments. */
+void ir_remove_pred(IrFunc *f, uint32_t b, uint32_t p);
+
+/* Blocks in reverse postorder, as filled in by ir_compact(). */
+typedef VEC(uint32_t) IrOrder;
+void ir_rpo(const IrFunc *f, IrOrder *out);
+
+/* The dominator tree as children lists: kids[kstart[b] .. kstart[b+1]). */
+typedef struct IrDomTree {
+    uint32_t *kstart, *kids;
+} IrDomTree;
+void ir_dom_tree(const IrFunc *f, IrDomTree *t);
+void ir_dom_tree_free(IrDomTree *t);
+
+bool ir_is_pure(const IrIns *ins);
+
+void ir_dump(const IrFunc *f, FILE *out);
+
+#endif
@@ -0,0 +1,434 @@
+#include "lexer.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "diag.h"
+#include "symbol.h"
+
+const char *const token_names[TOK_COUNT] = {
+#define X(name, text) [TOK_##name] = text,
+    TOKEN_LIST(X)
+#undef X
+};
+
+/*
+ * The scanner is a DFA driven by two precomputed tables: `char_class`
+ * folds the 256 byte values into a handful of classes and `lex_trans`
+ * maps (state, class) to the next state.  States at or above A_FIRST are
+ * accepting; the loop stops on them and `accept_consumes` says whether
+ * the byte that caused the transition belongs to the token (e.g. the '='
+ * of "<=") or is lookahead (the byte after an identifier).
+ *
+ * Nested comments are not regular, so the DFA only recognises the opener and
+ * hands off to a second, smaller table that tracks nesting with a depth
+ * counter.
+ */
+
+enum CharClass {
+    CC_NUL,     /* end-of-input sentinel */
+    CC_WS,
+    CC_NL,
+    CC_ALPHA,
+    CC_N,       /* 'n' and 't' are letters, but also escape characters */
+    CC_T,
+    CC_DIGIT,
+    CC_UNDER,
+    CC_QUOTE,
+    CC_BSLASH,
+    CC_CARET,
+    CC_SLASH,
+    CC_STAR,
+    CC_LT,
+    CC_GT,
+    CC_EQ,
+    CC_COLON,
+    CC_PUNCT,   /* single-byte tokens; see punct_kind */
+    CC_OTHER,
+    CC_COUNT
+};
+
+static const uint8_t char_class[256] = {
+    ['\0'] = CC_NUL,
+    [1 ... 255] = CC_OTHER,
+    [' '] = CC_WS, ['\t'] = CC_WS, ['\r'] = CC_WS, ['\f'] = CC_WS, ['\v'] = CC_WS,
+    ['\n'] = CC_NL,
+    ['a' ... 'z'] = CC_ALPHA,
+    ['A' ... 'Z'] = CC_ALPHA,
+    ['n'] = CC_N,
+    ['t'] = CC_T,
+    ['0' ... '9'] = CC_DIGIT,
+    ['_'] = CC_UNDER,
+    ['"'] = CC_QUOTE,
+    ['\\'] = CC_BSLASH,
+    ['^'] = CC_CARET,
+    ['/'] = CC_SLASH,
+    ['*'] = CC_STAR,
+    ['<'] = CC_LT,
+    ['>'] = CC_GT,
+    ['='] = CC_EQ,
+    [':'] = CC_COLON,
+    [','] = CC_PUNCT, [';'] = CC_PUNCT, ['('] = CC_PUNCT, [')'] = CC_PUNCT,
+    ['['] = CC_PUNCT, [']'] = CC_PUNCT, ['{'] = CC_PUNCT, ['}'] = CC_PUNCT,
+    ['.'] = CC_PUNCT, ['+'] = CC_PUNCT, ['-'] = CC_PUNCT, ['&'] = CC_PUNCT,
+    ['|'] = CC_PUNCT,
+};
+
+static const uint8_t punct_kind[256] = {
+    [','] = TOK_COMMA, [';'] = TOK_SEMI, ['('] = TOK_LPAREN, [')'] = TOK_RPAREN,
+    ['['] = TOK_LBRACK, [']'] = TOK_RBRACK, ['{'] = TOK_LBRACE, ['}'] = TOK_RBRACE,
+    ['.'] = TOK_DOT, ['+'] = TOK_PLUS, ['-'] = TOK_MINUS, ['&'] = TOK_AND,
+    ['|'] = TOK_OR, ['*'] = TOK_TIMES, ['='] = TOK_EQ,
+};
+
+enum LexState {
+    S_START,
+    S_IDENT,
+    S_INT,
+    S_SLASH,
+    S_LT,
+    S_GT,
+    S_COLON,
+    S_STR,          /* string body, no escapes seen yet */
+    S_STR_X,        /* string body after an escape */
+    S_ESC,          /* just read '\' */
+    S_ESC_D1,       /* \d */
+    S_ESC_D2,       /* \dd */
+    S_ESC_CTRL,     /* \^ */
+    S_ESC_GAP,      /* \ followed by formatting characters */
+
+    A_FIRST,
+    A_EOF = A_FIRST,
+    A_IDENT,
+    A_INT,
+    A_PUNCT,
+    A_DIVIDE,
+    A_COMMENT,
+    A_LT,
+    A_LE,
+    A_NEQ,
+    A_GT,
+    A_GE,
+    A_COLON,
+    A_ASSIGN,
+    A_STRING,
+    A_STRING_X,
+    A_BADCHAR,
+    A_BADESC,
+    A_UNTERM,
+    A_COUNT
+};
+
+static const uint8_t accept_consumes[A_COUNT] = {
+    [A_PUNCT] = 1, [A_COMMENT] = 1, [A_LE] = 1, [A_NEQ] = 1, [A_GE] = 1,
+    [A_ASSIGN] = 1, [A_STRING] = 1, [A_STRING_X] = 1, [A_BADCHAR] = 1,
+    [A_BADESC] = 1,
+};
+
+#define ALL(s) [0 ... CC_COUNT - 1] = (s)
+
+static const uint8_t lex_trans[A_FIRST][CC_COUNT] = {
+    [S_START] = {
+        ALL(A_BADCHAR),
+        [CC_NUL] = A_EOF,
+        [CC_WS] = S_START, [CC_NL] = S_START,
+        [CC_ALPHA] = S_IDENT, [CC_N] = S_IDENT, [CC_T] = S_IDENT,
+        [CC_DIGIT] = S_INT,
+        [CC_QUOTE] = S_STR,
+        [CC_SLASH] = S_SLASH,
+        [CC_STAR] = A_PUNCT, [CC_EQ] = A_PUNCT, [CC_PUNCT] = A_PUNCT,
+        [CC_LT] = S_LT,
+        [CC_GT] = S_GT,
+        [CC_COLON] = S_COLON,
+    },
+    [S_IDENT] = {
+        ALL(A_IDENT),
+        [CC_ALPHA] = S_IDENT, [CC_N] = S_IDENT, [CC_T] = S_IDENT,
+        [CC_DIGIT] = S_IDENT, [CC_UNDER] = S_IDENT,
+    },
+    [S_INT] = { ALL(A_INT), [CC_DIGIT] = S_INT },
+    [S_SLASH] = { ALL(A_DIVIDE), [CC_STAR] = A_COMMENT },
+    [S_LT] = { ALL(A_LT), [CC_EQ] = A_LE, [CC_GT] = A_NEQ },
+    [S_GT] = { ALL(A_GT), [CC_EQ] = A_GE },
+    [S_COLON] = { ALL(A_COLON), [CC_EQ] = A_ASSIGN },
+    [S_STR] = {
+        ALL(S_STR),
+        [CC_NUL] = A_UNTERM, [CC_QUOTE] = A_STRING, [CC_BSLASH] = S_ESC,
+    },
+    [S_STR_X] = {
+        ALL(S_STR_X),
+        [CC_NUL] = A_UNTERM, [CC_QUOTE] = A_STRING_X, [CC_BSLASH] = S_ESC,
+    },
+    [S_ESC] = {
+        ALL(A_BADESC),
+        [CC_NUL] = A_UNTERM,
+        [CC_N] = S_STR_X, [CC_T] = S_STR_X, [CC_QUOTE] = S_STR_X,
+        [CC_BSLASH] = S_STR_X,
+        [CC_DIGIT] = S_ESC_D1,
+        [CC_CARET] = S_ESC_CTRL,
+        [CC_WS] = S_ESC_GAP, [CC_NL] = S_ESC_GAP,
+    },
+    [S_ESC_D1] = { ALL(A_BADESC), [CC_NUL] = A_UNTERM, [CC_DIGIT] = S_ESC_D2 },
+    [S_ESC_D2] = { ALL(A_BADESC), [CC_NUL] = A_UNTERM, [CC_DIGIT] = S_STR_X },
+    [S_ESC_CTRL] = { ALL(S_STR_X), [CC_NUL] = A_UNTERM },
+    [S_ESC_GAP] = {
+        ALL(A_BADESC),
+        [CC_NUL] = A_UNTERM,
+        [CC_WS] = S_ESC_GAP, [CC_NL] = S_ESC_GAP,
+        [CC_BSLASH] = S_STR_X,
+    },
+};
+
+/* Comment scanner: CM_OPEN and CM_CLOSE are actions on the depth counter
+   that fall back into CM_BODY. */
+enum { CM_BODY, CM_STAR, CM_SLASH, CM_OPEN, CM_CLOSE, CM_EOF };
+enum { CMC_OTHER, CMC_SLASH, CMC_STAR, CMC_NUL };
+
+static const uint8_t comment_class[256] = {
+    ['\0'] = CMC_NUL, ['/'] = CMC_SLASH, ['*'] = CMC_STAR,
+};
+
+static const uint8_t comment_trans[3][4] = {
+    [CM_BODY]  = { CM_BODY, CM_SLASH, CM_STAR, CM_EOF },
+    [CM_STAR]  = { CM_BODY, CM_CLOSE, CM_STAR, CM_EOF },
+    [CM_SLASH] = { CM_BODY, CM_SLASH, CM_OPEN, CM_EOF },
+};
+
+void lexer_init(Lexer *lx, Source *src)
+{
+    lx->src = src;
+    lx->p = src->data;
+    lx->end = src->data + src->len;
+    lx->buf = NULL;
+    lx->buf_cap = 0;
+}
+
+void lexer_free(Lexer *lx)
+{
+    free(lx->buf);
+    lx->buf = NULL;
+    lx->buf_cap = 0;
+}
+
+static uint32_t offset_of(const Lexer *lx, const char *p)
+{
+    return (uint32_t)(p - lx->src->data);
+}
+
+/* Skip a comment whose opener ends just before `p`.  Returns the
+   position after the matching close, or NULL at end of input. */
+static const char *skip_comment(Lexer *lx, const char *p)
+{
+    uint32_t depth = 1;
+    unsigned st = CM_BODY;
+    for (;;) {
+        st = comment_trans[st][comment_class[(uint8_t)*p]];
+        p++;
+        if (st < CM_OPEN)
+            continue;
+        if (st == CM_CLOSE) {
+            if (--depth == 0)
+                return p;
+        } else if (st == CM_OPEN) {
+            depth++;
+        } else if (p - 1 == lx->end) {
+            return NULL;
+        }
+        st = CM_BODY;
+    }
+}
+
+/* Decode the body of a string literal and intern the result.  The DFA
+   has already reported malformed escapes; those decode as the bytes
+   written so the literal still gets a value. */
+static Symbol intern_escaped(Lexer *lx, const char *s, const char *end)
+{
+    if (lx->buf_cap < (uint32_t)(end - s)) {
+        lx->buf_cap = (uint32_t)(end - s) + 64;
+        lx->buf = xrealloc(lx->buf, lx->buf_cap);
+    }
+    char *out = lx->buf;
+    while (s < end) {
+        if (*s != '\\' || s + 1 == end) {
+            *out++ = *s++;
+            continue;
+        }
+        s++;
+        switch (char_class[(uint8_t)*s]) {
+        case CC_N: *out++ = '\n'; s++; break;
+        case CC_T: *out++ = '\t'; s++; break;
+        case CC_QUOTE:
+        case CC_BSLASH: *out++ = *s++; break;
+        case CC_CARET:
+            s++;
+            if (s < end) {
+                *out++ = (char)(*s == '?' ? 127 : (*s & 0x1f));
+                s++;
+            }
+            break;
+        case CC_DIGIT: {
+            const char *d = s;
+            int v = 0;
+            while (s < end && s - d < 3 && char_class[(uint8_t)*s] == CC_DIGIT)
+                v = v * 10 + (*s++ - '0');
+            if (v > 255)
+                diag_error(lx->src, offset_of(lx, d - 1), "character code %d out of range", v);
+            *out++ = (char)v;
+            break;
+        }
+        case CC_WS:
+        case CC_NL:
+            /* \f___f\ gap: formatting characters between backslashes */
+            while (s < end && *s != '\\')
+                s++;
+            if (s < end)
+                s++;
+            break;
+        default:
+            *out++ = *s++;
+            break;
+        }
+    }
+    return sym_intern_n(lx->buf, (uint32_t)(out - lx->buf));
+}
+
+static uint32_t int_value(Lexer *lx, const char *s, const char *end)
+{
+    uint64_t v = 0;
+    for (const char *q = s; q < end; q++) {
+        v = v * 10 + (uint64_t)(*q - '0');
+        if (v > INT32_MAX) {
+            diag_error(lx->src, offset_of(lx, s), "integer literal too large");
+            return 0;
+        }
+    }
+    return (uint32_t)v;
+}
+
+TokKind lexer_next(Lexer *lx, Token *tok)
+{
+    const char *p = lx->p;
+    const char *start;
+    unsigned st;
+
+restart:
+    start = p;
+    st = S_START;
+resume:
+    for (;;) {
+        unsigned next = lex_trans[st][char_class[(uint8_t)*p]];
+        if (next >= A_FIRST) {
+            st = next;
+            break;
+        }
+        p++;
+        if (next == S_START)
+            start = p;
+        st = next;
+    }
+    if (accept_consumes[st])
+        p++;
+
+    TokKind kind;
+    uint16_t flags = 0;
+    uint32_t value = 0;
+    switch (st) {
+    case A_EOF:
+        if (p != lx->end) {
+            diag_error(lx->src, offset_of(lx, p), "illegal NUL character");
+            p++;
+            goto restart;
+        }
+        kind = TOK_EOF;
+        break;
+    case A_IDENT: {
+        uint32_t n = (uint32_t)(p - start);
+        Symbol sym = sym_intern_hashed(start, n, sym_hash(start, n));
+        if (sym <= SYM_NKEYWORDS) {
+            kind = TOK_ARRAY + (sym - 1);
+        } else {
+            kind = TOK_ID;
+            value = sym;
+        }
+        break;
+    }
+    case A_INT:
+        kind = TOK_INT;
+        value = int_value(lx, start, p);
+        break;
+    case A_PUNCT:
+        kind = punct_kind[(uint8_t)p[-1]];
+        break;
+    case A_DIVIDE: kind = TOK_DIVIDE; break;
+    case A_LT:     kind = TOK_LT; break;
+    case A_LE:     kind = TOK_LE; break;
+    case A_NEQ:    kind = TOK_NEQ; break;
+    case A_GT:     kind = TOK_GT; break;
+    case A_GE:     kind = TOK_GE; break;
+    case A_COLON:  kind = TOK_COLON; break;
+    case A_ASSIGN: kind = TOK_ASSIGN; break;
+    case A_STRING:
+        kind = TOK_STRING;
+        value = sym_intern_n(start + 1, (uint32_t)(p - start) - 2);
+        break;
+    case A_STRING_X:
+        kind = TOK_STRING;
+        flags = TF_ESCAPED;
+        value = intern_escaped(lx, start + 1, p - 1);
+        break;
+    case A_COMMENT: {
+        const char *q = skip_comment(lx, p);
+        if (!q) {
+            diag_error(lx->src, offset_of(lx, start), "unterminated comment");
+            p = lx->end;
+        } else {
+            p = q;
+        }
+        goto restart;
+    }
+    case A_BADCHAR:
+        diag_error(lx->src, offset_of(lx, p - 1), "illegal character '%c'",
+                   (p[-1] >= 32 && p[-1] < 127) ? p[-1] : '?');
+        goto restart;
+    case A_BADESC:
+        diag_error(lx->src, offset_of(lx, p - 1), "invalid escape sequence in string");
+        st = S_STR_X;
+        goto resume;
+    case A_UNTERM:
+        if (p != lx->end) {
+            diag_error(lx->src, offset_of(lx, p), "illegal NUL character in string");
+            p++;
+            st = S_STR_X;
+            goto resume;
+        }
+        diag_error(lx->src, offset_of(lx, start), "unterminated string");
+        kind = TOK_STRING;
+        flags = TF_ESCAPED;
+        value = SYM_NONE;
+        break;
+    default:
+        fatal("lexer: bad accept state %u", st);
+    }
+
+    lx->p = p;
+    tok->kind = (uint16_t)kind;
+    tok->flags = flags;
+    tok->offset = offset_of(lx, start);
+    tok->length = (uint32_t)(p - start);
+    tok->value = value;
+    return kind;
+}
+
+void lex_all(Source *src, TokenVec *out)
+{
+    Lexer lx;
+    lexer_init(&lx, src);
+    /* Tiger averages well over four bytes per token. */
+    vec_reserve(out, src->len / 4 + 2);
+    Token tok;
+    do {
+        lexer_next(&lx, &tok);
+        vec_push(out, tok);
+    } while (tok.kind != TOK_EOF);
+    lexer_free(&lx);
+}
@@ -0,0 +1,30 @@
+#ifndef TIGER_LEXER_H
+#define TIGER_LEXER_H
+
+#include "source.h"
+#include "token.h"
+
+typedef struct Lexer {
+    Source *src;
+    const char *p;
+    const char *end;
+
+    /* Scratch space for decoding string literals with escapes. */
+    char *buf;
+    uint32_t buf_cap;
+} Lexer;
+
+/* Identifiers and string literals are interned as they are scanned, so
+   symtab_init() must have been called. */
+void lexer_init(Lexer *lx, Source *src);
+void lexer_free(Lexer *lx);
+
+/* Scan the next token into `tok`.  Lexical errors are reported through
+   diag_error() and the offending bytes skipped; TOK_EOF is returned at
+   the end of input and on every call after it. */
+TokKind lexer_next(Lexer *lx, Token *tok);
+
+/* Tokenize the whole source into `out`, terminated by a TOK_EOF token. */
+void lex_all(Source *src, TokenVec *out);
+
+#endif
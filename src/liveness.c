@@ -0,0 +1,155 @@
+#include "liveness.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static bool ends_block(const Instr *in)
+{
+    return in->njump || (in->flags & IF_JUMP);
+}
+
+static void find_blocks(Flow *f, const InstrList *code)
+{
+    VEC(uint32_t) start = {0};
+    for (uint32_t i = 0; i < code->len; i++)
+        if (i == 0 || code->data[i].kind == I_LABEL || ends_block(&code->data[i - 1]))
+            vec_push(&start, i);
+    vec_push(&start, code->len);
+    f->nblocks = start.len - 1;
+    f->start = start.data;
+
+    IdMap at = {0};
+    for (uint32_t b = 0; b < f->nblocks; b++) {
+        const Instr *first = &code->data[f->start[b]];
+        if (first->kind == I_LABEL)
+            idmap_put(&at, first->label, b);
+    }
+    f->succ = xcalloc(f->nblocks ? f->nblocks : 1, sizeof *f->succ);
+    f->nsucc = xcalloc(f->nblocks ? f->nblocks : 1, sizeof *f->nsucc);
+    for (uint32_t b = 0; b < f->nblocks; b++) {
+        const Instr *last = &code->data[f->start[b + 1] - 1];
+        for (uint32_t k = 0; k < last->njump; k++) {
+            uint32_t s = idmap_get(&at, last->jump[k], UINT32_MAX);
+            if (s != UINT32_MAX && f->nsucc[b] < 2)
+                f->succ[b][f->nsucc[b]++] = s;
+        }
+        if (!(last->flags & IF_JUMP) && b + 1 < f->nblocks && f->nsucc[b] < 2)
+            f->succ[b][f->nsucc[b]++] = b + 1;
+    }
+    idmap_free(&at);
+
+    /* A jump back to an earlier block closes a loop over the blocks in
+       between: add one level of depth to each, through differences. */
+    int32_t *diff = xcalloc(f->nblocks + 1, sizeof *diff);
+    for (uint32_t b = 0; b < f->nblocks; b++)
+        for (uint32_t k = 0; k < f->nsucc[b]; k++)
+            if (f->succ[b][k] <= b) {
+                diff[f->succ[b][k]]++;
+                diff[b + 1]--;
+            }
+    f->depth = xmalloc((f->nblocks ? f->nblocks : 1) * sizeof *f->depth);
+    int32_t d = 0;
+    for (uint32_t b = 0; b < f->nblocks; b++) {
+        d += diff[b];
+        f->depth[b] = (uint32_t)d;
+    }
+    free(diff);
+}
+
+void flow_build(Flow *f, const InstrList *code, uint32_t ntemps, uint32_t exit_live)
+{
+    memset(f, 0, sizeof *f);
+    f->ntemps = ntemps;
+    find_blocks(f, code);
+    uint32_t nb = f->nblocks;
+
+    /* Number the global temps: registers first, then every temp read
+       before being written in some block. */
+    uint32_t *gid = xmalloc(ntemps * sizeof *gid);
+    uint32_t *stamp = xcalloc(ntemps, sizeof *stamp);
+    memset(gid, 0xff, ntemps * sizeof *gid);
+    VEC(uint32_t) global = {0};
+    for (Temp r = 0; r < TEMP_NREGS; r++) {
+        gid[r] = r;
+        vec_push(&global, r);
+    }
+    for (uint32_t b = 0; b < nb; b++) {
+        for (uint32_t i = f->start[b]; i < f->start[b + 1]; i++) {
+            const Instr *in = &code->data[i];
+            for (uint32_t k = 0; k < in->nsrc; k++) {
+                Temp t = in->src[k];
+                if (stamp[t] != b + 1 && gid[t] == UINT32_MAX) {
+                    gid[t] = global.len;
+                    vec_push(&global, t);
+                }
+            }
+            for (uint32_t k = 0; k < in->ndst; k++)
+                stamp[in->dst[k]] = b + 1;
+        }
+    }
+    f->nglobal = global.len;
+    f->global = global.data;
+    uint32_t w = f->gwords = bs_words(f->nglobal);
+
+    BitWord *gen = xcalloc((size_t)nb * w + 1, sizeof *gen);
+    BitWord *kill = xcalloc((size_t)nb * w + 1, sizeof *kill);
+    BitWord *in = xcalloc((size_t)nb * w + 1, sizeof *in);
+    f->live_out = xcalloc((size_t)nb * w + 1, sizeof *f->live_out);
+    for (uint32_t b = 0; b < nb; b++) {
+        BitWord *g = &gen[(size_t)b * w], *k = &kill[(size_t)b * w];
+        for (uint32_t i = f->start[b]; i < f->start[b + 1]; i++) {
+            const Instr *ins = &code->data[i];
+            for (uint32_t j = 0; j < ins->nsrc; j++) {
+                uint32_t x = gid[ins->src[j]];
+                if (x != UINT32_MAX && !bs_has(k, x))
+                    bs_add(g, x);
+            }
+            for (uint32_t j = 0; j < ins->ndst; j++) {
+                uint32_t x = gid[ins->dst[j]];
+                if (x != UINT32_MAX)
+                    bs_add(k, x);
+            }
+        }
+    }
+
+    /* Backward dataflow, sweeping the blocks in reverse layout order
+       until nothing changes. */
+    for (bool changed = true; changed;) {
+        changed = false;
+        for (uint32_t b = nb; b-- > 0;) {
+            BitWord *out = &f->live_out[(size_t)b * w];
+            if (!f->nsucc[b])
+                out[0] |= exit_live;
+            for (uint32_t s = 0; s < f->nsucc[b]; s++) {
+                const BitWord *si = &in[(size_t)f->succ[b][s] * w];
+                for (uint32_t j = 0; j < w; j++)
+                    out[j] |= si[j];
+            }
+            BitWord *bi = &in[(size_t)b * w];
+            const BitWord *g = &gen[(size_t)b * w], *k = &kill[(size_t)b * w];
+            for (uint32_t j = 0; j < w; j++) {
+                BitWord x = g[j] | (out[j] & ~k[j]);
+                if (x != bi[j]) {
+                    bi[j] = x;
+                    changed = true;
+                }
+            }
+        }
+    }
+
+    free(gen);
+    free(kill);
+    free(in);
+    free(gid);
+    free(stamp);
+}
+
+void flow_free(Flow *f)
+{
+    free(f->start);
+    free(f->succ);
+    free(f->nsucc);
+    free(f->depth);
+    free(f->global);
+    free(f->live_out);
+}
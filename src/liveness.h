@@ -0,0 +1,47 @@
+#ifndef TIGER_LIVENESS_H
+#define TIGER_LIVENESS_H
+
+#include "assem.h"
+
+/*
+ * Control flow and liveness over the instructions of one function,
+ * whose temps have been renumbered densely: 0 .. TEMP_NREGS-1 are the
+ * machine registers, the rest up to `ntemps` the function's own.
+ *
+ * Only a temp read in some block before any write there can be live
+ * across a block boundary.  Those "global" temps, and the registers,
+ * get numbers of their own, and the per-block sets are kept over them
+ * alone; temps used within one block cost nothing here.
+ */
+
+typedef uint64_t BitWord;
+
+static inline uint32_t bs_words(uint32_t n) { return (n + 63) / 64; }
+static inline bool bs_has(const BitWord *s, uint32_t i) { return s[i / 64] >> (i % 64) & 1; }
+static inline void bs_add(BitWord *s, uint32_t i) { s[i / 64] |= (BitWord)1 << (i % 64); }
+static inline void bs_del(BitWord *s, uint32_t i) { s[i / 64] &= ~((BitWord)1 << (i % 64)); }
+
+typedef struct Flow {
+    uint32_t nblocks;
+    uint32_t *start;        /* block b is instructions start[b] .. start[b+1]-1 */
+    uint32_t (*succ)[2];
+    uint8_t *nsucc;
+    uint32_t *depth;        /* loop nesting depth of each block */
+
+    uint32_t ntemps;
+    uint32_t nglobal, gwords;
+    uint32_t *global;       /* global number -> temp; registers are 0 .. */
+    BitWord *live_out;      /* [block * gwords], over global numbers */
+} Flow;
+
+/* `exit_live` is the set of registers live where the function returns
+   (bit r for register r). */
+void flow_build(Flow *f, const InstrList *code, uint32_t ntemps, uint32_t exit_live);
+void flow_free(Flow *f);
+
+static inline const BitWord *flow_live_out(const Flow *f, uint32_t b)
+{
+    return &f->live_out[(size_t)b * f->gwords];
+}
+
+#endif
@@ -0,0 +1,622 @@
+#include <errno.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "ast.h"
+#include "canon.h"
+#include "closure.h"
+#include "codegen.h"
+#include "daemon.h"
+#include "diag.h"
+#include "emit.h"
+#include "escape.h"
+#include "lexer.h"
+#include "opt.h"
+#include "parser.h"
+#include "phase.h"
+#include "pool.h"
+#include "regalloc.h"
+#include "semant.h"
+#include "source.h"
+#include "symbol.h"
+#include "translate.h"
+#include "vm.h"
+
+typedef enum Mode {
+    MODE_LEX,
+    MODE_PARSE,
+    MODE_CHECK,
+    MODE_DUMP_AST,
+    MODE_DUMP_ESCAPES,
+    MODE_DUMP_CLOSURES,
+    MODE_DUMP_TREE,
+    MODE_DUMP_SSA,
+    MODE_DUMP_CANON,
+    MODE_DUMP_ASM,
+    MODE_ASM,
+    MODE_EXE,
+    MODE_RUN,
+} Mode;
+
+/* Settings from the command line that apply to every input file. */
+typedef struct Options {
+    Mode mode;
+    ParseMode parse_mode;
+    EnvKind env_kind;
+    bool time_report, mem_report;
+    int opt;
+    RegAllocKind ra;
+    InlineParams inl;
+    bool profile;           /* -pg */
+    const Profile *use;     /* -fprofile-use, or NULL */
+    Cache *cache;           /* -fcache, or NULL */
+} Options;
+
+extern char **environ;
+
+static void usage(FILE *out)
+{
+    fputs("usage: tigerc [options] file.tig...\n"
+          "       tigerc --daemon[=SOCKET] [options]\n"
+          "  -o FILE             compile and link an executable\n"
+          "  -S                  write assembly (to -o FILE, or stdout; to NAME.s\n"
+          "                      for each of several files)\n"
+          "  -j N                compile up to N files at once\n"
+          "  --run               interpret the program instead of compiling it\n"
+          "  --lex               print the token stream\n"
+          "  --parse             check syntax only\n"
+          "  --check             parse and type-check\n"
+          "  --dump-ast          print the syntax tree\n"
+          "  --dump-escapes      print which variables escape\n"
+          "  --dump-closures     print free variables and static links\n"
+          "  --dump-tree         print the Tree IR of every function\n"
+          "  --dump-ssa          print the SSA IR after each pass (at least -O1)\n"
+          "  --dump-canon        print the canonical trees after optimization\n"
+          "  --dump-asm          print the assembly after register allocation\n"
+          "  -O0, -O1, -O2       optimization level (default 0)\n"
+          "  -fparser=MODE       auto (default), recursive or explicit\n"
+          "  -fenv=KIND          undo (default) or hamt scope environments\n"
+          "  -fregalloc=KIND     linear (default below -O2) or irc\n"
+          "  -finline-limit=N    inline functions of up to N instructions at -O2\n"
+          "  -finline-growth=P   let inlining grow the program by P percent\n"
+          "  -fmax-errors=N      stop reporting after N errors (0: no limit)\n"
+          "  -fcache=FILE        reuse the code of unchanged files, and the back\n"
+          "                      end's work on unchanged functions, from FILE\n"
+          "  -ftime-report       print the time spent in each phase\n"
+          "  -fmem-report        print memory use per phase\n"
+          "  -ftrace=FILE        write a Chrome trace of the phases and functions\n"
+          "  -pg                 count calls and sample lines when the program runs\n"
+          "  -fprofile-use=FILE  lay out, inline and allocate registers after\n"
+          "                      the profile FILE of a -pg run\n"
+          "  --daemon[=SOCKET]   stay resident and answer check requests on the\n"
+          "                      Unix socket SOCKET, or on stdin\n"
+          "  -h, --help          show this help\n",
+          out);
+}
+
+static void dump_tokens(Source *src, const TokenVec *toks, FILE *out)
+{
+    for (uint32_t i = 0; i < toks->len; i++) {
+        const Token *t = &toks->data[i];
+        uint32_t line, col;
+        source_position(src, t->offset, &line, &col);
+        fprintf(out, "%u:%u %s", line, col, token_names[t->kind]);
+        if (t->kind == TOK_ID || t->kind == TOK_STRING)
+            fprintf(out, " %.*s #%u", (int)t->length, src->data + t->offset, t->value);
+        else if (t->kind == TOK_INT)
+            fprintf(out, " %u", t->value);
+        fputc('\n', out);
+    }
+}
+
+/* Select instructions for every function and allocate registers. */
+static void dump_asm(Program *p, RegAllocKind ra, FILE *out)
+{
+    for (uint32_t i = 0; i < p->frags.len; i++) {
+        Frag *f = &p->frags.data[i];
+        if (f->kind != FRAG_PROC)
+            continue;
+        const FunEntry *fun = f->u.proc.fun;
+        bool value = fun && type_actual(fun->result)->kind != TK_UNIT;
+        InstrList code = {0};
+        Phase prev = phase_enter(PHASE_ISEL);
+        codegen(&p->arena, f->u.proc.frame, f->u.proc.body, &code);
+        phase_enter(PHASE_REGALLOC);
+        RegAllocStats st = regalloc(&p->arena, f->u.proc.frame, &code, ra, value);
+        phase_enter(prev);
+        fputs("proc ", out);
+        label_print(f->label, out);
+        fprintf(out, " frame %d  # spilled %u, coalesced %u, rounds %u\n",
+                f->u.proc.frame->locals, st.spilled, st.moves, st.rounds);
+        instr_list_print(&code, out);
+        vec_free(&code);
+    }
+}
+
+/* Assemble `asm_path` and link it with the runtime into `out`, with $CC
+   (default cc). */
+static bool link_program(const char *asm_path, const char *out, FILE *err)
+{
+    const char *cc = getenv("CC");
+    const char *rt = getenv("TIGER_RUNTIME");
+    char *argv[] = { (char *)(cc && *cc ? cc : "cc"), "-o", (char *)out, (char *)asm_path,
+                     (char *)(rt && *rt ? rt : TIGER_RUNTIME), NULL };
+    pid_t pid;
+    int status;
+    if (posix_spawnp(&pid, argv[0], NULL, NULL, argv, environ) != 0) {
+        fprintf(err, "tigerc: cannot run '%s': %s\n", argv[0], strerror(errno));
+        return false;
+    }
+    if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status)) {
+        fprintf(err, "tigerc: %s failed\n", argv[0]);
+        return false;
+    }
+    return true;
+}
+
+/* What to write: the assembly of a whole file found in the code cache,
+   or a program to generate it for, caching it under `key` if set. */
+typedef struct Asm {
+    Program *prog;
+    const char *text;
+    uint32_t len;
+    const CacheKey *key;
+} Asm;
+
+static void emit_asm(const Asm *a, const Options *o, FILE *f)
+{
+    /* A whole file's text mentions no label from outside it. */
+    static const CacheLabels none;
+    if (a->text) {
+        cache_print(a->text, a->len, &none, f);
+        return;
+    }
+    if (!a->key) {
+        emit_program(a->prog, o->ra, o->cache, f);
+        return;
+    }
+    char *buf;
+    size_t len;
+    FILE *m = open_memstream(&buf, &len);
+    if (!m)
+        fatal("cannot buffer output: %s", strerror(errno));
+    emit_program(a->prog, o->ra, o->cache, m);
+    fclose(m);
+    fwrite(buf, 1, len, f);
+    cache_add(o->cache, a->key, buf, len, &none);
+    free(buf);
+}
+
+/* Assembly goes to `stdout_` when there is no output file. */
+static bool write_output(const Asm *a, const Options *o, const char *out, FILE *stdout_,
+                         FILE *err)
+{
+    Mode mode = o->mode;
+    if (mode == MODE_ASM && !out) {
+        emit_asm(a, o, stdout_);
+        return true;
+    }
+    char tmp[] = "/tmp/tigerXXXXXX.s";
+    const char *path = mode == MODE_ASM ? out : tmp;
+    FILE *f;
+    if (mode == MODE_ASM) {
+        f = fopen(path, "w");
+    } else {
+        int fd = mkstemps(tmp, 2);
+        f = fd < 0 ? NULL : fdopen(fd, "w");
+    }
+    if (!f) {
+        fprintf(err, "tigerc: cannot write '%s': %s\n", path, strerror(errno));
+        return false;
+    }
+    emit_asm(a, o, f);
+    bool ok = fclose(f) == 0;
+    if (ok && mode == MODE_EXE)
+        ok = link_program(path, out, err);
+    if (mode == MODE_EXE)
+        unlink(path);
+    return ok;
+}
+
+/* The code cache key of `src` compiled as a whole, if its assembly can
+   be cached: it depends on nothing but the text, the path it names in
+   error messages and the code generation settings. */
+static bool file_key(const Options *o, const Source *src, CacheKey *k)
+{
+    if (!o->cache || o->profile || o->use)
+        return false;
+    uint64_t salt = (uint64_t)o->opt | (uint64_t)o->ra << 4 | (uint64_t)o->inl.limit << 8 |
+                    (uint64_t)o->inl.growth << 36;
+    cache_file_key(src->path, src->data, src->len, salt, k);
+    return true;
+}
+
+/* Everything after parsing. */
+static bool compile(Ast *ast, const Options *o, const CacheKey *key, const char *out_path,
+                    FILE *out, FILE *err)
+{
+    bool ok = true;
+    Mode mode = o->mode;
+    Sema sema;
+    phase_enter(PHASE_SEMANT);
+    if (!sema_check(&sema, ast, o->env_kind) || mode == MODE_CHECK)
+        goto done;
+    phase_enter(PHASE_ESCAPE);
+    escape_find(&sema);
+    if (mode == MODE_DUMP_ESCAPES) {
+        escape_dump(&sema, out);
+        goto done;
+    }
+    closure_convert(&sema, mode == MODE_DUMP_CLOSURES ? out : NULL);
+    if (mode == MODE_DUMP_CLOSURES)
+        goto done;
+
+    Program prog;
+    phase_enter(PHASE_IR);
+    temp_reset();
+    translate_program(&prog, &sema, o->profile, o->use);
+    if (mode == MODE_DUMP_TREE) {
+        program_dump(&prog, out);
+    } else {
+        opt_program(&prog, mode == MODE_DUMP_SSA && !o->opt ? 1 : o->opt, &o->inl,
+                    mode == MODE_DUMP_SSA ? out : NULL);
+        if (mode == MODE_DUMP_CANON)
+            program_dump(&prog, out);
+        else if (mode == MODE_DUMP_ASM)
+            dump_asm(&prog, o->ra, out);
+        else if (mode == MODE_ASM || mode == MODE_EXE)
+            ok = write_output(&(Asm){ .prog = &prog, .key = key }, o, out_path, out, err);
+        else if (mode == MODE_RUN) {
+            phase_enter(PHASE_OTHER);
+            vm_run(&prog);
+        }
+    }
+    phase_enter(PHASE_OTHER);
+    program_free(&prog);
+
+done:
+    phase_enter(PHASE_OTHER);
+    sema_free(&sema);
+    return ok;
+}
+
+/* Compile one file, writing what would go to stdout and stderr to `out`
+   and `err`.  Returns the exit status for it. */
+static int compile_file(const Options *o, const char *path, const char *out_path, FILE *out,
+                        FILE *err)
+{
+    Source src;
+    if (!source_open(&src, path)) {
+        fprintf(err, "tigerc: cannot open '%s': %s\n", path, strerror(errno));
+        return 2;
+    }
+
+    /* An unchanged file is not even lexed. */
+    CacheKey key;
+    bool keyed = file_key(o, &src, &key);
+    uint32_t len;
+    const char *text = keyed ? cache_find(o->cache, &key, 0, &len) : NULL;
+    if (text) {
+        bool ok = write_output(&(Asm){ .text = text, .len = len }, o, out_path, out, err);
+        source_close(&src);
+        return ok ? 0 : 1;
+    }
+
+    uint64_t t = trace_open();
+    phase_reset();
+    symtab_init();
+    int errors = diag_errors;
+    bool failed = false;
+    TokenVec toks = {0};
+    phase_enter(PHASE_LEX);
+    lex_all(&src, &toks);
+    phase_enter(PHASE_OTHER);
+    if (o->mem_report)
+        fprintf(err, "lex: %u tokens, %zu bytes\n", toks.len, (size_t)toks.cap * sizeof(Token));
+    if (o->mode == MODE_LEX) {
+        dump_tokens(&src, &toks, out);
+        goto done;
+    }
+    if (diag_errors > errors)
+        goto done;
+
+    Ast ast;
+    phase_enter(PHASE_PARSE);
+    ast_init(&ast, &src, toks.len);
+    bool parsed = parse_program(&ast, &toks, o->parse_mode);
+    phase_enter(PHASE_OTHER);
+    if (parsed) {
+        if (o->mem_report)
+            ast_mem_report(&ast, err);
+        if (o->mode == MODE_DUMP_AST)
+            ast_dump(&ast, out);
+        else if (o->mode != MODE_PARSE)
+            failed = !compile(&ast, o, keyed ? &key : NULL, out_path, out, err);
+    }
+    ast_free(&ast);
+
+done:
+    phase_enter(PHASE_OTHER);
+    diag_flush(err);
+    vec_free(&toks);
+    source_close(&src);
+    trace_close(path, t);
+    if (o->time_report || o->mem_report)
+        phase_report(err, path, o->time_report, o->mem_report);
+    return diag_errors > errors || failed ? 1 : 0;
+}
+
+/* One input file of several.  Its output is buffered, to be written in
+   command-line order whichever worker compiles it. */
+typedef struct Job {
+    const char *path;
+    char *asm_path;         /* for -S */
+    char *out, *err;
+    size_t out_len, err_len;
+    int status;
+} Job;
+
+typedef struct Batch {
+    const Options *opts;
+    Job *jobs;
+} Batch;
+
+static void run_job(void *ctx, uint32_t i, uint32_t worker)
+{
+    Batch *b = ctx;
+    Job *j = &b->jobs[i];
+    FILE *out = open_memstream(&j->out, &j->out_len);
+    FILE *err = open_memstream(&j->err, &j->err_len);
+    if (!out || !err)
+        fatal("cannot buffer output: %s", strerror(errno));
+    j->status = compile_file(b->opts, j->path, j->asm_path, out, err);
+    fclose(out);
+    fclose(err);
+}
+
+/* NAME.s in the current directory for NAME.tig anywhere. */
+static char *asm_name(const char *path)
+{
+    const char *base = strrchr(path, '/');
+    base = base ? base + 1 : path;
+    size_t n = strlen(base);
+    if (n > 4 && strcmp(base + n - 4, ".tig") == 0)
+        n -= 4;
+    char *s = xmalloc(n + 3);
+    memcpy(s, base, n);
+    memcpy(s + n, ".s", 3);
+    return s;
+}
+
+static int compile_files(const Options *o, const char **paths, uint32_t n, uint32_t nthreads)
+{
+    Job *jobs = xcalloc(n, sizeof *jobs);
+    for (uint32_t i = 0; i < n; i++) {
+        jobs[i].path = paths[i];
+        if (o->mode == MODE_ASM)
+            jobs[i].asm_path = asm_name(paths[i]);
+    }
+    Batch b = { o, jobs };
+    pool_run(nthreads, n, run_job, &b);
+
+    int status = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        Job *j = &jobs[i];
+        fwrite(j->out, 1, j->out_len, stdout);
+        fflush(stdout);
+        fwrite(j->err, 1, j->err_len, stderr);
+        if (j->status > status)
+            status = j->status;
+        free(j->out);
+        free(j->err);
+        free(j->asm_path);
+    }
+    free(jobs);
+    return status;
+}
+
+int main(int argc, char **argv)
+{
+    Mode mode = MODE_DUMP_AST;
+    bool mode_set = false;
+    const char *out = NULL;
+    ParseMode parse_mode = PARSE_AUTO;
+    EnvKind env_kind = ENV_UNDO;
+    bool time_report = false, mem_report = false, profile = false;
+    const char *trace_path = NULL;
+    int opt = 0;
+    int regalloc_kind = -1;
+    InlineParams inl = INLINE_DEFAULTS;
+    const char *cache_path = NULL, *profile_path = NULL;
+    const char *socket_path = NULL;
+    bool daemon_mode = false;
+    uint32_t nthreads = 1;
+    VEC(const char *) paths = {0};
+
+    for (int i = 1; i < argc; i++) {
+        const char *a = argv[i];
+        if (a[0] == '-' && a[1] == '-')
+            mode_set = true;
+        if (strcmp(a, "--lex") == 0) {
+            mode = MODE_LEX;
+        } else if (strcmp(a, "--parse") == 0) {
+            mode = MODE_PARSE;
+        } else if (strcmp(a, "--check") == 0) {
+            mode = MODE_CHECK;
+        } else if (strcmp(a, "--dump-ast") == 0) {
+            mode = MODE_DUMP_AST;
+        } else if (strcmp(a, "--dump-escapes") == 0) {
+            mode = MODE_DUMP_ESCAPES;
+        } else if (strcmp(a, "--dump-closures") == 0) {
+            mode = MODE_DUMP_CLOSURES;
+        } else if (strcmp(a, "--dump-tree") == 0) {
+            mode = MODE_DUMP_TREE;
+        } else if (strcmp(a, "--dump-ssa") == 0) {
+            mode = MODE_DUMP_SSA;
+        } else if (strcmp(a, "--dump-canon") == 0) {
+            mode = MODE_DUMP_CANON;
+        } else if (strcmp(a, "--dump-asm") == 0) {
+            mode = MODE_DUMP_ASM;
+        } else if (strcmp(a, "--run") == 0) {
+            mode = MODE_RUN;
+        } else if (strcmp(a, "-S") == 0) {
+            mode = MODE_ASM;
+            mode_set = true;
+        } else if (strcmp(a, "-o") == 0) {
+            if (++i == argc) {
+                fprintf(stderr, "tigerc: -o needs a file name\n");
+                return 2;
+            }
+            out = argv[i];
+        } else if (strncmp(a, "-j", 2) == 0) {
+            const char *v = a[2] ? a + 2 : ++i < argc ? argv[i] : "";
+            char *end;
+            unsigned long n = strtoul(v, &end, 10);
+            if (!*v || *end || n == 0 || n > 1024) {
+                fprintf(stderr, "tigerc: bad job count '%s'\n", v);
+                return 2;
+            }
+            nthreads = (uint32_t)n;
+        } else if (strcmp(a, "-O0") == 0 || strcmp(a, "-O1") == 0 || strcmp(a, "-O2") == 0) {
+            opt = a[2] - '0';
+        } else if (strncmp(a, "-fparser=", 9) == 0) {
+            if (strcmp(a + 9, "auto") == 0)
+                parse_mode = PARSE_AUTO;
+            else if (strcmp(a + 9, "recursive") == 0)
+                parse_mode = PARSE_RECURSIVE;
+            else if (strcmp(a + 9, "explicit") == 0)
+                parse_mode = PARSE_EXPLICIT;
+            else {
+                fprintf(stderr, "tigerc: unknown parser mode '%s'\n", a + 9);
+                return 2;
+            }
+        } else if (strncmp(a, "-fenv=", 6) == 0) {
+            if (strcmp(a + 6, "undo") == 0)
+                env_kind = ENV_UNDO;
+            else if (strcmp(a + 6, "hamt") == 0)
+                env_kind = ENV_HAMT;
+            else {
+                fprintf(stderr, "tigerc: unknown environment kind '%s'\n", a + 6);
+                return 2;
+            }
+        } else if (strncmp(a, "-fregalloc=", 11) == 0) {
+            if (strcmp(a + 11, "linear") == 0)
+                regalloc_kind = RA_LINEAR;
+            else if (strcmp(a + 11, "irc") == 0)
+                regalloc_kind = RA_IRC;
+            else {
+                fprintf(stderr, "tigerc: unknown register allocator '%s'\n", a + 11);
+                return 2;
+            }
+        } else if (strncmp(a, "-fmax-errors=", 13) == 0) {
+            char *end;
+            unsigned long n = strtoul(a + 13, &end, 10);
+            if (!a[13] || *end || n > UINT32_MAX) {
+                fprintf(stderr, "tigerc: bad error limit '%s'\n", a + 13);
+                return 2;
+            }
+            diag_limit = (uint32_t)n;
+        } else if (strncmp(a, "-finline-limit=", 15) == 0 ||
+                   strncmp(a, "-finline-growth=", 16) == 0) {
+            const char *v = strchr(a, '=') + 1;
+            char *end;
+            unsigned long n = strtoul(v, &end, 10);
+            if (!*v || *end || n > UINT32_MAX) {
+                fprintf(stderr, "tigerc: bad inlining limit '%s'\n", v);
+                return 2;
+            }
+            if (a[9] == 'l')
+                inl.limit = (uint32_t)n;
+            else
+                inl.growth = (uint32_t)n;
+        } else if (strncmp(a, "-fcache=", 8) == 0) {
+            if (!a[8]) {
+                fprintf(stderr, "tigerc: -fcache needs a file name\n");
+                return 2;
+            }
+            cache_path = a + 8;
+        } else if (strcmp(a, "-ftime-report") == 0) {
+            time_report = true;
+        } else if (strcmp(a, "-fmem-report") == 0) {
+            mem_report = true;
+        } else if (strncmp(a, "-ftrace=", 8) == 0) {
+            if (!a[8]) {
+                fprintf(stderr, "tigerc: -ftrace needs a file name\n");
+                return 2;
+            }
+            trace_path = a + 8;
+        } else if (strncmp(a, "-fprofile-use=", 14) == 0) {
+            if (!a[14]) {
+                fprintf(stderr, "tigerc: -fprofile-use needs a file name\n");
+                return 2;
+            }
+            profile_path = a + 14;
+        } else if (strcmp(a, "-pg") == 0) {
+            profile = true;
+        } else if (strcmp(a, "--daemon") == 0 || strncmp(a, "--daemon=", 9) == 0) {
+            if (a[8] && !a[9]) {
+                fprintf(stderr, "tigerc: --daemon= needs a socket name\n");
+                return 2;
+            }
+            daemon_mode = true;
+            socket_path = a[8] ? a + 9 : NULL;
+        } else if (strcmp(a, "-h") == 0 || strcmp(a, "--help") == 0) {
+            usage(stdout);
+            return 0;
+        } else if (a[0] == '-' && a[1]) {
+            fprintf(stderr, "tigerc: unknown option '%s'\n", a);
+            usage(stderr);
+            return 2;
+        } else {
+            vec_push(&paths, a);
+        }
+    }
+    if (daemon_mode) {
+        if (paths.len) {
+            fprintf(stderr, "tigerc: --daemon takes no input files\n");
+            return 2;
+        }
+        return daemon_run(socket_path, parse_mode, env_kind);
+    }
+    if (!paths.len) {
+        usage(stderr);
+        return 2;
+    }
+    if (out && !mode_set)
+        mode = MODE_EXE;
+    if (regalloc_kind < 0)
+        regalloc_kind = opt >= 2 ? RA_IRC : RA_LINEAR;
+    if (paths.len > 1 && out) {
+        fprintf(stderr, "tigerc: -o with more than one input file\n");
+        return 2;
+    }
+    if (paths.len > 1 && mode == MODE_RUN) {
+        fprintf(stderr, "tigerc: --run takes one input file\n");
+        return 2;
+    }
+
+    Profile use;
+    if (profile_path && !profile_read(&use, profile_path, stderr))
+        return 2;
+    if (trace_path)
+        trace_start();
+    Options o = { mode, parse_mode, env_kind, time_report, mem_report, opt,
+                  (RegAllocKind)regalloc_kind, inl, profile,
+                  profile_path ? &use : NULL,
+                  cache_path && (mode == MODE_ASM || mode == MODE_EXE) ? cache_open(cache_path)
+                                                                       : NULL };
+    int status = paths.len == 1 ? compile_file(&o, paths.data[0], out, stdout, stderr)
+                                : compile_files(&o, paths.data, paths.len, nthreads);
+    if (o.cache && !cache_close(o.cache) && !status)
+        status = 1;
+    if (trace_path && !trace_write(trace_path, stderr) && !status)
+        status = 1;
+    if (profile_path)
+        profile_free(&use);
+    vec_free(&paths);
+    return status;
+}
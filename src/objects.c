@@ -0,0 +1,644 @@
+#include "opt.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "frame.h"
+
+/* An instruction, and for a use which of its arguments. */
+typedef struct Use {
+    uint32_t block, ins, arg;
+} Use;
+
+/* Records of at most MAX_WORDS words, and arrays of at most that many
+   elements of constant length, are candidates; a function keeps at most
+   FRAME_WORDS words of them in its frame. */
+enum { MAX_WORDS = 16, FRAME_WORDS = 64 };
+
+static const int64_t UNKNOWN = INT64_MIN;
+
+/* One function of the program, with where its values are defined and
+   used.  Following an object marks the values that point into it with
+   `token`, each at offset `off` from it (UNKNOWN if not constant). */
+typedef struct Func {
+    IrFunc *f;
+    Use *def;               /* block IR_NONE for registers */
+    uint32_t *ustart;       /* uses of v: use[ustart[v] .. ustart[v+1]) */
+    Use *use;
+    uint32_t *seen;
+    int64_t *off;
+    uint32_t token;
+    Value param[FRAME_NARG_REGS];   /* IR_NONE if not read */
+    bool inert[FRAME_NARG_REGS];
+} Func;
+
+typedef struct Objects {
+    Func *funcs;
+    uint32_t n;
+    IdMap index;            /* Label -> position in `funcs` */
+    Symbol card_bias, alloc_record, init_array, init_ptr_array;
+} Objects;
+
+/* What follow() found out about an object, or about what a parameter
+   points to. */
+typedef struct Reach {
+    VEC(Use) mem;           /* loads and stores through it */
+    VEC(Use) cards;         /* card marks of stores into it */
+    VEC(Use) nils;          /* comparisons of it with 0, arg of the object */
+    bool compared;          /* with something other than 0 */
+    bool calls;             /* handed to inert parameters */
+    bool dynamic;           /* accessed at an offset not known */
+} Reach;
+
+static IrIns *ins_at(IrFunc *f, Use u)
+{
+    return &f->blocks.data[u.block].ins.data[u.ins];
+}
+
+static const IrIns *def_of(const Func *fn, Value v)
+{
+    if (v < TEMP_NREGS || fn->def[v].block == IR_NONE)
+        return NULL;
+    return ins_at(fn->f, fn->def[v]);
+}
+
+static bool const_of(const Func *fn, Value v, int64_t *k)
+{
+    const IrIns *d = def_of(fn, v);
+    if (!d || d->op != IR_CONST)
+        return false;
+    *k = d->u.value;
+    return true;
+}
+
+static bool is_const(const Func *fn, Value v, int64_t k)
+{
+    int64_t x;
+    return const_of(fn, v, &x) && x == k;
+}
+
+static uint32_t func_of(const Objects *o, Label l)
+{
+    return idmap_get(&o->index, l, IR_NONE);
+}
+
+static void func_scan(Func *fn)
+{
+    IrFunc *f = fn->f;
+    free(fn->def);
+    free(fn->ustart);
+    free(fn->use);
+    free(fn->seen);
+    free(fn->off);
+    fn->def = xmalloc(f->nvalues * sizeof *fn->def);
+    memset(fn->def, 0xff, f->nvalues * sizeof *fn->def);
+    fn->ustart = xcalloc(f->nvalues + 1, sizeof *fn->ustart);
+    fn->seen = xcalloc(f->nvalues, sizeof *fn->seen);
+    fn->off = xmalloc(f->nvalues * sizeof *fn->off);
+    fn->token = 0;
+    for (uint32_t b = 0; b < f->blocks.len; b++) {
+        const IrBlock *blk = &f->blocks.data[b];
+        for (uint32_t i = 0; i < blk->ins.len; i++) {
+            const IrIns *ins = &blk->ins.data[i];
+            if (ins->dst != IR_NONE && ins->dst >= TEMP_NREGS)
+                fn->def[ins->dst] = (Use){ b, i, 0 };
+            for (uint32_t k = 0; k < ins->nargs; k++)
+                fn->ustart[ins->args[k] + 1]++;
+        }
+    }
+    for (Value v = 0; v < f->nvalues; v++)
+        fn->ustart[v + 1] += fn->ustart[v];
+    fn->use = xmalloc((fn->ustart[f->nvalues] + 1) * sizeof *fn->use);
+    uint32_t *fill = xmalloc(f->nvalues * sizeof *fill);
+    memcpy(fill, fn->ustart, f->nvalues * sizeof *fill);
+    for (uint32_t b = 0; b < f->blocks.len; b++) {
+        const IrBlock *blk = &f->blocks.data[b];
+        for (uint32_t i = 0; i < blk->ins.len; i++)
+            for (uint32_t k = 0; k < blk->ins.data[i].nargs; k++)
+                fn->use[fill[blk->ins.data[i].args[k]]++] = (Use){ b, i, k };
+    }
+    free(fill);
+}
+
+static void func_free(Func *fn)
+{
+    free(fn->def);
+    free(fn->ustart);
+    free(fn->use);
+    free(fn->seen);
+    free(fn->off);
+}
+
+/* Whether `t = x >> k` starts the card mark of a store to x, as
+   heap_store() in translate.c writes it: M[M[tiger_card_bias] + (t &
+   -8)] = 1; if so the stores of the mark go to `cards`. */
+static bool card_mark(const Objects *o, const Func *fn, const IrIns *shift, Reach *r)
+{
+    int64_t k;
+    if (!const_of(fn, shift->args[1], &k) || shift->dst < TEMP_NREGS)
+        return false;
+    Value t = shift->dst;
+    for (uint32_t i = fn->ustart[t]; i < fn->ustart[t + 1]; i++) {
+        const IrIns *and = ins_at(fn->f, fn->use[i]);
+        if (and->op != IR_BINOP || and->sub != T_AND || !const_of(fn, and->args[1], &k) ||
+            and->dst < TEMP_NREGS)
+            return false;
+        for (uint32_t j = fn->ustart[and->dst]; j < fn->ustart[and->dst + 1]; j++) {
+            const IrIns *plus = ins_at(fn->f, fn->use[j]);
+            if (plus->op != IR_BINOP || plus->sub != T_PLUS || plus->dst < TEMP_NREGS)
+                return false;
+            const IrIns *bias = def_of(fn, plus->args[1 - fn->use[j].arg]);
+            const IrIns *name = bias && bias->op == IR_LOAD ? def_of(fn, bias->args[0]) : NULL;
+            if (!name || name->op != IR_NAME || label_sym(name->u.label) != o->card_bias)
+                return false;
+            for (uint32_t m = fn->ustart[plus->dst]; m < fn->ustart[plus->dst + 1]; m++) {
+                Use u = fn->use[m];
+                const IrIns *st = ins_at(fn->f, u);
+                if (st->op != IR_STORE || u.arg != 0 || !is_const(fn, st->args[1], 1))
+                    return false;
+                vec_push(&r->cards, u);
+            }
+        }
+    }
+    return true;
+}
+
+/* Follow the uses of `root`, an object allocated in `fn` or one of
+   its parameters, through the addresses computed from it.  It escapes,
+   and this returns false, if anything but loads, stores, card marks
+   and comparisons uses them or, for an object, a tail call takes it. */
+static bool follow(const Objects *o, Func *fn, Value root, bool param, Reach *r)
+{
+    memset(r, 0, sizeof *r);
+    uint32_t token = ++fn->token;
+    VEC(Value) work = {0};
+    fn->seen[root] = token;
+    fn->off[root] = 0;
+    vec_push(&work, root);
+    bool ok = true;
+    while (ok && work.len) {
+        Value x = work.data[--work.len];
+        for (uint32_t i = fn->ustart[x]; ok && i < fn->ustart[x + 1]; i++) {
+            Use u = fn->use[i];
+            const IrIns *ins = ins_at(fn->f, u);
+            switch ((IrOp)ins->op) {
+            case IR_LOAD:
+            case IR_STORE:
+                if (u.arg != 0) {
+                    ok = false;
+                    break;
+                }
+                vec_push(&r->mem, u);
+                r->dynamic |= fn->off[x] == UNKNOWN;
+                break;
+            case IR_CJUMP: {
+                Value other = ins->args[1 - u.arg];
+                if (x == root && is_const(fn, other, 0) &&
+                    (ins->sub == T_EQ || ins->sub == T_NE))
+                    vec_push(&r->nils, u);
+                else
+                    r->compared = true;
+                break;
+            }
+            case IR_BINOP: {
+                int64_t k;
+                if (ins->sub == T_RSHIFT && u.arg == 0 &&
+                    card_mark(o, fn, ins, r))
+                    break;
+                Value other = ins->args[1 - u.arg];
+                if ((ins->sub != T_PLUS && (ins->sub != T_MINUS || u.arg != 0)) ||
+                    fn->seen[other] == token || ins->dst < TEMP_NREGS) {
+                    ok = false;
+                    break;
+                }
+                Value d = ins->dst;
+                fn->seen[d] = token;
+                fn->off[d] = UNKNOWN;
+                if (fn->off[x] != UNKNOWN && const_of(fn, other, &k))
+                    fn->off[d] = fn->off[x] + (ins->sub == T_PLUS ? k : -k);
+                vec_push(&work, d);
+                break;
+            }
+            case IR_CALL: {
+                uint32_t g = func_of(o, ins->u.label);
+                ok = g != IR_NONE && u.arg < FRAME_NARG_REGS && o->funcs[g].inert[u.arg] &&
+                     (param || !(ins->flags & TC_TAIL));
+                r->calls = true;
+                break;
+            }
+            default:
+                ok = false;
+                break;
+            }
+        }
+    }
+    vec_free(&work);
+    return ok;
+}
+
+static void reach_free(Reach *r)
+{
+    vec_free(&r->mem);
+    vec_free(&r->cards);
+    vec_free(&r->nils);
+}
+
+/* A parameter is inert when the function, and every function it hands
+   the parameter on to, only loads and stores through it and compares
+   it: what it points to may then live in the caller's frame.  A card
+   mark says it may be a heap object, so that makes it not inert. */
+static void find_inert(Objects *o)
+{
+    for (uint32_t i = 0; i < o->n; i++) {
+        Func *fn = &o->funcs[i];
+        IrFunc *f = fn->f;
+        uint32_t reads[FRAME_NARG_REGS] = {0};
+        for (int k = 0; k < FRAME_NARG_REGS; k++)
+            fn->param[k] = IR_NONE;
+        for (uint32_t b = 0; b < f->blocks.len; b++) {
+            const IrBlock *blk = &f->blocks.data[b];
+            for (uint32_t j = 0; j < blk->ins.len; j++) {
+                const IrIns *ins = &blk->ins.data[j];
+                for (uint32_t a = 0; a < ins->nargs; a++)
+                    for (int k = 0; k < FRAME_NARG_REGS; k++)
+                        if (ins->args[a] == arg_regs[k]) {
+                            reads[k]++;
+                            if (b == 0 && ins->op == IR_COPY && ins->dst >= TEMP_NREGS)
+                                fn->param[k] = ins->dst;
+                        }
+            }
+        }
+        bool entry = f->blocks.len && !f->blocks.data[0].preds.len;
+        for (int k = 0; k < FRAME_NARG_REGS; k++)
+            fn->inert[k] = entry && (reads[k] == 0 || (reads[k] == 1 && fn->param[k] != IR_NONE));
+    }
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (uint32_t i = 0; i < o->n; i++) {
+            Func *fn = &o->funcs[i];
+            for (int k = 0; k < FRAME_NARG_REGS; k++) {
+                if (!fn->inert[k] || fn->param[k] == IR_NONE)
+                    continue;
+                Reach r;
+                if (!follow(o, fn, fn->param[k], true, &r) || r.cards.len) {
+                    fn->inert[k] = false;
+                    changed = true;
+                }
+                reach_free(&r);
+            }
+        }
+    }
+}
+
+/* ---- Rewriting -------------------------------------------------------- */
+
+/* Insert `ins` before instruction `*at` of block `b`, moving `*at` past
+   it; returns its value. */
+static Value put(IrFunc *f, uint32_t b, uint32_t *at, IrIns ins)
+{
+    IrBlock *blk = &f->blocks.data[b];
+    vec_push(&blk->ins, ins);
+    memmove(&blk->ins.data[*at + 1], &blk->ins.data[*at],
+            (blk->ins.len - 1 - *at) * sizeof *blk->ins.data);
+    blk->ins.data[(*at)++] = ins;
+    return ins.dst;
+}
+
+static Value put_const(IrFunc *f, uint32_t b, uint32_t *at, int64_t k)
+{
+    return put(f, b, at, (IrIns){ .op = IR_CONST, .dst = ir_new_value(f), .u.value = k });
+}
+
+static Value put_binop(IrFunc *f, uint32_t b, uint32_t *at, TBinOp op, Value x, Value y)
+{
+    Value *av = arena_alloc(f->arena, 2 * sizeof *av);
+    av[0] = x;
+    av[1] = y;
+    return put(f, b, at, (IrIns){ .op = IR_BINOP, .sub = op, .dst = ir_new_value(f),
+                                  .nargs = 2, .args = av });
+}
+
+static void put_store(IrFunc *f, uint32_t b, uint32_t *at, Value addr, Value v)
+{
+    Value *av = arena_alloc(f->arena, 2 * sizeof *av);
+    av[0] = addr;
+    av[1] = v;
+    put(f, b, at, (IrIns){ .op = IR_STORE, .dst = IR_NONE, .nargs = 2, .args = av });
+}
+
+/* What `site` allocates. */
+typedef struct Alloc {
+    Use site;
+    Value v, init;          /* init: of an array's elements */
+    uint32_t words;         /* of the object, with an array's length */
+    uint32_t nptrs;         /* of a record */
+    bool array, ptrs;       /* ptrs: an array of pointers */
+} Alloc;
+
+static bool alloc_of(const Objects *o, const Func *fn, Use site, Alloc *a)
+{
+    const IrIns *ins = ins_at(fn->f, site);
+    if (ins->op != IR_CALL || ins->nargs != 2 || ins->dst < TEMP_NREGS || ins->dst == IR_NONE)
+        return false;
+    Symbol name = label_sym(ins->u.label);
+    int64_t x, y;
+    *a = (Alloc){ .site = site, .v = ins->dst };
+    if (name == o->alloc_record) {
+        if (!const_of(fn, ins->args[0], &x) || !const_of(fn, ins->args[1], &y) || x <= 0 ||
+            x % FRAME_WORD || x / FRAME_WORD > MAX_WORDS || y < 0 || y > x / FRAME_WORD)
+            return false;
+        a->words = (uint32_t)(x / FRAME_WORD);
+        a->nptrs = (uint32_t)y;
+        return true;
+    }
+    a->ptrs = name == o->init_ptr_array;
+    if (!a->ptrs && name != o->init_array)
+        return false;
+    if (!const_of(fn, ins->args[0], &x) || x < 0 || x > MAX_WORDS)
+        return false;
+    a->array = true;
+    a->words = (uint32_t)x + 1;
+    a->init = ins->args[1];
+    return true;
+}
+
+/* The card marks of stores into an object that does not live in the
+   heap go. */
+static void drop_cards(IrFunc *f, const Reach *r)
+{
+    for (uint32_t i = 0; i < r->cards.len; i++)
+        ins_at(f, r->cards.data[i])->op = IR_NOP;
+}
+
+/* Give the object a place below %rbp: its pointer words are frame
+   slots the collector scans.  Whatever stores to the words right after
+   the allocation leave out needs 0, or for an array its length and
+   initial value. */
+static void to_stack(Func *fn, Frame *frame, const Alloc *a, const Reach *r)
+{
+    IrFunc *f = fn->f;
+    int32_t base = 0;
+    for (uint32_t j = a->words; j-- > 0;) {
+        bool ptr = a->array ? a->ptrs && j > 0 : j < a->nptrs;
+        base = frame_alloc_local(frame, true, ptr).offset;
+    }
+    bool stored[MAX_WORDS + 1] = {0};
+    const IrBlock *blk = &f->blocks.data[a->site.block];
+    for (uint32_t i = a->site.ins + 1; !a->array && i < blk->ins.len; i++) {
+        const IrIns *ins = &blk->ins.data[i];
+        if (ins->op == IR_CALL || ins->op == IR_LOAD || ins->op >= IR_JUMP)
+            break;
+        if (ins->op != IR_STORE || fn->seen[ins->args[0]] != fn->token)
+            continue;
+        int64_t off = fn->off[ins->args[0]];
+        if (off >= 0 && off < a->words * FRAME_WORD && off % FRAME_WORD == 0)
+            stored[off / FRAME_WORD] = true;
+    }
+    drop_cards(f, r);
+    Value one = ir_new_value(f);
+    for (uint32_t i = 0; i < r->nils.len; i++) {
+        Use u = r->nils.data[i];
+        ins_at(f, u)->args[u.arg] = one;
+    }
+
+    uint32_t b = a->site.block, at = a->site.ins;
+    put(f, b, &at, (IrIns){ .op = IR_CONST, .dst = one, .u.value = 1 });
+    int32_t skip = a->array ? FRAME_WORD : 0;
+    Value k = put_const(f, b, &at, base + skip);
+    IrIns *call = &f->blocks.data[b].ins.data[at];
+    Value *av = arena_alloc(f->arena, 2 * sizeof *av);
+    av[0] = REG_FP;
+    av[1] = k;
+    *call = (IrIns){ .op = IR_BINOP, .sub = T_PLUS, .dst = a->v, .nargs = 2, .args = av };
+    at++;
+    Value zero = IR_NONE;
+    for (uint32_t j = 0; j < a->words; j++) {
+        if (stored[j])
+            continue;
+        Value v = a->init;
+        if (a->array && j == 0)
+            v = put_const(f, b, &at, (int64_t)a->words - 1);
+        else if (!a->array)
+            v = zero != IR_NONE ? zero : (zero = put_const(f, b, &at, 0));
+        Value addr = put_binop(f, b, &at, T_PLUS, a->v,
+                               put_const(f, b, &at, (int64_t)j * FRAME_WORD - skip));
+        put_store(f, b, &at, addr, v);
+    }
+}
+
+/* Each word of a record only read and written at known offsets, that
+   gets compared with nil and nothing else, becomes a variable of its
+   own, put in SSA form the way Cytron et al. do it: phis where the
+   stores and the allocation, which sets every word to 0, meet.  The
+   record itself becomes the constant 1, which is not nil. */
+static void to_scalars(Func *fn, const Alloc *a, const Reach *r)
+{
+    IrFunc *f = fn->f;
+    uint32_t n = f->blocks.len, w = a->words, nv = f->nvalues;
+    drop_cards(f, r);
+
+    /* The word each load and store touches, and the blocks that set one. */
+    uint32_t *word = xmalloc(f->nvalues * sizeof *word);
+    bool *sets = xcalloc(n, sizeof *sets);
+    sets[a->site.block] = true;
+    for (uint32_t i = 0; i < r->mem.len; i++) {
+        const IrIns *ins = ins_at(f, r->mem.data[i]);
+        word[ins->args[0]] = (uint32_t)(fn->off[ins->args[0]] / FRAME_WORD);
+        if (ins->op == IR_STORE)
+            sets[r->mem.data[i].block] = true;
+    }
+
+    /* Dominance frontiers (Cooper, Harvey and Kennedy), then phis on the
+       iterated frontier of the blocks that set words. */
+    VEC(uint32_t) *df = xcalloc(n, sizeof *df);
+    for (uint32_t b = 0; b < n; b++) {
+        const IrBlock *blk = &f->blocks.data[b];
+        if (blk->preds.len < 2)
+            continue;
+        for (uint32_t k = 0; k < blk->preds.len; k++)
+            for (uint32_t x = blk->preds.data[k]; x != blk->idom; x = f->blocks.data[x].idom) {
+                if (df[x].len && df[x].data[df[x].len - 1] == b)
+                    break;
+                vec_push(&df[x], b);
+            }
+    }
+    Value *phis = xmalloc((size_t)n * w * sizeof *phis);
+    memset(phis, 0xff, (size_t)n * w * sizeof *phis);
+    VEC(uint32_t) work = {0};
+    for (uint32_t b = 0; b < n; b++)
+        if (sets[b])
+            vec_push(&work, b);
+    while (work.len) {
+        uint32_t x = work.data[--work.len];
+        for (uint32_t k = 0; k < df[x].len; k++) {
+            uint32_t y = df[x].data[k];
+            if (phis[y * w] != IR_NONE)
+                continue;
+            IrBlock *blk = &f->blocks.data[y];
+            uint32_t at = 0;
+            for (uint32_t j = 0; j < w; j++) {
+                Value *av = arena_alloc(f->arena, blk->preds.len * sizeof *av);
+                phis[y * w + j] = put(f, y, &at, (IrIns){ .op = IR_PHI, .dst = ir_new_value(f),
+                                                          .nargs = blk->preds.len, .args = av });
+                blk = &f->blocks.data[y];
+            }
+            if (!sets[y])
+                vec_push(&work, y);
+            sets[y] = true;
+        }
+    }
+
+    /* Renaming, down the dominator tree. */
+    uint32_t at = 0;
+    while (f->blocks.data[0].ins.data[at].op == IR_PHI)
+        at++;
+    Value zero = put_const(f, 0, &at, 0);
+    IrDomTree t;
+    ir_dom_tree(f, &t);
+    Value *cur = xmalloc((size_t)(n + 1) * w * sizeof *cur);
+    for (uint32_t j = 0; j < w; j++)
+        cur[j] = zero;
+    typedef struct Visit {
+        uint32_t b, kid;
+    } Visit;
+    VEC(Visit) stack = {0};
+    vec_push(&stack, ((Visit){ 0, t.kstart[0] }));
+    bool entered = false;
+    while (stack.len) {
+        Visit *s = &stack.data[stack.len - 1];
+        Value *c = &cur[(size_t)stack.len * w];
+        if (!entered) {
+            memcpy(c, c - w, w * sizeof *c);
+            for (uint32_t j = 0; j < w; j++)
+                if (phis[s->b * w + j] != IR_NONE)
+                    c[j] = phis[s->b * w + j];
+            IrBlock *blk = &f->blocks.data[s->b];
+            for (uint32_t i = 0; i < blk->ins.len; i++) {
+                IrIns *ins = &blk->ins.data[i];
+                Value x = ins->nargs ? ins->args[0] : IR_NONE;
+                if (ins->op == IR_CALL && ins->dst == a->v) {
+                    for (uint32_t j = 0; j < w; j++)
+                        c[j] = zero;
+                    *ins = (IrIns){ .op = IR_CONST, .dst = a->v, .u.value = 1 };
+                } else if ((ins->op == IR_LOAD || ins->op == IR_STORE) && x >= TEMP_NREGS &&
+                           x < nv && fn->seen[x] == fn->token) {
+                    if (ins->op == IR_STORE) {
+                        c[word[x]] = ins->args[1];
+                        ins->op = IR_NOP;
+                    } else {
+                        ins->op = IR_COPY;
+                        ins->args = arena_alloc(f->arena, sizeof *ins->args);
+                        ins->args[0] = c[word[x]];
+                    }
+                }
+            }
+            for (uint32_t k = 0; k < blk->nsucc; k++) {
+                IrBlock *sb = &f->blocks.data[blk->succ[k]];
+                if (phis[blk->succ[k] * w] == IR_NONE)
+                    continue;
+                for (uint32_t p = 0; p < sb->preds.len; p++)
+                    if (sb->preds.data[p] == s->b)
+                        for (uint32_t j = 0; j < w; j++)
+                            sb->ins.data[j].args[p] = c[j];
+            }
+        }
+        if (s->kid < t.kstart[s->b + 1]) {
+            uint32_t kid = t.kids[s->kid++];
+            vec_push(&stack, ((Visit){ kid, t.kstart[kid] }));
+            entered = false;
+        } else {
+            stack.len--;
+            entered = true;
+        }
+    }
+    vec_free(&stack);
+    free(cur);
+    ir_dom_tree_free(&t);
+    vec_free(&work);
+    free(phis);
+    for (uint32_t b = 0; b < n; b++)
+        vec_free(&df[b]);
+    free(df);
+    free(sets);
+    free(word);
+}
+
+/* Whether every load and store of the object is of one of its words. */
+static bool words_known(const Func *fn, const Alloc *a, const Reach *r)
+{
+    for (uint32_t i = 0; i < r->mem.len; i++) {
+        int64_t off = fn->off[ins_at(fn->f, r->mem.data[i])->args[0]];
+        if (off < 0 || off >= (int64_t)a->words * FRAME_WORD || off % FRAME_WORD)
+            return false;
+    }
+    return true;
+}
+
+/* Move the objects of function `fi` that do not escape it out of the
+   heap; says whether there were any. */
+static bool objects_in(Objects *o, uint32_t fi, Frame *frame)
+{
+    Func *fn = &o->funcs[fi];
+    IrFunc *f = fn->f;
+    IdMap tried = {0};
+    uint32_t words = 0;
+    bool changed = false;
+    for (;;) {
+        Alloc a;
+        bool found = false;
+        for (uint32_t b = 0; !found && b < f->blocks.len; b++)
+            for (uint32_t i = 0; !found && i < f->blocks.data[b].ins.len; i++)
+                found = alloc_of(o, fn, (Use){ b, i, 0 }, &a) && !idmap_get(&tried, a.v, 0);
+        if (!found)
+            break;
+        idmap_put(&tried, a.v, 1);
+        Reach r;
+        bool local = follow(o, fn, a.v, false, &r);
+        if (local && !a.array && !r.calls && !r.dynamic && !r.compared &&
+            words_known(fn, &a, &r)) {
+            to_scalars(fn, &a, &r);
+        } else if (local && words + a.words <= FRAME_WORDS) {
+            to_stack(fn, frame, &a, &r);
+            words += a.words;
+        } else {
+            local = false;
+        }
+        reach_free(&r);
+        if (local) {
+            changed = true;
+            func_scan(fn);
+        }
+    }
+    idmap_free(&tried);
+    return changed;
+}
+
+void opt_objects(IrFunc *funcs, Frame **frames, uint32_t n, const OptGlobals *g, FILE *dump)
+{
+    Objects o = { .funcs = xcalloc(n ? n : 1, sizeof *o.funcs), .n = n,
+                  .card_bias = sym_intern("tiger_card_bias"),
+                  .alloc_record = sym_intern("tiger_alloc_record"),
+                  .init_array = sym_intern("tiger_init_array"),
+                  .init_ptr_array = sym_intern("tiger_init_ptr_array") };
+    for (uint32_t i = 0; i < n; i++) {
+        o.funcs[i].f = &funcs[i];
+        idmap_put(&o.index, funcs[i].name, i);
+        func_scan(&o.funcs[i]);
+    }
+    find_inert(&o);
+    for (uint32_t i = 0; i < n; i++) {
+        if (!objects_in(&o, i, frames[i]))
+            continue;
+        ir_compact(&funcs[i]);
+        if (dump) {
+            fputs("# objects\n", dump);
+            ir_dump(&funcs[i], dump);
+        }
+        opt_function(&funcs[i], g, dump);
+    }
+    for (uint32_t i = 0; i < n; i++)
+        func_free(&o.funcs[i]);
+    free(o.funcs);
+    idmap_free(&o.index);
+}
@@ -0,0 +1,1569 @@
+#include "opt.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "phase.h"
+
+typedef struct Site {
+    uint32_t block, ins;
+} Site;
+
+/* Where each value is defined; IR_NONE for registers. */
+static Site *def_sites(const IrFunc *f)
+{
+    Site *def = xmalloc(f->nvalues * sizeof *def);
+    memset(def, 0xff, f->nvalues * sizeof *def);
+    for (uint32_t b = 0; b < f->blocks.len; b++) {
+        const IrBlock *blk = &f->blocks.data[b];
+        for (uint32_t i = 0; i < blk->ins.len; i++) {
+            Value d = blk->ins.data[i].dst;
+            if (d != IR_NONE && d >= TEMP_NREGS)
+                def[d] = (Site){ b, i };
+        }
+    }
+    return def;
+}
+
+static const IrIns *def_of(const IrFunc *f, const Site *def, Value v)
+{
+    if (v < TEMP_NREGS || def[v].block == IR_NONE)
+        return NULL;
+    return &f->blocks.data[def[v].block].ins.data[def[v].ins];
+}
+
+/* Union-find over replacements: repl[v] == v for a value kept. */
+static Value find(Value *repl, Value v)
+{
+    Value r = v;
+    while (repl[r] != r)
+        r = repl[r];
+    while (repl[v] != r) {
+        Value next = repl[v];
+        repl[v] = r;
+        v = next;
+    }
+    return r;
+}
+
+static Value *repl_new(const IrFunc *f)
+{
+    Value *repl = xmalloc(f->nvalues * sizeof *repl);
+    for (Value v = 0; v < f->nvalues; v++)
+        repl[v] = v;
+    return repl;
+}
+
+static void apply_repl(IrFunc *f, Value *repl)
+{
+    for (uint32_t b = 0; b < f->blocks.len; b++) {
+        IrBlock *blk = &f->blocks.data[b];
+        for (uint32_t i = 0; i < blk->ins.len; i++) {
+            IrIns *ins = &blk->ins.data[i];
+            for (uint32_t k = 0; k < ins->nargs; k++)
+                ins->args[k] = find(repl, ins->args[k]);
+        }
+    }
+}
+
+/* ---- Sparse conditional constant propagation --------------------------------- */
+
+enum { L_TOP, L_CONST, L_BOTTOM };
+
+typedef struct Sccp {
+    IrFunc *f;
+    const OptGlobals *g;
+    Site *def;
+    uint8_t *state;         /* [value] L_* */
+    int64_t *val;           /* [value] when L_CONST */
+    uint32_t *ustart;       /* uses of v: use[ustart[v] .. ustart[v+1]) */
+    Site *use;
+    bool *bexec;            /* [block] */
+    uint8_t *eexec;         /* [block] bit i: the edge to succ[i] */
+    VEC(Value) ssa_work;
+    VEC(Site) cfg_work;     /* (block, successor index) */
+} Sccp;
+
+static uint8_t lat(const Sccp *c, Value v, int64_t *k)
+{
+    if (v < TEMP_NREGS)
+        return L_BOTTOM;
+    *k = c->val[v];
+    return c->state[v];
+}
+
+static void set_lat(Sccp *c, Value d, uint8_t st, int64_t k)
+{
+    if (d == IR_NONE || d < TEMP_NREGS || st <= c->state[d])
+        return;
+    c->state[d] = st;
+    c->val[d] = k;
+    vec_push(&c->ssa_work, d);
+}
+
+static void mark_edge(Sccp *c, uint32_t b, uint32_t i)
+{
+    if (c->eexec[b] & (1u << i))
+        return;
+    c->eexec[b] |= (uint8_t)(1u << i);
+    vec_push(&c->cfg_work, ((Site){ b, i }));
+}
+
+static bool edge_exec(const Sccp *c, uint32_t p, uint32_t b)
+{
+    const IrBlock *pb = &c->f->blocks.data[p];
+    for (uint32_t i = 0; i < pb->nsucc; i++)
+        if (pb->succ[i] == b && (c->eexec[p] & (1u << i)))
+            return true;
+    return false;
+}
+
+/* Fold `x op y`, unless it would trap or is not worth the trouble. */
+static bool fold_binop(TBinOp op, int64_t x, int64_t y, int64_t *r)
+{
+    uint64_t ux = (uint64_t)x, uy = (uint64_t)y;
+    switch (op) {
+    case T_PLUS: *r = (int64_t)(ux + uy); return true;
+    case T_MINUS: *r = (int64_t)(ux - uy); return true;
+    case T_MUL: *r = (int64_t)(ux * uy); return true;
+    case T_DIV:
+        if (y == 0 || (x == INT64_MIN && y == -1))
+            return false;
+        *r = x / y;
+        return true;
+    case T_AND: *r = x & y; return true;
+    case T_OR: *r = x | y; return true;
+    case T_XOR: *r = x ^ y; return true;
+    case T_LSHIFT: *r = (int64_t)(ux << (y & 63)); return true;
+    case T_RSHIFT: *r = (int64_t)(ux >> (y & 63)); return true;
+    case T_ARSHIFT: *r = x >> (y & 63); return true;
+    default: return false;
+    }
+}
+
+static bool fold_relop(TRelOp op, int64_t x, int64_t y)
+{
+    uint64_t ux = (uint64_t)x, uy = (uint64_t)y;
+    switch (op) {
+    case T_EQ: return x == y;
+    case T_NE: return x != y;
+    case T_LT: return x < y;
+    case T_GT: return x > y;
+    case T_LE: return x <= y;
+    case T_GE: return x >= y;
+    case T_ULT: return ux < uy;
+    case T_ULE: return ux <= uy;
+    case T_UGT: return ux > uy;
+    case T_UGE: return ux >= uy;
+    default: return false;
+    }
+}
+
+static void visit(Sccp *c, uint32_t b, uint32_t i)
+{
+    IrBlock *blk = &c->f->blocks.data[b];
+    IrIns *ins = &blk->ins.data[i];
+    int64_t x = 0, y = 0, r = 0;
+    switch ((IrOp)ins->op) {
+    case IR_CONST:
+        set_lat(c, ins->dst, L_CONST, ins->u.value);
+        break;
+    case IR_COPY: {
+        uint8_t s = lat(c, ins->args[0], &x);
+        set_lat(c, ins->dst, s, x);
+        break;
+    }
+    case IR_BINOP: {
+        uint8_t s = lat(c, ins->args[0], &x), t = lat(c, ins->args[1], &y);
+        if (s == L_BOTTOM || t == L_BOTTOM)
+            set_lat(c, ins->dst, L_BOTTOM, 0);
+        else if (s == L_CONST && t == L_CONST && fold_binop((TBinOp)ins->sub, x, y, &r))
+            set_lat(c, ins->dst, L_CONST, r);
+        else if (s == L_CONST && t == L_CONST)
+            set_lat(c, ins->dst, L_BOTTOM, 0);
+        break;
+    }
+    case IR_LOAD: {
+        const IrIns *a = def_of(c->f, c->def, ins->args[0]);
+        uint32_t gi = a && a->op == IR_NAME ? idmap_get(&c->g->index, a->u.label, IR_NONE)
+                                            : IR_NONE;
+        if (gi != IR_NONE)
+            set_lat(c, ins->dst, L_CONST, c->g->values.data[gi]);
+        else
+            set_lat(c, ins->dst, L_BOTTOM, 0);
+        break;
+    }
+    case IR_NAME:
+    case IR_CALL:
+        set_lat(c, ins->dst, L_BOTTOM, 0);
+        break;
+    case IR_PHI: {
+        uint8_t s = L_TOP;
+        int64_t k = 0;
+        for (uint32_t j = 0; j < ins->nargs && s != L_BOTTOM; j++) {
+            if (!edge_exec(c, blk->preds.data[j], b))
+                continue;
+            uint8_t t = lat(c, ins->args[j], &x);
+            if (t == L_TOP)
+                continue;
+            if (t == L_BOTTOM || (s == L_CONST && k != x))
+                s = L_BOTTOM;
+            else
+                s = L_CONST, k = x;
+        }
+        set_lat(c, ins->dst, s, k);
+        break;
+    }
+    case IR_JUMP:
+        mark_edge(c, b, 0);
+        break;
+    case IR_CJUMP: {
+        uint8_t s = lat(c, ins->args[0], &x), t = lat(c, ins->args[1], &y);
+        if (s == L_CONST && t == L_CONST) {
+            mark_edge(c, b, fold_relop((TRelOp)ins->sub, x, y) ? 0 : 1);
+        } else if (s == L_BOTTOM || t == L_BOTTOM) {
+            mark_edge(c, b, 0);
+            mark_edge(c, b, 1);
+        }
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+void opt_sccp(IrFunc *f, const OptGlobals *g)
+{
+    uint32_t nv = f->nvalues, nb = f->blocks.len;
+    Sccp c = { .f = f, .g = g };
+    c.def = def_sites(f);
+    c.state = xcalloc(nv, sizeof *c.state);
+    c.val = xcalloc(nv, sizeof *c.val);
+    c.bexec = xcalloc(nb, sizeof *c.bexec);
+    c.eexec = xcalloc(nb, sizeof *c.eexec);
+
+    c.ustart = xcalloc(nv + 1, sizeof *c.ustart);
+    for (uint32_t b = 0; b < nb; b++)
+        for (uint32_t i = 0; i < f->blocks.data[b].ins.len; i++) {
+            IrIns *ins = &f->blocks.data[b].ins.data[i];
+            for (uint32_t k = 0; k < ins->nargs; k++)
+                c.ustart[ins->args[k] + 1]++;
+        }
+    for (Value v = 0; v < nv; v++)
+        c.ustart[v + 1] += c.ustart[v];
+    c.use = xmalloc((c.ustart[nv] + 1) * sizeof *c.use);
+    uint32_t *fill = xmalloc((nv + 1) * sizeof *fill);
+    memcpy(fill, c.ustart, (nv + 1) * sizeof *fill);
+    for (uint32_t b = 0; b < nb; b++)
+        for (uint32_t i = 0; i < f->blocks.data[b].ins.len; i++) {
+            IrIns *ins = &f->blocks.data[b].ins.data[i];
+            for (uint32_t k = 0; k < ins->nargs; k++)
+                c.use[fill[ins->args[k]]++] = (Site){ b, i };
+        }
+    free(fill);
+
+    c.bexec[0] = true;
+    for (uint32_t i = 0; i < f->blocks.data[0].ins.len; i++)
+        visit(&c, 0, i);
+    while (c.cfg_work.len || c.ssa_work.len) {
+        while (c.cfg_work.len) {
+            Site e = c.cfg_work.data[--c.cfg_work.len];
+            uint32_t to = f->blocks.data[e.block].succ[e.ins];
+            IrBlock *tb = &f->blocks.data[to];
+            if (!c.bexec[to]) {
+                c.bexec[to] = true;
+                for (uint32_t i = 0; i < tb->ins.len; i++)
+                    visit(&c, to, i);
+            } else {
+                for (uint32_t i = 0; i < tb->ins.len && tb->ins.data[i].op == IR_PHI; i++)
+                    visit(&c, to, i);
+            }
+        }
+        while (c.ssa_work.len) {
+            Value v = c.ssa_work.data[--c.ssa_work.len];
+            for (uint32_t u = c.ustart[v]; u < c.ustart[v + 1]; u++)
+                if (c.bexec[c.use[u].block])
+                    visit(&c, c.use[u].block, c.use[u].ins);
+        }
+    }
+
+    /* Branches first, while phis are still in place for
+       ir_remove_pred(); then the constants. */
+    for (uint32_t b = 0; b < nb; b++) {
+        IrBlock *blk = &f->blocks.data[b];
+        if (!c.bexec[b]) {
+            blk->dead = true;
+            continue;
+        }
+        IrIns *t = &blk->ins.data[blk->ins.len - 1];
+        if (t->op != IR_CJUMP || (c.eexec[b] != 1 && c.eexec[b] != 2))
+            continue;
+        uint32_t keep = c.eexec[b] == 1 ? 0 : 1;
+        uint32_t taken = blk->succ[keep], other = blk->succ[1 - keep];
+        t->op = IR_JUMP;
+        t->nargs = 0;
+        blk->succ[0] = taken;
+        blk->nsucc = 1;
+        ir_remove_pred(f, other, b);
+    }
+    for (uint32_t b = 0; b < nb; b++) {
+        IrBlock *blk = &f->blocks.data[b];
+        if (blk->dead)
+            continue;
+        for (uint32_t i = 0; i < blk->ins.len; i++) {
+            IrIns *ins = &blk->ins.data[i];
+            Value d = ins->dst;
+            if (d == IR_NONE || d < TEMP_NREGS || c.state[d] != L_CONST || ins->op == IR_CONST)
+                continue;
+            ins->op = IR_CONST;
+            ins->nargs = 0;
+            ins->u.value = c.val[d];
+        }
+    }
+    ir_compact(f);
+
+    free(c.def);
+    free(c.state);
+    free(c.val);
+    free(c.bexec);
+    free(c.eexec);
+    free(c.ustart);
+    free(c.use);
+    vec_free(&c.ssa_work);
+    vec_free(&c.cfg_work);
+}
+
+/* ---- Copy propagation ------------------------------------------------------ */
+
+void opt_copyprop(IrFunc *f)
+{
+    Value *repl = repl_new(f);
+    for (uint32_t b = 0; b < f->blocks.len; b++) {
+        IrBlock *blk = &f->blocks.data[b];
+        for (uint32_t i = 0; i < blk->ins.len; i++) {
+            IrIns *ins = &blk->ins.data[i];
+            /* A read of a machine register stays where it is. */
+            if (ins->op == IR_COPY && ins->dst >= TEMP_NREGS && ins->args[0] >= TEMP_NREGS) {
+                repl[ins->dst] = find(repl, ins->args[0]);
+                ins->op = IR_NOP;
+            }
+        }
+    }
+    /* A phi whose arguments are all one value, or itself, is that value;
+       replacing one can make another such. */
+    for (bool changed = true; changed;) {
+        changed = false;
+        for (uint32_t b = 0; b < f->blocks.len; b++) {
+            IrBlock *blk = &f->blocks.data[b];
+            for (uint32_t i = 0; i < blk->ins.len; i++) {
+                IrIns *phi = &blk->ins.data[i];
+                if (phi->op != IR_PHI)
+                    continue;
+                Value same = IR_NONE;
+                bool one = true;
+                for (uint32_t k = 0; k < phi->nargs && one; k++) {
+                    Value a = find(repl, phi->args[k]);
+                    if (a == phi->dst || a == same)
+                        continue;
+                    if (same == IR_NONE)
+                        same = a;
+                    else
+                        one = false;
+                }
+                if (one && same != IR_NONE && same >= TEMP_NREGS) {
+                    repl[phi->dst] = same;
+                    phi->op = IR_NOP;
+                    changed = true;
+                }
+            }
+        }
+    }
+    apply_repl(f, repl);
+    ir_compact(f);
+    free(repl);
+}
+
+/* ---- Global value numbering ------------------------------------------------ */
+
+typedef struct VnEntry {
+    uint8_t op, sub;
+    Value a0, a1;
+    int64_t value;
+    Value leader;
+    uint32_t next;          /* next entry of the bucket */
+    uint32_t bucket;
+} VnEntry;
+
+typedef struct Vn {
+    uint32_t *head;         /* [bucket] newest entry, IR_NONE if none */
+    uint32_t mask;
+    VEC(VnEntry) entries;   /* removed newest first on leaving a scope */
+} Vn;
+
+static uint32_t vn_hash(const VnEntry *e)
+{
+    uint64_t h = e->op * 31u + e->sub;
+    h = h * 0x9e3779b97f4a7c15ull + e->a0;
+    h = h * 0x9e3779b97f4a7c15ull + e->a1;
+    /* Multiplied once more: a value added last would barely reach the
+       high bits, and constants would share a bucket. */
+    h = (h * 0x9e3779b97f4a7c15ull + (uint64_t)e->value) * 0x9e3779b97f4a7c15ull;
+    return (uint32_t)(h >> 32);
+}
+
+static bool commutative(TBinOp op)
+{
+    return op == T_PLUS || op == T_MUL || op == T_AND || op == T_OR || op == T_XOR;
+}
+
+void opt_gvn(IrFunc *f)
+{
+    Value *repl = repl_new(f);
+    Vn vn = {0};
+    vn.mask = 63;
+    while (vn.mask + 1 < f->nvalues)
+        vn.mask = vn.mask * 2 + 1;
+    vn.head = xmalloc((vn.mask + 1) * sizeof *vn.head);
+    memset(vn.head, 0xff, (vn.mask + 1) * sizeof *vn.head);
+
+    IrDomTree dt;
+    ir_dom_tree(f, &dt);
+    typedef struct { uint32_t block, mark; } Frame;
+    VEC(Frame) stack = {0};
+    vec_push(&stack, ((Frame){ 0, IR_NONE }));
+    while (stack.len) {
+        Frame fr = stack.data[--stack.len];
+        if (fr.mark != IR_NONE) {
+            while (vn.entries.len > fr.mark) {
+                VnEntry *e = &vn.entries.data[--vn.entries.len];
+                vn.head[e->bucket] = e->next;
+            }
+            continue;
+        }
+        uint32_t b = fr.block;
+        vec_push(&stack, ((Frame){ b, vn.entries.len }));
+        IrBlock *blk = &f->blocks.data[b];
+        for (uint32_t i = 0; i < blk->ins.len; i++) {
+            IrIns *ins = &blk->ins.data[i];
+            if (ins->op == IR_PHI)
+                continue;   /* arguments from back edges are not final yet */
+            for (uint32_t k = 0; k < ins->nargs; k++)
+                ins->args[k] = find(repl, ins->args[k]);
+            if (ins->op != IR_CONST && ins->op != IR_NAME && ins->op != IR_BINOP)
+                continue;
+            if (ins->dst < TEMP_NREGS)
+                continue;
+            VnEntry key = { .op = ins->op, .sub = ins->sub, .a0 = IR_NONE, .a1 = IR_NONE };
+            if (ins->op == IR_CONST)
+                key.value = ins->u.value;
+            else if (ins->op == IR_NAME)
+                key.value = ins->u.label;
+            else {
+                key.a0 = ins->args[0];
+                key.a1 = ins->args[1];
+                if (commutative((TBinOp)ins->sub) && key.a0 > key.a1) {
+                    key.a0 = ins->args[1];
+                    key.a1 = ins->args[0];
+                }
+            }
+            uint32_t h = vn_hash(&key) & vn.mask;
+            uint32_t j = vn.head[h];
+            while (j != IR_NONE) {
+                const VnEntry *e = &vn.entries.data[j];
+                if (e->op == key.op && e->sub == key.sub && e->a0 == key.a0 &&
+                    e->a1 == key.a1 && e->value == key.value)
+                    break;
+                j = e->next;
+            }
+            if (j != IR_NONE) {
+                repl[ins->dst] = vn.entries.data[j].leader;
+                ins->op = IR_NOP;
+                continue;
+            }
+            key.leader = ins->dst;
+            key.bucket = h;
+            key.next = vn.head[h];
+            vn.head[h] = vn.entries.len;
+            vec_push(&vn.entries, key);
+        }
+        for (uint32_t k = dt.kstart[b + 1]; k-- > dt.kstart[b];)
+            vec_push(&stack, ((Frame){ dt.kids[k], IR_NONE }));
+    }
+    apply_repl(f, repl);
+    ir_compact(f);
+
+    ir_dom_tree_free(&dt);
+    vec_free(&stack);
+    vec_free(&vn.entries);
+    free(vn.head);
+    free(repl);
+}
+
+/* ---- Loops ------------------------------------------------------------------- */
+
+/* A natural loop: its header and the blocks that reach one of the
+   header's back edges without passing through it. */
+typedef struct Loop {
+    uint32_t header;
+    uint32_t pre;           /* the header's only predecessor outside, or
+                               IR_NONE for a loop back to the entry */
+    uint32_t latch;         /* source of the only back edge, or IR_NONE */
+    uint32_t parent;        /* the innermost loop around it, or IR_NONE */
+    bool calls, stores;
+    bool stale;             /* an inner loop went: `blocks` is out of date */
+    VEC(uint32_t) blocks;   /* in reverse postorder, the header first */
+} Loop;
+
+typedef struct Loops {
+    IrFunc *f;
+    const OptGlobals *g;
+    VEC(Loop) loops;        /* inner loops before the loops around them */
+    uint32_t nblocks;       /* when they were found; blocks added since
+                               are in none */
+    uint32_t *inner;        /* [block] innermost loop holding it, or IR_NONE */
+    uint32_t *dom_in, *dom_out;     /* dominator tree intervals */
+    Site *def;              /* [value], kept up to date */
+    uint32_t ndef;
+} Loops;
+
+static bool dominates(const Loops *n, uint32_t a, uint32_t b)
+{
+    return n->dom_in[a] <= n->dom_in[b] && n->dom_out[b] <= n->dom_out[a];
+}
+
+static bool in_loop(const Loops *n, uint32_t b, uint32_t l)
+{
+    uint32_t k = b < n->nblocks ? n->inner[b] : IR_NONE;
+    while (k != IR_NONE && k < l)
+        k = n->loops.data[k].parent;
+    return k == l;
+}
+
+static void loops_clear(Loops *n)
+{
+    for (uint32_t i = 0; i < n->loops.len; i++)
+        vec_free(&n->loops.data[i].blocks);
+    n->loops.len = 0;
+    free(n->inner);
+    free(n->dom_in);
+    free(n->dom_out);
+    n->inner = n->dom_in = n->dom_out = NULL;
+}
+
+static int by_size(const void *x, const void *y)
+{
+    const Loop *a = x, *b = y;
+    return (a->blocks.len > b->blocks.len) - (a->blocks.len < b->blocks.len);
+}
+
+static void number_dom_tree(Loops *n)
+{
+    uint32_t nb = n->f->blocks.len, clock = 0;
+    IrDomTree dt;
+    ir_dom_tree(n->f, &dt);
+    n->dom_in = xmalloc(nb * sizeof *n->dom_in);
+    n->dom_out = xmalloc(nb * sizeof *n->dom_out);
+    VEC(uint32_t) stack = {0};      /* block * 2, plus 1 once its kids are done */
+    vec_push(&stack, 0);
+    while (stack.len) {
+        uint32_t x = stack.data[--stack.len], b = x >> 1;
+        if (x & 1) {
+            n->dom_out[b] = clock++;
+            continue;
+        }
+        n->dom_in[b] = clock++;
+        vec_push(&stack, x | 1);
+        for (uint32_t k = dt.kstart[b]; k < dt.kstart[b + 1]; k++)
+            vec_push(&stack, dt.kids[k] << 1);
+    }
+    vec_free(&stack);
+    ir_dom_tree_free(&dt);
+}
+
+/* The loops of the function as it is, without preheaders yet. */
+static void find_loops(Loops *n)
+{
+    IrFunc *f = n->f;
+    uint32_t nb = f->blocks.len;
+    loops_clear(n);
+    n->nblocks = nb;
+    number_dom_tree(n);
+
+    uint32_t *seen = xmalloc(nb * sizeof *seen);
+    memset(seen, 0xff, nb * sizeof *seen);
+    VEC(uint32_t) work = {0};
+    for (uint32_t h = 0; h < nb; h++) {
+        const IrBlock *hb = &f->blocks.data[h];
+        Loop l = { .header = h, .pre = IR_NONE, .latch = IR_NONE, .parent = IR_NONE };
+        uint32_t nlatch = 0, id = n->loops.len;
+        for (uint32_t k = 0; k < hb->preds.len; k++) {
+            uint32_t p = hb->preds.data[k];
+            if (!dominates(n, h, p) || seen[p] == id)
+                continue;
+            l.latch = p;
+            nlatch++;
+            seen[p] = id;
+            vec_push(&work, p);
+        }
+        if (!nlatch)
+            continue;
+        if (nlatch > 1)
+            l.latch = IR_NONE;
+        seen[h] = id;
+        vec_push(&l.blocks, h);
+        while (work.len) {
+            uint32_t b = work.data[--work.len];
+            if (b != h)
+                vec_push(&l.blocks, b);
+            const IrBlock *blk = &f->blocks.data[b];
+            for (uint32_t k = 0; k < blk->preds.len; k++)
+                if (seen[blk->preds.data[k]] != id) {
+                    seen[blk->preds.data[k]] = id;
+                    vec_push(&work, blk->preds.data[k]);
+                }
+        }
+        vec_push(&n->loops, l);
+    }
+    vec_free(&work);
+    free(seen);
+
+    /* Loops are nested or disjoint, so each one's parent is the
+       smallest larger loop holding it. */
+    qsort(n->loops.data, n->loops.len, sizeof *n->loops.data, by_size);
+    n->inner = xmalloc(nb * sizeof *n->inner);
+    memset(n->inner, 0xff, nb * sizeof *n->inner);
+    for (uint32_t i = 0; i < n->loops.len; i++) {
+        Loop *l = &n->loops.data[i];
+        for (uint32_t j = 0; j < l->blocks.len; j++) {
+            uint32_t b = l->blocks.data[j], k = n->inner[b];
+            if (k == IR_NONE) {
+                n->inner[b] = i;
+                continue;
+            }
+            while (n->loops.data[k].parent != IR_NONE)
+                k = n->loops.data[k].parent;
+            if (k != i)
+                n->loops.data[k].parent = i;
+        }
+        l->blocks.len = 0;
+    }
+    IrOrder rpo = {0};
+    ir_rpo(f, &rpo);
+    for (uint32_t i = 0; i < rpo.len; i++) {
+        uint32_t b = rpo.data[i];
+        const IrBlock *blk = &f->blocks.data[b];
+        bool calls = false, stores = false;
+        for (uint32_t j = 0; j < blk->ins.len; j++) {
+            calls |= blk->ins.data[j].op == IR_CALL;
+            stores |= blk->ins.data[j].op == IR_STORE;
+        }
+        for (uint32_t k = n->inner[b]; k != IR_NONE; k = n->loops.data[k].parent) {
+            Loop *l = &n->loops.data[k];
+            vec_push(&l->blocks, b);
+            l->calls |= calls;
+            l->stores |= stores;
+        }
+    }
+    vec_free(&rpo);
+}
+
+/* Give the header of loop `li` a predecessor of its own for all its
+   edges from outside, unless it has one.  Returns whether it added a
+   block. */
+static bool add_preheader(Loops *n, uint32_t li)
+{
+    IrFunc *f = n->f;
+    Loop *l = &n->loops.data[li];
+    uint32_t h = l->header;
+    if (h == 0)
+        return false;
+    IrBlock *hb = &f->blocks.data[h];
+    uint32_t nout = 0, out = IR_NONE;
+    for (uint32_t k = 0; k < hb->preds.len; k++)
+        if (!in_loop(n, hb->preds.data[k], li))
+            nout++, out = hb->preds.data[k];
+    if (nout == 1 && f->blocks.data[out].nsucc == 1) {
+        l->pre = out;
+        return false;
+    }
+
+    uint32_t m = f->blocks.len;
+    vec_push(&f->blocks, ((IrBlock){ .label = label_new() }));
+    IrBlock *pb = &f->blocks.data[m];
+    hb = &f->blocks.data[h];
+    VEC(uint32_t) inside = {0};     /* positions among the header's preds */
+    for (uint32_t k = 0; k < hb->preds.len; k++) {
+        uint32_t p = hb->preds.data[k];
+        if (in_loop(n, p, li)) {
+            vec_push(&inside, k);
+            continue;
+        }
+        vec_push(&pb->preds, p);
+        IrBlock *ob = &f->blocks.data[p];
+        for (uint32_t s = 0; s < ob->nsucc; s++)
+            if (ob->succ[s] == h)
+                ob->succ[s] = m;
+    }
+    for (uint32_t i = 0; i < hb->ins.len && hb->ins.data[i].op == IR_PHI; i++) {
+        IrIns *phi = &hb->ins.data[i];
+        Value *args = arena_alloc(f->arena, (inside.len + 1) * sizeof *args);
+        if (nout == 1) {
+            for (uint32_t k = 0; k < phi->nargs; k++)
+                if (!in_loop(n, hb->preds.data[k], li))
+                    args[0] = phi->args[k];
+        } else {
+            IrIns np = { .op = IR_PHI, .dst = ir_new_value(f), .nargs = nout };
+            np.args = arena_alloc(f->arena, nout * sizeof *np.args);
+            for (uint32_t k = 0, j = 0; k < phi->nargs; k++)
+                if (!in_loop(n, hb->preds.data[k], li))
+                    np.args[j++] = phi->args[k];
+            vec_push(&pb->ins, np);
+            args[0] = np.dst;
+        }
+        for (uint32_t j = 0; j < inside.len; j++)
+            args[j + 1] = phi->args[inside.data[j]];
+        phi->args = args;
+        phi->nargs = inside.len + 1;
+    }
+    hb->preds.data[0] = m;
+    for (uint32_t j = 0; j < inside.len; j++)
+        hb->preds.data[j + 1] = hb->preds.data[inside.data[j]];
+    hb->preds.len = inside.len + 1;
+    vec_push(&pb->ins, ((IrIns){ .op = IR_JUMP, .dst = IR_NONE }));
+    pb->succ[0] = h;
+    pb->nsucc = 1;
+    vec_free(&inside);
+    return true;
+}
+
+/* Find the loops and give each a preheader. */
+static void loops_find(Loops *n)
+{
+    find_loops(n);
+    bool added = false;
+    for (uint32_t i = 0; i < n->loops.len; i++)
+        added |= add_preheader(n, i);
+    if (added) {
+        ir_compact(n->f);
+        find_loops(n);
+        for (uint32_t i = 0; i < n->loops.len; i++)
+            add_preheader(n, i);
+    }
+    free(n->def);
+    n->def = def_sites(n->f);
+    n->ndef = n->f->nvalues;
+}
+
+static void loops_free(Loops *n)
+{
+    loops_clear(n);
+    vec_free(&n->loops);
+    free(n->def);
+}
+
+static bool const_of(const Loops *n, Value v, int64_t *k)
+{
+    const IrIns *d = def_of(n->f, n->def, v);
+    if (!d || d->op != IR_CONST)
+        return false;
+    *k = d->u.value;
+    return true;
+}
+
+/* Whether loop `li` leaves `v` alone. */
+static bool invariant(const Loops *n, uint32_t li, Value v)
+{
+    return v >= TEMP_NREGS && n->def[v].block != IR_NONE && !in_loop(n, n->def[v].block, li);
+}
+
+/* Add `ins` to block `b` before its terminator, as the definition of a
+   new value if it has one. */
+static Value put(Loops *n, uint32_t b, IrIns ins)
+{
+    IrBlock *blk = &n->f->blocks.data[b];
+    vec_push(&blk->ins, ins);
+    uint32_t i = blk->ins.len - 2;
+    blk->ins.data[i + 1] = blk->ins.data[i];
+    blk->ins.data[i] = ins;
+    Value d = ins.dst;
+    if (d == IR_NONE || d < TEMP_NREGS)
+        return d;
+    if (d >= n->ndef) {
+        uint32_t was = n->ndef;
+        n->ndef = d * 2 + 16;
+        n->def = xrealloc(n->def, n->ndef * sizeof *n->def);
+        memset(n->def + was, 0xff, (n->ndef - was) * sizeof *n->def);
+    }
+    n->def[d] = (Site){ b, i };
+    return d;
+}
+
+static Value put_const(Loops *n, uint32_t b, int64_t k)
+{
+    return put(n, b, (IrIns){ .op = IR_CONST, .dst = ir_new_value(n->f), .u.value = k });
+}
+
+/* `x op y` in block `b`, folded if it can be. */
+static Value put_binop(Loops *n, uint32_t b, TBinOp op, Value x, Value y)
+{
+    int64_t kx = 0, ky = 0, r;
+    bool cx = const_of(n, x, &kx), cy = const_of(n, y, &ky);
+    if (cx && cy && fold_binop(op, kx, ky, &r))
+        return put_const(n, b, r);
+    if (cy && ky == 0 && (op == T_PLUS || op == T_MINUS))
+        return x;
+    if (cx && kx == 0 && op == T_PLUS)
+        return y;
+    if (cy && ky == 1 && op == T_MUL)
+        return x;
+    IrIns ins = { .op = IR_BINOP, .sub = op, .dst = ir_new_value(n->f), .nargs = 2 };
+    ins.args = arena_alloc(n->f->arena, 2 * sizeof *ins.args);
+    ins.args[0] = x;
+    ins.args[1] = y;
+    return put(n, b, ins);
+}
+
+/* ---- Loop-invariant code motion ---- */
+
+static bool stores_to(const Loops *n, const Loop *l, Label name)
+{
+    for (uint32_t j = 0; j < l->blocks.len; j++) {
+        const IrBlock *blk = &n->f->blocks.data[l->blocks.data[j]];
+        for (uint32_t i = 0; i < blk->ins.len; i++) {
+            const IrIns *ins = &blk->ins.data[i];
+            const IrIns *a = ins->op == IR_STORE ? def_of(n->f, n->def, ins->args[0]) : NULL;
+            if (a && a->op == IR_NAME && a->u.label == name)
+                return true;
+        }
+    }
+    return false;
+}
+
+/* Whether `ins`, in block `b` of loop `li`, can move to the preheader.
+   The loop makes no calls. */
+static bool hoistable(const Loops *n, uint32_t li, uint32_t b, const IrIns *ins)
+{
+    const Loop *l = &n->loops.data[li];
+    if (ins->dst == IR_NONE || ins->dst < TEMP_NREGS)
+        return false;
+    for (uint32_t k = 0; k < ins->nargs; k++)
+        if (!invariant(n, li, ins->args[k]))
+            return false;
+    int64_t k;
+    switch ((IrOp)ins->op) {
+    case IR_CONST:
+    case IR_NAME:
+        return true;
+    case IR_BINOP:
+        /* x + k folds into an address or a lea, and hoisted would only
+           tie up a register; a division may be there to be skipped. */
+        if (ins->sub == T_PLUS || ins->sub == T_MINUS)
+            return !const_of(n, ins->args[0], &k) && !const_of(n, ins->args[1], &k);
+        return ins->sub != T_DIV || (const_of(n, ins->args[1], &k) && k != 0 && k != -1);
+    case IR_LOAD: {
+        const IrIns *a = def_of(n->f, n->def, ins->args[0]);
+        if (a && a->op == IR_NAME && idmap_get(&n->g->fixed, a->u.label, 0))
+            return !stores_to(n, l, a->u.label);
+        /* The header runs whenever the preheader does. */
+        return !l->stores && b == l->header;
+    }
+    default:
+        return false;
+    }
+}
+
+/* The instruction of block `b` computing what `ins` does, or NULL. */
+static const IrIns *same_as(const Loops *n, uint32_t b, const IrIns *ins)
+{
+    const IrBlock *blk = &n->f->blocks.data[b];
+    for (uint32_t i = 0; i < blk->ins.len; i++) {
+        const IrIns *o = &blk->ins.data[i];
+        if (o->op != ins->op || o->sub != ins->sub || o->nargs != ins->nargs ||
+            o->dst == IR_NONE || o->dst < TEMP_NREGS)
+            continue;
+        if ((o->op == IR_CONST || o->op == IR_NAME) && o->u.value != ins->u.value)
+            continue;
+        uint32_t k = 0;
+        while (k < o->nargs && o->args[k] == ins->args[k])
+            k++;
+        if (k == o->nargs)
+            return o;
+    }
+    return NULL;
+}
+
+/* Hoist what loop `li` computes the same way every time round.  In
+   reverse postorder an operand is hoisted before its uses.  With
+   `repl`, what the preheader already computes, as what licm hoisted
+   out of an inner loop next to this one, is replaced rather than
+   computed twice. */
+static void licm_loop(Loops *n, uint32_t li, Value *repl)
+{
+    const Loop *l = &n->loops.data[li];
+    for (uint32_t j = 0; j < l->blocks.len; j++) {
+        uint32_t b = l->blocks.data[j];
+        for (uint32_t i = 0; i < n->f->blocks.data[b].ins.len; i++) {
+            IrIns *ins = &n->f->blocks.data[b].ins.data[i];
+            for (uint32_t k = 0; repl && k < ins->nargs; k++)
+                ins->args[k] = find(repl, ins->args[k]);
+            if (!hoistable(n, li, b, ins))
+                continue;
+            const IrIns *o = repl ? same_as(n, l->pre, ins) : NULL;
+            if (o) {
+                repl[ins->dst] = o->dst;
+                ins->op = IR_NOP;
+                continue;
+            }
+            IrIns moved = *ins;
+            ins->op = IR_NOP;
+            put(n, l->pre, moved);
+        }
+    }
+}
+
+void opt_licm(IrFunc *f, const OptGlobals *g)
+{
+    Loops n = { .f = f, .g = g };
+    loops_find(&n);
+    Value *repl = repl_new(f);
+    /* What is hoisted out of a loop that calls lives across the calls,
+       in a callee-saved register or a stack slot: no cheaper than the
+       load or the addition it saves. */
+    for (uint32_t i = 0; i < n.loops.len; i++)
+        if (n.loops.data[i].pre != IR_NONE && !n.loops.data[i].calls)
+            licm_loop(&n, i, repl);
+    apply_repl(f, repl);
+    free(repl);
+    loops_free(&n);
+    ir_compact(f);
+}
+
+/* ---- Induction variables ---- */
+
+/* A value that is a recurrence `root` of the loop's header plus an
+   invariant `offv` (none if IR_NONE) plus `offk`. */
+typedef struct Chain {
+    Value root;
+    uint32_t depth;         /* additions on the way from the root */
+    Value offv;
+    int64_t offk;
+} Chain;
+
+typedef struct Iv {
+    Loops *n;
+    uint32_t li;
+    Chain *ch;              /* [value], valid where stamp[value] == serial */
+    uint32_t *stamp, serial, size;
+    bool *rec;              /* [value] header phis that are recurrences */
+    VEC(Value) repl;        /* pending replacements: from, to, ... */
+} Iv;
+
+static const Chain *chain_of(const Iv *s, Value v)
+{
+    return v < s->size && s->stamp[v] == s->serial ? &s->ch[v] : NULL;
+}
+
+static void set_chain(Iv *s, Value v, Chain c)
+{
+    if (v >= s->size)
+        return;
+    s->stamp[v] = s->serial;
+    s->ch[v] = c;
+}
+
+/* Whether `v` is invariant, as a constant (in *k) or a value. */
+static bool iv_operand(const Iv *s, Value v, bool *is_const, int64_t *k)
+{
+    *is_const = const_of(s->n, v, k);
+    return *is_const || invariant(s->n, s->li, v);
+}
+
+/* Find the chains of the loop, rooted at the header phis with one
+   argument per edge that `roots` allows (all of them if NULL).  With
+   `build`, the offsets are computed in the preheader. */
+static void find_chains(Iv *s, const bool *roots, bool build)
+{
+    Loops *n = s->n;
+    const Loop *l = &n->loops.data[s->li];
+    s->serial++;
+    for (uint32_t j = 0; j < l->blocks.len; j++) {
+        uint32_t b = l->blocks.data[j];
+        for (uint32_t i = 0; i < n->f->blocks.data[b].ins.len; i++) {
+            const IrIns ins = n->f->blocks.data[b].ins.data[i];
+            if (ins.op == IR_PHI && b == l->header && ins.nargs == 2 &&
+                (!roots || (ins.dst < s->size && roots[ins.dst]))) {
+                set_chain(s, ins.dst, (Chain){ ins.dst, 0, IR_NONE, 0 });
+                continue;
+            }
+            if (ins.op == IR_COPY && ins.dst >= TEMP_NREGS && chain_of(s, ins.args[0])) {
+                set_chain(s, ins.dst, *chain_of(s, ins.args[0]));
+                continue;
+            }
+            if (ins.op != IR_BINOP || (ins.sub != T_PLUS && ins.sub != T_MINUS))
+                continue;
+            const Chain *c = chain_of(s, ins.args[0]);
+            Value y = ins.args[1];
+            if (!c && ins.sub == T_PLUS) {
+                c = chain_of(s, ins.args[1]);
+                y = ins.args[0];
+            }
+            bool is_const;
+            int64_t k;
+            if (!c || !iv_operand(s, y, &is_const, &k))
+                continue;
+            Chain r = *c;
+            r.depth++;
+            if (is_const)
+                r.offk = (int64_t)(ins.sub == T_PLUS ? (uint64_t)r.offk + (uint64_t)k
+                                                     : (uint64_t)r.offk - (uint64_t)k);
+            else if (!build)
+                r.offv = y;
+            else if (ins.sub == T_PLUS)
+                r.offv = r.offv == IR_NONE ? y : put_binop(n, l->pre, T_PLUS, r.offv, y);
+            else if (r.offv == IR_NONE) {
+                r.offv = put_binop(n, l->pre, T_MINUS, put_const(n, l->pre, r.offk), y);
+                r.offk = 0;
+            } else
+                r.offv = put_binop(n, l->pre, T_MINUS, r.offv, y);
+            set_chain(s, ins.dst, r);
+        }
+    }
+}
+
+/* The offset of `c` as one value, in block `b`. */
+static Value offset_value(Iv *s, uint32_t b, const Chain *c)
+{
+    if (c->offv == IR_NONE)
+        return put_const(s->n, b, c->offk);
+    if (!c->offk)
+        return c->offv;
+    return put_binop(s->n, b, T_PLUS, c->offv, put_const(s->n, b, c->offk));
+}
+
+/* The positions of the preheader and the latch among the header's
+   predecessors. */
+static void edges(const Iv *s, uint32_t *kpre, uint32_t *klatch)
+{
+    const Loop *l = &s->n->loops.data[s->li];
+    const IrBlock *hb = &s->n->f->blocks.data[l->header];
+    *kpre = hb->preds.data[0] == l->pre ? 0 : 1;
+    *klatch = 1 - *kpre;
+}
+
+static const IrIns *header_phi(const Iv *s, Value v)
+{
+    const IrIns *d = def_of(s->n->f, s->n->def, v);
+    return d && d->op == IR_PHI ? d : NULL;
+}
+
+/* What recurrence `root` adds each time round, as a value in the
+   preheader. */
+static Value step_of(Iv *s, Value root)
+{
+    uint32_t kpre, klatch;
+    edges(s, &kpre, &klatch);
+    const Chain *c = chain_of(s, header_phi(s, root)->args[klatch]);
+    return offset_value(s, s->n->loops.data[s->li].pre, c);
+}
+
+/* A new recurrence starting at `init` and stepping by `step`. */
+static Value new_recurrence(Iv *s, Value init, Value step)
+{
+    Loops *n = s->n;
+    const Loop *l = &n->loops.data[s->li];
+    uint32_t kpre, klatch;
+    edges(s, &kpre, &klatch);
+    IrIns phi = { .op = IR_PHI, .dst = ir_new_value(n->f), .nargs = 2 };
+    phi.args = arena_alloc(n->f->arena, 2 * sizeof *phi.args);
+    phi.args[kpre] = init;
+    Value p = put(n, l->header, phi);
+    phi.args[klatch] = put_binop(n, l->latch, T_PLUS, p, step);
+    return p;
+}
+
+static void replace(Iv *s, Value from, Value to)
+{
+    vec_push(&s->repl, from);
+    vec_push(&s->repl, to);
+}
+
+/* Whether x * k has to be multiplied for rather than being part of an
+   address. */
+static bool worth_reducing(int64_t k)
+{
+    return k != 0 && k != 1 && k != 2 && k != 4 && k != 8;
+}
+
+/* Rewrite the chains and reduce the products of one loop. */
+static void reduce(Iv *s)
+{
+    Loops *n = s->n;
+    const Loop *l = &n->loops.data[s->li];
+    uint32_t kpre, klatch;
+    edges(s, &kpre, &klatch);
+    for (uint32_t j = 0; j < l->blocks.len; j++) {
+        uint32_t b = l->blocks.data[j];
+        for (uint32_t i = 0; i < n->f->blocks.data[b].ins.len; i++) {
+            IrIns *ins = &n->f->blocks.data[b].ins.data[i];
+            if (ins->op != IR_BINOP || ins->dst >= s->size)
+                continue;
+            const Chain *c = chain_of(s, ins->dst);
+            if (c && c->depth >= 2 && s->rec[c->root]) {
+                Value *args = arena_alloc(n->f->arena, 2 * sizeof *args);
+                args[0] = c->root;
+                args[1] = offset_value(s, l->pre, c);
+                ins = &n->f->blocks.data[b].ins.data[i];
+                ins->sub = T_PLUS;
+                ins->args = args;
+                continue;
+            }
+            if (c)
+                continue;
+
+            /* x * k for an invariant k goes up by step * k.  An address
+               a[i] is a + i * 8, which stays as it is for the subscript
+               to fold into the load. */
+            if (ins->sub != T_MUL)
+                continue;
+            const Chain *xc = NULL;
+            Value k = IR_NONE;
+            bool is_const = false;
+            int64_t kk = 0;
+            for (uint32_t a = 0; a < 2 && !xc; a++) {
+                const Chain *c2 = chain_of(s, ins->args[a]);
+                if (c2 && s->rec[c2->root] && iv_operand(s, ins->args[1 - a], &is_const, &kk)) {
+                    xc = c2;
+                    k = ins->args[1 - a];
+                }
+            }
+            if (!xc || (is_const && !worth_reducing(kk)))
+                continue;
+
+            Value d = ins->dst;
+            Value i0 = header_phi(s, xc->root)->args[kpre];
+            Value step = step_of(s, xc->root);
+            Value kv = is_const ? put_const(n, l->pre, kk) : k;
+            Value x0 = put_binop(n, l->pre, T_PLUS, i0, offset_value(s, l->pre, xc));
+            Value init = put_binop(n, l->pre, T_MUL, x0, kv);
+            replace(s, d, new_recurrence(s, init, put_binop(n, l->pre, T_MUL, step, kv)));
+        }
+    }
+}
+
+/* Whether a test on the way into the loop made sure that i0 <= lim. */
+static bool entered_below(const Iv *s, Value i0, Value lim)
+{
+    const Loops *n = s->n;
+    uint32_t pre = n->loops.data[s->li].pre, child = pre;
+    for (int up = 0; up < 16 && child != 0; up++) {
+        uint32_t d = n->f->blocks.data[child].idom;
+        const IrBlock *db = &n->f->blocks.data[d];
+        const IrIns *t = &db->ins.data[db->ins.len - 1];
+        child = d;
+        if (t->op != IR_CJUMP || db->succ[0] == db->succ[1])
+            continue;
+        uint32_t taken = IR_NONE;
+        for (uint32_t k = 0; k < 2; k++)
+            if (n->f->blocks.data[db->succ[k]].preds.len == 1 && dominates(n, db->succ[k], pre))
+                taken = k;
+        if (taken == IR_NONE)
+            continue;
+        TRelOp op = taken ? t_not_rel((TRelOp)t->sub) : (TRelOp)t->sub;
+        Value x = t->args[0], y = t->args[1];
+        if (op == T_GE || op == T_GT) {
+            op = t_commute_rel(op);
+            x = t->args[1];
+            y = t->args[0];
+        }
+        if ((op == T_LE || op == T_LT) && x == i0 && y == lim)
+            return true;
+    }
+    return false;
+}
+
+static int by_value(const void *x, const void *y)
+{
+    Value a = *(const Value *)x, b = *(const Value *)y;
+    return (a > b) - (a < b);
+}
+
+/* Replace a loop that does nothing but compute values by their closed
+   form after it.  Returns whether the loop went. */
+static bool close_loop(Iv *s)
+{
+    Loops *n = s->n;
+    IrFunc *f = n->f;
+    const Loop *l = &n->loops.data[s->li];
+    if (l->calls || l->stores)
+        return false;
+    uint32_t exit = IR_NONE, to = IR_NONE, nexit = 0;
+    for (uint32_t j = 0; j < l->blocks.len; j++) {
+        uint32_t b = l->blocks.data[j];
+        if (n->inner[b] != s->li)
+            return false;   /* which might not end */
+        const IrBlock *blk = &f->blocks.data[b];
+        for (uint32_t k = 0; k < blk->nsucc; k++)
+            if (!in_loop(n, blk->succ[k], s->li))
+                nexit++, exit = b, to = blk->succ[k];
+    }
+    if (nexit != 1 || !dominates(n, exit, l->latch))
+        return false;
+
+    /* cjump iv < lim staying, with iv stepping by 1. */
+    const IrBlock *eb = &f->blocks.data[exit];
+    const IrIns *t = &eb->ins.data[eb->ins.len - 1];
+    if (t->op != IR_CJUMP)
+        return false;
+    TRelOp op = eb->succ[0] == to ? t_not_rel((TRelOp)t->sub) : (TRelOp)t->sub;
+    Value iv = t->args[0], lim = t->args[1];
+    if (op == T_GT) {
+        op = T_LT;
+        iv = t->args[1];
+        lim = t->args[0];
+    }
+    bool is_const;
+    int64_t k = 0;
+    const Chain *ic = chain_of(s, iv);
+    if (op != T_LT || !ic || ic->root != iv || !s->rec[iv] || !iv_operand(s, lim, &is_const, &k))
+        return false;
+    uint32_t kpre, klatch;
+    edges(s, &kpre, &klatch);
+    const Chain *step = chain_of(s, header_phi(s, iv)->args[klatch]);
+    if (step->offv != IR_NONE || step->offk != 1)
+        return false;
+
+    /* Every value used after the loop must be a chain. */
+    VEC(Value) out = {0};
+    for (uint32_t b = 0; b < f->blocks.len; b++) {
+        if (in_loop(n, b, s->li) || f->blocks.data[b].dead)
+            continue;
+        const IrBlock *blk = &f->blocks.data[b];
+        for (uint32_t i = 0; i < blk->ins.len; i++)
+            for (uint32_t a = 0; a < blk->ins.data[i].nargs; a++) {
+                Value v = blk->ins.data[i].args[a];
+                if (v < TEMP_NREGS || n->def[v].block == IR_NONE ||
+                    !in_loop(n, n->def[v].block, s->li))
+                    continue;
+                const Chain *c = chain_of(s, v);
+                if (!c || !s->rec[c->root]) {
+                    vec_free(&out);
+                    return false;
+                }
+                vec_push(&out, v);
+            }
+    }
+
+    Value i0 = header_phi(s, iv)->args[kpre];
+    int64_t k0 = 0;
+    bool known = is_const && const_of(n, i0, &k0);
+    if (!known && !entered_below(s, i0, lim)) {
+        vec_free(&out);
+        return false;
+    }
+
+    /* A block on the way out to hold the values. */
+    uint32_t q = f->blocks.len;
+    vec_push(&f->blocks, ((IrBlock){ .label = label_new() }));
+    IrBlock *qb = &f->blocks.data[q];
+    vec_push(&qb->ins, ((IrIns){ .op = IR_JUMP, .dst = IR_NONE }));
+    qb->succ[0] = to;
+    qb->nsucc = 1;
+    qb->idom = exit;
+    vec_push(&qb->preds, exit);
+    Value trips = known ? put_const(n, q, k0 < k ? (int64_t)((uint64_t)k - (uint64_t)k0) : 0)
+                        : put_binop(n, q, T_MINUS, is_const ? put_const(n, q, k) : lim, i0);
+    IrBlock *tb = &f->blocks.data[to];
+    for (uint32_t j = 0; j < tb->preds.len; j++)
+        if (tb->preds.data[j] == exit)
+            tb->preds.data[j] = q;
+    eb = &f->blocks.data[exit];
+    f->blocks.data[exit].succ[eb->succ[0] == to ? 0 : 1] = q;
+
+    qsort(out.data, out.len, sizeof *out.data, by_value);
+    for (uint32_t j = 0; j < out.len; j++) {
+        Value v = out.data[j];
+        if (j && out.data[j - 1] == v)
+            continue;
+        const Chain *c = chain_of(s, v);
+        Value x0 = header_phi(s, c->root)->args[kpre];
+        Value sum = put_binop(n, q, T_MUL, step_of(s, c->root), trips);
+        Value r = put_binop(n, q, T_PLUS, put_binop(n, q, T_PLUS, x0, sum),
+                            offset_value(s, q, c));
+        replace(s, v, r);
+    }
+    vec_free(&out);
+
+    /* Go round it. */
+    l = &n->loops.data[s->li];
+    f->blocks.data[l->pre].succ[0] = q;
+    f->blocks.data[q].preds.data[0] = l->pre;
+    for (uint32_t j = 0; j < l->blocks.len; j++)
+        f->blocks.data[l->blocks.data[j]].dead = true;
+    return true;
+}
+
+/* Simplify the induction variables of loop `li`; returns whether the
+   loop went. */
+static bool iv_loop(Iv *s, uint32_t li)
+{
+    Loops *n = s->n;
+    const Loop *l = &n->loops.data[li];
+    s->li = li;
+    if (l->pre == IR_NONE || l->latch == IR_NONE || l->calls)
+        return false;
+    licm_loop(n, li, NULL);
+
+    /* The header phis whose latch argument is a chain back to them. */
+    uint32_t kpre, klatch;
+    edges(s, &kpre, &klatch);
+    find_chains(s, NULL, false);
+    const IrBlock *hb = &n->f->blocks.data[l->header];
+    bool any = false;
+    for (uint32_t i = 0; i < hb->ins.len; i++) {
+        const IrIns *phi = &hb->ins.data[i];
+        if (phi->op != IR_PHI || phi->nargs != 2 || phi->dst >= s->size)
+            continue;
+        const Chain *c = chain_of(s, phi->args[klatch]);
+        s->rec[phi->dst] = c && c->root == phi->dst;
+        any |= s->rec[phi->dst];
+    }
+    if (!any)
+        return false;
+    find_chains(s, s->rec, true);
+    reduce(s);
+    bool gone = close_loop(s);
+
+    hb = &n->f->blocks.data[n->loops.data[li].header];
+    for (uint32_t i = 0; i < hb->ins.len; i++)
+        if (hb->ins.data[i].dst < s->size)
+            s->rec[hb->ins.data[i].dst] = false;
+    if (s->repl.len) {
+        Value *repl = repl_new(n->f);
+        for (uint32_t i = 0; i < s->repl.len; i += 2)
+            repl[s->repl.data[i]] = s->repl.data[i + 1];
+        apply_repl(n->f, repl);
+        free(repl);
+        s->repl.len = 0;
+    }
+    return gone;
+}
+
+/* Nests go one level a round. */
+enum { IV_ROUNDS = 4 };
+
+void opt_iv(IrFunc *f, const OptGlobals *g)
+{
+    for (int round = 0; round < IV_ROUNDS; round++) {
+        Loops n = { .f = f, .g = g };
+        loops_find(&n);
+        Iv s = { .n = &n, .size = f->nvalues };
+        s.ch = xmalloc(s.size * sizeof *s.ch);
+        s.stamp = xcalloc(s.size, sizeof *s.stamp);
+        s.rec = xcalloc(s.size, sizeof *s.rec);
+        bool again = false;
+        for (uint32_t i = 0; i < n.loops.len; i++) {
+            if (n.loops.data[i].stale) {
+                again = true;
+                continue;
+            }
+            if (!iv_loop(&s, i))
+                continue;
+            for (uint32_t k = n.loops.data[i].parent; k != IR_NONE; k = n.loops.data[k].parent)
+                n.loops.data[k].stale = true;
+        }
+        free(s.ch);
+        free(s.stamp);
+        free(s.rec);
+        vec_free(&s.repl);
+        loops_free(&n);
+        ir_compact(f);
+        if (!again)
+            break;
+    }
+}
+
+/* ---- Dead code elimination ------------------------------------------------- */
+
+void opt_dce(IrFunc *f)
+{
+    Site *def = def_sites(f);
+    bool *live = xcalloc(f->nvalues, sizeof *live);
+    VEC(Value) work = {0};
+
+    /* Roots: effects, control flow and writes to machine registers. */
+    for (uint32_t b = 0; b < f->blocks.len; b++) {
+        IrBlock *blk = &f->blocks.data[b];
+        for (uint32_t i = 0; i < blk->ins.len; i++) {
+            IrIns *ins = &blk->ins.data[i];
+            if (ir_is_pure(ins) && ins->dst >= TEMP_NREGS)
+                continue;
+            for (uint32_t k = 0; k < ins->nargs; k++)
+                if (!live[ins->args[k]]) {
+                    live[ins->args[k]] = true;
+                    vec_push(&work, ins->args[k]);
+                }
+        }
+    }
+    while (work.len) {
+        const IrIns *ins = def_of(f, def, work.data[--work.len]);
+        if (!ins)
+            continue;
+        for (uint32_t k = 0; k < ins->nargs; k++)
+            if (!live[ins->args[k]]) {
+                live[ins->args[k]] = true;
+                vec_push(&work, ins->args[k]);
+            }
+    }
+
+    for (uint32_t b = 0; b < f->blocks.len; b++) {
+        IrBlock *blk = &f->blocks.data[b];
+        /* A conditional jump with one target is a jump. */
+        IrIns *t = &blk->ins.data[blk->ins.len - 1];
+        if (t->op == IR_CJUMP && blk->succ[0] == blk->succ[1]) {
+            t->op = IR_JUMP;
+            t->nargs = 0;
+            blk->nsucc = 1;
+            ir_remove_pred(f, blk->succ[0], b);
+        }
+    }
+    for (uint32_t b = 0; b < f->blocks.len; b++) {
+        IrBlock *blk = &f->blocks.data[b];
+        for (uint32_t i = 0; i < blk->ins.len; i++) {
+            IrIns *ins = &blk->ins.data[i];
+            if (ins->dst == IR_NONE || ins->dst < TEMP_NREGS || live[ins->dst])
+                continue;
+            if (ir_is_pure(ins))
+                ins->op = IR_NOP;
+            else if (ins->op == IR_CALL)
+                ins->dst = IR_NONE;
+        }
+    }
+    ir_merge_blocks(f);
+
+    free(def);
+    free(live);
+    vec_free(&work);
+}
+
+/* ---- Pipeline ---------------------------------------------------------------- */
+
+/* The end of a pass started at `start`: its trace span and its dump. */
+static void end_pass(const IrFunc *f, const char *pass, uint64_t start, FILE *dump)
+{
+    trace_span(pass, start);
+    if (!dump)
+        return;
+    fprintf(dump, "# %s\n", pass);
+    ir_dump(f, dump);
+}
+
+void opt_function(IrFunc *f, const OptGlobals *g, FILE *dump)
+{
+    uint64_t t = trace_now();
+    opt_sccp(f, g);
+    end_pass(f, "sccp", t, dump);
+    t = trace_now();
+    opt_copyprop(f);
+    end_pass(f, "copyprop", t, dump);
+    t = trace_now();
+    opt_licm(f, g);
+    end_pass(f, "licm", t, dump);
+    t = trace_now();
+    opt_gvn(f);
+    end_pass(f, "gvn", t, dump);
+    t = trace_now();
+    opt_dce(f);
+    end_pass(f, "dce", t, dump);
+}
+
+void opt_program(Program *p, int opt, const InlineParams *inl, FILE *ssa_dump)
+{
+    Phase prev = phase_enter(PHASE_IR);
+    OptGlobals globals = {0};
+    for (uint32_t i = 0; i < p->frags.len; i++) {
+        const Frag *f = &p->frags.data[i];
+        if (f->kind != FRAG_GLOBAL || !f->u.global.fixed)
+            continue;
+        idmap_put(&globals.fixed, f->label, 1);
+        if (f->u.global.constant) {
+            idmap_put(&globals.index, f->label, globals.values.len);
+            vec_push(&globals.values, f->u.global.value);
+        }
+    }
+    VEC(IrFunc) funcs = {0};
+    VEC(Frame *) frames = {0};
+    for (uint32_t i = 0; i < p->frags.len; i++) {
+        Frag *f = &p->frags.data[i];
+        if (f->kind != FRAG_PROC)
+            continue;
+        phase_enter(PHASE_IR);
+        uint64_t t = trace_open();
+        StmList stms = {0};
+        BlockList blocks;
+        canon_linearize(&p->arena, f->u.proc.body, &stms);
+        canon_blocks(&p->arena, &stms, &blocks);
+        if (opt) {
+            phase_enter(PHASE_OPT);
+            IrFunc ir;
+            ir_build(&ir, &p->arena, f->label, &blocks);
+            ir.profiled = f->u.proc.frame->profiled;
+            ir.calls = f->u.proc.frame->calls;
+            block_list_free(&blocks);
+            if (ssa_dump) {
+                fputs("# ssa\n", ssa_dump);
+                ir_dump(&ir, ssa_dump);
+            }
+            opt_function(&ir, &globals, ssa_dump);
+            vec_push(&funcs, ir);
+            vec_push(&frames, f->u.proc.frame);
+        } else {
+            stms.len = 0;
+            canon_trace(&p->arena, &blocks, &f->u.proc.frame->freq, &stms);
+            f->u.proc.body = stm_list_seq(&p->arena, &stms);
+            block_list_free(&blocks);
+        }
+        vec_free(&stms);
+        trace_close(sym_name(label_sym(f->label)), t);
+    }
+    if (opt >= 2) {
+        phase_enter(PHASE_OPT);
+        uint64_t t = trace_now();
+        opt_inline(funcs.data, funcs.len, inl, &globals, ssa_dump);
+        trace_span("inline", t);
+    }
+    if (opt) {
+        phase_enter(PHASE_OPT);
+        uint64_t t = trace_now();
+        opt_objects(funcs.data, frames.data, funcs.len, &globals, ssa_dump);
+        trace_span("objects", t);
+    }
+    for (uint32_t i = 0, k = 0; opt && i < p->frags.len; i++) {
+        Frag *f = &p->frags.data[i];
+        if (f->kind != FRAG_PROC)
+            continue;
+        phase_enter(PHASE_OPT);
+        uint64_t t = trace_open();
+        StmList stms = {0};
+        BlockList blocks;
+        uint64_t t1 = trace_now();
+        opt_iv(&funcs.data[k], &globals);
+        end_pass(&funcs.data[k], "iv", t1, ssa_dump);
+        t1 = trace_now();
+        opt_dce(&funcs.data[k]);
+        end_pass(&funcs.data[k], "dce", t1, ssa_dump);
+        ir_lower(&funcs.data[k], &blocks);
+        ir_free(&funcs.data[k++]);
+        phase_enter(PHASE_IR);
+        canon_trace(&p->arena, &blocks, &f->u.proc.frame->freq, &stms);
+        f->u.proc.body = stm_list_seq(&p->arena, &stms);
+        vec_free(&stms);
+        block_list_free(&blocks);
+        trace_close(sym_name(label_sym(f->label)), t);
+    }
+    vec_free(&funcs);
+    vec_free(&frames);
+    idmap_free(&globals.index);
+    idmap_free(&globals.fixed);
+    vec_free(&globals.values);
+    phase_enter(prev);
+}
@@ -0,0 +1,109 @@
+#ifndef TIGER_OPT_H
+#define TIGER_OPT_H
+
+#include <stdio.h>
+
+#include "ir.h"
+#include "translate.h"
+
+/*
+ * Scalar optimizations on the SSA IR, run in this order from -O1 up:
+ *
+ *   sccp      sparse conditional constant propagation (Wegman and
+ *             Zadeck): folds constants along executable paths only and
+ *             removes the branches and blocks it proves dead;
+ *   copyprop  replaces copies and single-valued phis by their source;
+ *   licm      gives every natural loop a preheader and hoists into
+ *             those of loops without calls, innermost loops first, the
+ *             arithmetic whose operands the loop does not change, and
+ *             the loads of fixed globals the loop does not store to (of
+ *             anything, in a loop that does not store, when the header
+ *             loads it), once for each preheader;
+ *   gvn       dominator-scoped value numbering of constants, addresses
+ *             and arithmetic;
+ *   dce       deletes pure instructions whose values are never used.
+ */
+
+/* What the passes know about global words.  No store follows the
+   initialization of a fixed word, which the front end guarantees runs
+   before any read (but runs again each time round a loop holding the
+   declaration); a constant one is always initialized to the same
+   value. */
+typedef struct OptGlobals {
+    IdMap index;            /* Label -> position in `values`: constants */
+    VEC(int64_t) values;
+    IdMap fixed;            /* Label -> 1: fixed words, constants among them */
+} OptGlobals;
+
+void opt_sccp(IrFunc *f, const OptGlobals *g);
+void opt_copyprop(IrFunc *f);
+void opt_licm(IrFunc *f, const OptGlobals *g);
+void opt_gvn(IrFunc *f);
+void opt_dce(IrFunc *f);
+
+/* Run the passes over `f`, in place.  If `dump` is not NULL, print the
+   IR after every pass. */
+void opt_function(IrFunc *f, const OptGlobals *g, FILE *dump);
+
+/*
+ * Induction variables, once per function after inlining, which leaves
+ * more loops without calls, followed by dce.  In every loop with one
+ * latch and no calls, after licm, the header phis that each iteration
+ * adds an invariant to are its recurrences, and a value that is a
+ * recurrence plus invariants is rewritten as the recurrence plus one
+ * invariant computed in the preheader.  A product of such a value and
+ * an invariant becomes a recurrence of its own, added to instead of
+ * multiplied (strength reduction), but for the multiplications by 2, 4
+ * and 8 that fold into an address.  A loop without stores or inner
+ * loops, left only through the test that a recurrence stepping by 1 is
+ * below an invariant limit, and entered only with the recurrence at
+ * most that limit, takes a known number of iterations: the values it
+ * leaves with get their closed form after it, and the loop goes.  Inner
+ * loops go first, so that a nest of them can go too.
+ */
+void opt_iv(IrFunc *f, const OptGlobals *g);
+
+/*
+ * Inlining at -O2, over every function of the program at once, callees
+ * before callers.  A call is replaced by a copy of the callee's body
+ * when the callee keeps nothing in its frame (no escaping variable, no
+ * frame that a nested function takes as its static link, no stack
+ * arguments), has at most `limit` instructions, or half as many if it
+ * calls functions of its own, and the program has grown by less than
+ * `growth` percent (or `limit` instructions, if that is more).  Calls that came out of `depth` inlined bodies stay
+ * calls, which bounds how far recursion unrolls.  Functions that change
+ * go through opt_function() again.  With -fprofile-use, calls in or to
+ * functions that never ran stay calls, and callees that ran often may
+ * be larger.
+ */
+typedef struct InlineParams {
+    uint32_t limit;
+    uint32_t growth;
+    uint32_t depth;
+} InlineParams;
+
+#define INLINE_DEFAULTS ((InlineParams){ .limit = 40, .growth = 50, .depth = 2 })
+
+void opt_inline(IrFunc *funcs, uint32_t n, const InlineParams *p, const OptGlobals *g,
+                FILE *dump);
+
+/*
+ * Records and arrays of constant, small size that do not escape the
+ * function allocating them, after inlining: they are only loaded from,
+ * stored to, compared, and handed to parameters that are inert, which
+ * the callee (and whoever it hands them on to) treats the same way.  A
+ * record that only has its words read and written, and is compared with
+ * nil at most, becomes one SSA value per word; any other one lives in
+ * `frames[i]`, pointer words in slots the collector scans.  Card marks
+ * of stores into either go.  Functions that change go through
+ * opt_function() again.
+ */
+void opt_objects(IrFunc *funcs, Frame **frames, uint32_t n, const OptGlobals *g, FILE *dump);
+
+/* Replace each function body of `p` by its canonical, traced
+   statements, optimized in SSA form from -O1 up, after inlining at -O2,
+   the objects that stay in their function out of the heap.  `dump` as
+   for opt_function(). */
+void opt_program(Program *p, int opt, const InlineParams *inl, FILE *dump);
+
+#endif
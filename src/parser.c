@@ -0,0 +1,1020 @@
+#include "parser.h"
+
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "diag.h"
+
+/*
+ * Two drivers share one set of grammar helpers.  Recursive descent is the
+ * default; binary operators are parsed by precedence climbing, so an
+ * operand reaches its operator after one call however many precedence
+ * levels Tiger has.  The explicit-stack driver walks the same grammar
+ * with its continuations in a heap-allocated frame stack, so nesting
+ * depth is bounded by memory rather than by the C stack.
+ */
+
+enum { FAIL_SYNTAX = 1, FAIL_TOO_DEEP = 2 };
+
+typedef struct PFrame PFrame;
+
+typedef struct Parser {
+    Ast *ast;
+    Source *src;
+    const Token *toks;
+    uint32_t pos;
+    ParseMode mode;
+    uint32_t depth;
+    jmp_buf fail;
+
+    /* Scratch stacks for children of nodes under construction.  Each
+       construct remembers where its run starts and moves it into the AST
+       when complete, so nested constructs never interleave. */
+    VEC(uint32_t) ids;
+    VEC(EField) efields;
+    VEC(Field) fields;
+
+    VEC(PFrame) stack;
+} Parser;
+
+/* ---- Tokens ------------------------------------------------------------ */
+
+static inline const Token *peek(const Parser *p)
+{
+    return &p->toks[p->pos];
+}
+
+static inline TokKind peek_kind(const Parser *p)
+{
+    return (TokKind)p->toks[p->pos].kind;
+}
+
+static inline const Token *advance(Parser *p)
+{
+    const Token *t = &p->toks[p->pos];
+    if (t->kind != TOK_EOF)
+        p->pos++;
+    return t;
+}
+
+static inline bool accept(Parser *p, TokKind k)
+{
+    if (peek_kind(p) != k)
+        return false;
+    p->pos++;
+    return true;
+}
+
+static noreturn void syntax_error(Parser *p, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+
+static noreturn void syntax_error(Parser *p, const char *fmt, ...)
+{
+    char msg[256];
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(msg, sizeof msg, fmt, ap);
+    va_end(ap);
+    diag_error(p->src, peek(p)->offset, "syntax error: %s, found %s",
+               msg, token_names[peek_kind(p)]);
+    longjmp(p->fail, FAIL_SYNTAX);
+}
+
+static const Token *expect(Parser *p, TokKind k)
+{
+    if (peek_kind(p) != k)
+        syntax_error(p, "expected %s", token_names[k]);
+    return advance(p);
+}
+
+static Symbol expect_id(Parser *p)
+{
+    return expect(p, TOK_ID)->value;
+}
+
+/* ---- Operators --------------------------------------------------------- */
+
+enum {
+    PREC_NONE = 0,
+    PREC_OR = 1,
+    PREC_AND,
+    PREC_CMP,
+    PREC_ADD,
+    PREC_MUL,
+    PREC_UNARY,     /* above every binary operator */
+};
+
+/* BinOp + 1 for operator tokens, 0 otherwise. */
+static const uint8_t tok_binop[TOK_COUNT] = {
+    [TOK_PLUS] = OP_PLUS + 1, [TOK_MINUS] = OP_MINUS + 1,
+    [TOK_TIMES] = OP_TIMES + 1, [TOK_DIVIDE] = OP_DIVIDE + 1,
+    [TOK_EQ] = OP_EQ + 1, [TOK_NEQ] = OP_NEQ + 1,
+    [TOK_LT] = OP_LT + 1, [TOK_LE] = OP_LE + 1,
+    [TOK_GT] = OP_GT + 1, [TOK_GE] = OP_GE + 1,
+    [TOK_AND] = OP_AND + 1, [TOK_OR] = OP_OR + 1,
+};
+
+static const uint8_t op_prec[OP_COUNT] = {
+    [OP_PLUS] = PREC_ADD, [OP_MINUS] = PREC_ADD,
+    [OP_TIMES] = PREC_MUL, [OP_DIVIDE] = PREC_MUL,
+    [OP_EQ] = PREC_CMP, [OP_NEQ] = PREC_CMP, [OP_LT] = PREC_CMP,
+    [OP_LE] = PREC_CMP, [OP_GT] = PREC_CMP, [OP_GE] = PREC_CMP,
+    [OP_AND] = PREC_AND, [OP_OR] = PREC_OR,
+};
+
+/* Precedence of the operator at the current token, PREC_NONE if none. */
+static inline int peek_prec(const Parser *p)
+{
+    unsigned op = tok_binop[peek_kind(p)];
+    return op ? op_prec[op - 1] : PREC_NONE;
+}
+
+/* Consume the operator at the current token and combine. */
+static ExpId climb_step(Parser *p, ExpId left, ExpId right, const Token *optok)
+{
+    BinOp op = (BinOp)(tok_binop[optok->kind] - 1);
+    ExpId x = ast_op(p->ast, optok->offset, op, left, right);
+    if (op_prec[op] == PREC_CMP && peek_prec(p) == PREC_CMP)
+        syntax_error(p, "comparison operators do not associate");
+    return x;
+}
+
+/* ---- Node construction shared by both drivers -------------------------- */
+
+static AstList take_ids(Parser *p, uint32_t start)
+{
+    AstList l = ast_list(p->ast, p->ids.data + start, p->ids.len - start);
+    p->ids.len = start;
+    return l;
+}
+
+static AstList take_efields(Parser *p, uint32_t start)
+{
+    AstList l = ast_efields(p->ast, p->efields.data + start, p->efields.len - start);
+    p->efields.len = start;
+    return l;
+}
+
+/* `(e1; ...; en)` collapses to `e1` when n == 1. */
+static ExpId mk_seq(Parser *p, uint32_t start, uint32_t pos)
+{
+    if (p->ids.len - start == 1) {
+        ExpId only = p->ids.data[start];
+        p->ids.len = start;
+        return only;
+    }
+    AstList l = take_ids(p, start);
+    ExpId id = ast_new_exp(p->ast, EXP_SEQ, pos);
+    ast_exp(p->ast, id)->u.seq.exps = l;
+    return id;
+}
+
+static ExpId mk_neg(Parser *p, uint32_t pos, ExpId x)
+{
+    return ast_op(p->ast, pos, OP_MINUS, ast_int(p->ast, pos, 0), x);
+}
+
+static ExpId mk_if(Parser *p, uint32_t pos, ExpId test, ExpId then, ExpId els)
+{
+    ExpId id = ast_new_exp(p->ast, EXP_IF, pos);
+    Exp *e = ast_exp(p->ast, id);
+    e->u.if_.test = test;
+    e->u.if_.then = then;
+    e->u.if_.els = els;
+    return id;
+}
+
+static ExpId mk_while(Parser *p, uint32_t pos, ExpId test, ExpId body)
+{
+    ExpId id = ast_new_exp(p->ast, EXP_WHILE, pos);
+    Exp *e = ast_exp(p->ast, id);
+    e->u.while_.test = test;
+    e->u.while_.body = body;
+    return id;
+}
+
+static ExpId mk_for(Parser *p, uint32_t pos, Symbol var, ExpId lo, ExpId hi, ExpId body)
+{
+    ExpId id = ast_new_exp(p->ast, EXP_FOR, pos);
+    Exp *e = ast_exp(p->ast, id);
+    e->u.for_.var = var;
+    e->u.for_.lo = lo;
+    e->u.for_.hi = hi;
+    e->u.for_.body = body;
+    return id;
+}
+
+static ExpId mk_call(Parser *p, uint32_t pos, Symbol func, uint32_t start)
+{
+    AstList args = take_ids(p, start);
+    ExpId id = ast_new_exp(p->ast, EXP_CALL, pos);
+    Exp *e = ast_exp(p->ast, id);
+    e->u.call.func = func;
+    e->u.call.args = args;
+    return id;
+}
+
+static ExpId mk_record(Parser *p, uint32_t pos, Symbol type, uint32_t start)
+{
+    AstList fields = take_efields(p, start);
+    ExpId id = ast_new_exp(p->ast, EXP_RECORD, pos);
+    Exp *e = ast_exp(p->ast, id);
+    e->u.record.type = type;
+    e->u.record.fields = fields;
+    return id;
+}
+
+static ExpId mk_array(Parser *p, uint32_t pos, Symbol type, ExpId size, ExpId init)
+{
+    ExpId id = ast_new_exp(p->ast, EXP_ARRAY, pos);
+    Exp *e = ast_exp(p->ast, id);
+    e->u.array.type = type;
+    e->u.array.size = size;
+    e->u.array.init = init;
+    return id;
+}
+
+static ExpId mk_assign(Parser *p, uint32_t pos, VarId var, ExpId rhs)
+{
+    ExpId id = ast_new_exp(p->ast, EXP_ASSIGN, pos);
+    Exp *e = ast_exp(p->ast, id);
+    e->u.assign.var = var;
+    e->u.assign.exp = rhs;
+    return id;
+}
+
+static ExpId mk_let(Parser *p, uint32_t pos, AstList decs, ExpId body)
+{
+    ExpId id = ast_new_exp(p->ast, EXP_LET, pos);
+    Exp *e = ast_exp(p->ast, id);
+    e->u.let.decs = decs;
+    e->u.let.body = body;
+    return id;
+}
+
+static VarId mk_simple_var(Parser *p, uint32_t pos, Symbol sym)
+{
+    VarId id = ast_new_var(p->ast, VAR_SIMPLE, pos);
+    ast_var(p->ast, id)->u.simple.sym = sym;
+    return id;
+}
+
+static VarId mk_subscript(Parser *p, uint32_t pos, VarId base, ExpId index)
+{
+    VarId id = ast_new_var(p->ast, VAR_SUBSCRIPT, pos);
+    Var *v = ast_var(p->ast, id);
+    v->u.subscript.var = base;
+    v->u.subscript.index = index;
+    return id;
+}
+
+/* Apply `.field` selectors; stops at '[' or anything else. */
+static VarId parse_field_selectors(Parser *p, VarId v)
+{
+    while (peek_kind(p) == TOK_DOT) {
+        uint32_t pos = advance(p)->offset;
+        Symbol f = expect_id(p);
+        VarId id = ast_new_var(p->ast, VAR_FIELD, pos);
+        Var *fv = ast_var(p->ast, id);
+        fv->u.field.var = v;
+        fv->u.field.sym = f;
+        v = id;
+    }
+    return v;
+}
+
+/* tyfields: [id : id {, id : id}] up to (but not including) `close`. */
+static AstList parse_tyfields(Parser *p, TokKind close)
+{
+    uint32_t start = p->fields.len;
+    if (peek_kind(p) != close) {
+        do {
+            const Token *t = expect(p, TOK_ID);
+            Field f = { .name = t->value, .pos = t->offset };
+            expect(p, TOK_COLON);
+            f.type = expect_id(p);
+            vec_push(&p->fields, f);
+        } while (accept(p, TOK_COMMA));
+    }
+    AstList l = ast_fields(p->ast, p->fields.data + start, p->fields.len - start);
+    p->fields.len = start;
+    return l;
+}
+
+/* `type id = ty`; contains no expressions, so it is parsed whole. */
+static DecId parse_type_dec(Parser *p)
+{
+    uint32_t pos = expect(p, TOK_TYPE)->offset;
+    Symbol name = expect_id(p);
+    expect(p, TOK_EQ);
+
+    TyId ty;
+    const Token *t = peek(p);
+    if (t->kind == TOK_ID) {
+        advance(p);
+        ty = ast_new_ty(p->ast, TY_NAME, t->offset);
+        ast_ty(p->ast, ty)->u.name.sym = t->value;
+    } else if (t->kind == TOK_LBRACE) {
+        advance(p);
+        AstList fields = parse_tyfields(p, TOK_RBRACE);
+        expect(p, TOK_RBRACE);
+        ty = ast_new_ty(p->ast, TY_RECORD, t->offset);
+        ast_ty(p->ast, ty)->u.record.fields = fields;
+    } else if (t->kind == TOK_ARRAY) {
+        advance(p);
+        expect(p, TOK_OF);
+        Symbol elem = expect_id(p);
+        ty = ast_new_ty(p->ast, TY_ARRAY, t->offset);
+        ast_ty(p->ast, ty)->u.array.sym = elem;
+    } else {
+        syntax_error(p, "expected type");
+    }
+
+    DecId id = ast_new_dec(p->ast, DEC_TYPE, pos, name);
+    ast_dec(p->ast, id)->u.type.ty = ty;
+    return id;
+}
+
+/* `var id [: id] :=`, leaving the initializer to the caller. */
+static DecId parse_var_header(Parser *p)
+{
+    uint32_t pos = expect(p, TOK_VAR)->offset;
+    Symbol name = expect_id(p);
+    Symbol type = SYM_NONE;
+    if (accept(p, TOK_COLON))
+        type = expect_id(p);
+    expect(p, TOK_ASSIGN);
+    DecId id = ast_new_dec(p->ast, DEC_VAR, pos, name);
+    ast_dec(p->ast, id)->u.var.type = type;
+    return id;
+}
+
+/* `function id ( tyfields ) [: id] =`, leaving the body to the caller. */
+static DecId parse_function_header(Parser *p)
+{
+    uint32_t pos = expect(p, TOK_FUNCTION)->offset;
+    Symbol name = expect_id(p);
+    expect(p, TOK_LPAREN);
+    AstList params = parse_tyfields(p, TOK_RPAREN);
+    expect(p, TOK_RPAREN);
+    Symbol result = SYM_NONE;
+    if (accept(p, TOK_COLON))
+        result = expect_id(p);
+    expect(p, TOK_EQ);
+    DecId id = ast_new_dec(p->ast, DEC_FUNCTION, pos, name);
+    Dec *d = ast_dec(p->ast, id);
+    d->u.function.params = params;
+    d->u.function.result = result;
+    return id;
+}
+
+static void set_dec_exp(Parser *p, DecId id, ExpId x)
+{
+    Dec *d = ast_dec(p->ast, id);
+    if (d->kind == DEC_VAR)
+        d->u.var.init = x;
+    else
+        d->u.function.body = x;
+}
+
+enum { NO_RUN = UINT32_MAX };
+
+/*
+ * A let's declarations accumulate on the ids stack.  Consecutive type or
+ * function declarations form an open run starting at `*run`; a
+ * declaration of another kind, or the end of the list, closes the run
+ * into one batch node.
+ */
+static void close_batch(Parser *p, uint32_t *run)
+{
+    if (*run == NO_RUN)
+        return;
+    const Dec *first = ast_dec(p->ast, p->ids.data[*run]);
+    DecKind kind = first->kind == DEC_TYPE ? DEC_TYPES : DEC_FUNCTIONS;
+    uint32_t pos = first->pos;
+    AstList members = take_ids(p, *run);
+    DecId b = ast_new_dec(p->ast, kind, pos, SYM_NONE);
+    ast_dec(p->ast, b)->u.batch.decs = members;
+    vec_push(&p->ids, b);
+    *run = NO_RUN;
+}
+
+static void add_dec(Parser *p, uint32_t *run, DecId d)
+{
+    DecKind kind = ast_dec(p->ast, d)->kind;
+    if (*run != NO_RUN && ast_dec(p->ast, p->ids.data[*run])->kind != kind)
+        close_batch(p, run);
+    if (kind != DEC_VAR && *run == NO_RUN)
+        *run = p->ids.len;
+    vec_push(&p->ids, d);
+}
+
+/* Atoms that need no further parsing, or AST_NONE. */
+static ExpId parse_atom(Parser *p)
+{
+    const Token *t = peek(p);
+    ExpId id;
+    switch (t->kind) {
+    case TOK_INT:
+        advance(p);
+        return ast_int(p->ast, t->offset, (int32_t)t->value);
+    case TOK_STRING:
+        advance(p);
+        id = ast_new_exp(p->ast, EXP_STRING, t->offset);
+        ast_exp(p->ast, id)->u.str.sym = t->value;
+        return id;
+    case TOK_NIL:
+        advance(p);
+        return ast_new_exp(p->ast, EXP_NIL, t->offset);
+    case TOK_BREAK:
+        advance(p);
+        return ast_new_exp(p->ast, EXP_BREAK, t->offset);
+    default:
+        return AST_NONE;
+    }
+}
+
+/* ---- Recursive descent ------------------------------------------------- */
+
+static ExpId rd_exp(Parser *p, int min_prec);
+
+static ExpId rd_climb(Parser *p, ExpId x, int min_prec)
+{
+    while (peek_prec(p) >= min_prec && peek_prec(p) != PREC_NONE) {
+        const Token *optok = advance(p);
+        ExpId rhs = rd_exp(p, op_prec[tok_binop[optok->kind] - 1] + 1);
+        x = climb_step(p, x, rhs, optok);
+    }
+    return x;
+}
+
+/* Expressions separated by `sep`; the caller consumes the terminator. */
+static void rd_exps(Parser *p, TokKind sep, TokKind close)
+{
+    if (peek_kind(p) == close)
+        return;
+    do {
+        ExpId x = rd_exp(p, PREC_NONE);
+        vec_push(&p->ids, x);
+    } while (accept(p, sep));
+}
+
+static ExpId rd_lvalue_tail(Parser *p, VarId v, uint32_t pos)
+{
+    for (;;) {
+        v = parse_field_selectors(p, v);
+        if (peek_kind(p) != TOK_LBRACK)
+            break;
+        uint32_t bpos = advance(p)->offset;
+        ExpId index = rd_exp(p, PREC_NONE);
+        expect(p, TOK_RBRACK);
+        v = mk_subscript(p, bpos, v, index);
+    }
+    if (peek_kind(p) == TOK_ASSIGN) {
+        uint32_t apos = advance(p)->offset;
+        return mk_assign(p, apos, v, rd_exp(p, PREC_NONE));
+    }
+    return ast_var_exp(p->ast, pos, v);
+}
+
+static ExpId rd_id(Parser *p)
+{
+    const Token *t = advance(p);
+    Symbol sym = t->value;
+    uint32_t pos = t->offset;
+
+    switch (peek_kind(p)) {
+    case TOK_LPAREN: {
+        advance(p);
+        uint32_t start = p->ids.len;
+        rd_exps(p, TOK_COMMA, TOK_RPAREN);
+        expect(p, TOK_RPAREN);
+        return mk_call(p, pos, sym, start);
+    }
+    case TOK_LBRACE: {
+        advance(p);
+        uint32_t start = p->efields.len;
+        if (peek_kind(p) != TOK_RBRACE) {
+            do {
+                const Token *f = expect(p, TOK_ID);
+                expect(p, TOK_EQ);
+                ExpId x = rd_exp(p, PREC_NONE);
+                EField ef = { f->value, x, f->offset };
+                vec_push(&p->efields, ef);
+            } while (accept(p, TOK_COMMA));
+        }
+        expect(p, TOK_RBRACE);
+        return mk_record(p, pos, sym, start);
+    }
+    case TOK_LBRACK: {
+        uint32_t bpos = advance(p)->offset;
+        ExpId index = rd_exp(p, PREC_NONE);
+        expect(p, TOK_RBRACK);
+        if (accept(p, TOK_OF))
+            return mk_array(p, pos, sym, index, rd_exp(p, PREC_NONE));
+        VarId v = mk_subscript(p, bpos, mk_simple_var(p, pos, sym), index);
+        return rd_lvalue_tail(p, v, pos);
+    }
+    default:
+        return rd_lvalue_tail(p, mk_simple_var(p, pos, sym), pos);
+    }
+}
+
+static ExpId rd_let(Parser *p)
+{
+    uint32_t pos = advance(p)->offset;
+    uint32_t start = p->ids.len;
+    uint32_t run = NO_RUN;
+    for (;;) {
+        DecId d;
+        TokKind k = peek_kind(p);
+        if (k == TOK_TYPE) {
+            d = parse_type_dec(p);
+        } else if (k == TOK_VAR || k == TOK_FUNCTION) {
+            d = k == TOK_VAR ? parse_var_header(p) : parse_function_header(p);
+            ExpId x = rd_exp(p, PREC_NONE);
+            set_dec_exp(p, d, x);
+        } else {
+            break;
+        }
+        add_dec(p, &run, d);
+    }
+    close_batch(p, &run);
+    AstList decs = take_ids(p, start);
+    uint32_t bpos = expect(p, TOK_IN)->offset;
+    start = p->ids.len;
+    rd_exps(p, TOK_SEMI, TOK_END);
+    expect(p, TOK_END);
+    return mk_let(p, pos, decs, mk_seq(p, start, bpos));
+}
+
+static ExpId rd_operand(Parser *p)
+{
+    if (++p->depth > PARSE_MAX_RECURSION && p->mode == PARSE_AUTO)
+        longjmp(p->fail, FAIL_TOO_DEEP);
+
+    ExpId x = parse_atom(p);
+    if (x != AST_NONE) {
+        p->depth--;
+        return x;
+    }
+
+    const Token *t = peek(p);
+    uint32_t pos = t->offset;
+    switch (t->kind) {
+    case TOK_ID:
+        x = rd_id(p);
+        break;
+    case TOK_MINUS:
+        advance(p);
+        x = mk_neg(p, pos, rd_operand(p));
+        break;
+    case TOK_LPAREN: {
+        advance(p);
+        uint32_t start = p->ids.len;
+        rd_exps(p, TOK_SEMI, TOK_RPAREN);
+        expect(p, TOK_RPAREN);
+        x = mk_seq(p, start, pos);
+        break;
+    }
+    case TOK_IF: {
+        advance(p);
+        ExpId test = rd_exp(p, PREC_NONE);
+        expect(p, TOK_THEN);
+        ExpId then = rd_exp(p, PREC_NONE);
+        ExpId els = AST_NONE;
+        if (accept(p, TOK_ELSE))
+            els = rd_exp(p, PREC_NONE);
+        x = mk_if(p, pos, test, then, els);
+        break;
+    }
+    case TOK_WHILE: {
+        advance(p);
+        ExpId test = rd_exp(p, PREC_NONE);
+        expect(p, TOK_DO);
+        x = mk_while(p, pos, test, rd_exp(p, PREC_NONE));
+        break;
+    }
+    case TOK_FOR: {
+        advance(p);
+        Symbol var = expect_id(p);
+        expect(p, TOK_ASSIGN);
+        ExpId lo = rd_exp(p, PREC_NONE);
+        expect(p, TOK_TO);
+        ExpId hi = rd_exp(p, PREC_NONE);
+        expect(p, TOK_DO);
+        x = mk_for(p, pos, var, lo, hi, rd_exp(p, PREC_NONE));
+        break;
+    }
+    case TOK_LET:
+        x = rd_let(p);
+        break;
+    default:
+        syntax_error(p, "expected expression");
+    }
+    p->depth--;
+    return x;
+}
+
+static ExpId rd_exp(Parser *p, int min_prec)
+{
+    return rd_climb(p, rd_operand(p), min_prec);
+}
+
+/* ---- Explicit stack ---------------------------------------------------- */
+
+/*
+ * Each frame is a construct waiting for the expression currently being
+ * parsed.  `m` is the minimum operator precedence of the enclosing
+ * expression context, restored when the frame completes.  The machine has
+ * three entry points: start an operand, continue the binary-operator loop
+ * after an operand (`operand_done`), and hand a finished expression to the
+ * top frame (`exp_done`).
+ */
+
+typedef enum FrameKind {
+    F_TOP,
+    F_BINOP,        /* a = lhs, b = operator token index */
+    F_UNARY,
+    F_IF,           /* a = test, b = then */
+    F_WHILE,        /* a = test */
+    F_FOR,          /* a = var, b = lo, c = hi */
+    F_SEQ,          /* a = ids start; state: 0 parens, 1 let body */
+    F_LET,          /* a = ids start; b = open batch run while in the
+                       declarations, then b, c = declaration list */
+    F_DEC,          /* a = dec id */
+    F_CALL,         /* a = func, b = ids start */
+    F_RECORD,       /* a = type, b = efields start, c = field token index */
+    F_SUBSCRIPT,    /* a = base var, b = '[' offset; state 1 if `id [` */
+    F_ARRAY,        /* a = type, b = size */
+    F_ASSIGN,       /* a = var */
+} FrameKind;
+
+struct PFrame {
+    uint8_t kind;
+    uint8_t state;
+    uint8_t m;
+    uint8_t pad;
+    uint32_t pos;
+    uint32_t a, b, c;
+};
+
+static PFrame *push_frame(Parser *p, FrameKind kind, uint32_t pos, int m)
+{
+    PFrame f = { .kind = (uint8_t)kind, .m = (uint8_t)m, .pos = pos };
+    vec_push(&p->stack, f);
+    return &p->stack.data[p->stack.len - 1];
+}
+
+static ExpId ex_parse(Parser *p)
+{
+    ExpId x = AST_NONE;
+    int m = PREC_NONE;
+    VarId v = AST_NONE;
+    uint32_t vpos = 0;
+    PFrame *f;
+
+    push_frame(p, F_TOP, 0, PREC_NONE);
+
+start_operand:
+    x = parse_atom(p);
+    if (x != AST_NONE)
+        goto operand_done;
+    {
+        const Token *t = peek(p);
+        uint32_t pos = t->offset;
+        switch (t->kind) {
+        case TOK_MINUS:
+            advance(p);
+            push_frame(p, F_UNARY, pos, m);
+            m = PREC_UNARY;
+            goto start_operand;
+        case TOK_LPAREN:
+            advance(p);
+            if (peek_kind(p) == TOK_RPAREN) {
+                advance(p);
+                x = mk_seq(p, p->ids.len, pos);
+                goto operand_done;
+            }
+            push_frame(p, F_SEQ, pos, m)->a = p->ids.len;
+            m = PREC_NONE;
+            goto start_operand;
+        case TOK_IF:
+            advance(p);
+            push_frame(p, F_IF, pos, m);
+            m = PREC_NONE;
+            goto start_operand;
+        case TOK_WHILE:
+            advance(p);
+            push_frame(p, F_WHILE, pos, m);
+            m = PREC_NONE;
+            goto start_operand;
+        case TOK_FOR: {
+            advance(p);
+            Symbol var = expect_id(p);
+            expect(p, TOK_ASSIGN);
+            push_frame(p, F_FOR, pos, m)->a = var;
+            m = PREC_NONE;
+            goto start_operand;
+        }
+        case TOK_LET:
+            advance(p);
+            f = push_frame(p, F_LET, pos, m);
+            f->a = p->ids.len;
+            f->b = NO_RUN;
+            goto let_decs;
+        case TOK_ID: {
+            advance(p);
+            Symbol sym = t->value;
+            switch (peek_kind(p)) {
+            case TOK_LPAREN:
+                advance(p);
+                if (peek_kind(p) == TOK_RPAREN) {
+                    advance(p);
+                    x = mk_call(p, pos, sym, p->ids.len);
+                    goto operand_done;
+                }
+                f = push_frame(p, F_CALL, pos, m);
+                f->a = sym;
+                f->b = p->ids.len;
+                m = PREC_NONE;
+                goto start_operand;
+            case TOK_LBRACE:
+                advance(p);
+                if (peek_kind(p) == TOK_RBRACE) {
+                    advance(p);
+                    x = mk_record(p, pos, sym, p->efields.len);
+                    goto operand_done;
+                }
+                f = push_frame(p, F_RECORD, pos, m);
+                f->a = sym;
+                f->b = p->efields.len;
+                goto record_field;
+            case TOK_LBRACK:
+                f = push_frame(p, F_SUBSCRIPT, pos, m);
+                f->a = sym;
+                f->b = advance(p)->offset;
+                f->state = 1;
+                m = PREC_NONE;
+                goto start_operand;
+            default:
+                v = mk_simple_var(p, pos, sym);
+                vpos = pos;
+                goto lvalue_tail;
+            }
+        }
+        default:
+            syntax_error(p, "expected expression");
+        }
+    }
+
+record_field:
+    {
+        f = &p->stack.data[p->stack.len - 1];
+        f->c = p->pos;
+        expect(p, TOK_ID);
+        expect(p, TOK_EQ);
+        m = PREC_NONE;
+        goto start_operand;
+    }
+
+lvalue_tail:
+    v = parse_field_selectors(p, v);
+    if (peek_kind(p) == TOK_LBRACK) {
+        f = push_frame(p, F_SUBSCRIPT, vpos, m);
+        f->a = v;
+        f->b = advance(p)->offset;
+        m = PREC_NONE;
+        goto start_operand;
+    }
+    if (peek_kind(p) == TOK_ASSIGN) {
+        push_frame(p, F_ASSIGN, advance(p)->offset, m)->a = v;
+        m = PREC_NONE;
+        goto start_operand;
+    }
+    x = ast_var_exp(p->ast, vpos, v);
+    goto operand_done;
+
+let_decs:
+    for (;;) {
+        TokKind k = peek_kind(p);
+        if (k == TOK_TYPE) {
+            DecId d = parse_type_dec(p);
+            add_dec(p, &p->stack.data[p->stack.len - 1].b, d);
+        } else if (k == TOK_VAR || k == TOK_FUNCTION) {
+            DecId d = k == TOK_VAR ? parse_var_header(p) : parse_function_header(p);
+            f = &p->stack.data[p->stack.len - 1];
+            push_frame(p, F_DEC, f->pos, PREC_NONE)->a = d;
+            m = PREC_NONE;
+            goto start_operand;
+        } else {
+            break;
+        }
+    }
+    {
+        f = &p->stack.data[p->stack.len - 1];
+        close_batch(p, &f->b);
+        AstList decs = take_ids(p, f->a);
+        f->b = decs.start;
+        f->c = decs.count;
+        uint32_t bpos = expect(p, TOK_IN)->offset;
+        if (peek_kind(p) == TOK_END) {
+            advance(p);
+            x = mk_let(p, f->pos, decs, mk_seq(p, p->ids.len, bpos));
+            m = f->m;
+            p->stack.len--;
+            goto operand_done;
+        }
+        f = push_frame(p, F_SEQ, bpos, PREC_NONE);
+        f->a = p->ids.len;
+        f->state = 1;
+        m = PREC_NONE;
+        goto start_operand;
+    }
+
+operand_done:
+    if (peek_prec(p) >= m && peek_prec(p) != PREC_NONE) {
+        const Token *optok = advance(p);
+        f = push_frame(p, F_BINOP, optok->offset, m);
+        f->a = x;
+        f->b = (uint32_t)(optok - p->toks);
+        m = op_prec[tok_binop[optok->kind] - 1] + 1;
+        goto start_operand;
+    }
+
+    /* exp_done: `x` is complete; give it to the innermost frame. */
+    f = &p->stack.data[p->stack.len - 1];
+    switch ((FrameKind)f->kind) {
+    case F_TOP:
+        p->stack.len--;
+        return x;
+    case F_BINOP:
+        x = climb_step(p, f->a, x, &p->toks[f->b]);
+        break;
+    case F_UNARY:
+        x = mk_neg(p, f->pos, x);
+        break;
+    case F_IF:
+        if (f->state == 0) {
+            expect(p, TOK_THEN);
+            f->a = x;
+            f->state = 1;
+            m = PREC_NONE;
+            goto start_operand;
+        }
+        if (f->state == 1 && accept(p, TOK_ELSE)) {
+            f->b = x;
+            f->state = 2;
+            m = PREC_NONE;
+            goto start_operand;
+        }
+        x = f->state == 1 ? mk_if(p, f->pos, f->a, x, AST_NONE)
+                          : mk_if(p, f->pos, f->a, f->b, x);
+        break;
+    case F_WHILE:
+        if (f->state == 0) {
+            expect(p, TOK_DO);
+            f->a = x;
+            f->state = 1;
+            m = PREC_NONE;
+            goto start_operand;
+        }
+        x = mk_while(p, f->pos, f->a, x);
+        break;
+    case F_FOR:
+        if (f->state == 0) {
+            expect(p, TOK_TO);
+            f->b = x;
+            f->state = 1;
+            m = PREC_NONE;
+            goto start_operand;
+        }
+        if (f->state == 1) {
+            expect(p, TOK_DO);
+            f->c = x;
+            f->state = 2;
+            m = PREC_NONE;
+            goto start_operand;
+        }
+        x = mk_for(p, f->pos, f->a, f->b, f->c, x);
+        break;
+    case F_SEQ: {
+        vec_push(&p->ids, x);
+        TokKind close = f->state ? TOK_END : TOK_RPAREN;
+        if (accept(p, TOK_SEMI)) {
+            m = PREC_NONE;
+            goto start_operand;
+        }
+        expect(p, close);
+        x = mk_seq(p, f->a, f->pos);
+        if (f->state) {
+            /* let body: finish the enclosing F_LET too */
+            p->stack.len--;
+            f = &p->stack.data[p->stack.len - 1];
+            x = mk_let(p, f->pos, (AstList){ f->b, f->c }, x);
+        }
+        break;
+    }
+    case F_DEC: {
+        DecId d = f->a;
+        set_dec_exp(p, d, x);
+        p->stack.len--;
+        add_dec(p, &p->stack.data[p->stack.len - 1].b, d);
+        goto let_decs;
+    }
+    case F_CALL:
+        vec_push(&p->ids, x);
+        if (accept(p, TOK_COMMA)) {
+            m = PREC_NONE;
+            goto start_operand;
+        }
+        expect(p, TOK_RPAREN);
+        x = mk_call(p, f->pos, f->a, f->b);
+        break;
+    case F_RECORD: {
+        const Token *ft = &p->toks[f->c];
+        EField ef = { ft->value, x, ft->offset };
+        vec_push(&p->efields, ef);
+        if (accept(p, TOK_COMMA))
+            goto record_field;
+        expect(p, TOK_RBRACE);
+        x = mk_record(p, f->pos, f->a, f->b);
+        break;
+    }
+    case F_SUBSCRIPT:
+        expect(p, TOK_RBRACK);
+        if (f->state == 1 && peek_kind(p) == TOK_OF) {
+            advance(p);
+            f->kind = F_ARRAY;
+            f->b = x;
+            m = PREC_NONE;
+            goto start_operand;
+        }
+        {
+            VarId base = f->state == 1 ? mk_simple_var(p, f->pos, f->a) : f->a;
+            v = mk_subscript(p, f->b, base, x);
+            vpos = f->pos;
+            m = f->m;
+            p->stack.len--;
+            goto lvalue_tail;
+        }
+    case F_ARRAY:
+        x = mk_array(p, f->pos, f->a, f->b, x);
+        break;
+    case F_ASSIGN:
+        x = mk_assign(p, f->pos, f->a, x);
+        break;
+    case F_LET:
+        fatal("parser: expression delivered to a let frame");
+    }
+    /* The frame is complete: pop it and resume its context. */
+    f = &p->stack.data[p->stack.len - 1];
+    m = f->m;
+    p->stack.len--;
+    goto operand_done;
+}
+
+/* ---- Entry point ------------------------------------------------------- */
+
+static int run(Parser *p)
+{
+    int why = setjmp(p->fail);
+    if (why != 0)
+        return why;
+    ExpId root = p->mode == PARSE_EXPLICIT ? ex_parse(p) : rd_exp(p, PREC_NONE);
+    if (peek_kind(p) != TOK_EOF)
+        syntax_error(p, "expected end of file");
+    p->ast->root = root;
+    return 0;
+}
+
+bool parse_program(Ast *ast, const TokenVec *toks, ParseMode mode)
+{
+    Parser p = {
+        .ast = ast,
+        .src = ast->src,
+        .toks = toks->data,
+        .mode = mode,
+    };
+
+    int why = run(&p);
+    if (why == FAIL_TOO_DEEP) {
+        /* Throw away the partial tree and start over iteratively. */
+        Source *src = ast->src;
+        ast_free(ast);
+        ast_init(ast, src, toks->len);
+        p.pos = 0;
+        p.depth = 0;
+        p.ids.len = p.efields.len = p.fields.len = p.stack.len = 0;
+        p.mode = PARSE_EXPLICIT;
+        why = run(&p);
+    }
+
+    vec_free(&p.ids);
+    vec_free(&p.efields);
+    vec_free(&p.fields);
+    vec_free(&p.stack);
+    return why == 0;
+}
@@ -0,0 +1,24 @@
+#ifndef TIGER_PARSER_H
+#define TIGER_PARSER_H
+
+#include "ast.h"
+#include "token.h"
+
+typedef enum ParseMode {
+    PARSE_AUTO,         /* recursive, falling back to explicit when deep */
+    PARSE_RECURSIVE,    /* recursive descent on the C stack */
+    PARSE_EXPLICIT,     /* same grammar driven by a heap-allocated stack */
+} ParseMode;
+
+/* Nesting depth at which PARSE_AUTO abandons recursive descent and
+   reparses with an explicit stack. */
+enum { PARSE_MAX_RECURSION = 4096 };
+
+/*
+ * Parse the token stream `toks` (terminated by TOK_EOF) into `ast`, which
+ * must be freshly initialised.  Reports the first syntax error through
+ * diag_error() and returns false.  Both modes build the same tree.
+ */
+bool parse_program(Ast *ast, const TokenVec *toks, ParseMode mode);
+
+#endif
@@ -0,0 +1,214 @@
+#include "phase.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+const char *const phase_names[PHASE_COUNT] = {
+    "other", "lex", "parse", "semant", "escape", "ir", "opt", "isel", "regalloc", "emit",
+};
+
+static _Thread_local struct {
+    Phase cur;
+    uint64_t since;         /* when `cur` was entered, 0 before any phase */
+    AllocStats at;          /* alloc_stats then */
+    PhaseStats st[PHASE_COUNT];
+} st;
+
+/* Trace events of every thread.  Their names live in one buffer, so
+   that recording them does not show in the allocation counts. */
+typedef struct Event {
+    uint64_t ts, dur;
+    uint32_t name, tid;
+    const char *cat;
+} Event;
+
+static struct {
+    atomic_bool on;
+    uint64_t t0;
+    pthread_mutex_t lock;
+    Event *ev;
+    size_t nev, cap;
+    char *names;
+    size_t nnames, names_cap;
+} trace = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+static atomic_uint next_tid = 1;
+static _Thread_local uint32_t tid;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static void *grow(void *p, size_t *cap, size_t need, size_t elem)
+{
+    if (need <= *cap)
+        return p;
+    while (*cap < need)
+        *cap = *cap ? *cap * 2 : 1024;
+    p = realloc(p, *cap * elem);
+    if (!p)
+        fatal("out of memory (trace)");
+    return p;
+}
+
+static void record(const char *cat, const char *name, uint64_t start, uint64_t end)
+{
+    if (!tid)
+        tid = atomic_fetch_add(&next_tid, 1);
+    size_t len = strlen(name) + 1;
+    pthread_mutex_lock(&trace.lock);
+    trace.ev = grow(trace.ev, &trace.cap, trace.nev + 1, sizeof *trace.ev);
+    trace.names = grow(trace.names, &trace.names_cap, trace.nnames + len, 1);
+    memcpy(trace.names + trace.nnames, name, len);
+    trace.ev[trace.nev++] = (Event){ start, end - start, (uint32_t)trace.nnames, tid, cat };
+    trace.nnames += len;
+    pthread_mutex_unlock(&trace.lock);
+}
+
+/* Charge the time since the last switch to the current phase and make
+   `p` current, even if it already is. */
+static Phase switch_to(Phase p)
+{
+    uint64_t t = now_ns();
+    Phase prev = st.cur;
+    if (st.since) {
+        PhaseStats *s = &st.st[prev];
+        s->ns += t - st.since;
+        s->allocs += alloc_stats.calls - st.at.calls;
+        s->bytes += alloc_stats.bytes - st.at.bytes;
+        if (prev != PHASE_OTHER && atomic_load_explicit(&trace.on, memory_order_relaxed))
+            record("phase", phase_names[prev], st.since, t);
+    }
+    st.cur = p;
+    st.since = t;
+    st.at = alloc_stats;
+    return prev;
+}
+
+Phase phase_enter(Phase p)
+{
+    return p == st.cur && st.since ? p : switch_to(p);
+}
+
+void phase_stats(PhaseStats out[PHASE_COUNT])
+{
+    memcpy(out, st.st, sizeof st.st);
+    if (st.since) {
+        PhaseStats *s = &out[st.cur];
+        s->ns += now_ns() - st.since;
+        s->allocs += alloc_stats.calls - st.at.calls;
+        s->bytes += alloc_stats.bytes - st.at.bytes;
+    }
+}
+
+void phase_reset(void)
+{
+    memset(st.st, 0, sizeof st.st);
+    st.since = st.since ? now_ns() : 0;
+    st.at = alloc_stats;
+}
+
+void phase_report(FILE *out, const char *title, bool time, bool mem)
+{
+    PhaseStats s[PHASE_COUNT], total = {0};
+    phase_stats(s);
+    for (int p = 0; p < PHASE_COUNT; p++) {
+        total.ns += s[p].ns;
+        total.allocs += s[p].allocs;
+        total.bytes += s[p].bytes;
+    }
+    fprintf(out, "%s:\n", title);
+    for (int p = 0; p <= PHASE_COUNT; p++) {
+        const PhaseStats *r = p < PHASE_COUNT ? &s[p] : &total;
+        if (p < PHASE_COUNT && !r->ns && !r->allocs)
+            continue;
+        fprintf(out, "  %-9s", p < PHASE_COUNT ? phase_names[p] : "total");
+        if (time)
+            fprintf(out, " %10.3f ms %5.1f%%", r->ns / 1e6,
+                    total.ns ? 100.0 * r->ns / total.ns : 0.0);
+        if (mem)
+            fprintf(out, " %10" PRIu64 " allocs %12" PRIu64 " bytes", r->allocs, r->bytes);
+        fputc('\n', out);
+    }
+}
+
+void trace_start(void)
+{
+    trace.t0 = now_ns();
+    atomic_store(&trace.on, true);
+}
+
+uint64_t trace_now(void)
+{
+    return atomic_load_explicit(&trace.on, memory_order_relaxed) ? now_ns() : 0;
+}
+
+void trace_span(const char *name, uint64_t start)
+{
+    if (start)
+        record("pass", name, start, now_ns());
+}
+
+uint64_t trace_open(void)
+{
+    if (!atomic_load_explicit(&trace.on, memory_order_relaxed))
+        return 0;
+    switch_to(st.cur);
+    return st.since;
+}
+
+void trace_close(const char *name, uint64_t start)
+{
+    if (!start)
+        return;
+    switch_to(st.cur);
+    record("scope", name, start, st.since);
+}
+
+static void json_string(FILE *out, const char *s)
+{
+    fputc('"', out);
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\')
+            fprintf(out, "\\%c", *s);
+        else if ((unsigned char)*s < 32)
+            fprintf(out, "\\u%04x", *s);
+        else
+            fputc(*s, out);
+    }
+    fputc('"', out);
+}
+
+bool trace_write(const char *path, FILE *err)
+{
+    FILE *out = fopen(path, "w");
+    if (!out) {
+        fprintf(err, "tigerc: cannot write '%s': %s\n", path, strerror(errno));
+        return false;
+    }
+    pthread_mutex_lock(&trace.lock);
+    fputs("{\"displayTimeUnit\": \"ms\", \"traceEvents\": [", out);
+    for (size_t i = 0; i < trace.nev; i++) {
+        const Event *e = &trace.ev[i];
+        fprintf(out, "%s\n{\"name\": ", i ? "," : "");
+        json_string(out, trace.names + e->name);
+        fprintf(out, ", \"cat\": \"%s\", \"ph\": \"X\", \"ts\": %.3f, \"dur\": %.3f, "
+                     "\"pid\": 1, \"tid\": %u}",
+                e->cat, (e->ts - trace.t0) / 1e3, e->dur / 1e3, e->tid);
+    }
+    fputs("\n]}\n", out);
+    pthread_mutex_unlock(&trace.lock);
+    if (fclose(out) != 0) {
+        fprintf(err, "tigerc: cannot write '%s': %s\n", path, strerror(errno));
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,71 @@
+#ifndef TIGER_PHASE_H
+#define TIGER_PHASE_H
+
+#include <stdio.h>
+
+#include "util.h"
+
+/*
+ * Time and allocations per compiler phase.  The driver switches phases
+ * as it goes, and opt_program() and emit_program() switch between the
+ * phases inside them themselves; each switch charges the time and the
+ * allocations since the previous one to the phase that was current.
+ * Totals belong to the calling thread.
+ *
+ * With tracing on, every phase switch, and every span marked below,
+ * also becomes an event of a Chrome trace (chrome://tracing, Perfetto).
+ */
+
+typedef enum Phase {
+    PHASE_OTHER,
+    PHASE_LEX,
+    PHASE_PARSE,
+    PHASE_SEMANT,           /* type checking */
+    PHASE_ESCAPE,           /* escapes and closure conversion */
+    PHASE_IR,               /* translation and canonical trees */
+    PHASE_OPT,              /* SSA passes and inlining */
+    PHASE_ISEL,
+    PHASE_REGALLOC,
+    PHASE_EMIT,
+    PHASE_COUNT
+} Phase;
+
+extern const char *const phase_names[PHASE_COUNT];
+
+typedef struct PhaseStats {
+    uint64_t ns;
+    uint64_t allocs, bytes; /* through xmalloc() and friends */
+} PhaseStats;
+
+/* Make `p` the current phase; returns the one it replaces. */
+Phase phase_enter(Phase p);
+
+/* The totals of each phase so far, counting the current one up to now. */
+void phase_stats(PhaseStats st[PHASE_COUNT]);
+
+/* Zero the totals. */
+void phase_reset(void);
+
+/* Print the totals as a table: times if `time`, allocations if `mem`. */
+void phase_report(FILE *out, const char *title, bool time, bool mem);
+
+/* Start recording trace events, for every thread. */
+void trace_start(void);
+
+/* The start of a span, or 0 if tracing is off. */
+uint64_t trace_now(void);
+
+/* A span called `name`, from `start` to now, inside the current phase. */
+void trace_span(const char *name, uint64_t start);
+
+/* A span that phases switch inside, such as one function's code
+   generation: the current phase's span is split where it opens and
+   where it closes, so that the trace nests. */
+uint64_t trace_open(void);
+void trace_close(const char *name, uint64_t start);
+
+/* Write the events recorded so far to `path` as Chrome trace JSON.
+   Returns false, with a message on `err`, if it cannot. */
+bool trace_write(const char *path, FILE *err);
+
+#endif
@@ -0,0 +1,131 @@
+#include "pool.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+
+/* Jobs [top, bottom) of `jobs` are still to run.  The owner moves
+   bottom down, thieves move top up; they race only for the last job. */
+typedef struct Deque {
+    _Alignas(64) _Atomic int64_t top;
+    _Alignas(64) _Atomic int64_t bottom;
+    uint32_t *jobs;
+} Deque;
+
+typedef struct Pool {
+    Deque *deques;
+    uint32_t n;
+    PoolJob fn;
+    void *ctx;
+} Pool;
+
+typedef struct Worker {
+    Pool *pool;
+    uint32_t id;
+} Worker;
+
+enum { NO_JOB = UINT32_MAX };
+
+static uint32_t take(Deque *d)
+{
+    int64_t b = atomic_load_explicit(&d->bottom, memory_order_relaxed) - 1;
+    atomic_store_explicit(&d->bottom, b, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    int64_t t = atomic_load_explicit(&d->top, memory_order_relaxed);
+    if (t > b) {
+        atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+        return NO_JOB;
+    }
+    uint32_t job = d->jobs[b];
+    if (t == b) {
+        if (!atomic_compare_exchange_strong_explicit(&d->top, &t, t + 1,
+                                                     memory_order_seq_cst,
+                                                     memory_order_relaxed))
+            job = NO_JOB;
+        atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+    }
+    return job;
+}
+
+static uint32_t steal(Deque *d)
+{
+    int64_t t = atomic_load_explicit(&d->top, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    int64_t b = atomic_load_explicit(&d->bottom, memory_order_acquire);
+    if (t >= b)
+        return NO_JOB;
+    uint32_t job = d->jobs[t];
+    if (!atomic_compare_exchange_strong_explicit(&d->top, &t, t + 1, memory_order_seq_cst,
+                                                 memory_order_relaxed))
+        return NO_JOB;
+    return job;
+}
+
+/* Whether any deque may still hold a job: a failed steal can be a lost
+   race rather than an empty deque. */
+static bool any_left(Pool *p)
+{
+    for (uint32_t i = 0; i < p->n; i++)
+        if (atomic_load(&p->deques[i].top) < atomic_load(&p->deques[i].bottom))
+            return true;
+    return false;
+}
+
+static void *work(void *arg)
+{
+    Worker *w = arg;
+    Pool *p = w->pool;
+    Deque *own = &p->deques[w->id];
+    for (;;) {
+        uint32_t job = take(own);
+        for (uint32_t k = 1; job == NO_JOB && k < p->n; k++)
+            job = steal(&p->deques[(w->id + k) % p->n]);
+        if (job != NO_JOB)
+            p->fn(p->ctx, job, w->id);
+        else if (!any_left(p))
+            return NULL;
+    }
+}
+
+void pool_run(uint32_t nthreads, uint32_t njobs, PoolJob fn, void *ctx)
+{
+    if (nthreads > njobs)
+        nthreads = njobs;
+    if (nthreads <= 1) {
+        for (uint32_t i = 0; i < njobs; i++)
+            fn(ctx, i, 0);
+        return;
+    }
+
+    Pool p = { xcalloc(nthreads, sizeof *p.deques), nthreads, fn, ctx };
+    uint32_t *jobs = xmalloc(njobs * sizeof *jobs);
+    /* Worker i owns jobs i, i + n, ...; it takes from the bottom, so its
+       deque holds them last first and it runs them in order. */
+    for (uint32_t i = 0, at = 0; i < nthreads; i++) {
+        Deque *d = &p.deques[i];
+        d->jobs = jobs + at;
+        int64_t n = 0;
+        for (int64_t j = (int64_t)i + (int64_t)(njobs - 1 - i) / nthreads * nthreads; j >= i;
+             j -= nthreads)
+            d->jobs[n++] = (uint32_t)j;
+        atomic_init(&d->top, 0);
+        atomic_init(&d->bottom, n);
+        at += (uint32_t)n;
+    }
+
+    Worker *workers = xmalloc(nthreads * sizeof *workers);
+    pthread_t *threads = xmalloc(nthreads * sizeof *threads);
+    for (uint32_t i = 0; i < nthreads; i++)
+        workers[i] = (Worker){ &p, i };
+    for (uint32_t i = 1; i < nthreads; i++)
+        if (pthread_create(&threads[i], NULL, work, &workers[i]) != 0)
+            fatal("cannot start a worker thread");
+    work(&workers[0]);
+    for (uint32_t i = 1; i < nthreads; i++)
+        pthread_join(threads[i], NULL);
+
+    free(threads);
+    free(workers);
+    free(jobs);
+    free(p.deques);
+}
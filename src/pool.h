@@ -0,0 +1,20 @@
+#ifndef TIGER_POOL_H
+#define TIGER_POOL_H
+
+#include "util.h"
+
+/*
+ * A work-stealing thread pool for a fixed set of independent jobs.
+ * Each worker starts with its own deque of jobs, dealt out round-robin,
+ * and takes from its bottom; a worker whose deque runs dry steals from
+ * the top of another's.  Taking and stealing are lock-free (Chase-Lev
+ * without growth, since no job adds more).
+ */
+
+typedef void (*PoolJob)(void *ctx, uint32_t job, uint32_t worker);
+
+/* Run jobs 0..njobs-1 as fn(ctx, job, worker) on `nthreads` workers,
+   the calling thread among them, and return when all have finished. */
+void pool_run(uint32_t nthreads, uint32_t njobs, PoolJob fn, void *ctx);
+
+#endif
@@ -0,0 +1,141 @@
+#include "profile.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char *base_name(const char *path)
+{
+    const char *s = strrchr(path, '/');
+    return s ? s + 1 : path;
+}
+
+static int by_name(const void *a, const void *b)
+{
+    return strcmp(((const ProfileFunc *)a)->name, ((const ProfileFunc *)b)->name);
+}
+
+static int branch_cmp(uint32_t line, uint32_t col, const char *file, const ProfileBranch *b)
+{
+    if (line != b->line)
+        return line < b->line ? -1 : 1;
+    if (col != b->col)
+        return col < b->col ? -1 : 1;
+    return strcmp(file, b->file);
+}
+
+static int by_place(const void *a, const void *b)
+{
+    const ProfileBranch *x = a;
+    return branch_cmp(x->line, x->col, x->file, b);
+}
+
+/* "FILE:LINE:COL" into its parts; FILE may hold colons. */
+static bool split_place(char *s, uint32_t *line, uint32_t *col)
+{
+    char *c2 = strrchr(s, ':');
+    if (!c2)
+        return false;
+    *c2 = '\0';
+    char *c1 = strrchr(s, ':');
+    if (!c1)
+        return false;
+    *c1 = '\0';
+    char *end1, *end2;
+    unsigned long l = strtoul(c1 + 1, &end1, 10), c = strtoul(c2 + 1, &end2, 10);
+    *line = (uint32_t)l;
+    *col = (uint32_t)c;
+    return end1 != c1 + 1 && !*end1 && end2 != c2 + 1 && !*end2;
+}
+
+bool profile_read(Profile *p, const char *path, FILE *err)
+{
+    memset(p, 0, sizeof *p);
+    FILE *in = fopen(path, "r");
+    if (!in) {
+        fprintf(err, "tigerc: cannot read '%s': %s\n", path, strerror(errno));
+        return false;
+    }
+    enum { NONE, CALLS, BRANCHES, SAMPLES } section = NONE;
+    bool seen = false;
+    char line[4096];
+    while (fgets(line, sizeof line, in)) {
+        line[strcspn(line, "\n")] = '\0';
+        if (strstr(line, "  function") && strstr(line, "calls")) {
+            section = CALLS;
+            seen = true;
+            continue;
+        }
+        if (strstr(line, "  branch") && strstr(line, "taken")) {
+            section = BRANCHES;
+            continue;
+        }
+        if (strstr(line, "samples") && strstr(line, "line")) {
+            section = SAMPLES;
+            continue;
+        }
+        unsigned long long a, b;
+        int n;
+        if (section == CALLS && sscanf(line, " %llu %n", &a, &n) == 1 && line[n]) {
+            vec_push(&p->funcs, ((ProfileFunc){ xstrdup(line + n), a }));
+            if (a > p->max_calls)
+                p->max_calls = a;
+        } else if (section == BRANCHES && sscanf(line, " %llu %llu %n", &a, &b, &n) == 2) {
+            uint32_t l, c;
+            char *place = xstrdup(line + n);
+            if (!split_place(place, &l, &c)) {
+                free(place);
+                continue;
+            }
+            char *file = xstrdup(base_name(place));
+            free(place);
+            vec_push(&p->names, file);
+            vec_push(&p->branches, ((ProfileBranch){ file, l, c, a, b }));
+        }
+    }
+    fclose(in);
+    if (!seen) {
+        fprintf(err, "tigerc: '%s' is not a profile written by a -pg program\n", path);
+        profile_free(p);
+        return false;
+    }
+    qsort(p->funcs.data, p->funcs.len, sizeof *p->funcs.data, by_name);
+    qsort(p->branches.data, p->branches.len, sizeof *p->branches.data, by_place);
+    return true;
+}
+
+void profile_free(Profile *p)
+{
+    for (uint32_t i = 0; i < p->funcs.len; i++)
+        free(p->funcs.data[i].name);
+    for (uint32_t i = 0; i < p->names.len; i++)
+        free(p->names.data[i]);
+    vec_free(&p->funcs);
+    vec_free(&p->branches);
+    vec_free(&p->names);
+}
+
+uint64_t profile_calls(const Profile *p, const char *name)
+{
+    ProfileFunc key = { (char *)name, 0 };
+    const ProfileFunc *f = bsearch(&key, p->funcs.data, p->funcs.len, sizeof key, by_name);
+    return f ? f->calls : 0;
+}
+
+const ProfileBranch *profile_branch(const Profile *p, const char *path, uint32_t line,
+                                    uint32_t col)
+{
+    const char *file = base_name(path);
+    uint32_t lo = 0, hi = p->branches.len;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        int c = branch_cmp(line, col, file, &p->branches.data[mid]);
+        if (!c)
+            return &p->branches.data[mid];
+        if (c < 0)
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+    return NULL;
+}
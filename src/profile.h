@@ -0,0 +1,50 @@
+#ifndef TIGER_PROFILE_H
+#define TIGER_PROFILE_H
+
+#include <stdio.h>
+
+#include "util.h"
+
+/*
+ * Profiles for -fprofile-use: the report a program built with -pg
+ * writes at exit (runtime/prof.c), read back.  What code generation
+ * uses of it is how often each function was called and, for each if
+ * and while, how often its test went each way.  Functions are known by
+ * their assembly names, branches by the file name (without its
+ * directory) and the line and column of the if or while.  A profile is
+ * read once and only read after, so one serves every thread.
+ */
+
+typedef struct ProfileFunc {
+    char *name;
+    uint64_t calls;
+} ProfileFunc;
+
+typedef struct ProfileBranch {
+    const char *file;       /* into `names` */
+    uint32_t line, col;
+    uint64_t taken, not_taken;
+} ProfileBranch;
+
+typedef struct Profile {
+    VEC(ProfileFunc) funcs;         /* by name */
+    VEC(ProfileBranch) branches;    /* by line, column and file */
+    VEC(char *) names;
+    uint64_t max_calls;
+} Profile;
+
+/* Read the report at `path`.  Returns false, with a message on `err`,
+   if it cannot be read or is not a report. */
+bool profile_read(Profile *p, const char *path, FILE *err);
+void profile_free(Profile *p);
+
+/* How often function `name` was called: 0 if the report does not list
+   it, as it lists only the functions that ran. */
+uint64_t profile_calls(const Profile *p, const char *name);
+
+/* The counts of the branch at `line`:`col` of source `path`, or NULL if
+   it never ran. */
+const ProfileBranch *profile_branch(const Profile *p, const char *path, uint32_t line,
+                                    uint32_t col);
+
+#endif
@@ -0,0 +1,934 @@
+#include "regalloc.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "liveness.h"
+
+enum { K = TEMP_NREGS - 2 };    /* all but %rsp and %rbp */
+enum { NONE = UINT32_MAX };
+
+/* Caller-saved registers first: a callee-saved one costs a save and a
+   restore, and only values live across calls need one. */
+static const Temp alloc_order[K] = {
+    REG_RAX, REG_RCX, REG_RDX, REG_RSI, REG_RDI, REG_R8, REG_R9, REG_R10, REG_R11,
+    REG_RBX, REG_R12, REG_R13, REG_R14, REG_R15,
+};
+
+static bool allocatable(Temp t)
+{
+    return t != REG_RSP && t != REG_RBP;
+}
+
+static bool is_move(const Instr *in)
+{
+    return in->kind == I_MOVE && in->src[0] != in->dst[0] && allocatable(in->src[0]) &&
+           allocatable(in->dst[0]);
+}
+
+typedef struct Ra {
+    Arena *a;
+    Frame *frame;
+    InstrList *code;
+    uint32_t n;             /* temps, numbered densely */
+    VEC(uint8_t) nospill;   /* [temp] made by spilling: never spilled again */
+    Temp *color;            /* [temp] register, or NONE */
+    double *cost;           /* [temp] spill weight */
+    VEC(Temp) spilled;
+} Ra;
+
+/* ---- Spill weights ------------------------------------------------------ */
+
+static const double depth_weight[] = { 1, 10, 100, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8 };
+
+/* A use or definition weighs as often as its block runs per call: 10
+   to the loop depth, or what the profile counted for the block's label
+   (never quite nothing, so that costs still order by use). */
+static void spill_costs(Ra *r, const Flow *f)
+{
+    r->cost = xcalloc(r->n, sizeof *r->cost);
+    const Frame *fr = r->frame;
+    for (uint32_t b = 0; b < f->nblocks; b++) {
+        uint32_t d = f->depth[b];
+        double w = depth_weight[d < ARRAY_LEN(depth_weight) ? d : ARRAY_LEN(depth_weight) - 1];
+        const Instr *head = &r->code->data[f->start[b]];
+        uint32_t n = fr->profiled && f->start[b] < f->start[b + 1] && head->kind == I_LABEL
+                         ? idmap_get(&fr->freq, head->label, UINT32_MAX)
+                         : UINT32_MAX;
+        if (n != UINT32_MAX)
+            w = n ? (double)n / (double)(fr->calls ? fr->calls : 1) : 1e-3;
+        for (uint32_t i = f->start[b]; i < f->start[b + 1]; i++) {
+            const Instr *in = &r->code->data[i];
+            for (uint32_t k = 0; k < in->ndst; k++)
+                r->cost[in->dst[k]] += w;
+            for (uint32_t k = 0; k < in->nsrc; k++)
+                r->cost[in->src[k]] += w;
+        }
+    }
+}
+
+static double spill_score(const Ra *r, Temp t, double span)
+{
+    return r->nospill.data[t] ? 1e300 : r->cost[t] / span;
+}
+
+/* ---- Sets ---------------------------------------------------------------- */
+
+/* Sparse set of temps (Briggs and Torczon): constant-time insertion,
+   deletion and clearing, and iteration over the members only. */
+typedef struct Sparse {
+    uint32_t *dense, *sparse, len;
+} Sparse;
+
+static void sp_init(Sparse *s, uint32_t n)
+{
+    s->dense = xmalloc((n ? n : 1) * sizeof *s->dense);
+    s->sparse = xcalloc(n ? n : 1, sizeof *s->sparse);
+    s->len = 0;
+}
+
+static void sp_free(Sparse *s)
+{
+    free(s->dense);
+    free(s->sparse);
+}
+
+static bool sp_has(const Sparse *s, uint32_t x)
+{
+    uint32_t i = s->sparse[x];
+    return i < s->len && s->dense[i] == x;
+}
+
+static void sp_add(Sparse *s, uint32_t x)
+{
+    if (!sp_has(s, x)) {
+        s->sparse[x] = s->len;
+        s->dense[s->len++] = x;
+    }
+}
+
+static void sp_del(Sparse *s, uint32_t x)
+{
+    if (sp_has(s, x)) {
+        uint32_t i = s->sparse[x], last = s->dense[--s->len];
+        s->dense[i] = last;
+        s->sparse[last] = i;
+    }
+}
+
+/* Fill `live` with the temps live out of block `b`. */
+static void live_out_set(const Flow *f, uint32_t b, Sparse *live)
+{
+    const BitWord *out = flow_live_out(f, b);
+    live->len = 0;
+    for (uint32_t w = 0; w < f->gwords; w++)
+        for (BitWord x = out[w]; x; x &= x - 1)
+            sp_add(live, f->global[w * 64 + (uint32_t)__builtin_ctzll(x)]);
+}
+
+/* Unordered pairs of temps, for the interference test. */
+typedef struct PairSet {
+    uint64_t *slots;
+    uint32_t mask, used;
+} PairSet;
+
+static uint64_t pair_key(uint32_t u, uint32_t v)
+{
+    return u < v ? (uint64_t)u << 32 | v : (uint64_t)v << 32 | u;
+}
+
+static uint32_t pair_slot(const PairSet *s, uint64_t key)
+{
+    uint32_t i = (uint32_t)((key * 0x9e3779b97f4a7c15u) >> 32) & s->mask;
+    while (s->slots[i] && s->slots[i] != key)
+        i = (i + 1) & s->mask;
+    return i;
+}
+
+static bool pair_has(const PairSet *s, uint32_t u, uint32_t v)
+{
+    return s->slots && s->slots[pair_slot(s, pair_key(u, v))];
+}
+
+/* Add the pair; false if it was there already. */
+static bool pair_add(PairSet *s, uint32_t u, uint32_t v)
+{
+    if (2 * (s->used + 1) > s->mask) {
+        PairSet g = { .mask = s->mask ? 2 * s->mask + 1 : 255 };
+        g.slots = xcalloc((size_t)g.mask + 1, sizeof *g.slots);
+        for (uint32_t i = 0; s->slots && i <= s->mask; i++)
+            if (s->slots[i])
+                g.slots[pair_slot(&g, s->slots[i])] = s->slots[i];
+        free(s->slots);
+        g.used = s->used;
+        *s = g;
+    }
+    uint64_t key = pair_key(u, v);
+    uint32_t i = pair_slot(s, key);
+    if (s->slots[i])
+        return false;
+    s->slots[i] = key;
+    s->used++;
+    return true;
+}
+
+/* ---- Iterated register coalescing --------------------------------------- */
+
+enum {
+    N_SIMPLIFY, N_FREEZE, N_SPILL,     /* the worklists */
+    N_PRECOLORED, N_STACK, N_COALESCED, N_COLORED, N_SPILLED,
+};
+
+enum {
+    M_WORKLIST, M_ACTIVE,               /* the move lists */
+    M_COALESCED, M_CONSTRAINED, M_FROZEN,
+};
+
+typedef struct Move {
+    Temp src, dst;
+} Move;
+
+typedef VEC(uint32_t) U32Vec;
+
+typedef struct Irc {
+    Ra *r;
+    uint32_t n;
+    uint8_t *state;
+    uint32_t *next, *prev, head[N_SPILL + 1];
+    uint32_t *degree, *alias;
+    U32Vec *adj;            /* [temp] neighbours, for temps above the registers */
+    U32Vec *moves;          /* [temp] moves it takes part in */
+    PairSet adjset;
+    VEC(Move) mv;
+    uint8_t *mstate;
+    uint32_t *mnext, *mprev, mhead[M_ACTIVE + 1];
+    VEC(Temp) stack;
+    uint32_t *mark, stamp;
+} Irc;
+
+static void nl_push(Irc *c, uint8_t list, uint32_t x)
+{
+    c->state[x] = list;
+    c->prev[x] = NONE;
+    c->next[x] = c->head[list];
+    if (c->head[list] != NONE)
+        c->prev[c->head[list]] = x;
+    c->head[list] = x;
+}
+
+static void nl_remove(Irc *c, uint32_t x)
+{
+    uint8_t list = c->state[x];
+    if (c->prev[x] != NONE)
+        c->next[c->prev[x]] = c->next[x];
+    else
+        c->head[list] = c->next[x];
+    if (c->next[x] != NONE)
+        c->prev[c->next[x]] = c->prev[x];
+}
+
+static void ml_push(Irc *c, uint8_t list, uint32_t m)
+{
+    c->mstate[m] = list;
+    c->mprev[m] = NONE;
+    c->mnext[m] = c->mhead[list];
+    if (c->mhead[list] != NONE)
+        c->mprev[c->mhead[list]] = m;
+    c->mhead[list] = m;
+}
+
+static void ml_remove(Irc *c, uint32_t m)
+{
+    uint8_t list = c->mstate[m];
+    if (list > M_ACTIVE)
+        return;
+    if (c->mprev[m] != NONE)
+        c->mnext[c->mprev[m]] = c->mnext[m];
+    else
+        c->mhead[list] = c->mnext[m];
+    if (c->mnext[m] != NONE)
+        c->mprev[c->mnext[m]] = c->mprev[m];
+}
+
+static bool precolored(Temp t)
+{
+    return t < TEMP_NREGS;
+}
+
+static void add_edge(Irc *c, Temp u, Temp v)
+{
+    if (u == v || !allocatable(u) || !allocatable(v) || !pair_add(&c->adjset, u, v))
+        return;
+    if (!precolored(u)) {
+        vec_push(&c->adj[u], v);
+        c->degree[u]++;
+    }
+    if (!precolored(v)) {
+        vec_push(&c->adj[v], u);
+        c->degree[v]++;
+    }
+}
+
+static void irc_build(Irc *c, const Flow *f)
+{
+    const InstrList *code = c->r->code;
+    Sparse live;
+    sp_init(&live, c->n);
+    for (uint32_t b = 0; b < f->nblocks; b++) {
+        live_out_set(f, b, &live);
+        for (uint32_t i = f->start[b + 1]; i-- > f->start[b];) {
+            const Instr *in = &code->data[i];
+            if (is_move(in)) {
+                /* The source does not interfere with the copy. */
+                sp_del(&live, in->src[0]);
+                uint32_t m = c->mv.len;
+                vec_push(&c->mv, ((Move){ in->src[0], in->dst[0] }));
+                vec_push(&c->moves[in->src[0]], m);
+                vec_push(&c->moves[in->dst[0]], m);
+            }
+            for (uint32_t k = 0; k < in->ndst; k++)
+                sp_add(&live, in->dst[k]);
+            for (uint32_t k = 0; k < in->ndst; k++)
+                for (uint32_t j = 0; j < live.len; j++)
+                    add_edge(c, live.dense[j], in->dst[k]);
+            for (uint32_t k = 0; k < in->ndst; k++)
+                sp_del(&live, in->dst[k]);
+            for (uint32_t k = 0; k < in->nsrc; k++)
+                sp_add(&live, in->src[k]);
+        }
+    }
+    sp_free(&live);
+}
+
+static bool move_related(const Irc *c, Temp t)
+{
+    for (uint32_t i = 0; i < c->moves[t].len; i++)
+        if (c->mstate[c->moves[t].data[i]] <= M_ACTIVE)
+            return true;
+    return false;
+}
+
+static bool gone(const Irc *c, Temp t)
+{
+    return c->state[t] == N_STACK || c->state[t] == N_COALESCED;
+}
+
+static Temp get_alias(const Irc *c, Temp t)
+{
+    while (c->state[t] == N_COALESCED)
+        t = c->alias[t];
+    return t;
+}
+
+static void enable_moves(Irc *c, Temp t)
+{
+    for (uint32_t i = 0; i < c->moves[t].len; i++) {
+        uint32_t m = c->moves[t].data[i];
+        if (c->mstate[m] == M_ACTIVE) {
+            ml_remove(c, m);
+            ml_push(c, M_WORKLIST, m);
+        }
+    }
+}
+
+static void decrement_degree(Irc *c, Temp t)
+{
+    if (precolored(t))
+        return;
+    if (c->degree[t]-- != K)
+        return;
+    enable_moves(c, t);
+    for (uint32_t i = 0; i < c->adj[t].len; i++)
+        if (!gone(c, c->adj[t].data[i]))
+            enable_moves(c, c->adj[t].data[i]);
+    if (c->state[t] == N_SPILL) {
+        nl_remove(c, t);
+        nl_push(c, move_related(c, t) ? N_FREEZE : N_SIMPLIFY, t);
+    }
+}
+
+static void simplify(Irc *c)
+{
+    Temp t = c->head[N_SIMPLIFY];
+    nl_remove(c, t);
+    c->state[t] = N_STACK;
+    vec_push(&c->stack, t);
+    for (uint32_t i = 0; i < c->adj[t].len; i++)
+        if (!gone(c, c->adj[t].data[i]))
+            decrement_degree(c, c->adj[t].data[i]);
+}
+
+static void add_worklist(Irc *c, Temp u)
+{
+    if (!precolored(u) && c->state[u] == N_FREEZE && !move_related(c, u) && c->degree[u] < K) {
+        nl_remove(c, u);
+        nl_push(c, N_SIMPLIFY, u);
+    }
+}
+
+/* George: every neighbour of `v` already interferes with register `u`
+   or is of low degree. */
+static bool george(const Irc *c, Temp u, Temp v)
+{
+    for (uint32_t i = 0; i < c->adj[v].len; i++) {
+        Temp t = c->adj[v].data[i];
+        if (!gone(c, t) && c->degree[t] >= K && !precolored(t) && !pair_has(&c->adjset, t, u))
+            return false;
+    }
+    return true;
+}
+
+/* Briggs: the merged node has fewer than K neighbours of high degree. */
+static bool briggs(Irc *c, Temp u, Temp v)
+{
+    uint32_t k = 0;
+    c->stamp++;
+    Temp both[2] = { u, v };
+    for (int j = 0; j < 2; j++) {
+        const U32Vec *adj = &c->adj[both[j]];
+        for (uint32_t i = 0; i < adj->len; i++) {
+            Temp t = adj->data[i];
+            if (gone(c, t) || c->mark[t] == c->stamp)
+                continue;
+            c->mark[t] = c->stamp;
+            if (c->degree[t] >= K)
+                k++;
+        }
+    }
+    return k < K;
+}
+
+static void combine(Irc *c, Temp u, Temp v)
+{
+    nl_remove(c, v);
+    c->state[v] = N_COALESCED;
+    c->alias[v] = u;
+    for (uint32_t i = 0; i < c->moves[v].len; i++)
+        vec_push(&c->moves[u], c->moves[v].data[i]);
+    enable_moves(c, v);
+    for (uint32_t i = 0; i < c->adj[v].len; i++) {
+        Temp t = c->adj[v].data[i];
+        if (gone(c, t))
+            continue;
+        add_edge(c, t, u);
+        decrement_degree(c, t);
+    }
+    if (!precolored(u) && c->degree[u] >= K && c->state[u] == N_FREEZE) {
+        nl_remove(c, u);
+        nl_push(c, N_SPILL, u);
+    }
+}
+
+static void coalesce(Irc *c)
+{
+    uint32_t m = c->mhead[M_WORKLIST];
+    Temp x = get_alias(c, c->mv.data[m].src), y = get_alias(c, c->mv.data[m].dst);
+    Temp u = precolored(y) ? y : x, v = precolored(y) ? x : y;
+    ml_remove(c, m);
+    if (u == v) {
+        c->mstate[m] = M_COALESCED;
+        add_worklist(c, u);
+    } else if (precolored(v) || pair_has(&c->adjset, u, v)) {
+        c->mstate[m] = M_CONSTRAINED;
+        add_worklist(c, u);
+        add_worklist(c, v);
+    } else if (precolored(u) ? george(c, u, v) : briggs(c, u, v)) {
+        c->mstate[m] = M_COALESCED;
+        combine(c, u, v);
+        add_worklist(c, u);
+    } else {
+        ml_push(c, M_ACTIVE, m);
+    }
+}
+
+static void freeze_moves(Irc *c, Temp u)
+{
+    for (uint32_t i = 0; i < c->moves[u].len; i++) {
+        uint32_t m = c->moves[u].data[i];
+        if (c->mstate[m] > M_ACTIVE)
+            continue;
+        Temp x = c->mv.data[m].src, y = c->mv.data[m].dst;
+        Temp v = get_alias(c, y) == get_alias(c, u) ? get_alias(c, x) : get_alias(c, y);
+        ml_remove(c, m);
+        c->mstate[m] = M_FROZEN;
+        if (!precolored(v) && c->state[v] == N_FREEZE && !move_related(c, v) && c->degree[v] < K) {
+            nl_remove(c, v);
+            nl_push(c, N_SIMPLIFY, v);
+        }
+    }
+}
+
+static void freeze(Irc *c)
+{
+    Temp u = c->head[N_FREEZE];
+    nl_remove(c, u);
+    nl_push(c, N_SIMPLIFY, u);
+    freeze_moves(c, u);
+}
+
+static void select_spill(Irc *c)
+{
+    Temp best = NONE;
+    double score = 0;
+    for (Temp t = c->head[N_SPILL]; t != NONE; t = c->next[t]) {
+        double s = spill_score(c->r, t, c->degree[t]);
+        if (best == NONE || s < score) {
+            best = t;
+            score = s;
+        }
+    }
+    nl_remove(c, best);
+    nl_push(c, N_SIMPLIFY, best);
+    freeze_moves(c, best);
+}
+
+static void assign_colors(Irc *c)
+{
+    Ra *r = c->r;
+    while (c->stack.len) {
+        Temp t = c->stack.data[--c->stack.len];
+        uint32_t ok = 0;
+        for (uint32_t i = 0; i < K; i++)
+            ok |= 1u << alloc_order[i];
+        for (uint32_t i = 0; i < c->adj[t].len; i++) {
+            Temp w = get_alias(c, c->adj[t].data[i]);
+            if (c->state[w] == N_COLORED || precolored(w))
+                ok &= ~(1u << r->color[w]);
+        }
+        if (!ok) {
+            c->state[t] = N_SPILLED;
+            vec_push(&r->spilled, t);
+            continue;
+        }
+        c->state[t] = N_COLORED;
+        for (uint32_t i = 0; i < K; i++)
+            if (ok & 1u << alloc_order[i]) {
+                r->color[t] = alloc_order[i];
+                break;
+            }
+    }
+    for (Temp t = TEMP_NREGS; t < c->n; t++)
+        if (c->state[t] == N_COALESCED)
+            r->color[t] = r->color[get_alias(c, t)];
+}
+
+static void irc(Ra *r, const Flow *f)
+{
+    uint32_t n = r->n;
+    Irc c = { .r = r, .n = n };
+    c.state = xcalloc(n, sizeof *c.state);
+    c.next = xmalloc(n * sizeof *c.next);
+    c.prev = xmalloc(n * sizeof *c.prev);
+    c.degree = xcalloc(n, sizeof *c.degree);
+    c.alias = xmalloc(n * sizeof *c.alias);
+    c.adj = xcalloc(n, sizeof *c.adj);
+    c.moves = xcalloc(n, sizeof *c.moves);
+    c.mark = xcalloc(n, sizeof *c.mark);
+    for (uint32_t i = 0; i <= N_SPILL; i++)
+        c.head[i] = NONE;
+    for (Temp t = 0; t < TEMP_NREGS; t++) {
+        c.state[t] = N_PRECOLORED;
+        c.degree[t] = UINT32_MAX / 2;
+    }
+
+    irc_build(&c, f);
+    uint32_t nm = c.mv.len;
+    c.mstate = xmalloc((nm ? nm : 1) * sizeof *c.mstate);
+    c.mnext = xmalloc((nm ? nm : 1) * sizeof *c.mnext);
+    c.mprev = xmalloc((nm ? nm : 1) * sizeof *c.mprev);
+    c.mhead[M_WORKLIST] = c.mhead[M_ACTIVE] = NONE;
+    for (uint32_t m = nm; m-- > 0;)
+        ml_push(&c, M_WORKLIST, m);
+    for (Temp t = n; t-- > TEMP_NREGS;) {
+        if (c.degree[t] >= K)
+            nl_push(&c, N_SPILL, t);
+        else if (move_related(&c, t))
+            nl_push(&c, N_FREEZE, t);
+        else
+            nl_push(&c, N_SIMPLIFY, t);
+    }
+
+    for (;;) {
+        if (c.head[N_SIMPLIFY] != NONE)
+            simplify(&c);
+        else if (c.mhead[M_WORKLIST] != NONE)
+            coalesce(&c);
+        else if (c.head[N_FREEZE] != NONE)
+            freeze(&c);
+        else if (c.head[N_SPILL] != NONE)
+            select_spill(&c);
+        else
+            break;
+    }
+    assign_colors(&c);
+
+    for (Temp t = 0; t < n; t++) {
+        vec_free(&c.adj[t]);
+        vec_free(&c.moves[t]);
+    }
+    free(c.state);
+    free(c.next);
+    free(c.prev);
+    free(c.degree);
+    free(c.alias);
+    free(c.adj);
+    free(c.moves);
+    free(c.mark);
+    free(c.adjset.slots);
+    vec_free(&c.mv);
+    free(c.mstate);
+    free(c.mnext);
+    free(c.mprev);
+    vec_free(&c.stack);
+}
+
+/* ---- Linear scan ----------------------------------------------------------- */
+
+/* Instruction i has two points: 2i, where it reads its sources, and
+   2i + 1, where it writes its destinations.  A temp occupies its
+   register from its first point to its last, without holes; a machine
+   register is blocked at every point where it is live or written. */
+typedef struct Scan {
+    Ra *r;
+    uint32_t *start, *end;  /* [temp] interval, start NONE if unused */
+    Temp *hint;             /* [temp] register or temp it is moved from or to */
+    BitWord *blocked[TEMP_NREGS];
+} Scan;
+
+static void extend(Scan *s, Temp t, uint32_t p)
+{
+    if (s->start[t] == NONE || p < s->start[t])
+        s->start[t] = p;
+    if (p > s->end[t])
+        s->end[t] = p;
+}
+
+static void block_regs(Scan *s, uint32_t regs, uint32_t p)
+{
+    for (; regs; regs &= regs - 1)
+        bs_add(s->blocked[__builtin_ctz(regs)], p);
+}
+
+static void scan_intervals(Scan *s, const Flow *f)
+{
+    const InstrList *code = s->r->code;
+    Sparse live;
+    sp_init(&live, s->r->n);
+    for (uint32_t b = 0; b < f->nblocks; b++) {
+        uint32_t first = f->start[b], last = f->start[b + 1] - 1;
+        live_out_set(f, b, &live);
+        uint32_t regs = 0;
+        for (uint32_t j = 0; j < live.len; j++) {
+            Temp t = live.dense[j];
+            if (precolored(t))
+                regs |= 1u << t;
+            else
+                extend(s, t, 2 * last + 1);
+        }
+        for (uint32_t i = last + 1; i-- > first;) {
+            const Instr *in = &code->data[i];
+            uint32_t defs = 0;
+            for (uint32_t k = 0; k < in->ndst; k++) {
+                Temp t = in->dst[k];
+                if (precolored(t))
+                    defs |= 1u << t;
+                else
+                    extend(s, t, 2 * i + 1);
+                sp_del(&live, t);
+            }
+            block_regs(s, regs | defs, 2 * i + 1);
+            regs &= ~defs;
+            for (uint32_t k = 0; k < in->nsrc; k++) {
+                Temp t = in->src[k];
+                if (precolored(t))
+                    regs |= 1u << t;
+                else
+                    extend(s, t, 2 * i);
+                sp_add(&live, t);
+            }
+            block_regs(s, regs, 2 * i);
+            if (in->kind == I_MOVE) {
+                Temp d = in->dst[0], src = in->src[0];
+                if (!precolored(d) && allocatable(src))
+                    s->hint[d] = src;
+                if (!precolored(src) && allocatable(d))
+                    s->hint[src] = d;
+            }
+        }
+        for (uint32_t j = 0; j < live.len; j++)
+            if (!precolored(live.dense[j]))
+                extend(s, live.dense[j], 2 * first);
+    }
+    sp_free(&live);
+}
+
+/* Whether register `reg` is free of fixed uses over [from, to]. */
+static bool unblocked(const Scan *s, Temp reg, uint32_t from, uint32_t to)
+{
+    const BitWord *b = s->blocked[reg];
+    for (uint32_t w = from / 64; w <= to / 64; w++) {
+        BitWord m = ~(BitWord)0;
+        if (w == from / 64)
+            m &= ~(BitWord)0 << (from % 64);
+        if (w == to / 64 && to % 64 != 63)
+            m &= ((BitWord)1 << (to % 64 + 1)) - 1;
+        if (b[w] & m)
+            return false;
+    }
+    return true;
+}
+
+static const Scan *sort_scan;
+
+static int by_start(const void *x, const void *y)
+{
+    uint32_t a = sort_scan->start[*(const Temp *)x], b = sort_scan->start[*(const Temp *)y];
+    return a < b ? -1 : a > b;
+}
+
+static void linear_scan(Ra *r, const Flow *f)
+{
+    uint32_t n = r->n, npoints = 2 * r->code->len + 2;
+    Scan s = { .r = r };
+    s.start = xmalloc(n * sizeof *s.start);
+    s.end = xcalloc(n, sizeof *s.end);
+    s.hint = xmalloc(n * sizeof *s.hint);
+    memset(s.start, 0xff, n * sizeof *s.start);
+    memset(s.hint, 0xff, n * sizeof *s.hint);
+    for (Temp t = 0; t < TEMP_NREGS; t++)
+        s.blocked[t] = xcalloc(bs_words(npoints), sizeof(BitWord));
+    scan_intervals(&s, f);
+
+    VEC(Temp) order = {0};
+    for (Temp t = TEMP_NREGS; t < n; t++)
+        if (s.start[t] != NONE)
+            vec_push(&order, t);
+    sort_scan = &s;
+    qsort(order.data, order.len, sizeof *order.data, by_start);
+
+    Temp owner[TEMP_NREGS];
+    for (Temp t = 0; t < TEMP_NREGS; t++)
+        owner[t] = NONE;
+    for (uint32_t i = 0; i < order.len; i++) {
+        Temp t = order.data[i];
+        uint32_t from = s.start[t], to = s.end[t];
+        for (uint32_t k = 0; k < K; k++) {
+            Temp reg = alloc_order[k];
+            if (owner[reg] != NONE && s.end[owner[reg]] < from)
+                owner[reg] = NONE;
+        }
+
+        /* The register of a move partner first, then the first free. */
+        Temp pick = NONE, h = s.hint[t];
+        if (h != NONE && !precolored(h))
+            h = r->color[h];
+        if (h != NONE && owner[h] == NONE && unblocked(&s, h, from, to))
+            pick = h;
+        for (uint32_t k = 0; k < K && pick == NONE; k++) {
+            Temp reg = alloc_order[k];
+            if (owner[reg] == NONE && unblocked(&s, reg, from, to))
+                pick = reg;
+        }
+        if (pick == NONE) {
+            /* Spill the cheapest of `t` and the holders of registers it
+               could use. */
+            Temp victim = t;
+            double best = spill_score(r, t, to - from + 1);
+            for (uint32_t k = 0; k < K; k++) {
+                Temp reg = alloc_order[k], o = owner[reg];
+                if (o == NONE || !unblocked(&s, reg, from, to))
+                    continue;
+                double sc = spill_score(r, o, s.end[o] - s.start[o] + 1);
+                if (sc < best) {
+                    best = sc;
+                    victim = o;
+                    pick = reg;
+                }
+            }
+            vec_push(&r->spilled, victim);
+            if (victim == t)
+                continue;
+            r->color[victim] = NONE;
+        }
+        owner[pick] = t;
+        r->color[t] = pick;
+    }
+
+    vec_free(&order);
+    free(s.start);
+    free(s.end);
+    free(s.hint);
+    for (Temp t = 0; t < TEMP_NREGS; t++)
+        free(s.blocked[t]);
+}
+
+/* ---- Driver ----------------------------------------------------------------- */
+
+static Temp new_temp(Ra *r, bool nospill)
+{
+    vec_push(&r->nospill, nospill);
+    return r->n++;
+}
+
+static void renumber(Ra *r)
+{
+    IdMap map = {0};
+    r->n = TEMP_NREGS;
+    for (Temp t = 0; t < TEMP_NREGS; t++)
+        vec_push(&r->nospill, 0);
+    for (uint32_t i = 0; i < r->code->len; i++) {
+        Instr *in = &r->code->data[i];
+        Temp *lists[2] = { in->dst, in->src };
+        uint32_t lens[2] = { in->ndst, in->nsrc };
+        for (int j = 0; j < 2; j++)
+            for (uint32_t k = 0; k < lens[j]; k++) {
+                Temp t = lists[j][k];
+                if (t < TEMP_NREGS)
+                    continue;
+                uint32_t d = idmap_get(&map, t, NONE);
+                if (d == NONE) {
+                    d = new_temp(r, false);
+                    idmap_put(&map, t, d);
+                }
+                lists[j][k] = d;
+            }
+    }
+    idmap_free(&map);
+}
+
+static Instr spill_oper(Ra *r, const char *fmt, Temp dst, Temp src)
+{
+    Instr in = { .kind = I_OPER, .fmt = fmt };
+    Temp *t = arena_alloc(r->a, sizeof *t);
+    if (dst != NONE) {
+        *t = dst;
+        in.dst = t;
+        in.ndst = 1;
+    } else {
+        *t = src;
+        in.src = t;
+        in.nsrc = 1;
+    }
+    return in;
+}
+
+/* Give each spilled temp a frame slot, and every instruction that
+   mentions one a fresh temp loaded before it and stored after it. */
+static void rewrite(Ra *r)
+{
+    int32_t *slot = xcalloc(r->n, sizeof *slot);
+    for (uint32_t i = 0; i < r->spilled.len; i++)
+        slot[r->spilled.data[i]] = frame_alloc_local(r->frame, true, false).offset;
+
+    InstrList out = {0};
+    for (uint32_t i = 0; i < r->code->len; i++) {
+        Instr in = r->code->data[i];
+        if (in.kind == I_MOVE && slot[in.dst[0]] && !slot[in.src[0]]) {
+            vec_push(&out, spill_oper(r, instr_fmt(r->a, "movq `s0, %d(%%rbp)", slot[in.dst[0]]),
+                                      NONE, in.src[0]));
+            continue;
+        }
+        if (in.kind == I_MOVE && slot[in.src[0]] && !slot[in.dst[0]]) {
+            vec_push(&out, spill_oper(r, instr_fmt(r->a, "movq %d(%%rbp), `d0", slot[in.src[0]]),
+                                      in.dst[0], NONE));
+            continue;
+        }
+        Temp from[8], to[8];
+        uint32_t nre = 0;
+        for (uint32_t k = 0; k < in.nsrc; k++) {
+            Temp t = in.src[k];
+            if (!slot[t])
+                continue;
+            uint32_t j = 0;
+            while (j < nre && from[j] != t)
+                j++;
+            if (j == nre) {
+                from[nre] = t;
+                to[nre++] = new_temp(r, true);
+                vec_push(&out, spill_oper(r, instr_fmt(r->a, "movq %d(%%rbp), `d0", slot[t]),
+                                          to[j], NONE));
+            }
+            in.src[k] = to[j];
+        }
+        Instr after[8];
+        uint32_t nafter = 0;
+        for (uint32_t k = 0; k < in.ndst; k++) {
+            Temp t = in.dst[k];
+            if (!slot[t])
+                continue;
+            uint32_t j = 0;
+            while (j < nre && from[j] != t)
+                j++;
+            if (j == nre) {
+                from[nre] = t;
+                to[nre++] = new_temp(r, true);
+            }
+            in.dst[k] = to[j];
+            after[nafter++] = spill_oper(r, instr_fmt(r->a, "movq `s0, %d(%%rbp)", slot[t]),
+                                         NONE, to[j]);
+        }
+        vec_push(&out, in);
+        for (uint32_t k = 0; k < nafter; k++)
+            vec_push(&out, after[k]);
+    }
+    vec_free(r->code);
+    *r->code = out;
+    free(slot);
+}
+
+RegAllocStats regalloc(Arena *a, Frame *f, InstrList *code, RegAllocKind kind, bool value)
+{
+    RegAllocStats st = {0};
+    Ra r = { .a = a, .frame = f, .code = code };
+    renumber(&r);
+
+    for (;;) {
+        st.rounds++;
+        if (st.rounds > 32)
+            fatal("regalloc: no progress in %s", kind == RA_IRC ? "irc" : "linear scan");
+        Flow flow;
+        flow_build(&flow, code, r.n, value ? 1u << REG_RAX : 0);
+        r.color = xmalloc(r.n * sizeof *r.color);
+        for (Temp t = 0; t < r.n; t++)
+            r.color[t] = t < TEMP_NREGS ? t : NONE;
+        spill_costs(&r, &flow);
+        if (kind == RA_IRC)
+            irc(&r, &flow);
+        else
+            linear_scan(&r, &flow);
+        flow_free(&flow);
+        free(r.cost);
+        if (!r.spilled.len)
+            break;
+        st.spilled += r.spilled.len;
+        rewrite(&r);
+        r.spilled.len = 0;
+        free(r.color);
+    }
+
+    /* Registers for temps, and away with moves that became no-ops. */
+    uint32_t keep = 0;
+    f->saved = 0;
+    for (uint32_t i = 0; i < code->len; i++) {
+        Instr *in = &code->data[i];
+        for (uint32_t k = 0; k < in->ndst; k++) {
+            in->dst[k] = r.color[in->dst[k]];
+            for (uint32_t j = 0; j < FRAME_NCALLEE_SAVES; j++)
+                if (in->dst[k] == callee_saves[j])
+                    f->saved |= 1u << in->dst[k];
+        }
+        for (uint32_t k = 0; k < in->nsrc; k++)
+            in->src[k] = r.color[in->src[k]];
+        if (in->kind == I_MOVE && in->dst[0] == in->src[0]) {
+            st.moves++;
+            continue;
+        }
+        code->data[keep++] = *in;
+    }
+    code->len = keep;
+
+    free(r.color);
+    vec_free(&r.nospill);
+    vec_free(&r.spilled);
+    return st;
+}
@@ -0,0 +1,33 @@
+#ifndef TIGER_REGALLOC_H
+#define TIGER_REGALLOC_H
+
+#include "assem.h"
+#include "frame.h"
+
+/*
+ * Register allocation.  RA_IRC is iterated register coalescing (George
+ * and Appel): graph coloring that merges move-related temps whenever
+ * the Briggs or George test shows it cannot cause a spill.  RA_LINEAR
+ * is linear scan over live intervals (Poletto and Sarkar), for fast
+ * compiles.  Both spill the temps of least weight, where every use or
+ * definition counts ten times more one loop deeper, and both repeat
+ * after rewriting spilled temps into loads and stores of frame slots.
+ */
+
+typedef enum RegAllocKind {
+    RA_LINEAR,
+    RA_IRC,
+} RegAllocKind;
+
+typedef struct RegAllocStats {
+    uint32_t spilled;       /* temps given frame slots */
+    uint32_t moves;         /* moves deleted as coalesced */
+    uint32_t rounds;
+} RegAllocStats;
+
+/* Give every temp in `code` a machine register, in place.  Spill slots
+   come from `f`, and f->saved records the callee-saved registers used.
+   `value`: the function returns a value in %rax. */
+RegAllocStats regalloc(Arena *a, Frame *f, InstrList *code, RegAllocKind kind, bool value);
+
+#endif
@@ -0,0 +1,806 @@
+#include "semant.h"
+
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "diag.h"
+#include "env.h"
+
+typedef struct Checker {
+    Sema *s;
+    Ast *ast;
+    Env *tenv;              /* Symbol -> Type* */
+    Env *venv;              /* Symbol -> Entry* */
+    FunEntry *fun;          /* function being checked */
+    uint32_t loop_depth;    /* loops enclosing the current expression */
+
+    /* Per-symbol scratch for batch checks: a symbol belongs to the
+       current batch iff stamp[sym] == gen, and slot[sym] is then its
+       index within the batch.  Symbols are dense, so this is O(1).
+       mark[] is the same idea for duplicate fields and parameters. */
+    uint32_t *stamp;
+    uint32_t *slot;
+    uint32_t *mark;
+    uint32_t gen;
+
+    VEC(Type *) headers;
+    VEC(uint32_t) uf;
+
+    /* Lets, sequences and ifs entered on the way down to the expression
+       they end with, each waiting for its type.  See check_exp. */
+    VEC(ExpId) spine;
+    VEC(Type *) then_types;
+} Checker;
+
+static const struct {
+    const char *name;
+    Type *formals[3];
+    uint32_t nformals;
+    Type *result;
+} builtins[] = {
+    { "print",     { &type_string }, 1, &type_unit },
+    { "flush",     { 0 }, 0, &type_unit },
+    { "getchar",   { 0 }, 0, &type_string },
+    { "ord",       { &type_string }, 1, &type_int },
+    { "chr",       { &type_int }, 1, &type_string },
+    { "size",      { &type_string }, 1, &type_int },
+    { "substring", { &type_string, &type_int, &type_int }, 3, &type_string },
+    { "concat",    { &type_string, &type_string }, 2, &type_string },
+    { "not",       { &type_int }, 1, &type_int },
+    { "exit",      { &type_int }, 1, &type_unit },
+};
+
+static void error(Checker *c, uint32_t pos, const char *fmt, ...)
+    __attribute__((format(printf, 3, 4)));
+
+static void error(Checker *c, uint32_t pos, const char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    diag_verror(c->ast->src, pos, fmt, ap);
+    va_end(ap);
+}
+
+static Type *check_exp(Checker *c, ExpId id);
+
+static Type *lookup_type(Checker *c, Symbol sym, uint32_t pos)
+{
+    Type *t = env_lookup(c->tenv, sym);
+    if (!t) {
+        error(c, pos, "undefined type '%s'", sym_name(sym));
+        return &type_error;
+    }
+    return t;
+}
+
+static uint32_t exp_pos(Checker *c, ExpId id)
+{
+    return ast_exp(c->ast, id)->pos;
+}
+
+static void expect_int(Checker *c, ExpId id, const char *what)
+{
+    Type *t = check_exp(c, id);
+    TypeKind k = type_actual(t)->kind;
+    if (k != TK_INT && k != TK_ERROR)
+        error(c, exp_pos(c, id), "%s must be int, found %s", what, type_str(t));
+}
+
+static VarEntry *new_var(Checker *c, uint8_t flags, Symbol name, uint32_t pos, Type *ty,
+                         FunEntry *owner)
+{
+    VarEntry *ve = arena_alloc(&c->s->arena, sizeof *ve);
+    *ve = (VarEntry){ .kind = ENT_VAR, .flags = flags, .name = name, .pos = pos,
+                      .ty = ty, .owner = owner, .index = c->s->vars.len };
+    vec_push(&c->s->vars, ve);
+    return ve;
+}
+
+/* ---- L-values ---------------------------------------------------------- */
+
+static Type *check_var(Checker *c, VarId id)
+{
+    Var *v = ast_var(c->ast, id);
+    Type *t = &type_error;
+    switch ((VarKind)v->kind) {
+    case VAR_SIMPLE: {
+        Entry *e = env_lookup(c->venv, v->u.simple.sym);
+        if (!e || e->kind != ENT_VAR) {
+            error(c, v->pos, "undefined variable '%s'", sym_name(v->u.simple.sym));
+            break;
+        }
+        VarEntry *ve = (VarEntry *)e;
+        c->s->var_entry[id] = ve;
+        t = ve->ty;
+        break;
+    }
+    case VAR_FIELD: {
+        Type *rt = type_actual(check_var(c, v->u.field.var));
+        v = ast_var(c->ast, id);
+        if (rt->kind == TK_ERROR)
+            break;
+        if (rt->kind != TK_RECORD) {
+            error(c, v->pos, "variable is not a record (it has type %s)", type_str(rt));
+            break;
+        }
+        int i = type_field_index(rt, v->u.field.sym);
+        if (i < 0) {
+            error(c, v->pos, "record type '%s' has no field '%s'",
+                  type_str(rt), sym_name(v->u.field.sym));
+            break;
+        }
+        t = rt->u.record.fields[i].ty;
+        break;
+    }
+    case VAR_SUBSCRIPT: {
+        Type *at = type_actual(check_var(c, v->u.subscript.var));
+        v = ast_var(c->ast, id);
+        expect_int(c, v->u.subscript.index, "array index");
+        v = ast_var(c->ast, id);
+        if (at->kind == TK_ERROR)
+            break;
+        if (at->kind != TK_ARRAY) {
+            error(c, v->pos, "variable is not an array (it has type %s)", type_str(at));
+            break;
+        }
+        t = at->u.array.elem;
+        break;
+    }
+    default:
+        break;
+    }
+    c->s->var_type[id] = t;
+    return t;
+}
+
+/* ---- Declarations ------------------------------------------------------ */
+
+static uint32_t uf_find(Checker *c, uint32_t i)
+{
+    uint32_t *p = c->uf.data;
+    while (p[i] != i) {
+        p[i] = p[p[i]];
+        i = p[i];
+    }
+    return i;
+}
+
+/*
+ * A batch of mutually recursive type declarations is checked in linear
+ * time: enter a NAME placeholder per declaration, resolve every body
+ * against the placeholders, then look for alias cycles.  Only `type a =
+ * b` declarations whose target is in the same batch add edges, and each
+ * declaration has at most one, so a cycle shows up as a union-find edge
+ * joining a set to itself.
+ */
+static void check_type_batch(Checker *c, AstList decs)
+{
+    uint32_t gen = ++c->gen;
+    uint32_t n = decs.count;
+    Ast *ast = c->ast;
+    Arena *a = &c->s->arena;
+
+    c->headers.len = 0;
+    vec_reserve(&c->headers, n);
+    for (uint32_t i = 0; i < n; i++) {
+        const Dec *d = ast_dec(ast, ast_list_at(ast, decs, i));
+        Type *h = type_name(a, d->name);
+        c->headers.data[i] = h;
+        if (c->stamp[d->name] == gen) {
+            error(c, d->pos, "type '%s' declared twice in the same batch", sym_name(d->name));
+            continue;
+        }
+        c->stamp[d->name] = gen;
+        c->slot[d->name] = i;
+        env_enter(c->tenv, d->name, h);
+    }
+    c->headers.len = n;
+
+    for (uint32_t i = 0; i < n; i++) {
+        const Dec *d = ast_dec(ast, ast_list_at(ast, decs, i));
+        const Ty *ty = ast_ty(ast, d->u.type.ty);
+        Type *h = c->headers.data[i];
+        switch ((TyKind)ty->kind) {
+        case TY_NAME:
+            h->u.name.bound = lookup_type(c, ty->u.name.sym, ty->pos);
+            break;
+        case TY_RECORD: {
+            AstList fl = ty->u.record.fields;
+            Type *r = type_record(a, d->name, fl.count);
+            uint32_t fgen = ++c->gen;
+            for (uint32_t k = 0; k < fl.count; k++) {
+                const Field *f = ast_field(ast, fl, k);
+                if (c->mark[f->name] == fgen)
+                    error(c, f->pos, "duplicate field '%s'", sym_name(f->name));
+                c->mark[f->name] = fgen;
+                r->u.record.fields[k].name = f->name;
+                r->u.record.fields[k].ty = lookup_type(c, f->type, f->pos);
+            }
+            h->u.name.bound = r;
+            break;
+        }
+        case TY_ARRAY:
+            h->u.name.bound = type_array(a, d->name, lookup_type(c, ty->u.array.sym, ty->pos));
+            break;
+        default:
+            h->u.name.bound = &type_error;
+        }
+    }
+
+    /* Alias cycles. */
+    c->uf.len = 0;
+    vec_reserve(&c->uf, n);
+    for (uint32_t i = 0; i < n; i++)
+        c->uf.data[i] = i;
+    c->uf.len = n;
+    for (uint32_t i = 0; i < n; i++) {
+        const Dec *d = ast_dec(ast, ast_list_at(ast, decs, i));
+        const Ty *ty = ast_ty(ast, d->u.type.ty);
+        if (ty->kind != TY_NAME || c->stamp[ty->u.name.sym] != gen)
+            continue;
+        uint32_t j = c->slot[ty->u.name.sym];
+        uint32_t ri = uf_find(c, i), rj = uf_find(c, j);
+        if (ri == rj) {
+            error(c, d->pos, "illegal cycle in type declarations: '%s' never reaches a record or array",
+                  sym_name(d->name));
+            c->headers.data[i]->u.name.bound = &type_error;
+        } else {
+            c->uf.data[ri] = rj;
+        }
+    }
+
+    /* Point every placeholder straight at its actual type, compressing
+       alias chains so the work stays linear. */
+    for (uint32_t i = 0; i < n; i++) {
+        Type *h = c->headers.data[i];
+        Type *t = type_actual(h);
+        while (h->kind == TK_NAME && h->u.name.bound != t) {
+            Type *next = h->u.name.bound;
+            h->u.name.bound = t;
+            h = next;
+        }
+    }
+}
+
+static void check_function_batch(Checker *c, AstList decs)
+{
+    uint32_t gen = ++c->gen;
+    uint32_t n = decs.count;
+    Ast *ast = c->ast;
+    Arena *a = &c->s->arena;
+
+    for (uint32_t i = 0; i < n; i++) {
+        DecId did = ast_list_at(ast, decs, i);
+        const Dec *d = ast_dec(ast, did);
+        AstList params = d->u.function.params;
+
+        FunEntry *f = arena_alloc(a, sizeof *f);
+        memset(f, 0, sizeof *f);
+        f->kind = ENT_FUN;
+        f->name = d->name;
+        f->pos = d->pos;
+        f->dec = did;
+        f->parent = c->fun;
+        f->nformals = params.count;
+        f->formals = arena_alloc(a, params.count * sizeof *f->formals);
+        for (uint32_t k = 0; k < params.count; k++) {
+            const Field *p = ast_field(ast, params, k);
+            f->formals[k] = lookup_type(c, p->type, p->pos);
+        }
+        f->result = d->u.function.result
+                  ? lookup_type(c, d->u.function.result, d->pos)
+                  : &type_unit;
+        f->index = c->s->funs.len;
+        vec_push(&c->s->funs, f);
+        c->s->dec_entry[did] = (Entry *)f;
+
+        if (c->stamp[d->name] == gen) {
+            error(c, d->pos, "function '%s' declared twice in the same batch", sym_name(d->name));
+            continue;
+        }
+        c->stamp[d->name] = gen;
+        env_enter(c->venv, d->name, f);
+    }
+
+    for (uint32_t i = 0; i < n; i++) {
+        DecId did = ast_list_at(ast, decs, i);
+        FunEntry *f = (FunEntry *)c->s->dec_entry[did];
+        const Dec *d = ast_dec(ast, did);
+        AstList params = d->u.function.params;
+
+        env_begin_scope(c->venv);
+        uint32_t pgen = ++c->gen;
+        for (uint32_t k = 0; k < params.count; k++) {
+            const Field *p = ast_field(ast, params, k);
+            if (c->mark[p->name] == pgen)
+                error(c, p->pos, "duplicate parameter '%s'", sym_name(p->name));
+            c->mark[p->name] = pgen;
+            VarEntry *ve = new_var(c, VE_PARAM, p->name, p->pos, f->formals[k], f);
+            c->s->param_entry[params.start + k] = ve;
+            env_enter(c->venv, p->name, ve);
+        }
+
+        FunEntry *saved_fun = c->fun;
+        uint32_t saved_loops = c->loop_depth;
+        c->fun = f;
+        c->loop_depth = 0;
+        Type *bt = check_exp(c, d->u.function.body);
+        c->fun = saved_fun;
+        c->loop_depth = saved_loops;
+        env_end_scope(c->venv);
+
+        d = ast_dec(ast, did);
+        if (!d->u.function.result) {
+            TypeKind k = type_actual(bt)->kind;
+            if (k != TK_UNIT && k != TK_ERROR)
+                error(c, d->pos, "procedure '%s' returns a value of type %s",
+                      sym_name(f->name), type_str(bt));
+        } else if (!type_assignable(f->result, bt)) {
+            error(c, d->pos, "function '%s' returns %s, expected %s",
+                  sym_name(f->name), type_str(bt), type_str(f->result));
+        }
+    }
+}
+
+static void check_var_dec(Checker *c, DecId did)
+{
+    Type *it = check_exp(c, ast_dec(c->ast, did)->u.var.init);
+    const Dec *d = ast_dec(c->ast, did);
+    Type *t = it;
+    if (d->u.var.type) {
+        t = lookup_type(c, d->u.var.type, d->pos);
+        if (!type_assignable(t, it))
+            error(c, d->pos, "type mismatch in initialization of '%s': expected %s, found %s",
+                  sym_name(d->name), type_str(t), type_str(it));
+    } else if (type_actual(it)->kind == TK_NIL) {
+        error(c, d->pos, "nil initializer of '%s' needs a record type constraint",
+              sym_name(d->name));
+    }
+
+    VarEntry *ve = new_var(c, 0, d->name, d->pos, t, c->fun);
+    c->s->dec_entry[did] = (Entry *)ve;
+    env_enter(c->venv, d->name, ve);
+}
+
+static void check_decs(Checker *c, AstList decs)
+{
+    for (uint32_t i = 0; i < decs.count; i++) {
+        DecId did = ast_list_at(c->ast, decs, i);
+        const Dec *d = ast_dec(c->ast, did);
+        switch ((DecKind)d->kind) {
+        case DEC_VAR:
+            check_var_dec(c, did);
+            break;
+        case DEC_TYPES:
+            check_type_batch(c, d->u.batch.decs);
+            break;
+        case DEC_FUNCTIONS:
+            check_function_batch(c, d->u.batch.decs);
+            break;
+        default:
+            fatal("semant: unbatched declaration");
+        }
+    }
+}
+
+/* ---- Expressions ------------------------------------------------------- */
+
+static Type *check_call(Checker *c, ExpId id)
+{
+    Exp *e = ast_exp(c->ast, id);
+    Symbol name = e->u.call.func;
+    AstList args = e->u.call.args;
+    uint32_t pos = e->pos;
+
+    Entry *ent = env_lookup(c->venv, name);
+    FunEntry *f = ent && ent->kind == ENT_FUN ? (FunEntry *)ent : NULL;
+    if (!f)
+        error(c, pos, "undefined function '%s'", sym_name(name));
+    else
+        c->s->call_fun[id] = f;
+
+    for (uint32_t i = 0; i < args.count; i++) {
+        ExpId arg = ast_list_at(c->ast, args, i);
+        Type *t = check_exp(c, arg);
+        if (f && i < f->nformals && !type_assignable(f->formals[i], t))
+            error(c, exp_pos(c, arg), "argument %u of '%s' has type %s, expected %s",
+                  i + 1, sym_name(name), type_str(t), type_str(f->formals[i]));
+    }
+    if (!f)
+        return &type_error;
+    if (args.count < f->nformals)
+        error(c, pos, "too few arguments to '%s': expected %u, found %u",
+              sym_name(name), f->nformals, args.count);
+    else if (args.count > f->nformals)
+        error(c, pos, "too many arguments to '%s': expected %u, found %u",
+              sym_name(name), f->nformals, args.count);
+    return f->result;
+}
+
+static Type *check_op(Checker *c, ExpId id)
+{
+    Exp *e = ast_exp(c->ast, id);
+    BinOp op = (BinOp)e->op;
+    ExpId l = e->u.op.left, r = e->u.op.right;
+    uint32_t pos = e->pos;
+    Type *lt = check_exp(c, l);
+    Type *rt = check_exp(c, r);
+    Type *la = type_actual(lt), *ra = type_actual(rt);
+    bool poisoned = la->kind == TK_ERROR || ra->kind == TK_ERROR;
+
+    switch (op) {
+    case OP_PLUS: case OP_MINUS: case OP_TIMES: case OP_DIVIDE:
+    case OP_AND: case OP_OR:
+        if (la->kind != TK_INT && la->kind != TK_ERROR)
+            error(c, exp_pos(c, l), "integer required, found %s", type_str(lt));
+        if (ra->kind != TK_INT && ra->kind != TK_ERROR)
+            error(c, exp_pos(c, r), "integer required, found %s", type_str(rt));
+        break;
+    case OP_EQ: case OP_NEQ: {
+        bool ok = (type_assignable(la, ra) || type_assignable(ra, la))
+               && la->kind != TK_UNIT
+               && !(la->kind == TK_NIL && ra->kind == TK_NIL);
+        if (!ok && !poisoned)
+            error(c, pos, "comparison of incompatible types %s and %s",
+                  type_str(lt), type_str(rt));
+        break;
+    }
+    default:
+        if (!poisoned && (la != ra || (la->kind != TK_INT && la->kind != TK_STRING)))
+            error(c, pos, "comparison of incompatible types %s and %s",
+                  type_str(lt), type_str(rt));
+        break;
+    }
+    return &type_int;
+}
+
+static Type *check_record(Checker *c, ExpId id)
+{
+    Exp *e = ast_exp(c->ast, id);
+    AstList fields = e->u.record.fields;
+    Symbol tname = e->u.record.type;
+    uint32_t pos = e->pos;
+
+    Type *t = env_lookup(c->tenv, tname);
+    Type *rt = t ? type_actual(t) : NULL;
+    if (!t)
+        error(c, pos, "undefined type '%s'", sym_name(tname));
+    else if (rt->kind != TK_RECORD && rt->kind != TK_ERROR)
+        error(c, pos, "'%s' is not a record type", sym_name(tname));
+    if (rt && rt->kind != TK_RECORD)
+        rt = NULL;
+
+    for (uint32_t i = 0; i < fields.count; i++) {
+        EField ef = *ast_efield(c->ast, fields, i);
+        Type *ft = check_exp(c, ef.exp);
+        if (!rt)
+            continue;
+        if (i >= rt->u.record.count || rt->u.record.fields[i].name != ef.name) {
+            int k = type_field_index(rt, ef.name);
+            if (k < 0)
+                error(c, ef.pos, "record type '%s' has no field '%s'",
+                      sym_name(tname), sym_name(ef.name));
+            else
+                error(c, ef.pos, "field '%s' out of order in '%s'",
+                      sym_name(ef.name), sym_name(tname));
+            continue;
+        }
+        if (!type_assignable(rt->u.record.fields[i].ty, ft))
+            error(c, ef.pos, "field '%s' has type %s, expected %s", sym_name(ef.name),
+                  type_str(ft), type_str(rt->u.record.fields[i].ty));
+    }
+    if (rt && fields.count < rt->u.record.count)
+        error(c, pos, "missing field '%s' in '%s'",
+              sym_name(rt->u.record.fields[fields.count].name), sym_name(tname));
+    return t ? t : &type_error;
+}
+
+static Type *check_array(Checker *c, ExpId id)
+{
+    Exp *e = ast_exp(c->ast, id);
+    Symbol tname = e->u.array.type;
+    ExpId size = e->u.array.size, init = e->u.array.init;
+    uint32_t pos = e->pos;
+
+    Type *t = env_lookup(c->tenv, tname);
+    Type *at = t ? type_actual(t) : NULL;
+    if (!t)
+        error(c, pos, "undefined type '%s'", sym_name(tname));
+    else if (at->kind != TK_ARRAY && at->kind != TK_ERROR)
+        error(c, pos, "'%s' is not an array type", sym_name(tname));
+
+    expect_int(c, size, "array size");
+    Type *it = check_exp(c, init);
+    if (at && at->kind == TK_ARRAY && !type_assignable(at->u.array.elem, it))
+        error(c, exp_pos(c, init), "array initializer has type %s, expected %s",
+              type_str(it), type_str(at->u.array.elem));
+    return t ? t : &type_error;
+}
+
+/* The type of the if `id`, whose then-arm has type `tt` and else-arm, if
+   it has one, type `et`. */
+static Type *if_type(Checker *c, ExpId id, Type *tt, Type *et)
+{
+    Exp *e = ast_exp(c->ast, id);
+    if (!e->u.if_.els) {
+        TypeKind k = type_actual(tt)->kind;
+        if (k != TK_UNIT && k != TK_ERROR)
+            error(c, e->pos, "if-then without else must produce no value, found %s",
+                  type_str(tt));
+        return &type_unit;
+    }
+    if (type_assignable(tt, et)) {
+        TypeKind k = type_actual(tt)->kind;
+        return k == TK_NIL || k == TK_ERROR ? et : tt;
+    }
+    if (type_assignable(et, tt))
+        return et;
+    error(c, e->pos, "then and else branches have different types: %s and %s",
+          type_str(tt), type_str(et));
+    return tt;
+}
+
+/* Any expression but a let, a non-empty sequence or an if. */
+static Type *check_other(Checker *c, ExpId id)
+{
+    Exp *e = ast_exp(c->ast, id);
+    Type *t = &type_unit;
+    switch ((ExpKind)e->kind) {
+    case EXP_VAR:
+        t = check_var(c, e->u.var.var);
+        break;
+    case EXP_NIL:
+        t = &type_nil;
+        break;
+    case EXP_INT:
+        t = &type_int;
+        break;
+    case EXP_STRING:
+        t = &type_string;
+        break;
+    case EXP_CALL:
+        t = check_call(c, id);
+        break;
+    case EXP_OP:
+        t = check_op(c, id);
+        break;
+    case EXP_RECORD:
+        t = check_record(c, id);
+        break;
+    case EXP_ASSIGN: {
+        VarId v = e->u.assign.var;
+        ExpId rhs = e->u.assign.exp;
+        uint32_t pos = e->pos;
+        Type *vt = check_var(c, v);
+        Type *rt = check_exp(c, rhs);
+        VarEntry *ve = c->s->var_entry[v];
+        if (ast_var(c->ast, v)->kind == VAR_SIMPLE && ve && (ve->flags & VE_READONLY))
+            error(c, pos, "cannot assign to loop variable '%s'", sym_name(ve->name));
+        if (!type_assignable(vt, rt))
+            error(c, pos, "type mismatch in assignment: expected %s, found %s",
+                  type_str(vt), type_str(rt));
+        t = &type_unit;
+        break;
+    }
+    case EXP_WHILE: {
+        ExpId test = e->u.while_.test, body = e->u.while_.body;
+        expect_int(c, test, "while condition");
+        c->loop_depth++;
+        Type *bt = check_exp(c, body);
+        c->loop_depth--;
+        if (type_actual(bt)->kind != TK_UNIT && !type_is_error(bt))
+            error(c, exp_pos(c, body), "body of while loop must produce no value, found %s",
+                  type_str(bt));
+        break;
+    }
+    case EXP_FOR: {
+        Symbol var = e->u.for_.var;
+        ExpId lo = e->u.for_.lo, hi = e->u.for_.hi, body = e->u.for_.body;
+        uint32_t pos = e->pos;
+        expect_int(c, lo, "for loop lower bound");
+        expect_int(c, hi, "for loop upper bound");
+
+        VarEntry *ve = new_var(c, VE_READONLY, var, pos, &type_int, c->fun);
+        c->s->for_var[id] = ve;
+        env_begin_scope(c->venv);
+        env_enter(c->venv, var, ve);
+        c->loop_depth++;
+        Type *bt = check_exp(c, body);
+        c->loop_depth--;
+        env_end_scope(c->venv);
+        if (type_actual(bt)->kind != TK_UNIT && !type_is_error(bt))
+            error(c, exp_pos(c, body), "body of for loop must produce no value, found %s",
+                  type_str(bt));
+        break;
+    }
+    case EXP_BREAK:
+        if (!c->loop_depth)
+            error(c, e->pos, "break outside of a loop");
+        break;
+    case EXP_ARRAY:
+        t = check_array(c, id);
+        break;
+    default:
+        break;
+    }
+    c->s->exp_type[id] = t;
+    return t;
+}
+
+/* Lets, sequences and ifs nest as deep as the parser allows, which is
+   far deeper than the C stack: so the body of a let, the last
+   expression of a sequence and the arm of an if that ends it (the else,
+   or the then of an if without one) are checked without recursing.  The
+   way down is kept on c->spine and given its types on the way back. */
+static Type *check_exp(Checker *c, ExpId id)
+{
+    uint32_t base = c->spine.len;
+    Type *t;
+    for (;;) {
+        Exp *e = ast_exp(c->ast, id);
+        ExpId next;
+        Type *tt = NULL;
+        if (e->kind == EXP_LET) {
+            AstList decs = e->u.let.decs;
+            next = e->u.let.body;
+            env_begin_scope(c->tenv);
+            env_begin_scope(c->venv);
+            check_decs(c, decs);
+        } else if (e->kind == EXP_SEQ && e->u.seq.exps.count) {
+            AstList l = e->u.seq.exps;
+            for (uint32_t i = 0; i + 1 < l.count; i++)
+                check_exp(c, ast_list_at(c->ast, l, i));
+            next = ast_list_at(c->ast, l, l.count - 1);
+        } else if (e->kind == EXP_IF) {
+            ExpId then = e->u.if_.then, els = e->u.if_.els;
+            expect_int(c, e->u.if_.test, "if condition");
+            if (els)
+                tt = check_exp(c, then);
+            next = els ? els : then;
+        } else {
+            t = check_other(c, id);
+            break;
+        }
+        vec_push(&c->spine, id);
+        vec_push(&c->then_types, tt);
+        id = next;
+    }
+
+    while (c->spine.len > base) {
+        id = c->spine.data[--c->spine.len];
+        Type *tt = c->then_types.data[--c->then_types.len];
+        switch ((ExpKind)ast_exp(c->ast, id)->kind) {
+        case EXP_LET:
+            env_end_scope(c->venv);
+            env_end_scope(c->tenv);
+            break;
+        case EXP_IF:
+            t = ast_exp(c->ast, id)->u.if_.els ? if_type(c, id, tt, t) : if_type(c, id, t, NULL);
+            break;
+        default:
+            break;
+        }
+        c->s->exp_type[id] = t;
+    }
+    return t;
+}
+
+/* ---- Entry point ------------------------------------------------------- */
+
+static void *side_table(Sema *s, uint32_t n)
+{
+    void *p = arena_alloc(&s->arena, (size_t)n * sizeof(void *));
+    memset(p, 0, (size_t)n * sizeof(void *));
+    return p;
+}
+
+static void sema_init(Sema *s, Ast *ast)
+{
+    memset(s, 0, sizeof *s);
+    s->ast = ast;
+    arena_init(&s->arena);
+    s->exp_type = side_table(s, ast->exps.len);
+    s->var_type = side_table(s, ast->vars.len);
+    s->var_entry = side_table(s, ast->vars.len);
+    s->call_fun = side_table(s, ast->exps.len);
+    s->for_var = side_table(s, ast->exps.len);
+    s->dec_entry = side_table(s, ast->decs.len);
+    s->param_entry = side_table(s, ast->fields.len);
+}
+
+/* Bind the predefined types and functions, with entries from `arena`. */
+static void enter_builtins(Arena *arena, Env *tenv, Env *venv)
+{
+    env_enter(tenv, sym_intern("int"), &type_int);
+    env_enter(tenv, sym_intern("string"), &type_string);
+
+    for (uint32_t i = 0; i < ARRAY_LEN(builtins); i++) {
+        FunEntry *f = arena_alloc(arena, sizeof *f);
+        memset(f, 0, sizeof *f);
+        f->kind = ENT_FUN;
+        f->builtin = (uint8_t)(i + 1);
+        f->name = sym_intern(builtins[i].name);
+        f->formals = (Type **)builtins[i].formals;
+        f->nformals = builtins[i].nformals;
+        f->result = builtins[i].result;
+        env_enter(venv, f->name, f);
+    }
+}
+
+static bool check_program(Sema *s, Env *tenv, Env *venv)
+{
+    Checker c = { .s = s, .ast = s->ast, .tenv = tenv, .venv = venv };
+
+    FunEntry *main_fn = arena_alloc(&s->arena, sizeof *main_fn);
+    memset(main_fn, 0, sizeof *main_fn);
+    main_fn->kind = ENT_FUN;
+    main_fn->name = sym_intern("tigermain");
+    main_fn->result = &type_unit;
+    vec_push(&s->funs, main_fn);
+    c.fun = main_fn;
+
+    uint32_t nsyms = sym_count();
+    c.stamp = xcalloc(nsyms, sizeof *c.stamp);
+    c.slot = xcalloc(nsyms, sizeof *c.slot);
+    c.mark = xcalloc(nsyms, sizeof *c.mark);
+
+    int before = diag_errors;
+    check_exp(&c, s->ast->root);
+
+    free(c.stamp);
+    free(c.slot);
+    free(c.mark);
+    vec_free(&c.headers);
+    vec_free(&c.uf);
+    vec_free(&c.spine);
+    vec_free(&c.then_types);
+    return diag_errors == before;
+}
+
+bool sema_check(Sema *s, Ast *ast, EnvKind env_kind)
+{
+    sema_init(s, ast);
+    Env *tenv = env_new(env_kind);
+    Env *venv = env_new(env_kind);
+    enter_builtins(&s->arena, tenv, venv);
+    bool ok = check_program(s, tenv, venv);
+    env_free(tenv);
+    env_free(venv);
+    return ok;
+}
+
+void sema_base_init(SemaBase *b, EnvKind env_kind)
+{
+    arena_init(&b->arena);
+    b->tenv = env_new(env_kind);
+    b->venv = env_new(env_kind);
+    enter_builtins(&b->arena, b->tenv, b->venv);
+}
+
+void sema_base_free(SemaBase *b)
+{
+    env_free(b->tenv);
+    env_free(b->venv);
+    arena_free(&b->arena);
+    memset(b, 0, sizeof *b);
+}
+
+bool sema_check_in(Sema *s, Ast *ast, SemaBase *base)
+{
+    sema_init(s, ast);
+    env_begin_scope(base->tenv);
+    env_begin_scope(base->venv);
+    bool ok = check_program(s, base->tenv, base->venv);
+    env_end_scope(base->venv);
+    env_end_scope(base->tenv);
+    return ok;
+}
+
+void sema_free(Sema *s)
+{
+    vec_free(&s->funs);
+    vec_free(&s->vars);
+    arena_free(&s->arena);
+    memset(s, 0, sizeof *s);
+}
@@ -0,0 +1,49 @@
+#ifndef TIGER_SEMANT_H
+#define TIGER_SEMANT_H
+
+#include "ast.h"
+#include "env.h"
+#include "types.h"
+
+/*
+ * Results of type checking, as side tables indexed by AST node id so
+ * later phases can find the type of an expression or the binding a name
+ * resolved to without re-walking scopes.
+ */
+typedef struct Sema {
+    Ast *ast;
+    Arena arena;            /* types and entries */
+
+    Type **exp_type;        /* [ExpId] */
+    Type **var_type;        /* [VarId] */
+    VarEntry **var_entry;   /* [VarId] binding of a VAR_SIMPLE */
+    FunEntry **call_fun;    /* [ExpId] callee of an EXP_CALL */
+    VarEntry **for_var;     /* [ExpId] loop variable of an EXP_FOR */
+    Entry **dec_entry;      /* [DecId] entry made by a VAR/FUNCTION dec */
+    VarEntry **param_entry; /* [field index] entry for a function formal */
+
+    /* Every function, the main program first, in source order. */
+    VEC(FunEntry *) funs;
+    /* Every variable, formal and loop variable, in the order checked. */
+    VEC(VarEntry *) vars;
+} Sema;
+
+/* Type-check `ast`, keeping scopes in environments of `env_kind`.
+   Errors go through diag_error(); returns true if there were none. */
+bool sema_check(Sema *s, Ast *ast, EnvKind env_kind);
+void sema_free(Sema *s);
+
+/* The predefined types and functions, built once for a process that
+   checks many programs.  sema_check_in() checks each in a scope of its
+   own on top of them and leaves the environments as it found them; the
+   builtin entries it resolves calls to live as long as `b`. */
+typedef struct SemaBase {
+    Arena arena;
+    Env *tenv, *venv;
+} SemaBase;
+
+void sema_base_init(SemaBase *b, EnvKind env_kind);
+void sema_base_free(SemaBase *b);
+bool sema_check_in(Sema *s, Ast *ast, SemaBase *base);
+
+#endif
@@ -0,0 +1,146 @@
+#include "source.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+enum { OWN_STATIC, OWN_MMAP, OWN_MALLOC };
+
+static bool read_all(int fd, char *buf, size_t len)
+{
+    size_t done = 0;
+    while (done < len) {
+        ssize_t n = read(fd, buf + done, len - done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        done += (size_t)n;
+    }
+    return true;
+}
+
+static bool open_source(Source *src, const char *path, bool copy)
+{
+    memset(src, 0, sizeof *src);
+    src->path = path;
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        return false;
+    }
+    if (!S_ISREG(st.st_mode) || st.st_size >= UINT32_MAX) {
+        close(fd);
+        errno = S_ISREG(st.st_mode) ? EFBIG : EINVAL;
+        return false;
+    }
+
+    size_t len = (size_t)st.st_size;
+    long page = sysconf(_SC_PAGESIZE);
+    src->len = (uint32_t)len;
+
+    if (len == 0) {
+        src->data = "";
+        src->owner = OWN_STATIC;
+    } else if (!copy && len % (size_t)page != 0) {
+        /* The kernel zero-fills the tail of the last page, which gives us
+           the NUL sentinel for free. */
+        void *p = mmap(NULL, len, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+        if (p == MAP_FAILED) {
+            close(fd);
+            return false;
+        }
+        madvise(p, len, MADV_SEQUENTIAL);
+        src->data = p;
+        src->map_len = len;
+        src->owner = OWN_MMAP;
+    } else {
+        /* Page-aligned size, where there is no slack for the sentinel,
+           or a caller that wants a copy. */
+        char *buf = xmalloc(len + 1);
+        if (!read_all(fd, buf, len)) {
+            free(buf);
+            close(fd);
+            errno = EIO;
+            return false;
+        }
+        buf[len] = '\0';
+        src->data = buf;
+        src->owner = OWN_MALLOC;
+    }
+    close(fd);
+    return true;
+}
+
+bool source_open(Source *src, const char *path)
+{
+    return open_source(src, path, false);
+}
+
+bool source_read(Source *src, const char *path)
+{
+    return open_source(src, path, true);
+}
+
+void source_adopt(Source *src, const char *path, char *data, uint32_t len)
+{
+    memset(src, 0, sizeof *src);
+    src->path = path;
+    data[len] = '\0';
+    src->data = data;
+    src->len = len;
+    src->owner = OWN_MALLOC;
+}
+
+void source_close(Source *src)
+{
+    if (src->owner == OWN_MMAP)
+        munmap((void *)src->data, src->map_len);
+    else if (src->owner == OWN_MALLOC)
+        free((void *)src->data);
+    free(src->lines);
+    memset(src, 0, sizeof *src);
+}
+
+static void build_lines(Source *src)
+{
+    uint32_t cap = 64, n = 0;
+    uint32_t *lines = xmalloc(cap * sizeof *lines);
+    lines[n++] = 0;
+    const char *p = src->data, *end = src->data + src->len;
+    while ((p = memchr(p, '\n', (size_t)(end - p))) != NULL) {
+        p++;
+        if (n == cap) {
+            cap *= 2;
+            lines = xrealloc(lines, cap * sizeof *lines);
+        }
+        lines[n++] = (uint32_t)(p - src->data);
+    }
+    src->lines = lines;
+    src->nlines = n;
+}
+
+void source_position(Source *src, uint32_t offset, uint32_t *line, uint32_t *col)
+{
+    if (!src->lines)
+        build_lines(src);
+    uint32_t lo = 0, hi = src->nlines;
+    while (hi - lo > 1) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (src->lines[mid] <= offset)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    *line = lo + 1;
+    *col = offset - src->lines[lo] + 1;
+}
@@ -0,0 +1,42 @@
+#ifndef TIGER_SOURCE_H
+#define TIGER_SOURCE_H
+
+#include "util.h"
+
+/*
+ * A source file held in memory for the whole compilation.  Regular files
+ * are mmap'd read-only; `data[len]` is always a readable NUL so the lexer
+ * can use it as an end-of-input sentinel instead of bounds-checking every
+ * byte.  Offsets into `data` are 32-bit throughout the compiler.
+ */
+typedef struct Source {
+    const char *path;
+    const char *data;
+    uint32_t len;
+
+    /* How `data` is owned: 0 = static, 1 = mmap, 2 = malloc. */
+    int owner;
+    size_t map_len;
+
+    /* Offsets of line starts, built lazily by source_position(). */
+    uint32_t *lines;
+    uint32_t nlines;
+} Source;
+
+/* Map `path` into memory.  Returns false (with errno set) on failure. */
+bool source_open(Source *src, const char *path);
+
+/* Like source_open(), but copy the file into memory, so the text stays
+   as it was if the file is rewritten in place while `src` holds it. */
+bool source_read(Source *src, const char *path);
+
+/* Hold the `len` bytes at `data`, which came from xmalloc() with room
+   for the sentinel at data[len].  source_close() frees them. */
+void source_adopt(Source *src, const char *path, char *data, uint32_t len);
+
+void source_close(Source *src);
+
+/* 1-based line and column of byte `offset`. */
+void source_position(Source *src, uint32_t offset, uint32_t *line, uint32_t *col);
+
+#endif
@@ -0,0 +1,166 @@
+#include "symbol.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "token.h"
+
+typedef struct SymEntry {
+    const char *name;
+    uint32_t len;
+    uint32_t hash;
+} SymEntry;
+
+/* Open-addressing slot: the low hash bits let most probes reject a
+   mismatch without touching the entry array. */
+typedef struct Slot {
+    uint32_t hash;
+    Symbol id;          /* SYM_NONE marks an empty slot */
+} Slot;
+
+typedef struct StrChunk {
+    struct StrChunk *next;
+    uint32_t used, cap;
+    char bytes[];
+} StrChunk;
+
+static _Thread_local struct {
+    SymEntry *entries;
+    uint32_t count, cap;
+    Slot *slots;
+    uint32_t mask;
+    StrChunk *chunks;
+} tab;
+
+enum { CHUNK_SIZE = 64 * 1024 };
+
+static const char *store_bytes(const char *s, uint32_t len)
+{
+    StrChunk *c = tab.chunks;
+    if (!c || c->cap - c->used < len + 1) {
+        uint32_t cap = len + 1 > CHUNK_SIZE ? len + 1 : CHUNK_SIZE;
+        c = xmalloc(sizeof *c + cap);
+        c->used = 0;
+        c->cap = cap;
+        c->next = tab.chunks;
+        tab.chunks = c;
+    }
+    char *dst = c->bytes + c->used;
+    memcpy(dst, s, len);
+    dst[len] = '\0';
+    c->used += len + 1;
+    return dst;
+}
+
+static void rehash(uint32_t nslots)
+{
+    Slot *slots = xcalloc(nslots, sizeof *slots);
+    uint32_t mask = nslots - 1;
+    for (uint32_t id = 1; id < tab.count; id++) {
+        uint32_t h = tab.entries[id].hash, i = h & mask;
+        while (slots[i].id)
+            i = (i + 1) & mask;
+        slots[i].hash = h;
+        slots[i].id = id;
+    }
+    free(tab.slots);
+    tab.slots = slots;
+    tab.mask = mask;
+}
+
+void symtab_init(void)
+{
+    if (tab.entries)
+        return;
+    tab.cap = 1024;
+    tab.entries = xmalloc(tab.cap * sizeof *tab.entries);
+    tab.entries[0] = (SymEntry){ "", 0, 0 };
+    tab.count = 1;
+    rehash(2048);
+
+    for (int k = TOK_ARRAY; k <= TOK_TYPE; k++) {
+        /* token_names[] holds the keyword quoted: 'array' */
+        const char *q = token_names[k];
+        sym_intern_n(q + 1, (uint32_t)strlen(q) - 2);
+    }
+}
+
+uint64_t sym_hash(const char *s, uint32_t len)
+{
+    /* Word-at-a-time multiply/xorshift mix. */
+    const uint64_t m = 0x9e3779b97f4a7c15ull;
+    uint64_t h = len * m;
+    while (len >= 8) {
+        uint64_t w;
+        memcpy(&w, s, 8);
+        h = (h ^ w) * m;
+        h ^= h >> 29;
+        s += 8;
+        len -= 8;
+    }
+    uint64_t w = 0;
+    switch (len) {
+    case 7: w |= (uint64_t)(uint8_t)s[6] << 48; /* fallthrough */
+    case 6: w |= (uint64_t)(uint8_t)s[5] << 40; /* fallthrough */
+    case 5: w |= (uint64_t)(uint8_t)s[4] << 32; /* fallthrough */
+    case 4: w |= (uint64_t)(uint8_t)s[3] << 24; /* fallthrough */
+    case 3: w |= (uint64_t)(uint8_t)s[2] << 16; /* fallthrough */
+    case 2: w |= (uint64_t)(uint8_t)s[1] << 8;  /* fallthrough */
+    case 1: w |= (uint64_t)(uint8_t)s[0];
+        h = (h ^ w) * m;
+    }
+    h ^= h >> 32;
+    return h;
+}
+
+Symbol sym_intern_hashed(const char *s, uint32_t len, uint64_t hash)
+{
+    uint32_t h = (uint32_t)hash, i = h & tab.mask;
+    for (;;) {
+        Slot *sl = &tab.slots[i];
+        if (!sl->id)
+            break;
+        if (sl->hash == h) {
+            const SymEntry *e = &tab.entries[sl->id];
+            if (e->len == len && memcmp(e->name, s, len) == 0)
+                return sl->id;
+        }
+        i = (i + 1) & tab.mask;
+    }
+
+    if (tab.count == UINT32_MAX)
+        fatal("symbol table full");
+    if (tab.count == tab.cap) {
+        tab.cap *= 2;
+        tab.entries = xrealloc(tab.entries, (size_t)tab.cap * sizeof *tab.entries);
+    }
+    Symbol id = tab.count++;
+    tab.entries[id] = (SymEntry){ store_bytes(s, len), len, h };
+    tab.slots[i].hash = h;
+    tab.slots[i].id = id;
+
+    /* Keep the load factor under 1/2. */
+    if (tab.count * 2 > tab.mask + 1)
+        rehash((tab.mask + 1) * 2);
+    return id;
+}
+
+Symbol sym_intern(const char *s)
+{
+    return sym_intern_n(s, (uint32_t)strlen(s));
+}
+
+const char *sym_name(Symbol s)
+{
+    return tab.entries[s].name;
+}
+
+uint32_t sym_len(Symbol s)
+{
+    return tab.entries[s].len;
+}
+
+uint32_t sym_count(void)
+{
+    return tab.count;
+}
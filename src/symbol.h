@@ -0,0 +1,46 @@
+#ifndef TIGER_SYMBOL_H
+#define TIGER_SYMBOL_H
+
+#include "util.h"
+
+/*
+ * Interned identifiers and string literals.  Every distinct byte string
+ * gets a dense 32-bit id, so symbols compare with `==` and can index
+ * side tables directly.  Id 0 is SYM_NONE; ids 1..SYM_NKEYWORDS are the
+ * Tiger keywords in TOK_ARRAY..TOK_TYPE order, which lets the lexer
+ * classify a word with a single range check after interning it.
+ *
+ * There is one table per thread, shared by all phases of the files it
+ * compiles: symbols of files compiled on different threads do not
+ * compare.  symtab_init() must run on each thread before it interns.
+ */
+typedef uint32_t Symbol;
+
+enum {
+    SYM_NONE = 0,
+    SYM_NKEYWORDS = 17,
+};
+
+/* Intern the keywords.  Safe to call more than once. */
+void symtab_init(void);
+
+uint64_t sym_hash(const char *s, uint32_t len);
+
+/* Return the id of `s`, adding it if new.  `hash` must be sym_hash(s, len). */
+Symbol sym_intern_hashed(const char *s, uint32_t len, uint64_t hash);
+
+static inline Symbol sym_intern_n(const char *s, uint32_t len)
+{
+    return sym_intern_hashed(s, len, sym_hash(s, len));
+}
+
+Symbol sym_intern(const char *s);
+
+/* The interned bytes, NUL-terminated (the NUL is not part of the length). */
+const char *sym_name(Symbol s);
+uint32_t sym_len(Symbol s);
+
+/* Number of ids handed out so far, including SYM_NONE. */
+uint32_t sym_count(void);
+
+#endif
@@ -0,0 +1,53 @@
+#include "temp.h"
+
+#include <stdlib.h>
+
+static _Thread_local uint32_t ntemps = TEMP_NREGS;
+static _Thread_local VEC(Symbol) labels;
+
+void temp_reset(void)
+{
+    ntemps = TEMP_NREGS;
+    labels.len = 0;
+}
+
+Temp temp_new(void)
+{
+    return ntemps++;
+}
+
+uint32_t temp_count(void)
+{
+    return ntemps;
+}
+
+Label label_new(void)
+{
+    vec_push(&labels, SYM_NONE);
+    return labels.len - 1;
+}
+
+Label label_named(Symbol name)
+{
+    vec_push(&labels, name);
+    return labels.len - 1;
+}
+
+uint32_t label_count(void)
+{
+    return labels.len;
+}
+
+Symbol label_sym(Label l)
+{
+    return labels.data[l];
+}
+
+void label_print(Label l, FILE *out)
+{
+    Symbol s = labels.data[l];
+    if (s)
+        fputs(sym_name(s), out);
+    else
+        fprintf(out, ".L%u", l);
+}
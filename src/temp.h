@@ -0,0 +1,37 @@
+#ifndef TIGER_TEMP_H
+#define TIGER_TEMP_H
+
+#include <stdio.h>
+
+#include "symbol.h"
+
+/*
+ * Temporaries (abstract registers) and code labels, both dense 32-bit
+ * ids.  The first TEMP_NREGS temps are the machine registers, numbered
+ * by the target (see frame.h); temp_new() hands out the rest.  A label
+ * either carries a name (functions, runtime entry points, string
+ * literals that must be addressable by name) or is printed as "L<n>".
+ * Both id spaces belong to the calling thread.
+ */
+typedef uint32_t Temp;
+typedef uint32_t Label;
+
+enum { TEMP_NREGS = 16 };
+
+/* Forget every temp and label; ids restart for a new compilation. */
+void temp_reset(void);
+
+Temp temp_new(void);
+uint32_t temp_count(void);
+
+Label label_new(void);
+Label label_named(Symbol name);
+uint32_t label_count(void);
+
+/* The label's name, or SYM_NONE for an anonymous label. */
+Symbol label_sym(Label l);
+
+/* Print a label as it appears in dumps and assembly. */
+void label_print(Label l, FILE *out);
+
+#endif
@@ -0,0 +1,83 @@
+#ifndef TIGER_TOKEN_H
+#define TIGER_TOKEN_H
+
+#include "util.h"
+
+#define TOKEN_LIST(X)                                                     \
+    X(EOF, "end of file")                                                 \
+    X(ID, "identifier")                                                   \
+    X(INT, "integer")                                                     \
+    X(STRING, "string")                                                   \
+    X(COMMA, "','")                                                       \
+    X(COLON, "':'")                                                       \
+    X(SEMI, "';'")                                                        \
+    X(LPAREN, "'('")                                                      \
+    X(RPAREN, "')'")                                                      \
+    X(LBRACK, "'['")                                                      \
+    X(RBRACK, "']'")                                                      \
+    X(LBRACE, "'{'")                                                      \
+    X(RBRACE, "'}'")                                                      \
+    X(DOT, "'.'")                                                         \
+    X(PLUS, "'+'")                                                        \
+    X(MINUS, "'-'")                                                       \
+    X(TIMES, "'*'")                                                       \
+    X(DIVIDE, "'/'")                                                      \
+    X(EQ, "'='")                                                          \
+    X(NEQ, "'<>'")                                                        \
+    X(LT, "'<'")                                                          \
+    X(LE, "'<='")                                                         \
+    X(GT, "'>'")                                                          \
+    X(GE, "'>='")                                                         \
+    X(AND, "'&'")                                                         \
+    X(OR, "'|'")                                                          \
+    X(ASSIGN, "':='")                                                     \
+    X(ARRAY, "'array'")                                                   \
+    X(IF, "'if'")                                                         \
+    X(THEN, "'then'")                                                     \
+    X(ELSE, "'else'")                                                     \
+    X(WHILE, "'while'")                                                   \
+    X(FOR, "'for'")                                                       \
+    X(TO, "'to'")                                                         \
+    X(DO, "'do'")                                                         \
+    X(LET, "'let'")                                                       \
+    X(IN, "'in'")                                                         \
+    X(END, "'end'")                                                       \
+    X(OF, "'of'")                                                         \
+    X(BREAK, "'break'")                                                   \
+    X(NIL, "'nil'")                                                       \
+    X(FUNCTION, "'function'")                                             \
+    X(VAR, "'var'")                                                       \
+    X(TYPE, "'type'")
+
+typedef enum TokKind {
+#define X(name, text) TOK_##name,
+    TOKEN_LIST(X)
+#undef X
+    TOK_COUNT
+} TokKind;
+
+/* Token flags. */
+enum {
+    TF_ESCAPED = 1 << 0,    /* string literal contains escape sequences */
+};
+
+/*
+ * A token is a view into the source buffer: no text is copied.  The
+ * literal text is `src->data + offset` for `length` bytes (string tokens
+ * include their quotes).  `value` is the interned Symbol of an identifier
+ * or of a string literal's decoded contents, and the value of an integer
+ * literal.
+ */
+typedef struct Token {
+    uint16_t kind;
+    uint16_t flags;
+    uint32_t offset;
+    uint32_t length;
+    uint32_t value;
+} Token;
+
+typedef VEC(Token) TokenVec;
+
+extern const char *const token_names[TOK_COUNT];
+
+#endif
@@ -0,0 +1,1734 @@
+#include "translate.h"
+
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * A translated expression is one of three shapes (Appel's Ex/Nx/Cx):
+ * a value, a statement for effect only, or a condition — a statement
+ * that jumps to one of two labels not chosen yet.  A condition keeps
+ * the label slots still to be filled in as patch lists.
+ */
+typedef struct Patch {
+    Label *slot;
+    struct Patch *next;
+} Patch;
+
+typedef enum TrKind {
+    TR_EX,
+    TR_NX,
+    TR_CX,
+} TrKind;
+
+typedef struct Tr {
+    TrKind kind;
+    union {
+        TExp *ex;
+        TStm *nx;
+        struct { TStm *stm; Patch *t, *f; } cx;
+    } u;
+} Tr;
+
+typedef struct Level {
+    struct Level *parent;
+    Frame *frame;
+    FunEntry *fun;
+    /* Shared out-of-line targets for failed runtime checks. */
+    Label nil_fail, bounds_fail;
+    /* Self calls in tail position jump to `entry`, past the view shift.
+       In a `trmc` function the result is a record built around such a
+       call: `last` is the record whose final field is still open (0 for
+       none yet), `off` that field's offset, `res` the outermost one. */
+    Label entry, exit;
+    bool trmc;
+    Temp res, last, off;
+} Level;
+
+/* What is known of a variable that is never assigned: its value lies
+   in [lo, hi] if `ranged`, and an array it holds has at least `length`
+   elements.  Variables are numbered by `seq` in the order they come
+   into scope. */
+typedef struct Fact {
+    uint32_t seq;
+    bool ranged;
+    int64_t lo, hi;
+    int64_t length;
+} Fact;
+
+/* A subscript check in the body of a `for` loop that one test ahead of
+   the loop can stand in for: the array is loop-invariant and the index
+   is too, or is the loop variable plus an invariant (`varies`). */
+typedef struct Hoist {
+    TStm *check;
+    VarId base;
+    ExpId index;
+    bool varies;
+} Hoist;
+
+typedef struct Loop {
+    Level *level;
+    VarEntry *var;
+    uint32_t seq;           /* variables declared in the body from here */
+    bool versioned;         /* the body holds a versioned loop */
+    VEC(Hoist) hoists;
+} Loop;
+
+/* A let, sequence or if whose last part is still being translated: what
+   comes before that part, translated already.  See tr_exp. */
+typedef struct Pending {
+    ExpId id;
+    TStm *s;                /* a let's declarations, a sequence's leading expressions */
+    Tr test, then;          /* an if's test, and its then-arm if the else is last */
+} Pending;
+
+typedef struct Translator {
+    Program *p;
+    Sema *s;
+    Ast *ast;
+    Arena *a;
+    Level **levels;         /* [FunEntry.index] */
+    Access *access;         /* [VarEntry.index] */
+    Fact *facts;            /* [VarEntry.index] */
+    uint32_t nseq;
+    VEC(Loop) loops;        /* enclosing `for` loops, innermost last */
+    Label *strings;         /* [Symbol] label of the literal, or 0 */
+    Level *level;           /* function being translated */
+    /* Exit labels of the enclosing loops.  A function's loops stack on
+       top of those around its declaration and are gone again when it is
+       done; semant has made sure every break is in a loop of its own
+       function, so the top is always the right one. */
+    VEC(Label) breaks;
+    bool tail;              /* next expression is in tail position */
+    VEC(Pending) spine;
+    Label card_bias;        /* tiger_card_bias, once used */
+} Translator;
+
+static Tr tr_exp(Translator *t, ExpId id);
+
+/* Under -pg, the mark of the line `id` starts on; NULL otherwise. */
+static TStm *line_mark(Translator *t, ExpId id)
+{
+    if (!t->p->profile)
+        return NULL;
+    uint32_t line, col;
+    source_position(t->ast->src, ast_exp(t->ast, id)->pos, &line, &col);
+    return t_line(t->a, line);
+}
+
+/* Under -pg, add one to word `i` of the branch counts. */
+static TStm *bump(Translator *t, uint32_t i)
+{
+    Arena *a = t->a;
+    TExp *addr = t_binop(a, T_PLUS, t_name(a, t->p->branch_counts), t_const(a, 8 * i));
+    TExp *again = t_binop(a, T_PLUS, t_name(a, t->p->branch_counts), t_const(a, 8 * i));
+    return t_move(a, t_mem(a, addr), t_binop(a, T_PLUS, t_mem(a, again), t_const(a, 1)));
+}
+
+static void set_freq(Frame *f, Label l, uint64_t n)
+{
+    idmap_put(&f->freq, l, n < UINT32_MAX ? (uint32_t)n : UINT32_MAX - 1);
+}
+
+/* Static weights for branches no profile counts, in the spirit of
+   __builtin_expect: a failed runtime check is never expected, and a
+   loop is expected to go round again rather than leave, though not so
+   surely that what follows it counts as rare. */
+enum { HINT_NEVER = 0, HINT_AGAIN = 3, HINT_LEAVE = 1 };
+
+/* Give `l` weight `w` unless it has one.  In a function with a profile
+   only HINT_NEVER goes in, the one weight that reads as a count. */
+static void hint(Translator *t, Label l, uint32_t w)
+{
+    Frame *f = t->level->frame;
+    if ((f->profiled && w != HINT_NEVER) || idmap_get(&f->freq, l, UINT32_MAX) != UINT32_MAX)
+        return;
+    set_freq(f, l, w);
+}
+
+/* The shared target `*l` of a failing check, made on first use. */
+static Label fail_label(Translator *t, Label *l)
+{
+    if (!*l) {
+        *l = label_new();
+        hint(t, *l, HINT_NEVER);
+    }
+    return *l;
+}
+
+/* With a profile, what it says about the function of frame `f`. */
+static void use_profile(Translator *t, Frame *f)
+{
+    if (!t->p->use)
+        return;
+    f->profiled = true;
+    f->calls = profile_calls(t->p->use, sym_name(label_sym(f->name)));
+}
+
+/* The branch `id`, an if or a while, goes to `lt` when its test holds
+   and to `lf` when not.  With a profile, the labels get the counts it
+   has for the branch; under -pg, the statements that count each way
+   are returned, to follow the labels. */
+typedef struct Arms {
+    TStm *t, *f;
+} Arms;
+
+static Arms branch_arms(Translator *t, ExpId id, Label lt, Label lf)
+{
+    Arms r = { NULL, NULL };
+    if (!t->p->profile && !t->p->use)
+        return r;
+    uint32_t line, col;
+    source_position(t->ast->src, ast_exp(t->ast, id)->pos, &line, &col);
+    const ProfileBranch *b = t->p->use ? profile_branch(t->p->use, t->p->path, line, col) : NULL;
+    if (b) {
+        set_freq(t->level->frame, lt, b->taken);
+        set_freq(t->level->frame, lf, b->not_taken);
+    }
+    if (t->p->profile) {
+        uint32_t k = t->p->branches.len;
+        vec_push(&t->p->branches, ((BranchSite){ line, col }));
+        r.t = bump(t, 2 * k);
+        r.f = bump(t, 2 * k + 1);
+    }
+    return r;
+}
+
+/* Translate `id`, in tail position if `tail`. */
+static Tr tr_tail(Translator *t, ExpId id, bool tail)
+{
+    t->tail = tail;
+    return tr_exp(t, id);
+}
+
+/* ---- Tr shapes --------------------------------------------------------- */
+
+static Tr ex(TExp *e) { return (Tr){ .kind = TR_EX, .u.ex = e }; }
+static Tr nx(TStm *s) { return (Tr){ .kind = TR_NX, .u.nx = s }; }
+
+static Patch *patch(Translator *t, Label *slot, Patch *next)
+{
+    Patch *p = arena_alloc(t->a, sizeof *p);
+    p->slot = slot;
+    p->next = next;
+    return p;
+}
+
+static void do_patch(Patch *p, Label l)
+{
+    for (; p; p = p->next)
+        *p->slot = l;
+}
+
+static Patch *join_patches(Patch *a, Patch *b)
+{
+    if (!a)
+        return b;
+    Patch *p = a;
+    while (p->next)
+        p = p->next;
+    p->next = b;
+    return a;
+}
+
+/* A condition settled before it runs: a jump to its one target. */
+static Tr cx_const(Translator *t, bool v)
+{
+    TStm *s = t_jump(t->a, 0);
+    Patch *p = patch(t, &s->u.jump.target->u.name, patch(t, &s->u.jump.labels[0], NULL));
+    return (Tr){ .kind = TR_CX, .u.cx = { s, v ? p : NULL, v ? NULL : p } };
+}
+
+/* The value of `tr` as a condition if it is known without running
+   anything: 1 or 0, or -1 if not. */
+static int known(Tr tr)
+{
+    if (tr.kind == TR_EX && tr.u.ex->kind == TE_CONST)
+        return tr.u.ex->u.value != 0;
+    if (tr.kind == TR_CX && tr.u.cx.stm->kind == TS_JUMP)
+        return tr.u.cx.t != NULL;
+    return -1;
+}
+
+static bool rel_holds(TRelOp op, int64_t l, int64_t r)
+{
+    switch (op) {
+    case T_EQ: return l == r;
+    case T_NE: return l != r;
+    case T_LT: return l < r;
+    case T_GT: return l > r;
+    case T_LE: return l <= r;
+    case T_GE: return l >= r;
+    case T_ULT: return (uint64_t)l < (uint64_t)r;
+    case T_ULE: return (uint64_t)l <= (uint64_t)r;
+    case T_UGT: return (uint64_t)l > (uint64_t)r;
+    case T_UGE: return (uint64_t)l >= (uint64_t)r;
+    default: break;
+    }
+    fatal("translate: bad relation");
+}
+
+static Tr cx_cjump(Translator *t, TRelOp op, TExp *l, TExp *r)
+{
+    if (l->kind == TE_CONST && r->kind == TE_CONST)
+        return cx_const(t, rel_holds(op, l->u.value, r->u.value));
+    TStm *s = t_cjump(t->a, op, l, r, 0, 0);
+    return (Tr){ .kind = TR_CX, .u.cx = { s, patch(t, &s->u.cjump.t, NULL),
+                                          patch(t, &s->u.cjump.f, NULL) } };
+}
+
+static TExp *un_ex(Translator *t, Tr tr)
+{
+    Arena *a = t->a;
+    switch (tr.kind) {
+    case TR_EX:
+        return tr.u.ex;
+    case TR_NX:
+        return t_eseq(a, tr.u.nx, t_const(a, 0));
+    case TR_CX: {
+        if (known(tr) >= 0)
+            return t_const(a, known(tr));
+        Temp r = temp_new();
+        Label lt = label_new(), lf = label_new();
+        do_patch(tr.u.cx.t, lt);
+        do_patch(tr.u.cx.f, lf);
+        TStm *s = t_seq(a, t_move(a, t_temp(a, r), t_const(a, 1)),
+                  t_seq(a, tr.u.cx.stm,
+                  t_seq(a, t_label(a, lf),
+                  t_seq(a, t_move(a, t_temp(a, r), t_const(a, 0)),
+                           t_label(a, lt)))));
+        return t_eseq(a, s, t_temp(a, r));
+    }
+    }
+    return NULL;
+}
+
+static TStm *un_nx(Translator *t, Tr tr)
+{
+    switch (tr.kind) {
+    case TR_EX:
+        return t_exp(t->a, tr.u.ex);
+    case TR_NX:
+        return tr.u.nx;
+    case TR_CX: {
+        if (known(tr) >= 0)
+            return t_exp(t->a, t_const(t->a, 0));
+        Label join = label_new();
+        do_patch(tr.u.cx.t, join);
+        do_patch(tr.u.cx.f, join);
+        return t_seq(t->a, tr.u.cx.stm, t_label(t->a, join));
+    }
+    }
+    return NULL;
+}
+
+static Tr un_cx(Translator *t, Tr tr)
+{
+    if (tr.kind == TR_CX)
+        return tr;
+    if (tr.kind == TR_NX)
+        fatal("translate: condition has no value");
+    if (known(tr) >= 0)
+        return cx_const(t, known(tr));
+    return cx_cjump(t, T_NE, tr.u.ex, t_const(t->a, 0));
+}
+
+/* ---- Helpers ----------------------------------------------------------- */
+
+static bool is_ptr(Type *ty)
+{
+    TypeKind k = type_actual(ty)->kind;
+    return k == TK_RECORD || k == TK_ARRAY || k == TK_STRING;
+}
+
+/* Records keep their pointer fields first, each group in declaration
+   order, so that the collector needs only their number.  The slot of
+   field `i` of record type `rt`: */
+static int64_t field_slot(Type *rt, int i)
+{
+    rt = type_actual(rt);
+    bool ptr = is_ptr(rt->u.record.fields[i].ty);
+    int64_t slot = 0;
+    for (uint32_t j = 0; j < rt->u.record.count; j++) {
+        bool p = is_ptr(rt->u.record.fields[j].ty);
+        if (ptr ? p && (int)j < i : p || (int)j < i)
+            slot++;
+    }
+    return slot * FRAME_WORD;
+}
+
+static int64_t record_ptrs(Type *rt)
+{
+    rt = type_actual(rt);
+    int64_t n = 0;
+    for (uint32_t j = 0; j < rt->u.record.count; j++)
+        n += is_ptr(rt->u.record.fields[j].ty);
+    return n;
+}
+
+static TExp *fp(Translator *t)
+{
+    return t_temp(t->a, REG_FP);
+}
+
+/* Address of the frame of `target`, an enclosing level of the current
+   one, found by following static links outward. */
+static TExp *frame_of(Translator *t, Level *target)
+{
+    TExp *e = fp(t);
+    for (Level *l = t->level; l != target; l = l->parent) {
+        if (!l->parent || !(l->fun->flags & FE_LINK))
+            fatal("translate: static link chain broken");
+        e = frame_exp(t->a, l->frame->formals[0], e);
+    }
+    return e;
+}
+
+static TExp *call_runtime(Translator *t, const char *name, uint32_t nargs, ...)
+{
+    TExp **args = arena_alloc(t->a, nargs * sizeof *args);
+    va_list ap;
+    va_start(ap, nargs);
+    for (uint32_t i = 0; i < nargs; i++)
+        args[i] = va_arg(ap, TExp *);
+    va_end(ap);
+    return frame_external_call(t->a, name, args, nargs);
+}
+
+static Label lazy_label(Label *l)
+{
+    if (!*l)
+        *l = label_new();
+    return *l;
+}
+
+/* Store pointer `v` into the heap word at `addr` and dirty the word's
+   card, so that a minor collection finds old objects pointing into the
+   nursery.  The card table entry of address x is at
+   tiger_card_bias + (x >> CARD_SHIFT) * 8; runtime/gc.h has the other
+   half of this. */
+enum { CARD_SHIFT = 10 };
+
+static TStm *heap_store(Translator *t, TExp *addr, TExp *v)
+{
+    Arena *a = t->a;
+    if (!t->card_bias)
+        t->card_bias = label_named(sym_intern("tiger_card_bias"));
+    Temp p = temp_new();
+    TExp *card = t_binop(a, T_AND,
+                         t_binop(a, T_RSHIFT, t_temp(a, p), t_const(a, CARD_SHIFT - 3)),
+                         t_const(a, -FRAME_WORD));
+    TExp *entry = t_binop(a, T_PLUS, t_mem(a, t_name(a, t->card_bias)), card);
+    return t_seq(a, t_move(a, t_temp(a, p), addr),
+           t_seq(a, t_move(a, t_mem(a, t_temp(a, p)), v),
+                    t_move(a, t_mem(a, entry), t_const(a, 1))));
+}
+
+static Label string_label(Translator *t, Symbol sym)
+{
+    if (!t->strings[sym]) {
+        Label l = label_new();
+        t->strings[sym] = l;
+        vec_push(&t->p->frags, ((Frag){ .kind = FRAG_STRING, .label = l,
+                                        .u.string.str = sym }));
+    }
+    return t->strings[sym];
+}
+
+/* The main program runs once, so its escaping variables can be static
+   words instead of frame slots; inner functions then reach them without
+   a static link. */
+static Access alloc_local(Translator *t, bool escape, bool ptr)
+{
+    if (!escape || t->level->fun->index)
+        return frame_alloc_local(t->level->frame, escape, ptr);
+    Access acc = { .kind = AC_GLOBAL, .ptr = ptr, .label = label_new() };
+    vec_push(&t->p->frags, ((Frag){ .kind = FRAG_GLOBAL, .label = acc.label,
+                                    .u.global.ptr = ptr }));
+    return acc;
+}
+
+/* Give `ve` its access as it comes into scope. */
+static void declare(Translator *t, VarEntry *ve, Access acc)
+{
+    t->access[ve->index] = acc;
+    t->facts[ve->index] = (Fact){ .seq = t->nseq++ };
+}
+
+/* ---- Ranges ------------------------------------------------------------- */
+
+/* The facts about `id` if it names a variable that is never assigned. */
+static Fact *fact_of(Translator *t, VarId id)
+{
+    const Var *v = ast_var(t->ast, id);
+    if (v->kind != VAR_SIMPLE)
+        return NULL;
+    VarEntry *ve = t->s->var_entry[id];
+    return ve->flags & VE_ASSIGNED ? NULL : &t->facts[ve->index];
+}
+
+static bool mul_range(int64_t a, int64_t b, int64_t c, int64_t d, int64_t *lo, int64_t *hi)
+{
+    int64_t p[4];
+    if (__builtin_mul_overflow(a, c, &p[0]) || __builtin_mul_overflow(a, d, &p[1]) ||
+        __builtin_mul_overflow(b, c, &p[2]) || __builtin_mul_overflow(b, d, &p[3]))
+        return false;
+    *lo = *hi = p[0];
+    for (int i = 1; i < 4; i++) {
+        *lo = p[i] < *lo ? p[i] : *lo;
+        *hi = p[i] > *hi ? p[i] : *hi;
+    }
+    return true;
+}
+
+/* Bound the value of integer expression `id` from constants, variables
+   that are never assigned and loop variables, without overflow. */
+static bool range_of(Translator *t, ExpId id, int64_t *lo, int64_t *hi)
+{
+    const Exp *e = ast_exp(t->ast, id);
+    switch ((ExpKind)e->kind) {
+    case EXP_INT:
+        *lo = *hi = e->u.intv.value;
+        return true;
+    case EXP_VAR: {
+        const Fact *f = fact_of(t, e->u.var.var);
+        if (!f || !f->ranged)
+            return false;
+        *lo = f->lo;
+        *hi = f->hi;
+        return true;
+    }
+    case EXP_OP: {
+        int64_t a, b, c, d;
+        if (!range_of(t, e->u.op.left, &a, &b) || !range_of(t, e->u.op.right, &c, &d))
+            return false;
+        switch ((BinOp)e->op) {
+        case OP_PLUS:
+            return !__builtin_add_overflow(a, c, lo) && !__builtin_add_overflow(b, d, hi);
+        case OP_MINUS:
+            return !__builtin_sub_overflow(a, d, lo) && !__builtin_sub_overflow(b, c, hi);
+        case OP_TIMES:
+            return mul_range(a, b, c, d, lo, hi);
+        default:
+            return false;
+        }
+    }
+    default:
+        return false;
+    }
+}
+
+/* How `id` depends on the variable of loop `l`: 0 if it is invariant,
+   1 if it is the variable plus an invariant, -1 otherwise. */
+static int loop_coef(Translator *t, const Loop *l, ExpId id)
+{
+    const Exp *e = ast_exp(t->ast, id);
+    switch ((ExpKind)e->kind) {
+    case EXP_INT:
+        return 0;
+    case EXP_VAR: {
+        if (ast_var(t->ast, e->u.var.var)->kind != VAR_SIMPLE)
+            return -1;
+        if (t->s->var_entry[e->u.var.var] == l->var)
+            return 1;
+        const Fact *f = fact_of(t, e->u.var.var);
+        return f && f->seq < l->seq ? 0 : -1;
+    }
+    case EXP_OP: {
+        int x = loop_coef(t, l, e->u.op.left), y = loop_coef(t, l, e->u.op.right);
+        if (x < 0 || y < 0)
+            return -1;
+        switch ((BinOp)e->op) {
+        case OP_PLUS:
+            return x + y <= 1 ? x + y : -1;
+        case OP_MINUS:
+            return y == 0 ? x : -1;
+        case OP_TIMES:
+            return x == 0 && y == 0 ? 0 : -1;
+        default:
+            return -1;
+        }
+    }
+    default:
+        return -1;
+    }
+}
+
+/* ---- Subscript checks --------------------------------------------------- */
+
+/* The check of index `i` against the length of array `r`, the word
+   before element 0; an unsigned compare rejects negative indices too. */
+static TStm *bounds_check(Translator *t, Temp r, Temp i, Label ok, Label fail)
+{
+    Arena *a = t->a;
+    TExp *len = t_mem(a, t_binop(a, T_MINUS, t_temp(a, r), t_const(a, FRAME_WORD)));
+    return t_cjump(a, T_ULT, t_temp(a, i), len, ok, fail);
+}
+
+/* Whether `base[index]` needs a check: not if the index provably lies
+   within the array's known minimum length. */
+static bool needs_check(Translator *t, VarId base, ExpId index)
+{
+    const Fact *f = fact_of(t, base);
+    int64_t lo, hi;
+    return !f || !range_of(t, index, &lo, &hi) || lo < 0 || hi >= f->length;
+}
+
+/* Record `check` of `base[index]` with the innermost loop of this
+   function if a test ahead of that loop can stand in for it. */
+static void try_hoist(Translator *t, TStm *check, VarId base, ExpId index)
+{
+    if (!t->loops.len)
+        return;
+    Loop *l = &t->loops.data[t->loops.len - 1];
+    if (l->level != t->level)
+        return;
+    const Fact *f = fact_of(t, base);
+    int coef = loop_coef(t, l, index);
+    if (f && f->seq < l->seq && coef >= 0)
+        vec_push(&l->hoists, ((Hoist){ check, base, index, coef == 1 }));
+}
+
+/* ---- L-values ---------------------------------------------------------- */
+
+static TExp *tr_var(Translator *t, VarId id)
+{
+    Arena *a = t->a;
+    const Var *v = ast_var(t->ast, id);
+    switch ((VarKind)v->kind) {
+    case VAR_SIMPLE: {
+        VarEntry *ve = t->s->var_entry[id];
+        Access acc = t->access[ve->index];
+        if (acc.kind == AC_GLOBAL)
+            return frame_exp(a, acc, NULL);
+        return frame_exp(a, acc, frame_of(t, t->levels[ve->owner->index]));
+    }
+    case VAR_FIELD: {
+        Type *rt = type_actual(t->s->var_type[v->u.field.var]);
+        int64_t off = field_slot(rt, type_field_index(rt, v->u.field.sym));
+        Temp r = temp_new();
+        Label ok = label_new();
+        TStm *check = t_seq(a, t_move(a, t_temp(a, r), tr_var(t, v->u.field.var)),
+                      t_seq(a, t_cjump(a, T_EQ, t_temp(a, r), t_const(a, 0),
+                                       fail_label(t, &t->level->nil_fail), ok),
+                               t_label(a, ok)));
+        TExp *addr = t_binop(a, T_PLUS, t_temp(a, r), t_const(a, off));
+        return t_eseq(a, check, t_mem(a, addr));
+    }
+    case VAR_SUBSCRIPT: {
+        VarId base = v->u.subscript.var;
+        ExpId index = v->u.subscript.index;
+        Temp r = temp_new(), i = temp_new();
+        TStm *s = t_seq(a, t_move(a, t_temp(a, r), tr_var(t, base)),
+                           t_move(a, t_temp(a, i), un_ex(t, tr_exp(t, index))));
+        if (needs_check(t, base, index)) {
+            Label ok = label_new();
+            TStm *check = bounds_check(t, r, i, ok, fail_label(t, &t->level->bounds_fail));
+            try_hoist(t, check, base, index);
+            s = t_seq(a, s, t_seq(a, check, t_label(a, ok)));
+        }
+        TExp *addr = t_binop(a, T_PLUS, t_temp(a, r),
+                             t_binop(a, T_MUL, t_temp(a, i), t_const(a, FRAME_WORD)));
+        return t_eseq(a, s, t_mem(a, addr));
+    }
+    default:
+        break;
+    }
+    fatal("translate: bad l-value");
+}
+
+/* ---- Expressions ------------------------------------------------------- */
+
+/* The length of string `s`, from the word before its first byte. */
+static TExp *str_len(Translator *t, TExp *s)
+{
+    return t_mem(t->a, t_binop(t->a, T_MINUS, s, t_const(t->a, FRAME_WORD)));
+}
+
+/* l = r or l <> r on strings.  Strings of different lengths differ
+   without a call, which settles most tests against a literal of length
+   `known` (or -1 if r is no literal); the empty literal takes no call
+   at all. */
+static Tr string_eq(Translator *t, BinOp op, TExp *l, TExp *r, int64_t known)
+{
+    Arena *a = t->a;
+    Temp ls = temp_new(), rs = temp_new();
+    TStm *args = t_seq(a, t_move(a, t_temp(a, ls), l), t_move(a, t_temp(a, rs), r));
+    TExp *rlen = known >= 0 ? t_const(a, known) : str_len(t, t_temp(a, rs));
+    if (known == 0) {
+        Tr c = cx_cjump(t, op == OP_EQ ? T_EQ : T_NE, str_len(t, t_temp(a, ls)), rlen);
+        c.u.cx.stm = t_seq(a, args, c.u.cx.stm);
+        return c;
+    }
+    Label same = label_new();
+    TStm *len = t_cjump(a, T_EQ, str_len(t, t_temp(a, ls)), rlen, same, 0);
+    Patch *differ = patch(t, &len->u.cjump.f, NULL);
+    Tr c = cx_cjump(t, op == OP_EQ ? T_NE : T_EQ,
+                    call_runtime(t, "tiger_string_equal", 2, t_temp(a, ls), t_temp(a, rs)),
+                    t_const(a, 0));
+    TStm *s = t_seq(a, args, t_seq(a, len, t_seq(a, t_label(a, same), c.u.cx.stm)));
+    if (op == OP_EQ)
+        return (Tr){ .kind = TR_CX, .u.cx = { s, c.u.cx.t, join_patches(c.u.cx.f, differ) } };
+    return (Tr){ .kind = TR_CX, .u.cx = { s, join_patches(c.u.cx.t, differ), c.u.cx.f } };
+}
+
+static Tr tr_op(Translator *t, ExpId id)
+{
+    Arena *a = t->a;
+    const Exp *e = ast_exp(t->ast, id);
+    BinOp op = (BinOp)e->op;
+    ExpId le = e->u.op.left, re = e->u.op.right;
+
+    if (op == OP_AND || op == OP_OR) {
+        /* a & b: b is tested only where a is true; a | b: only where a
+           is false.  A known operand decides the whole or drops out; b
+           is translated even when it cannot run, so that what it
+           declares still exists, and then dropped. */
+        bool conj = op == OP_AND;
+        Tr l = un_cx(t, tr_exp(t, le));
+        Tr r = un_cx(t, tr_exp(t, re));
+        int kl = known(l), kr = known(r);
+        if (kl >= 0)
+            return kl == conj ? r : l;
+        if (kr == conj)
+            return l;
+        if (kr >= 0) {
+            /* a & 0 or a | 1: a runs for its effects only. */
+            Patch *all = join_patches(l.u.cx.t, l.u.cx.f);
+            return (Tr){ .kind = TR_CX, .u.cx = { l.u.cx.stm, conj ? NULL : all, conj ? all : NULL } };
+        }
+        Label mid = label_new();
+        TStm *s = t_seq(a, l.u.cx.stm, t_seq(a, t_label(a, mid), r.u.cx.stm));
+        if (conj) {
+            do_patch(l.u.cx.t, mid);
+            return (Tr){ .kind = TR_CX, .u.cx = { s, r.u.cx.t, join_patches(l.u.cx.f, r.u.cx.f) } };
+        }
+        do_patch(l.u.cx.f, mid);
+        return (Tr){ .kind = TR_CX, .u.cx = { s, join_patches(l.u.cx.t, r.u.cx.t), r.u.cx.f } };
+    }
+
+    Type *lt = type_actual(t->s->exp_type[le]);
+    TExp *l = un_ex(t, tr_exp(t, le));
+    TExp *r = un_ex(t, tr_exp(t, re));
+    static const TBinOp arith[] = {
+        [OP_PLUS] = T_PLUS, [OP_MINUS] = T_MINUS, [OP_TIMES] = T_MUL, [OP_DIVIDE] = T_DIV,
+    };
+    static const TRelOp rel[] = {
+        [OP_EQ] = T_EQ, [OP_NEQ] = T_NE, [OP_LT] = T_LT,
+        [OP_LE] = T_LE, [OP_GT] = T_GT, [OP_GE] = T_GE,
+    };
+    switch (op) {
+    case OP_PLUS: case OP_MINUS: case OP_TIMES: case OP_DIVIDE:
+        return ex(t_binop(a, arith[op], l, r));
+    default:
+        break;
+    }
+    if (lt->kind == TK_STRING) {
+        if (op == OP_EQ || op == OP_NEQ) {
+            const Exp *lit = ast_exp(t->ast, re), *other = ast_exp(t->ast, le);
+            if (lit->kind == EXP_STRING && other->kind == EXP_STRING)
+                return cx_const(t, (lit->u.str.sym == other->u.str.sym) == (op == OP_EQ));
+            if (lit->kind != EXP_STRING) {
+                lit = ast_exp(t->ast, le);
+                if (lit->kind == EXP_STRING) {
+                    TExp *x = l;
+                    l = r;
+                    r = x;
+                }
+            }
+            return string_eq(t, op, l, r,
+                             lit->kind == EXP_STRING ? (int64_t)sym_len(lit->u.str.sym) : -1);
+        }
+        return cx_cjump(t, rel[op], call_runtime(t, "tiger_string_compare", 2, l, r),
+                        t_const(a, 0));
+    }
+    return cx_cjump(t, rel[op], l, r);
+}
+
+/* Arguments of call `id`, after a slot for the static link if the
+   callee takes one. */
+static TExp **call_args(Translator *t, ExpId id, uint32_t *n)
+{
+    FunEntry *f = t->s->call_fun[id];
+    AstList args = ast_exp(t->ast, id)->u.call.args;
+    uint32_t link = f->flags & FE_LINK ? 1 : 0;
+    *n = args.count + link;
+    TExp **av = arena_alloc(t->a, *n * sizeof *av);
+    for (uint32_t i = 0; i < args.count; i++)
+        av[i + link] = un_ex(t, tr_exp(t, ast_list_at(t->ast, args, i)));
+    return av;
+}
+
+/* A self call in tail position: assign the arguments to the formals
+   and go back to the top of the body.  Every argument is evaluated
+   before any formal changes; the static link is the same. */
+static TStm *self_jump(Translator *t, TExp **av, uint32_t n)
+{
+    Arena *a = t->a;
+    Level *l = t->level;
+    uint32_t link = l->fun->flags & FE_LINK ? 1 : 0;
+    Temp *tmp = arena_alloc(a, n * sizeof *tmp);
+    TStm *s = NULL;
+    for (uint32_t i = link; i < n; i++) {
+        tmp[i] = temp_new();
+        s = t_seq(a, s, t_move(a, t_temp(a, tmp[i]), av[i]));
+    }
+    for (uint32_t i = link; i < n; i++)
+        s = t_seq(a, s, t_move(a, frame_exp(a, l->frame->formals[i], fp(t)),
+                               t_temp(a, tmp[i])));
+    return t_seq(a, s, t_jump(a, lazy_label(&l->entry)));
+}
+
+static uint32_t stack_args(uint32_t nargs)
+{
+    return nargs > FRAME_NARG_REGS ? nargs - FRAME_NARG_REGS : 0;
+}
+
+/* Whether a tail call to `callee` can replace the current frame: the
+   callee must not take this frame as its static link, its stack
+   arguments must fit where ours arrived, and no result record of a
+   trmc function may be waiting for its value. */
+static bool can_tail_call(Translator *t, Level *callee, uint32_t nargs)
+{
+    Level *l = t->level;
+    if (l->trmc || ((callee->fun->flags & FE_LINK) && callee->parent == l))
+        return false;
+    return stack_args(nargs) <= stack_args(l->frame->nformals);
+}
+
+static Tr tr_call(Translator *t, ExpId id, bool tail)
+{
+    Arena *a = t->a;
+    FunEntry *f = t->s->call_fun[id];
+    uint32_t link = f->flags & FE_LINK ? 1 : 0;
+    if (f->builtin && strcmp(sym_name(f->name), "not") == 0) {
+        /* not(c) is c with its targets swapped. */
+        AstList args = ast_exp(t->ast, id)->u.call.args;
+        Tr c = un_cx(t, tr_exp(t, ast_list_at(t->ast, args, 0)));
+        Patch *p = c.u.cx.t;
+        c.u.cx.t = c.u.cx.f;
+        c.u.cx.f = p;
+        return c;
+    }
+    uint32_t n;
+    TExp **av = call_args(t, id, &n);
+    bool unit = type_actual(f->result)->kind == TK_UNIT;
+
+    if (tail && f == t->level->fun) {
+        TStm *s = self_jump(t, av, n);
+        return unit ? nx(s) : ex(t_eseq(a, s, t_const(a, 0)));
+    }
+
+    TExp *call;
+    if (f->builtin && strcmp(sym_name(f->name), "size") == 0)
+        return ex(str_len(t, av[0]));
+    if (f->builtin) {
+        char name[64];
+        snprintf(name, sizeof name, "tiger_%s", sym_name(f->name));
+        call = frame_external_call(a, name, av, n);
+        if (strcmp(name, "tiger_exit") == 0)
+            call->flags |= TC_NORETURN;
+    } else {
+        Level *callee = t->levels[f->index];
+        if (link)
+            av[0] = frame_of(t, callee->parent);
+        call = t_call(a, t_name(a, callee->frame->name), av, n);
+        if (tail && can_tail_call(t, callee, n)) {
+            /* Return straight from here, so that the call is followed
+               by nothing but the epilogue. */
+            call->flags |= TC_TAIL;
+            Label exit = lazy_label(&t->level->exit);
+            if (unit)
+                return nx(t_seq(a, t_exp(a, call), t_jump(a, exit)));
+            return ex(t_eseq(a, t_seq(a, t_move(a, t_temp(a, REG_RV), call),
+                                      t_jump(a, exit)),
+                             t_const(a, 0)));
+        }
+    }
+    if (unit)
+        return nx(t_exp(a, call));
+    return ex(call);
+}
+
+/* Allocate a record of type `rt` into `r`.  It starts in the nursery,
+   so filling it in needs no card marks. */
+static TStm *alloc_record(Translator *t, Type *rt, Temp r)
+{
+    Arena *a = t->a;
+    uint32_t n = type_actual(rt)->u.record.count;
+    return t_move(a, t_temp(a, r),
+                  call_runtime(t, "tiger_alloc_record", 2, t_const(a, (int64_t)n * FRAME_WORD),
+                               t_const(a, record_ptrs(rt))));
+}
+
+static Tr tr_record(Translator *t, ExpId id)
+{
+    Arena *a = t->a;
+    const Exp *e = ast_exp(t->ast, id);
+    AstList fields = e->u.record.fields;
+    Type *rt = t->s->exp_type[id];
+    Temp r = temp_new();
+
+    TStm *s = alloc_record(t, rt, r);
+    for (uint32_t i = 0; i < fields.count; i++) {
+        ExpId fe = ast_efield(t->ast, fields, i)->exp;
+        TExp *addr = t_binop(a, T_PLUS, t_temp(a, r), t_const(a, field_slot(rt, (int)i)));
+        s = t_seq(a, s, t_move(a, t_mem(a, addr), un_ex(t, tr_exp(t, fe))));
+    }
+    return ex(t_eseq(a, s, t_temp(a, r)));
+}
+
+/* ---- Tail recursion modulo record construction ------------------------ */
+
+/* Whether `id` is a record expression in tail position whose last
+   field is a self call: the call can then become a jump once the record
+   is linked in and the field is left open for the next round. */
+static bool trmc_site(Translator *t, ExpId id)
+{
+    const Exp *e = ast_exp(t->ast, id);
+    AstList fields = e->u.record.fields;
+    if (!fields.count)
+        return false;
+    ExpId last = ast_efield(t->ast, fields, fields.count - 1)->exp;
+    return ast_exp(t->ast, last)->kind == EXP_CALL &&
+           t->s->call_fun[last] == t->level->fun;
+}
+
+/* Whether any tail position of `id` is a trmc site. */
+static bool has_trmc(Translator *t, ExpId id)
+{
+    const Exp *e = ast_exp(t->ast, id);
+    switch ((ExpKind)e->kind) {
+    case EXP_RECORD:
+        return trmc_site(t, id);
+    case EXP_SEQ:
+        return e->u.seq.exps.count &&
+               has_trmc(t, ast_list_at(t->ast, e->u.seq.exps, e->u.seq.exps.count - 1));
+    case EXP_IF:
+        return e->u.if_.els && (has_trmc(t, e->u.if_.then) || has_trmc(t, e->u.if_.els));
+    case EXP_LET:
+        return has_trmc(t, e->u.let.body);
+    default:
+        return false;
+    }
+}
+
+/* Store `v` where the function's result belongs: the open field of
+   `last`, or `res` while there is no record yet. */
+static TStm *fill_hole(Translator *t, Temp v)
+{
+    Arena *a = t->a;
+    Level *l = t->level;
+    Label lres = label_new(), lfield = label_new(), join = label_new();
+    TExp *field = t_binop(a, T_PLUS, t_temp(a, l->last), t_temp(a, l->off));
+    return t_seq(a, t_cjump(a, T_EQ, t_temp(a, l->last), t_const(a, 0), lres, lfield),
+           t_seq(a, t_label(a, lres),
+           t_seq(a, t_move(a, t_temp(a, l->res), t_temp(a, v)),
+           t_seq(a, t_jump(a, join),
+           t_seq(a, t_label(a, lfield),
+           t_seq(a, heap_store(t, field, t_temp(a, v)),
+                    t_label(a, join)))))));
+}
+
+/* A trmc site: allocate the record and fill all but its last field,
+   link it in, open its last field and loop with the call's arguments.
+   The record is allocated before the call's arguments run, which no
+   Tiger program can observe. */
+static Tr tr_record_tail(Translator *t, ExpId id)
+{
+    Arena *a = t->a;
+    Level *l = t->level;
+    AstList fields = ast_exp(t->ast, id)->u.record.fields;
+    Type *rt = t->s->exp_type[id];
+    uint32_t k = fields.count - 1;
+    Temp r = temp_new();
+
+    TStm *s = alloc_record(t, rt, r);
+    for (uint32_t i = 0; i < k; i++) {
+        ExpId fe = ast_efield(t->ast, fields, i)->exp;
+        TExp *addr = t_binop(a, T_PLUS, t_temp(a, r), t_const(a, field_slot(rt, (int)i)));
+        s = t_seq(a, s, t_move(a, t_mem(a, addr), un_ex(t, tr_exp(t, fe))));
+    }
+    s = t_seq(a, s, fill_hole(t, r));
+    s = t_seq(a, s, t_move(a, t_temp(a, l->last), t_temp(a, r)));
+    s = t_seq(a, s, t_move(a, t_temp(a, l->off), t_const(a, field_slot(rt, (int)k))));
+    uint32_t n;
+    TExp **av = call_args(t, ast_efield(t->ast, fields, k)->exp, &n);
+    s = t_seq(a, s, self_jump(t, av, n));
+    return ex(t_eseq(a, s, t_const(a, 0)));
+}
+
+/* Whether `tr` is a condition or a value of 0 or 1, which a condition
+   can stand for. */
+static bool is_bool(Tr tr)
+{
+    return tr.kind == TR_CX ||
+           (tr.kind == TR_EX && tr.u.ex->kind == TE_CONST && (uint64_t)tr.u.ex->u.value <= 1);
+}
+
+/* The if `id` from its translated test and arms; `tf` is a no-op for an
+   if without an else. */
+static Tr tr_if(Translator *t, ExpId id, Tr test, Tr tt, Tr tf)
+{
+    Arena *a = t->a;
+    bool els = ast_exp(t->ast, id)->u.if_.els;
+    bool value = els && type_actual(t->s->exp_type[id])->kind != TK_UNIT;
+
+    int k = known(test);
+    if (k >= 0)
+        return k ? tt : tf;
+
+    Label lt = label_new(), lf = label_new(), join = label_new();
+    do_patch(test.u.cx.t, lt);
+    do_patch(test.u.cx.f, lf);
+    Arms arms = branch_arms(t, id, lt, lf);
+
+    if (value && is_bool(tt) && is_bool(tf)) {
+        /* A condition made of conditions: each arm jumps on to where
+           the whole one goes. */
+        Tr ct = un_cx(t, tt), cf = un_cx(t, tf);
+        TStm *s = t_seq(a, test.u.cx.stm,
+                  t_seq(a, t_label(a, lt),
+                  t_seq(a, arms.t,
+                  t_seq(a, ct.u.cx.stm,
+                  t_seq(a, t_label(a, lf),
+                  t_seq(a, arms.f, cf.u.cx.stm))))));
+        return (Tr){ .kind = TR_CX, .u.cx = { s, join_patches(ct.u.cx.t, cf.u.cx.t),
+                                              join_patches(ct.u.cx.f, cf.u.cx.f) } };
+    }
+    if (!els) {
+        return nx(t_seq(a, test.u.cx.stm,
+                  t_seq(a, t_label(a, lt),
+                  t_seq(a, arms.t,
+                  t_seq(a, un_nx(t, tt),
+                  t_seq(a, t_label(a, lf),
+                           arms.f))))));
+    }
+    if (!value) {
+        return nx(t_seq(a, test.u.cx.stm,
+                  t_seq(a, t_label(a, lt),
+                  t_seq(a, arms.t,
+                  t_seq(a, un_nx(t, tt),
+                  t_seq(a, t_jump(a, join),
+                  t_seq(a, t_label(a, lf),
+                  t_seq(a, arms.f,
+                  t_seq(a, un_nx(t, tf),
+                           t_label(a, join))))))))));
+    }
+    Temp r = temp_new();
+    TStm *s = t_seq(a, test.u.cx.stm,
+              t_seq(a, t_label(a, lt),
+              t_seq(a, arms.t,
+              t_seq(a, t_move(a, t_temp(a, r), un_ex(t, tt)),
+              t_seq(a, t_jump(a, join),
+              t_seq(a, t_label(a, lf),
+              t_seq(a, arms.f,
+              t_seq(a, t_move(a, t_temp(a, r), un_ex(t, tf)),
+                       t_label(a, join)))))))));
+    return ex(t_eseq(a, s, t_temp(a, r)));
+}
+
+static Tr tr_while(Translator *t, ExpId id)
+{
+    Arena *a = t->a;
+    const Exp *e = ast_exp(t->ast, id);
+    ExpId body = e->u.while_.body;
+    Label test = label_new(), lbody = label_new(), done = label_new();
+
+    Tr c = un_cx(t, tr_exp(t, e->u.while_.test));
+    do_patch(c.u.cx.t, lbody);
+    Label exit = done;
+    Arms arms = { NULL, NULL };
+    if (t->p->profile || t->p->use) {
+        /* Breaks leave through `done` too, but do not count. */
+        exit = label_new();
+        arms = branch_arms(t, id, lbody, exit);
+    }
+    do_patch(c.u.cx.f, exit);
+    hint(t, lbody, HINT_AGAIN);
+    hint(t, exit, HINT_LEAVE);
+    vec_push(&t->breaks, done);
+    TStm *b = t_seq(a, line_mark(t, body), un_nx(t, tr_exp(t, body)));
+    t->breaks.len--;
+
+    return nx(t_seq(a, t_label(a, test),
+              t_seq(a, c.u.cx.stm,
+              t_seq(a, t_label(a, lbody),
+              t_seq(a, arms.t,
+              t_seq(a, b,
+              t_seq(a, t_jump(a, test),
+              t_seq(a, t_label(a, exit),
+              t_seq(a, arms.f,
+                       t_label(a, done))))))))));
+}
+
+/* ---- Loop versioning ---------------------------------------------------- */
+
+/* A `for` loop whose checks can be hoisted runs in two versions: one
+   without those checks, entered when a test of the first and last
+   iteration passes, and the original for when it does not.  Bodies
+   larger than this stay single. */
+enum { VERSION_MAX_STMS = 1024 };
+
+typedef VEC(TStm *) Stms;
+
+/* Copying a body: the labels it defines get fresh names, with the
+   counts of the originals in `freq`, and the checks in `drop` become
+   jumps to their success label. */
+typedef struct Clone {
+    Arena *a;
+    IdMap labels;
+    IdMap *freq;
+    const Hoist *drop;
+    uint32_t ndrop;
+    uint32_t size;
+} Clone;
+
+/* The statements of `s` that are not SEQs, in order. */
+static void flatten(TStm *s, Stms *out)
+{
+    Stms stack = {0};
+    vec_push(&stack, s);
+    while (stack.len) {
+        TStm *x = stack.data[--stack.len];
+        if (x->kind == TS_SEQ) {
+            vec_push(&stack, x->u.seq.second);
+            vec_push(&stack, x->u.seq.first);
+        } else {
+            vec_push(out, x);
+        }
+    }
+    vec_free(&stack);
+}
+
+static void collect_stm(Clone *c, TStm *s);
+
+static void collect_exp(Clone *c, const TExp *e)
+{
+    switch ((TExpKind)e->kind) {
+    case TE_BINOP:
+        collect_exp(c, e->u.bin.left);
+        collect_exp(c, e->u.bin.right);
+        break;
+    case TE_MEM:
+        collect_exp(c, e->u.mem);
+        break;
+    case TE_CALL:
+        for (uint32_t i = 0; i < e->u.call.nargs; i++)
+            collect_exp(c, e->u.call.args[i]);
+        break;
+    case TE_ESEQ:
+        collect_stm(c, e->u.eseq.stm);
+        collect_exp(c, e->u.eseq.exp);
+        break;
+    default:
+        break;
+    }
+}
+
+/* Name the labels `s` defines anew, and count its statements. */
+static void collect_stm(Clone *c, TStm *s)
+{
+    Stms list = {0};
+    flatten(s, &list);
+    c->size += list.len;
+    for (uint32_t i = 0; i < list.len; i++) {
+        TStm *x = list.data[i];
+        switch ((TStmKind)x->kind) {
+        case TS_LABEL: {
+            Label l = label_new();
+            idmap_put(&c->labels, x->u.label, l);
+            uint32_t n = idmap_get(c->freq, x->u.label, UINT32_MAX);
+            if (n != UINT32_MAX)
+                idmap_put(c->freq, l, n);
+            break;
+        }
+        case TS_MOVE:
+            collect_exp(c, x->u.move.dst);
+            collect_exp(c, x->u.move.src);
+            break;
+        case TS_EXP:
+            collect_exp(c, x->u.exp);
+            break;
+        case TS_CJUMP:
+            collect_exp(c, x->u.cjump.left);
+            collect_exp(c, x->u.cjump.right);
+            break;
+        default:
+            break;
+        }
+    }
+    vec_free(&list);
+}
+
+static Label clone_label(const Clone *c, Label l)
+{
+    return idmap_get(&c->labels, l, l);
+}
+
+static TStm *clone_stm(Clone *c, TStm *s);
+
+static TExp *clone_exp(Clone *c, const TExp *e)
+{
+    Arena *a = c->a;
+    TExp *r;
+    switch ((TExpKind)e->kind) {
+    case TE_CONST:
+        return t_const(a, e->u.value);
+    case TE_NAME:
+        return t_name(a, clone_label(c, e->u.name));
+    case TE_TEMP:
+        return t_temp(a, e->u.temp);
+    case TE_BINOP:
+        return t_binop(a, (TBinOp)e->op, clone_exp(c, e->u.bin.left),
+                       clone_exp(c, e->u.bin.right));
+    case TE_MEM:
+        return t_mem(a, clone_exp(c, e->u.mem));
+    case TE_CALL: {
+        uint32_t n = e->u.call.nargs;
+        TExp **args = arena_alloc(a, n * sizeof *args);
+        for (uint32_t i = 0; i < n; i++)
+            args[i] = clone_exp(c, e->u.call.args[i]);
+        r = t_call(a, clone_exp(c, e->u.call.func), args, n);
+        r->flags = e->flags;
+        return r;
+    }
+    case TE_ESEQ:
+        return t_eseq(a, clone_stm(c, e->u.eseq.stm), clone_exp(c, e->u.eseq.exp));
+    }
+    fatal("translate: bad expression");
+}
+
+static TStm *clone_one(Clone *c, const TStm *s)
+{
+    Arena *a = c->a;
+    switch ((TStmKind)s->kind) {
+    case TS_MOVE:
+        return t_move(a, clone_exp(c, s->u.move.dst), clone_exp(c, s->u.move.src));
+    case TS_EXP:
+        return t_exp(a, clone_exp(c, s->u.exp));
+    case TS_JUMP: {
+        TStm *r = t_jump(a, 0);
+        uint32_t n = s->u.jump.nlabels;
+        r->u.jump.target = clone_exp(c, s->u.jump.target);
+        r->u.jump.labels = arena_alloc(a, n * sizeof *r->u.jump.labels);
+        r->u.jump.nlabels = n;
+        for (uint32_t i = 0; i < n; i++)
+            r->u.jump.labels[i] = clone_label(c, s->u.jump.labels[i]);
+        return r;
+    }
+    case TS_CJUMP:
+        for (uint32_t i = 0; i < c->ndrop; i++)
+            if (c->drop[i].check == s)
+                return t_jump(a, clone_label(c, s->u.cjump.t));
+        return t_cjump(a, (TRelOp)s->op, clone_exp(c, s->u.cjump.left),
+                       clone_exp(c, s->u.cjump.right), clone_label(c, s->u.cjump.t),
+                       clone_label(c, s->u.cjump.f));
+    case TS_LABEL:
+        return t_label(a, clone_label(c, s->u.label));
+    case TS_LINE:
+        return t_line(a, s->u.line);
+    case TS_SEQ:
+        break;
+    }
+    fatal("translate: bad statement");
+}
+
+static TStm *clone_stm(Clone *c, TStm *s)
+{
+    Stms list = {0};
+    flatten(s, &list);
+    TStm *r = NULL;
+    for (uint32_t i = 0; i < list.len; i++)
+        r = t_seq(c->a, r, clone_one(c, list.data[i]));
+    vec_free(&list);
+    return r;
+}
+
+static bool same_index(Translator *t, ExpId x, ExpId y)
+{
+    const Exp *a = ast_exp(t->ast, x), *b = ast_exp(t->ast, y);
+    if (a->kind != b->kind)
+        return false;
+    switch ((ExpKind)a->kind) {
+    case EXP_INT:
+        return a->u.intv.value == b->u.intv.value;
+    case EXP_VAR:
+        return t->s->var_entry[a->u.var.var] == t->s->var_entry[b->u.var.var];
+    case EXP_OP:
+        return a->op == b->op && same_index(t, a->u.op.left, b->u.op.left) &&
+               same_index(t, a->u.op.right, b->u.op.right);
+    default:
+        return false;
+    }
+}
+
+static bool same_hoist(Translator *t, const Hoist *x, const Hoist *y)
+{
+    return t->s->var_entry[x->base] == t->s->var_entry[y->base] &&
+           same_index(t, x->index, y->index);
+}
+
+/* Test the hoisted checks of `l` for the loop variable's current value,
+   all of them or only those that vary with it, jumping to `fail` if one
+   does not hold.  Repeats of an earlier check are left out. */
+static TStm *pre_checks(Translator *t, const Loop *l, bool varying, Label fail)
+{
+    Arena *a = t->a;
+    TStm *s = NULL;
+    for (uint32_t k = 0; k < l->hoists.len; k++) {
+        const Hoist *h = &l->hoists.data[k];
+        if (varying && !h->varies)
+            continue;
+        uint32_t j = 0;
+        while (j < k && !same_hoist(t, &l->hoists.data[j], h))
+            j++;
+        if (j < k)
+            continue;
+        Temp r = temp_new(), i = temp_new();
+        Label ok = label_new();
+        s = t_seq(a, s, t_move(a, t_temp(a, r), tr_var(t, h->base)));
+        s = t_seq(a, s, t_move(a, t_temp(a, i), un_ex(t, tr_exp(t, h->index))));
+        s = t_seq(a, s, bounds_check(t, r, i, ok, fail));
+        s = t_seq(a, s, t_label(a, ok));
+    }
+    return s;
+}
+
+/* `i < limit`, `i := i + 1` and back to `body`, or on to `done`. */
+static TStm *loop_step(Translator *t, Access i, Temp limit, Label body, Label done)
+{
+    Arena *a = t->a;
+    Label inc = label_new();
+    hint(t, inc, HINT_AGAIN);
+    hint(t, done, HINT_LEAVE);
+    return t_seq(a, t_cjump(a, T_LT, frame_exp(a, i, fp(t)), t_temp(a, limit), inc, done),
+           t_seq(a, t_label(a, inc),
+           t_seq(a, t_move(a, frame_exp(a, i, fp(t)),
+                          t_binop(a, T_PLUS, frame_exp(a, i, fp(t)), t_const(a, 1))),
+                    t_jump(a, body))));
+}
+
+static Tr tr_for(Translator *t, ExpId id)
+{
+    Arena *a = t->a;
+    const Exp *e = ast_exp(t->ast, id);
+    ExpId lo = e->u.for_.lo, hi = e->u.for_.hi, body = e->u.for_.body;
+    VarEntry *ve = t->s->for_var[id];
+
+    Access acc = alloc_local(t, e->flags & EF_ESCAPE, false);
+    declare(t, ve, acc);
+    Fact *f = &t->facts[ve->index];
+    int64_t l0, l1, h0, h1;
+    if (range_of(t, lo, &l0, &l1) && range_of(t, hi, &h0, &h1)) {
+        f->ranged = true;
+        f->lo = l0;
+        f->hi = h1;
+    }
+    Temp limit = temp_new(), first = temp_new();
+    Label lbody = label_new(), done = label_new();
+
+    TStm *init = t_seq(a, t_move(a, t_temp(a, first), un_ex(t, tr_exp(t, lo))),
+                 t_seq(a, t_move(a, t_temp(a, limit), un_ex(t, tr_exp(t, hi))),
+                          t_move(a, frame_exp(a, acc, fp(t)), t_temp(a, first))));
+    vec_push(&t->loops, ((Loop){ .level = t->level, .var = ve, .seq = t->nseq }));
+    vec_push(&t->breaks, done);
+    TStm *b = t_seq(a, line_mark(t, body), un_nx(t, tr_exp(t, body)));
+    t->breaks.len--;
+    Loop l = t->loops.data[--t->loops.len];
+
+    /* Test against the limit before incrementing so that a loop up to
+       the largest int terminates. */
+    TStm *loop = t_seq(a, t_label(a, lbody), t_seq(a, b, loop_step(t, acc, limit, lbody, done)));
+    Label start = lbody;
+    Clone c = { .a = a, .freq = &t->level->frame->freq, .drop = l.hoists.data,
+                .ndrop = l.hoists.len };
+    if (l.hoists.len && !l.versioned)
+        collect_stm(&c, b);
+    if (c.size && c.size <= VERSION_MAX_STMS) {
+        /* Every index is the loop variable plus an invariant, or just an
+           invariant, so the first and the last iteration bound them. */
+        Label pre = label_new(), fast = label_new(), slow = label_new();
+        TStm *test = pre_checks(t, &l, false, slow);
+        TStm *last = pre_checks(t, &l, true, slow);
+        if (last)
+            test = t_seq(a, test,
+                   t_seq(a, t_move(a, frame_exp(a, acc, fp(t)), t_temp(a, limit)),
+                   t_seq(a, last, t_move(a, frame_exp(a, acc, fp(t)), t_temp(a, first)))));
+        loop = t_seq(a, t_label(a, pre),
+               t_seq(a, test,
+               t_seq(a, t_label(a, fast),
+               t_seq(a, clone_stm(&c, b),
+               t_seq(a, loop_step(t, acc, limit, fast, done),
+               t_seq(a, t_label(a, slow),
+               t_seq(a, t_move(a, frame_exp(a, acc, fp(t)), t_temp(a, first)),
+                        loop)))))));
+        l.versioned = true;
+        start = pre;
+    }
+    idmap_free(&c.labels);
+    vec_free(&l.hoists);
+    if (l.versioned && t->loops.len)
+        t->loops.data[t->loops.len - 1].versioned = true;
+
+    hint(t, start, HINT_AGAIN);
+    return nx(t_seq(a, init,
+              t_seq(a, t_cjump(a, T_LE, frame_exp(a, acc, fp(t)), t_temp(a, limit), start, done),
+              t_seq(a, loop, t_label(a, done)))));
+}
+
+static void tr_function(Translator *t, DecId did);
+
+static TStm *tr_decs(Translator *t, AstList decs)
+{
+    Arena *a = t->a;
+    TStm *s = NULL;
+    for (uint32_t i = 0; i < decs.count; i++) {
+        DecId did = ast_list_at(t->ast, decs, i);
+        const Dec *d = ast_dec(t->ast, did);
+        if (d->kind == DEC_VAR) {
+            VarEntry *ve = (VarEntry *)t->s->dec_entry[did];
+            bool esc = d->flags & DF_ESCAPE;
+            ExpId init = d->u.var.init;
+            Access acc = alloc_local(t, esc, is_ptr(ve->ty));
+            TExp *val = un_ex(t, tr_exp(t, init));
+            declare(t, ve, acc);
+            if (!(ve->flags & VE_ASSIGNED)) {
+                Fact *f = &t->facts[ve->index];
+                f->ranged = range_of(t, init, &f->lo, &f->hi);
+                const Exp *ie = ast_exp(t->ast, init);
+                int64_t lo, hi;
+                if (ie->kind == EXP_ARRAY && range_of(t, ie->u.array.size, &lo, &hi) && lo > 0)
+                    f->length = lo;
+            }
+            if (acc.kind == AC_GLOBAL && !(ve->flags & VE_ASSIGNED)) {
+                /* The initializer may have added fragments of its own. */
+                uint32_t i = t->p->frags.len;
+                while (t->p->frags.data[--i].label != acc.label)
+                    ;
+                t->p->frags.data[i].u.global.fixed = true;
+                if (val->kind == TE_CONST) {
+                    t->p->frags.data[i].u.global.constant = true;
+                    t->p->frags.data[i].u.global.value = val->u.value;
+                }
+            }
+            s = t_seq(a, s, line_mark(t, init));
+            s = t_seq(a, s, t_move(a, frame_exp(a, acc, fp(t)), val));
+        } else if (d->kind == DEC_FUNCTIONS) {
+            AstList fl = d->u.batch.decs;
+            /* Create every level first: the bodies may call each other. */
+            for (uint32_t k = 0; k < fl.count; k++) {
+                DecId fid = ast_list_at(t->ast, fl, k);
+                FunEntry *f = (FunEntry *)t->s->dec_entry[fid];
+                const Dec *fd = ast_dec(t->ast, fid);
+                AstList params = fd->u.function.params;
+                uint32_t link = f->flags & FE_LINK ? 1 : 0;
+                uint32_t n = params.count + link;
+                bool *esc = xmalloc((n + 1) * sizeof *esc);
+                bool *ptr = xmalloc((n + 1) * sizeof *ptr);
+                esc[0] = f->flags & FE_LINK_ESCAPES;
+                ptr[0] = false;
+                for (uint32_t j = 0; j < params.count; j++) {
+                    esc[j + link] = ast_field(t->ast, params, j)->flags & DF_ESCAPE;
+                    ptr[j + link] = is_ptr(f->formals[j]);
+                }
+                char name[256];
+                snprintf(name, sizeof name, "%s.%u", sym_name(f->name), f->index);
+                Level *l = arena_alloc(t->a, sizeof *l);
+                memset(l, 0, sizeof *l);
+                l->parent = t->level;
+                l->fun = f;
+                l->frame = frame_new(t->a, label_named(sym_intern(name)), n, esc, ptr);
+                use_profile(t, l->frame);
+                free(esc);
+                free(ptr);
+                t->levels[f->index] = l;
+                for (uint32_t j = 0; j < params.count; j++)
+                    declare(t, t->s->param_entry[params.start + j], l->frame->formals[j + link]);
+            }
+            for (uint32_t k = 0; k < fl.count; k++)
+                tr_function(t, ast_list_at(t->ast, fl, k));
+        }
+    }
+    return s;
+}
+
+/* Any expression but a let, a non-empty sequence or an if. */
+static Tr tr_other(Translator *t, ExpId id)
+{
+    Arena *a = t->a;
+    const Exp *e = ast_exp(t->ast, id);
+    bool tail = t->tail;
+    t->tail = false;
+    switch ((ExpKind)e->kind) {
+    case EXP_VAR:
+        return ex(tr_var(t, e->u.var.var));
+    case EXP_NIL:
+        return ex(t_const(a, 0));
+    case EXP_INT:
+        return ex(t_const(a, e->u.intv.value));
+    case EXP_STRING:
+        return ex(t_name(a, string_label(t, e->u.str.sym)));
+    case EXP_CALL:
+        return tr_call(t, id, tail);
+    case EXP_OP:
+        return tr_op(t, id);
+    case EXP_RECORD:
+        if (tail && t->level->trmc && trmc_site(t, id))
+            return tr_record_tail(t, id);
+        return tr_record(t, id);
+    case EXP_SEQ:
+        return nx(t_exp(a, t_const(a, 0)));
+    case EXP_ASSIGN: {
+        VarId v = e->u.assign.var;
+        ExpId rhs = e->u.assign.exp;
+        TExp *dst = tr_var(t, v);
+        TExp *src = un_ex(t, tr_exp(t, rhs));
+        if (ast_var(t->ast, v)->kind != VAR_SIMPLE && is_ptr(t->s->var_type[v]))
+            return nx(t_seq(a, dst->u.eseq.stm, heap_store(t, dst->u.eseq.exp->u.mem, src)));
+        return nx(t_move(a, dst, src));
+    }
+    case EXP_WHILE:
+        return tr_while(t, id);
+    case EXP_FOR:
+        return tr_for(t, id);
+    case EXP_BREAK:
+        return nx(t_jump(a, t->breaks.data[t->breaks.len - 1]));
+    case EXP_ARRAY: {
+        ExpId size = e->u.array.size, init = e->u.array.init;
+        TExp *n = un_ex(t, tr_exp(t, size));
+        TExp *v = un_ex(t, tr_exp(t, init));
+        bool ptr = is_ptr(type_actual(t->s->exp_type[id])->u.array.elem);
+        return ex(call_runtime(t, ptr ? "tiger_init_ptr_array" : "tiger_init_array", 2, n, v));
+    }
+    default:
+        break;
+    }
+    fatal("translate: bad expression");
+}
+
+/* Lets, sequences and ifs nest as deep as the parser allows, far deeper
+   than the C stack: so the body of a let, the last expression of a
+   sequence and the arm of an if that ends it (the else, or the then of
+   an if without one) are translated without recursing, and the rest of
+   each is kept on t->spine until they are.  Only these inherit tail
+   position. */
+static Tr tr_exp(Translator *t, ExpId id)
+{
+    Arena *a = t->a;
+    uint32_t base = t->spine.len;
+    bool tail = t->tail;
+    Tr r;
+    for (;;) {
+        const Exp *e = ast_exp(t->ast, id);
+        Pending p = { .id = id };
+        ExpId next;
+        t->tail = false;
+        if (e->kind == EXP_LET) {
+            next = e->u.let.body;
+            p.s = tr_decs(t, e->u.let.decs);
+        } else if (e->kind == EXP_SEQ && e->u.seq.exps.count) {
+            AstList l = e->u.seq.exps;
+            for (uint32_t i = 0; i + 1 < l.count; i++) {
+                ExpId x = ast_list_at(t->ast, l, i);
+                p.s = t_seq(a, p.s, t_seq(a, line_mark(t, x), un_nx(t, tr_exp(t, x))));
+            }
+            next = ast_list_at(t->ast, l, l.count - 1);
+            if (l.count > 1)
+                p.s = t_seq(a, p.s, line_mark(t, next));
+        } else if (e->kind == EXP_IF) {
+            ExpId then = e->u.if_.then, els = e->u.if_.els;
+            p.test = un_cx(t, tr_exp(t, e->u.if_.test));
+            if (els)
+                p.then = tr_tail(t, then, tail);
+            next = els ? els : then;
+        } else {
+            t->tail = tail;
+            r = tr_other(t, id);
+            break;
+        }
+        vec_push(&t->spine, p);
+        id = next;
+    }
+
+    while (t->spine.len > base) {
+        Pending p = t->spine.data[--t->spine.len];
+        if (ast_exp(t->ast, p.id)->kind == EXP_IF) {
+            if (ast_exp(t->ast, p.id)->u.if_.els)
+                r = tr_if(t, p.id, p.test, p.then, r);
+            else
+                r = tr_if(t, p.id, p.test, r, nx(t_exp(a, t_const(a, 0))));
+        } else if (r.kind == TR_NX) {
+            r = nx(t_seq(a, p.s, r.u.nx));
+        } else {
+            r = ex(t_eseq(a, p.s, un_ex(t, r)));
+        }
+    }
+    return r;
+}
+
+/* ---- Functions --------------------------------------------------------- */
+
+/* Append the shared failure blocks of the current level to `body`. */
+static TStm *fail_blocks(Translator *t, TStm *body)
+{
+    Arena *a = t->a;
+    Level *l = t->level;
+    if (l->nil_fail) {
+        TExp *c = call_runtime(t, "tiger_nil_error", 0);
+        c->flags |= TC_NORETURN;
+        body = t_seq(a, body, t_seq(a, t_label(a, l->nil_fail), t_exp(a, c)));
+    }
+    if (l->bounds_fail) {
+        TExp *c = call_runtime(t, "tiger_bounds_error", 0);
+        c->flags |= TC_NORETURN;
+        body = t_seq(a, body, t_seq(a, t_label(a, l->bounds_fail), t_exp(a, c)));
+    }
+    return body;
+}
+
+static void finish_proc(Translator *t, ExpId id, Tr body, bool value)
+{
+    Arena *a = t->a;
+    Level *l = t->level;
+    Label done = lazy_label(&l->exit);
+    TStm *s = value ? t_move(a, t_temp(a, REG_RV), un_ex(t, body)) : un_nx(t, body);
+    s = t_seq(a, line_mark(t, id), s);
+    if (l->trmc) {
+        /* The body's value closes the innermost record; the result is
+           the outermost. */
+        s = t_seq(a, s, fill_hole(t, REG_RV));
+        s = t_seq(a, s, t_move(a, t_temp(a, REG_RV), t_temp(a, l->res)));
+    }
+    /* Failure blocks come after the normal exit so that they stay out of
+       the straight-line path. */
+    s = t_seq(a, s, t_jump(a, done));
+    s = fail_blocks(t, s);
+    s = t_seq(a, s, t_label(a, done));
+    if (l->entry)
+        s = t_seq(a, t_label(a, l->entry), s);
+    if (l->trmc)
+        s = t_seq(a, t_move(a, t_temp(a, l->last), t_const(a, 0)), s);
+    s = frame_view_shift(a, l->frame, s);
+    vec_push(&t->p->frags, ((Frag){ .kind = FRAG_PROC, .label = t->level->frame->name,
+                                    .u.proc = { s, t->level->frame, t->level->fun } }));
+}
+
+static void tr_function(Translator *t, DecId did)
+{
+    FunEntry *f = (FunEntry *)t->s->dec_entry[did];
+    const Dec *d = ast_dec(t->ast, did);
+    ExpId body = d->u.function.body;
+    bool value = d->u.function.result != SYM_NONE;
+
+    Level *saved = t->level;
+    t->level = t->levels[f->index];
+    if (value && has_trmc(t, body)) {
+        t->level->trmc = true;
+        t->level->res = temp_new();
+        t->level->last = temp_new();
+        t->level->off = temp_new();
+    }
+    Tr b = tr_tail(t, body, true);
+    finish_proc(t, body, b, value);
+    t->level = saved;
+}
+
+void translate_program(Program *p, Sema *s, bool profile, const Profile *use)
+{
+    memset(p, 0, sizeof *p);
+    arena_init(&p->arena);
+    p->profile = profile;
+    p->path = s->ast->src->path;
+    p->branch_counts = profile ? label_new() : 0;
+    p->use = use;
+
+    Translator t = { .p = p, .s = s, .ast = s->ast, .a = &p->arena };
+    t.levels = xcalloc(s->funs.len, sizeof *t.levels);
+    t.access = xcalloc(s->vars.len, sizeof *t.access);
+    t.facts = xcalloc(s->vars.len, sizeof *t.facts);
+    t.strings = xcalloc(sym_count(), sizeof *t.strings);
+
+    /* Keep the main program's fragment first. */
+    vec_push(&p->frags, ((Frag){ .kind = FRAG_PROC }));
+
+    Level *main_level = arena_alloc(t.a, sizeof *main_level);
+    memset(main_level, 0, sizeof *main_level);
+    main_level->fun = s->funs.data[0];
+    main_level->frame = frame_new(t.a, label_named(sym_intern("tigermain")), 0, NULL, NULL);
+    use_profile(&t, main_level->frame);
+    t.levels[0] = main_level;
+    t.level = main_level;
+
+    Tr body = tr_exp(&t, s->ast->root);
+    uint32_t nfrags = p->frags.len;
+    finish_proc(&t, s->ast->root, body, false);
+    p->frags.data[0] = p->frags.data[nfrags];
+    p->frags.len--;
+
+    free(t.levels);
+    free(t.access);
+    free(t.facts);
+    free(t.strings);
+    vec_free(&t.breaks);
+    vec_free(&t.loops);
+    vec_free(&t.spine);
+}
+
+void program_free(Program *p)
+{
+    for (uint32_t i = 0; i < p->frags.len; i++)
+        if (p->frags.data[i].kind == FRAG_PROC)
+            frame_free(p->frags.data[i].u.proc.frame);
+    vec_free(&p->frags);
+    vec_free(&p->branches);
+    arena_free(&p->arena);
+}
+
+static void dump_string(Symbol sym, FILE *out)
+{
+    const unsigned char *s = (const unsigned char *)sym_name(sym);
+    uint32_t n = sym_len(sym);
+    fputc('"', out);
+    for (uint32_t i = 0; i < n; i++) {
+        if (s[i] == '"' || s[i] == '\\')
+            fprintf(out, "\\%c", s[i]);
+        else if (s[i] < 32 || s[i] >= 127)
+            fprintf(out, "\\%03o", s[i]);
+        else
+            fputc(s[i], out);
+    }
+    fputc('"', out);
+}
+
+void program_dump(const Program *p, FILE *out)
+{
+    for (uint32_t i = 0; i < p->frags.len; i++) {
+        const Frag *f = &p->frags.data[i];
+        if (f->kind == FRAG_GLOBAL) {
+            fputs("global ", out);
+            label_print(f->label, out);
+            if (f->u.global.ptr)
+                fputs(" ptr", out);
+            if (f->u.global.constant)
+                fprintf(out, " = %" PRId64, f->u.global.value);
+            else if (f->u.global.fixed)
+                fputs(" fixed", out);
+            fputc('\n', out);
+            continue;
+        }
+        if (f->kind == FRAG_STRING) {
+            fputs("string ", out);
+            label_print(f->label, out);
+            fputc(' ', out);
+            dump_string(f->u.string.str, out);
+            fputc('\n', out);
+            continue;
+        }
+        fputs("proc ", out);
+        label_print(f->label, out);
+        fprintf(out, " frame %d\n", f->u.proc.frame->locals);
+        tree_dump_stm(f->u.proc.body, out);
+    }
+}
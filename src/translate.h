@@ -0,0 +1,70 @@
+#ifndef TIGER_TRANSLATE_H
+#define TIGER_TRANSLATE_H
+
+#include <stdio.h>
+
+#include "frame.h"
+#include "profile.h"
+#include "semant.h"
+#include "tree.h"
+
+/*
+ * Translation of a checked program into Tree IR fragments: one PROC per
+ * function (the main program is the first, "tigermain"), one STRING
+ * per distinct string literal and one GLOBAL word per escaping variable
+ * of the main program.
+ *
+ * A function with FE_LINK takes its static link, the frame address of
+ * its lexically enclosing function, as formal 0; lifted functions have
+ * none.  Variables are reached through their Access: escaping ones by
+ * chasing static links to the owner's frame, the rest as temps of the
+ * current function.
+ */
+
+typedef enum FragKind {
+    FRAG_PROC,
+    FRAG_STRING,
+    FRAG_GLOBAL,
+} FragKind;
+
+typedef struct Frag {
+    uint8_t kind;
+    Label label;
+    union {
+        struct { TStm *body; Frame *frame; FunEntry *fun; } proc;
+        struct { Symbol str; } string;
+        /* `fixed`: never assigned after its initialization;
+           `constant`: fixed, and initialized to `value`. */
+        struct { bool ptr, fixed, constant; int64_t value; } global;
+    } u;
+} Frag;
+
+/* Where an if or a while is, in the source. */
+typedef struct BranchSite {
+    uint32_t line, col;
+} BranchSite;
+
+typedef struct Program {
+    Arena arena;            /* trees and frames */
+    VEC(Frag) frags;
+    bool profile;           /* -pg: line marks and branch counters in the
+                               trees, and emit_program() adds call
+                               counters and a line table */
+    const char *path;       /* of the source, for the line table */
+    VEC(BranchSite) branches;   /* under -pg, counted at branch_counts */
+    Label branch_counts;
+    const Profile *use;     /* -fprofile-use, or NULL */
+} Program;
+
+/* `s` must have been checked without errors and run through
+   escape_find() and closure_convert().  With `profile`, statements
+   start with TS_LINE marks and the arms of every if and while count
+   how often they run.  With `use`, frames get the counts it has for
+   their functions (Frame.profiled), and the functions are ordered by
+   how often they were called, the hottest first. */
+void translate_program(Program *p, Sema *s, bool profile, const Profile *use);
+void program_free(Program *p);
+
+void program_dump(const Program *p, FILE *out);
+
+#endif
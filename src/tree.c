@@ -0,0 +1,282 @@
+#include "tree.h"
+
+#include <inttypes.h>
+#include <string.h>
+
+#include "frame.h"
+
+const char *const t_binop_names[T_BINOP_COUNT] = {
+    "+", "-", "*", "/", "and", "or", "xor", "<<", ">>", ">>a",
+};
+
+const char *const t_relop_names[T_RELOP_COUNT] = {
+    "=", "<>", "<", ">", "<=", ">=", "u<", "u<=", "u>", "u>=",
+};
+
+static TExp *new_exp(Arena *a, TExpKind kind)
+{
+    TExp *e = arena_alloc(a, sizeof *e);
+    memset(e, 0, sizeof *e);
+    e->kind = kind;
+    return e;
+}
+
+static TStm *new_stm(Arena *a, TStmKind kind)
+{
+    TStm *s = arena_alloc(a, sizeof *s);
+    memset(s, 0, sizeof *s);
+    s->kind = kind;
+    return s;
+}
+
+TExp *t_const(Arena *a, int64_t value)
+{
+    TExp *e = new_exp(a, TE_CONST);
+    e->u.value = value;
+    return e;
+}
+
+TExp *t_name(Arena *a, Label l)
+{
+    TExp *e = new_exp(a, TE_NAME);
+    e->u.name = l;
+    return e;
+}
+
+TExp *t_temp(Arena *a, Temp t)
+{
+    TExp *e = new_exp(a, TE_TEMP);
+    e->u.temp = t;
+    return e;
+}
+
+TExp *t_binop(Arena *a, TBinOp op, TExp *l, TExp *r)
+{
+    TExp *e = new_exp(a, TE_BINOP);
+    e->op = (uint8_t)op;
+    e->u.bin.left = l;
+    e->u.bin.right = r;
+    return e;
+}
+
+TExp *t_mem(Arena *a, TExp *addr)
+{
+    TExp *e = new_exp(a, TE_MEM);
+    e->u.mem = addr;
+    return e;
+}
+
+TExp *t_call(Arena *a, TExp *func, TExp **args, uint32_t nargs)
+{
+    TExp *e = new_exp(a, TE_CALL);
+    e->u.call.func = func;
+    e->u.call.args = args;
+    e->u.call.nargs = nargs;
+    return e;
+}
+
+TExp *t_eseq(Arena *a, TStm *s, TExp *e)
+{
+    if (!s)
+        return e;
+    TExp *x = new_exp(a, TE_ESEQ);
+    x->u.eseq.stm = s;
+    x->u.eseq.exp = e;
+    return x;
+}
+
+TStm *t_move(Arena *a, TExp *dst, TExp *src)
+{
+    TStm *s = new_stm(a, TS_MOVE);
+    s->u.move.dst = dst;
+    s->u.move.src = src;
+    return s;
+}
+
+TStm *t_exp(Arena *a, TExp *e)
+{
+    TStm *s = new_stm(a, TS_EXP);
+    s->u.exp = e;
+    return s;
+}
+
+TStm *t_jump(Arena *a, Label l)
+{
+    TStm *s = new_stm(a, TS_JUMP);
+    s->u.jump.target = t_name(a, l);
+    s->u.jump.labels = arena_alloc(a, sizeof(Label));
+    s->u.jump.labels[0] = l;
+    s->u.jump.nlabels = 1;
+    return s;
+}
+
+TStm *t_cjump(Arena *a, TRelOp op, TExp *l, TExp *r, Label t, Label f)
+{
+    TStm *s = new_stm(a, TS_CJUMP);
+    s->op = (uint8_t)op;
+    s->u.cjump.left = l;
+    s->u.cjump.right = r;
+    s->u.cjump.t = t;
+    s->u.cjump.f = f;
+    return s;
+}
+
+TStm *t_label(Arena *a, Label l)
+{
+    TStm *s = new_stm(a, TS_LABEL);
+    s->u.label = l;
+    return s;
+}
+
+TStm *t_line(Arena *a, uint32_t line)
+{
+    TStm *s = new_stm(a, TS_LINE);
+    s->u.line = line;
+    return s;
+}
+
+TStm *t_seq(Arena *a, TStm *first, TStm *second)
+{
+    if (!first)
+        return second;
+    if (!second)
+        return first;
+    TStm *s = new_stm(a, TS_SEQ);
+    s->u.seq.first = first;
+    s->u.seq.second = second;
+    return s;
+}
+
+TRelOp t_not_rel(TRelOp op)
+{
+    static const TRelOp inv[T_RELOP_COUNT] = {
+        [T_EQ] = T_NE, [T_NE] = T_EQ, [T_LT] = T_GE, [T_GE] = T_LT,
+        [T_GT] = T_LE, [T_LE] = T_GT, [T_ULT] = T_UGE, [T_UGE] = T_ULT,
+        [T_UGT] = T_ULE, [T_ULE] = T_UGT,
+    };
+    return inv[op];
+}
+
+TRelOp t_commute_rel(TRelOp op)
+{
+    static const TRelOp swap[T_RELOP_COUNT] = {
+        [T_EQ] = T_EQ, [T_NE] = T_NE, [T_LT] = T_GT, [T_GT] = T_LT,
+        [T_LE] = T_GE, [T_GE] = T_LE, [T_ULT] = T_UGT, [T_UGT] = T_ULT,
+        [T_ULE] = T_UGE, [T_UGE] = T_ULE,
+    };
+    return swap[op];
+}
+
+/* ---- Dump -------------------------------------------------------------- */
+
+static void dump_temp(Temp t, FILE *out)
+{
+    if (t < TEMP_NREGS)
+        fprintf(out, "%%%s", reg_names[t]);
+    else
+        fprintf(out, "t%u", t);
+}
+
+static void dump_stm(const TStm *s, FILE *out);
+
+void tree_dump_exp(const TExp *e, FILE *out)
+{
+    switch ((TExpKind)e->kind) {
+    case TE_CONST:
+        fprintf(out, "%" PRId64, e->u.value);
+        break;
+    case TE_NAME:
+        label_print(e->u.name, out);
+        break;
+    case TE_TEMP:
+        dump_temp(e->u.temp, out);
+        break;
+    case TE_BINOP:
+        fprintf(out, "(%s ", t_binop_names[e->op]);
+        tree_dump_exp(e->u.bin.left, out);
+        fputc(' ', out);
+        tree_dump_exp(e->u.bin.right, out);
+        fputc(')', out);
+        break;
+    case TE_MEM:
+        fputs("(mem ", out);
+        tree_dump_exp(e->u.mem, out);
+        fputc(')', out);
+        break;
+    case TE_CALL:
+        fputs(e->flags & TC_TAIL ? "(tailcall " : "(call ", out);
+        tree_dump_exp(e->u.call.func, out);
+        for (uint32_t i = 0; i < e->u.call.nargs; i++) {
+            fputc(' ', out);
+            tree_dump_exp(e->u.call.args[i], out);
+        }
+        fputc(')', out);
+        break;
+    case TE_ESEQ:
+        fputs("(eseq ", out);
+        dump_stm(e->u.eseq.stm, out);
+        fputc(' ', out);
+        tree_dump_exp(e->u.eseq.exp, out);
+        fputc(')', out);
+        break;
+    }
+}
+
+static void dump_stm(const TStm *s, FILE *out)
+{
+    switch ((TStmKind)s->kind) {
+    case TS_MOVE:
+        fputs("(move ", out);
+        tree_dump_exp(s->u.move.dst, out);
+        fputc(' ', out);
+        tree_dump_exp(s->u.move.src, out);
+        fputc(')', out);
+        break;
+    case TS_EXP:
+        fputs("(exp ", out);
+        tree_dump_exp(s->u.exp, out);
+        fputc(')', out);
+        break;
+    case TS_JUMP:
+        fputs("(jump ", out);
+        tree_dump_exp(s->u.jump.target, out);
+        fputc(')', out);
+        break;
+    case TS_CJUMP:
+        fprintf(out, "(cjump %s ", t_relop_names[s->op]);
+        tree_dump_exp(s->u.cjump.left, out);
+        fputc(' ', out);
+        tree_dump_exp(s->u.cjump.right, out);
+        fputc(' ', out);
+        label_print(s->u.cjump.t, out);
+        fputc(' ', out);
+        label_print(s->u.cjump.f, out);
+        fputc(')', out);
+        break;
+    case TS_SEQ:
+        fputs("(seq ", out);
+        dump_stm(s->u.seq.first, out);
+        fputc(' ', out);
+        dump_stm(s->u.seq.second, out);
+        fputc(')', out);
+        break;
+    case TS_LABEL:
+        fputs("(label ", out);
+        label_print(s->u.label, out);
+        fputc(')', out);
+        break;
+    case TS_LINE:
+        fprintf(out, "(line %u)", s->u.line);
+        break;
+    }
+}
+
+void tree_dump_stm(const TStm *s, FILE *out)
+{
+    while (s->kind == TS_SEQ) {
+        tree_dump_stm(s->u.seq.first, out);
+        s = s->u.seq.second;
+    }
+    dump_stm(s, out);
+    fputc('\n', out);
+}
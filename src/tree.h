@@ -0,0 +1,118 @@
+#ifndef TIGER_TREE_H
+#define TIGER_TREE_H
+
+#include <stdio.h>
+
+#include "arena.h"
+#include "temp.h"
+
+/*
+ * Tree intermediate representation: expressions that compute a 64-bit
+ * value and statements that perform side effects and control flow.
+ * Nodes are allocated from an arena and, unlike the AST, refer to one
+ * another by pointer, since the later phases rewrite trees freely.
+ */
+
+typedef enum TBinOp {
+    T_PLUS, T_MINUS, T_MUL, T_DIV,
+    T_AND, T_OR, T_XOR, T_LSHIFT, T_RSHIFT, T_ARSHIFT,
+    T_BINOP_COUNT
+} TBinOp;
+
+typedef enum TRelOp {
+    T_EQ, T_NE, T_LT, T_GT, T_LE, T_GE,
+    T_ULT, T_ULE, T_UGT, T_UGE,
+    T_RELOP_COUNT
+} TRelOp;
+
+typedef enum TExpKind {
+    TE_CONST,
+    TE_NAME,
+    TE_TEMP,
+    TE_BINOP,
+    TE_MEM,
+    TE_CALL,
+    TE_ESEQ,
+} TExpKind;
+
+typedef enum TStmKind {
+    TS_MOVE,
+    TS_EXP,
+    TS_JUMP,
+    TS_CJUMP,
+    TS_SEQ,
+    TS_LABEL,
+    TS_LINE,                /* marks where source line `line` starts, for -pg */
+} TStmKind;
+
+/* TExp.flags on TE_CALL */
+enum {
+    TC_NORETURN = 1 << 0,   /* runtime error routines */
+    TC_TAIL = 1 << 1,       /* last action of the caller, whose epilogue is
+                               all that follows: may pop the caller's
+                               frame and `jmp` */
+};
+
+typedef struct TExp TExp;
+typedef struct TStm TStm;
+
+struct TExp {
+    uint8_t kind;
+    uint8_t op;             /* TBinOp for TE_BINOP */
+    uint8_t flags;
+    union {
+        int64_t value;
+        Label name;
+        Temp temp;
+        struct { TExp *left, *right; } bin;
+        TExp *mem;
+        struct { TExp *func; TExp **args; uint32_t nargs; } call;
+        struct { TStm *stm; TExp *exp; } eseq;
+    } u;
+};
+
+struct TStm {
+    uint8_t kind;
+    uint8_t op;             /* TRelOp for TS_CJUMP */
+    union {
+        struct { TExp *dst, *src; } move;
+        TExp *exp;
+        struct { TExp *target; Label *labels; uint32_t nlabels; } jump;
+        struct { TExp *left, *right; Label t, f; } cjump;
+        struct { TStm *first, *second; } seq;
+        Label label;
+        uint32_t line;
+    } u;
+};
+
+TExp *t_const(Arena *a, int64_t value);
+TExp *t_name(Arena *a, Label l);
+TExp *t_temp(Arena *a, Temp t);
+TExp *t_binop(Arena *a, TBinOp op, TExp *l, TExp *r);
+TExp *t_mem(Arena *a, TExp *addr);
+TExp *t_call(Arena *a, TExp *func, TExp **args, uint32_t nargs);
+TExp *t_eseq(Arena *a, TStm *s, TExp *e);
+
+TStm *t_move(Arena *a, TExp *dst, TExp *src);
+TStm *t_exp(Arena *a, TExp *e);
+TStm *t_jump(Arena *a, Label l);
+TStm *t_cjump(Arena *a, TRelOp op, TExp *l, TExp *r, Label t, Label f);
+TStm *t_label(Arena *a, Label l);
+TStm *t_line(Arena *a, uint32_t line);
+
+/* SEQ of the two statements; either may be NULL. */
+TStm *t_seq(Arena *a, TStm *first, TStm *second);
+
+/* The relation that holds exactly when `op` does not. */
+TRelOp t_not_rel(TRelOp op);
+/* The relation `op` with its operands exchanged. */
+TRelOp t_commute_rel(TRelOp op);
+
+extern const char *const t_binop_names[T_BINOP_COUNT];
+extern const char *const t_relop_names[T_RELOP_COUNT];
+
+/* Print as S-expressions, one top-level statement of a SEQ per line. */
+void tree_dump_stm(const TStm *s, FILE *out);
+void tree_dump_exp(const TExp *e, FILE *out);
+
+#endif
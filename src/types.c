@@ -0,0 +1,71 @@
+#include "types.h"
+
+#include <string.h>
+
+Type type_int = { .kind = TK_INT };
+Type type_string = { .kind = TK_STRING };
+Type type_nil = { .kind = TK_NIL };
+Type type_unit = { .kind = TK_UNIT };
+Type type_error = { .kind = TK_ERROR };
+
+Type *type_record(Arena *a, Symbol name, uint32_t nfields)
+{
+    Type *t = arena_alloc(a, sizeof *t);
+    t->kind = TK_RECORD;
+    t->u.record.name = name;
+    t->u.record.count = nfields;
+    t->u.record.fields = nfields ? arena_alloc(a, nfields * sizeof(TypeField)) : NULL;
+    return t;
+}
+
+Type *type_array(Arena *a, Symbol name, Type *elem)
+{
+    Type *t = arena_alloc(a, sizeof *t);
+    t->kind = TK_ARRAY;
+    t->u.array.name = name;
+    t->u.array.elem = elem;
+    return t;
+}
+
+Type *type_name(Arena *a, Symbol sym)
+{
+    Type *t = arena_alloc(a, sizeof *t);
+    t->kind = TK_NAME;
+    t->u.name.sym = sym;
+    t->u.name.bound = NULL;
+    return t;
+}
+
+bool type_assignable(Type *expected, Type *actual)
+{
+    expected = type_actual(expected);
+    actual = type_actual(actual);
+    if (expected == actual || expected->kind == TK_ERROR || actual->kind == TK_ERROR)
+        return true;
+    return actual->kind == TK_NIL && expected->kind == TK_RECORD;
+}
+
+int type_field_index(Type *t, Symbol name)
+{
+    t = type_actual(t);
+    for (uint32_t i = 0; i < t->u.record.count; i++)
+        if (t->u.record.fields[i].name == name)
+            return (int)i;
+    return -1;
+}
+
+const char *type_str(Type *t)
+{
+    t = type_actual(t);
+    switch ((TypeKind)t->kind) {
+    case TK_INT: return "int";
+    case TK_STRING: return "string";
+    case TK_NIL: return "nil";
+    case TK_UNIT: return "unit";
+    case TK_RECORD: return t->u.record.name ? sym_name(t->u.record.name) : "record";
+    case TK_ARRAY: return t->u.array.name ? sym_name(t->u.array.name) : "array";
+    case TK_ERROR: return "<error>";
+    case TK_NAME: break;
+    }
+    return "?";
+}
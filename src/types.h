@@ -0,0 +1,123 @@
+#ifndef TIGER_TYPES_H
+#define TIGER_TYPES_H
+
+#include "ast.h"
+
+/*
+ * Semantic types.  Every record and array type expression denotes a new
+ * type, so identity is pointer identity.  A NAME type is the placeholder
+ * entered for a type declaration before its body is resolved; after its
+ * batch is checked `bound` points at a non-NAME type.
+ *
+ * ERROR is the poison type given to anything whose type could not be
+ * determined.  It is compatible with every type, so one mistake yields
+ * one diagnostic rather than a cascade through every enclosing
+ * expression.
+ */
+typedef enum TypeKind {
+    TK_INT,
+    TK_STRING,
+    TK_NIL,
+    TK_UNIT,
+    TK_RECORD,
+    TK_ARRAY,
+    TK_NAME,
+    TK_ERROR,
+} TypeKind;
+
+typedef struct Type Type;
+
+typedef struct TypeField {
+    Symbol name;
+    Type *ty;
+} TypeField;
+
+struct Type {
+    uint8_t kind;
+    union {
+        struct { Symbol name; TypeField *fields; uint32_t count; } record;
+        struct { Symbol name; Type *elem; } array;
+        struct { Symbol sym; Type *bound; } name;
+    } u;
+};
+
+extern Type type_int, type_string, type_nil, type_unit, type_error;
+
+Type *type_record(Arena *a, Symbol name, uint32_t nfields);
+Type *type_array(Arena *a, Symbol name, Type *elem);
+Type *type_name(Arena *a, Symbol sym);
+
+/* Strip NAME indirections. */
+static inline Type *type_actual(Type *t)
+{
+    while (t->kind == TK_NAME)
+        t = t->u.name.bound;
+    return t;
+}
+
+static inline bool type_is_error(Type *t)
+{
+    return type_actual(t)->kind == TK_ERROR;
+}
+
+/* Can a value of type `actual` be used where `expected` is required? */
+bool type_assignable(Type *expected, Type *actual);
+
+/* Index of field `name` in record `t`, or -1. */
+int type_field_index(Type *t, Symbol name);
+
+/* Human-readable type name for messages. */
+const char *type_str(Type *t);
+
+/* ---- Environment entries ---------------------------------------------- */
+
+typedef enum EntryKind {
+    ENT_VAR,
+    ENT_FUN,
+} EntryKind;
+
+typedef struct FunEntry FunEntry;
+
+/* VarEntry.flags */
+enum {
+    VE_READONLY = 1 << 0,   /* for-loop variable */
+    VE_PARAM = 1 << 1,
+    VE_ESCAPE = 1 << 2,     /* used by a function nested inside its owner */
+    VE_ASSIGNED = 1 << 3,   /* target of an assignment */
+};
+
+typedef struct VarEntry {
+    uint8_t kind;           /* ENT_VAR */
+    uint8_t flags;
+    Symbol name;
+    uint32_t pos;
+    Type *ty;
+    FunEntry *owner;        /* function whose frame holds the variable */
+    uint32_t index;         /* position in Sema.vars */
+} VarEntry;
+
+/* FunEntry.flags, set by closure_convert() */
+enum {
+    FE_LINK = 1 << 0,           /* takes a static link */
+    FE_LINK_ESCAPES = 1 << 1,   /* ... which inner functions read from its frame */
+};
+
+struct FunEntry {
+    uint8_t kind;           /* ENT_FUN */
+    uint8_t builtin;
+    uint8_t flags;
+    Symbol name;
+    uint32_t pos;
+    Type *result;
+    Type **formals;
+    uint32_t nformals;
+    DecId dec;              /* AST_NONE for builtins and the main program */
+    FunEntry *parent;       /* lexically enclosing function */
+    uint32_t index;         /* position in Sema.funs */
+};
+
+typedef struct Entry {
+    uint8_t kind;
+} Entry;
+
+#endif
@@ -0,0 +1,105 @@
+#include "util.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+_Thread_local AllocStats alloc_stats;
+
+void *xmalloc(size_t n)
+{
+    alloc_stats.calls++;
+    alloc_stats.bytes += n;
+    void *p = malloc(n ? n : 1);
+    if (!p)
+        fatal("out of memory (%zu bytes)", n);
+    return p;
+}
+
+void *xcalloc(size_t n, size_t size)
+{
+    alloc_stats.calls++;
+    alloc_stats.bytes += n * size;
+    void *p = calloc(n ? n : 1, size ? size : 1);
+    if (!p)
+        fatal("out of memory (%zu x %zu bytes)", n, size);
+    return p;
+}
+
+void *xrealloc(void *p, size_t n)
+{
+    alloc_stats.calls++;
+    alloc_stats.bytes += n;
+    p = realloc(p, n ? n : 1);
+    if (!p)
+        fatal("out of memory (%zu bytes)", n);
+    return p;
+}
+
+char *xstrdup(const char *s)
+{
+    size_t n = strlen(s) + 1;
+    return memcpy(xmalloc(n), s, n);
+}
+
+void fatal(const char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    fputs("tigerc: fatal: ", stderr);
+    vfprintf(stderr, fmt, ap);
+    fputc('\n', stderr);
+    va_end(ap);
+    exit(2);
+}
+
+void vec_grow_(void **data, uint32_t *cap, size_t elem)
+{
+    uint32_t ncap = *cap ? *cap * 2 : 8;
+    if (ncap < *cap)
+        fatal("array too large");
+    *data = xrealloc(*data, (size_t)ncap * elem);
+    *cap = ncap;
+}
+
+static uint32_t idmap_slot(const IdMap *m, uint32_t key)
+{
+    uint32_t j = (uint32_t)((key + 1) * 0x9e3779b97f4a7c15ull >> 32) & m->mask;
+    while (m->slots[j] && (uint32_t)(m->slots[j] >> 32) != key + 1)
+        j = (j + 1) & m->mask;
+    return j;
+}
+
+void idmap_put(IdMap *m, uint32_t key, uint32_t value)
+{
+    if ((m->used + 1) * 2 > m->mask + 1) {
+        uint64_t *old = m->slots;
+        uint32_t old_mask = m->mask;
+        m->mask = old ? old_mask * 2 + 1 : 63;
+        m->slots = xcalloc((size_t)m->mask + 1, sizeof *m->slots);
+        for (uint32_t i = 0; old && i <= old_mask; i++)
+            if (old[i])
+                m->slots[idmap_slot(m, (uint32_t)(old[i] >> 32) - 1)] = old[i];
+        free(old);
+    }
+    uint32_t j = idmap_slot(m, key);
+    if (!m->slots[j])
+        m->used++;
+    m->slots[j] = (uint64_t)(key + 1) << 32 | value;
+}
+
+uint32_t idmap_get(const IdMap *m, uint32_t key, uint32_t missing)
+{
+    if (!m->slots)
+        return missing;
+    uint64_t v = m->slots[idmap_slot(m, key)];
+    return v ? (uint32_t)v : missing;
+}
+
+void idmap_free(IdMap *m)
+{
+    free(m->slots);
+    m->slots = NULL;
+    m->mask = m->used = 0;
+}
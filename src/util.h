@@ -0,0 +1,62 @@
+#ifndef TIGER_UTIL_H
+#define TIGER_UTIL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdnoreturn.h>
+
+void *xmalloc(size_t n);
+void *xcalloc(size_t n, size_t size);
+void *xrealloc(void *p, size_t n);
+char *xstrdup(const char *s);
+
+/* What the calling thread has asked of the allocators above, for
+   -fmem-report: calls, and bytes requested (by realloc, the new size). */
+typedef struct AllocStats {
+    uint64_t calls, bytes;
+} AllocStats;
+extern _Thread_local AllocStats alloc_stats;
+
+noreturn void fatal(const char *fmt, ...);
+
+/* Growable array: `VEC(T) v = {0};` then vec_push(&v, x). */
+#define VEC(T) struct { T *data; uint32_t len, cap; }
+
+#define vec_push(v, x)                                                      \
+    do {                                                                    \
+        if ((v)->len == (v)->cap)                                           \
+            vec_grow_((void **)&(v)->data, &(v)->cap, sizeof(*(v)->data));  \
+        (v)->data[(v)->len++] = (x);                                        \
+    } while (0)
+
+#define vec_reserve(v, n)                                                   \
+    do {                                                                    \
+        while ((v)->cap < (n))                                              \
+            vec_grow_((void **)&(v)->data, &(v)->cap, sizeof(*(v)->data));  \
+    } while (0)
+
+#define vec_free(v)                                                         \
+    do {                                                                    \
+        free((v)->data);                                                    \
+        (v)->data = NULL;                                                   \
+        (v)->len = (v)->cap = 0;                                            \
+    } while (0)
+
+void vec_grow_(void **data, uint32_t *cap, size_t elem);
+
+/* Map from 32-bit ids to 32-bit values, for id spaces too large to
+   index per function (temps, labels).  `IdMap m = {0};` is empty. */
+typedef struct IdMap {
+    uint64_t *slots;        /* (key + 1) << 32 | value; 0 is empty */
+    uint32_t mask, used;
+} IdMap;
+
+void idmap_put(IdMap *m, uint32_t key, uint32_t value);
+/* The value of `key`, or `missing` if it has none. */
+uint32_t idmap_get(const IdMap *m, uint32_t key, uint32_t missing);
+void idmap_free(IdMap *m);
+
+#define ARRAY_LEN(a) (sizeof(a) / sizeof((a)[0]))
+
+#endif
@@ -0,0 +1,887 @@
+#include "vm.h"
+
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "canon.h"
+#include "gc.h"
+#include "runtime.h"
+
+/* No compiled code runs, so the collector has no frames or globals to
+   read precisely: the VM stack holds them all, and is scanned.  Nor is
+   there any for -pg to profile. */
+const uint64_t tiger_frametable[1];
+const uint64_t tiger_roots[1];
+const uint64_t tiger_profile[6];
+
+/* The fixed registers at the bottom of every frame's register window:
+   the frame pointer, the six argument registers and the return value,
+   which the trees name as machine registers, then the call linkage. */
+enum {
+    R_FP,
+    R_ARG,
+    R_RV = R_ARG + FRAME_NARG_REGS,
+    R_PC,                   /* where the caller resumes */
+    R_REGS,                 /* the caller's window; NULL for tigermain */
+    R_DST,                  /* the caller's register for the result */
+    R_TOP,                  /* the stack top at the call */
+    R_NFIXED,
+};
+
+enum {
+    VM_STACK = 256 << 20,   /* reserved, not committed */
+    VM_MAX_ARGS = 64,
+    VM_MAX_REGS = UINT16_MAX,
+};
+
+/* The relation and arithmetic groups follow TRelOp and TBinOp. */
+#define VM_OPS(X)                                                           \
+    X(MOV) X(LI)                                                            \
+    X(ADD) X(SUB) X(MUL) X(DIV) X(AND) X(OR) X(XOR) X(SHL) X(SHR) X(SAR)    \
+    X(ADDI) X(SUBI) X(MULI) X(DIVI) X(ANDI) X(ORI) X(XORI)                  \
+    X(SHLI) X(SHRI) X(SARI)                                                 \
+    X(LD) X(LDX) X(LDA) X(ST) X(STX) X(STA)                                 \
+    X(JEQ) X(JNE) X(JLT) X(JGT) X(JLE) X(JGE)                               \
+    X(JULT) X(JULE) X(JUGT) X(JUGE)                                         \
+    X(JEQI) X(JNEI) X(JLTI) X(JGTI) X(JLEI) X(JGEI)                         \
+    X(JULTI) X(JULEI) X(JUGTI) X(JUGEI)                                     \
+    X(JMP) X(CHKJ) X(CHKLD) X(CALL) X(TCALL) X(RTCALL) X(RET)
+
+typedef enum VmOp {
+#define X(op) VM_##op,
+    VM_OPS(X)
+#undef X
+    VM_NOPS
+} VmOp;
+
+typedef int64_t (*VmBuiltin)(const int64_t *args);
+typedef struct VmFunc VmFunc;
+
+/*
+ * One instruction.  Register operands are indices into the current
+ * window, r[]:
+ *
+ *   MOV a b         r[a] = r[b]
+ *   LI a k          r[a] = k
+ *   ADD.. a b c     r[a] = r[b] op r[c]
+ *   ADDI.. a b c    r[a] = r[b] op c
+ *   LD a b c        r[a] = M[r[b] + c]
+ *   LDX a b c k     r[a] = M[r[b] + 8 r[c] + k]
+ *   LDA a k         r[a] = M[k]
+ *   ST a b c        M[r[a] + c] = r[b]
+ *   STX a b c k     M[r[a] + 8 r[c] + k] = r[b]
+ *   STA b k         M[k] = r[b]
+ *   JEQ.. a b to    if r[a] rel r[b], go to `to`
+ *   JEQI.. a c to   if r[a] rel c, go to `to`
+ *   CHKJ a b to     if r[a] is an index of array r[b], go to `to`
+ *   CHKLD a b c to  r[a] = r[b][r[c]] if r[c] is an index, else go to `to`
+ *   CALL a b c fn   r[a] = fn(r[b], .., r[b + c - 1])
+ *   TCALL b c fn    the same in place of this frame, returning to its caller
+ *   RTCALL a b rt   r[a] = rt(&r[b])
+ *   RET             return r[R_RV]
+ *
+ * CHKJ and CHKLD are superinstructions for the bounds check translate.c
+ * puts before a subscript, the second fused with the load that follows
+ * the check; compare-and-branch always takes one instruction.
+ */
+typedef struct VmIns {
+    union {
+        const void *h;      /* the handler, once threaded */
+        uintptr_t op;
+    };
+    uint16_t a, b;
+    int32_t c;
+    union {
+        int64_t k;
+        const struct VmIns *to;
+        const VmFunc *fn;
+        VmBuiltin rt;
+    };
+} VmIns;
+
+struct VmFunc {
+    VmIns *code;
+    uint32_t nregs;
+    int32_t locals;         /* bytes of frame slots below the frame pointer */
+};
+
+/* ---- Builtins ----------------------------------------------------------- */
+
+#define S(i) ((const char *)a[i])
+
+static int64_t rt_print(const int64_t *a) { tiger_print(S(0)); return 0; }
+static int64_t rt_flush(const int64_t *a) { tiger_flush(); return 0; }
+static int64_t rt_getchar(const int64_t *a) { return (int64_t)tiger_getchar(); }
+static int64_t rt_ord(const int64_t *a) { return tiger_ord(S(0)); }
+static int64_t rt_chr(const int64_t *a) { return (int64_t)tiger_chr(a[0]); }
+static int64_t rt_size(const int64_t *a) { return tiger_size(S(0)); }
+static int64_t rt_substring(const int64_t *a) { return (int64_t)tiger_substring(S(0), a[1], a[2]); }
+static int64_t rt_concat(const int64_t *a) { return (int64_t)tiger_concat(S(0), S(1)); }
+static int64_t rt_not(const int64_t *a) { return tiger_not(a[0]); }
+static int64_t rt_exit(const int64_t *a) { tiger_exit(a[0]); return 0; }
+static int64_t rt_string_equal(const int64_t *a) { return tiger_string_equal(S(0), S(1)); }
+static int64_t rt_string_compare(const int64_t *a) { return tiger_string_compare(S(0), S(1)); }
+static int64_t rt_init_array(const int64_t *a) { return (int64_t)tiger_init_array(a[0], a[1]); }
+static int64_t rt_init_ptr_array(const int64_t *a) { return (int64_t)tiger_init_ptr_array(a[0], a[1]); }
+static int64_t rt_alloc_record(const int64_t *a) { return (int64_t)tiger_alloc_record(a[0], a[1]); }
+static int64_t rt_bounds_error(const int64_t *a) { tiger_bounds_error(); return 0; }
+static int64_t rt_nil_error(const int64_t *a) { tiger_nil_error(); return 0; }
+
+#undef S
+
+static const struct {
+    const char *name;
+    VmBuiltin fn;
+} builtins[] = {
+    { "tiger_print", rt_print },
+    { "tiger_flush", rt_flush },
+    { "tiger_getchar", rt_getchar },
+    { "tiger_ord", rt_ord },
+    { "tiger_chr", rt_chr },
+    { "tiger_size", rt_size },
+    { "tiger_substring", rt_substring },
+    { "tiger_concat", rt_concat },
+    { "tiger_not", rt_not },
+    { "tiger_exit", rt_exit },
+    { "tiger_string_equal", rt_string_equal },
+    { "tiger_string_compare", rt_string_compare },
+    { "tiger_init_array", rt_init_array },
+    { "tiger_init_ptr_array", rt_init_ptr_array },
+    { "tiger_alloc_record", rt_alloc_record },
+    { "tiger_bounds_error", rt_bounds_error },
+    { "tiger_nil_error", rt_nil_error },
+};
+
+/* ---- Translation to bytecode ------------------------------------------ */
+
+static void *vm_sp;         /* the lowest live word, for the collector */
+static char *vm_stack_lo;
+
+static const void *const *execute(const VmIns *ip, int64_t *r);
+
+typedef struct Vm {
+    VmFunc *funcs;
+    IdMap func_of;          /* proc label -> index into funcs */
+    IdMap addr_of;          /* data label -> index into addrs */
+    VEC(int64_t) addrs;
+    VEC(char *) strings;    /* literals, to free */
+    char *stack, *globals;  /* globals sit at the top of the stack */
+} Vm;
+
+typedef struct VmBlock {
+    uint32_t first, end;    /* statements [first, end), the first a LABEL */
+    bool emitted;
+} VmBlock;
+
+typedef struct VmCompiler {
+    Vm *vm;
+    StmList stms;
+    VEC(VmBlock) blocks;
+    IdMap block_of;         /* label -> block */
+    IdMap refs;             /* label -> jumps to it */
+    IdMap regs;             /* temp -> register */
+    uint32_t ntemps, scratch, nregs;
+    VEC(VmIns) code;
+    IdMap label_at;         /* label -> instruction index */
+    VEC(uint32_t) fixups;   /* instructions whose `k` is a label to resolve */
+} VmCompiler;
+
+#define NO_BLOCK UINT32_MAX
+#define END_BLOCK (UINT32_MAX - 1)
+
+/* The statements of `s` in order, without -pg's line marks. */
+static void flatten(TStm *s, StmList *out)
+{
+    while (s && s->kind == TS_SEQ) {
+        flatten(s->u.seq.first, out);
+        s = s->u.seq.second;
+    }
+    if (s && s->kind != TS_LINE)
+        vec_push(out, s);
+}
+
+static void note_temp(VmCompiler *c, Temp t)
+{
+    if (t >= TEMP_NREGS && idmap_get(&c->regs, t, UINT32_MAX) == UINT32_MAX)
+        idmap_put(&c->regs, t, R_NFIXED + c->ntemps++);
+}
+
+static void note_exp(VmCompiler *c, const TExp *e)
+{
+    switch (e->kind) {
+    case TE_TEMP:
+        note_temp(c, e->u.temp);
+        break;
+    case TE_BINOP:
+        note_exp(c, e->u.bin.left);
+        note_exp(c, e->u.bin.right);
+        break;
+    case TE_MEM:
+        note_exp(c, e->u.mem);
+        break;
+    case TE_CALL:
+        note_exp(c, e->u.call.func);
+        for (uint32_t i = 0; i < e->u.call.nargs; i++)
+            note_exp(c, e->u.call.args[i]);
+        break;
+    default:
+        break;
+    }
+}
+
+static void note_ref(VmCompiler *c, Label l)
+{
+    idmap_put(&c->refs, l, idmap_get(&c->refs, l, 0) + 1);
+}
+
+static void note_stm(VmCompiler *c, const TStm *s)
+{
+    switch (s->kind) {
+    case TS_MOVE:
+        note_exp(c, s->u.move.dst);
+        note_exp(c, s->u.move.src);
+        break;
+    case TS_EXP:
+        note_exp(c, s->u.exp);
+        break;
+    case TS_JUMP:
+        for (uint32_t i = 0; i < s->u.jump.nlabels; i++)
+            note_ref(c, s->u.jump.labels[i]);
+        break;
+    case TS_CJUMP:
+        note_exp(c, s->u.cjump.left);
+        note_exp(c, s->u.cjump.right);
+        note_ref(c, s->u.cjump.t);
+        note_ref(c, s->u.cjump.f);
+        break;
+    default:
+        break;
+    }
+}
+
+static uint16_t reg_of(VmCompiler *c, Temp t)
+{
+    if (t == REG_FP)
+        return R_FP;
+    if (t == REG_RV)
+        return R_RV;
+    for (uint32_t i = 0; i < FRAME_NARG_REGS; i++)
+        if (t == arg_regs[i])
+            return (uint16_t)(R_ARG + i);
+    if (t < TEMP_NREGS)
+        fatal("--run: unexpected use of %%%s", reg_names[t]);
+    return (uint16_t)idmap_get(&c->regs, t, 0);
+}
+
+static uint16_t new_scratch(VmCompiler *c)
+{
+    if (c->scratch >= VM_MAX_REGS)
+        fatal("--run: function needs more than %u registers", VM_MAX_REGS);
+    if (c->scratch + 1 > c->nregs)
+        c->nregs = c->scratch + 1;
+    return (uint16_t)c->scratch++;
+}
+
+static VmIns *emit(VmCompiler *c, VmOp op, uint32_t a, uint32_t b, int32_t cc, int64_t k)
+{
+    vec_push(&c->code, ((VmIns){ .op = op, .a = (uint16_t)a, .b = (uint16_t)b, .c = cc, .k = k }));
+    return &c->code.data[c->code.len - 1];
+}
+
+/* An instruction whose `k` is label `l`, to become a jump target. */
+static void emit_jump(VmCompiler *c, VmOp op, uint32_t a, uint32_t b, int32_t cc, Label l)
+{
+    vec_push(&c->fixups, c->code.len);
+    emit(c, op, a, b, cc, l);
+}
+
+static bool imm32(const TExp *e, int32_t *v)
+{
+    if (e->kind != TE_CONST || e->u.value != (int32_t)e->u.value)
+        return false;
+    *v = (int32_t)e->u.value;
+    return true;
+}
+
+static int64_t address(VmCompiler *c, Label l)
+{
+    uint32_t i = idmap_get(&c->vm->addr_of, l, UINT32_MAX);
+    if (i != UINT32_MAX)
+        return c->vm->addrs.data[i];
+    Symbol s = label_sym(l);
+    if (s && strcmp(sym_name(s), "tiger_card_bias") == 0)
+        return (int64_t)(uintptr_t)&tiger_card_bias;
+    fatal("--run: no address for label %s", s ? sym_name(s) : "(anonymous)");
+}
+
+static void exp_into(VmCompiler *c, const TExp *e, uint16_t dst);
+
+static uint16_t exp_reg(VmCompiler *c, const TExp *e)
+{
+    if (e->kind == TE_TEMP)
+        return reg_of(c, e->u.temp);
+    uint16_t r = new_scratch(c);
+    exp_into(c, e, r);
+    return r;
+}
+
+/* An address as base + 8 index + disp, or as the absolute disp. */
+typedef struct VmAddr {
+    const TExp *base, *index;
+    int64_t disp;
+} VmAddr;
+
+static bool is_times8(const TExp *e)
+{
+    return e->kind == TE_BINOP && e->u.bin.right->kind == TE_CONST &&
+           ((e->op == T_MUL && e->u.bin.right->u.value == 8) ||
+            (e->op == T_LSHIFT && e->u.bin.right->u.value == 3));
+}
+
+static VmAddr split_addr(VmCompiler *c, const TExp *e)
+{
+    VmAddr a = { NULL, NULL, 0 };
+    if (e->kind == TE_BINOP && (e->op == T_PLUS || e->op == T_MINUS) &&
+        e->u.bin.right->kind == TE_CONST) {
+        a.disp = e->op == T_PLUS ? e->u.bin.right->u.value : -e->u.bin.right->u.value;
+        e = e->u.bin.left;
+    } else if (e->kind == TE_BINOP && e->op == T_PLUS && e->u.bin.left->kind == TE_CONST) {
+        a.disp = e->u.bin.left->u.value;
+        e = e->u.bin.right;
+    }
+    if (e->kind == TE_NAME) {
+        a.disp += address(c, e->u.name);
+        return a;
+    }
+    if (e->kind == TE_BINOP && e->op == T_PLUS) {
+        if (is_times8(e->u.bin.right)) {
+            a.base = e->u.bin.left;
+            a.index = e->u.bin.right->u.bin.left;
+            return a;
+        }
+        if (is_times8(e->u.bin.left)) {
+            a.base = e->u.bin.right;
+            a.index = e->u.bin.left->u.bin.left;
+            return a;
+        }
+    }
+    a.base = e;
+    return a;
+}
+
+static void load(VmCompiler *c, const TExp *addr, uint16_t dst)
+{
+    VmAddr a = split_addr(c, addr);
+    if (!a.base) {
+        emit(c, VM_LDA, dst, 0, 0, a.disp);
+    } else if (a.index) {
+        uint16_t b = exp_reg(c, a.base);
+        emit(c, VM_LDX, dst, b, exp_reg(c, a.index), a.disp);
+    } else if (a.disp == (int32_t)a.disp) {
+        emit(c, VM_LD, dst, exp_reg(c, a.base), (int32_t)a.disp, 0);
+    } else {
+        emit(c, VM_LD, dst, exp_reg(c, addr), 0, 0);
+    }
+}
+
+static void store(VmCompiler *c, const TExp *addr, const TExp *src)
+{
+    VmAddr a = split_addr(c, addr);
+    if (!a.base) {
+        emit(c, VM_STA, 0, exp_reg(c, src), 0, a.disp);
+    } else if (a.index) {
+        uint16_t b = exp_reg(c, a.base), i = exp_reg(c, a.index);
+        emit(c, VM_STX, b, exp_reg(c, src), i, a.disp);
+    } else if (a.disp == (int32_t)a.disp) {
+        uint16_t b = exp_reg(c, a.base);
+        emit(c, VM_ST, b, exp_reg(c, src), (int32_t)a.disp, 0);
+    } else {
+        uint16_t b = exp_reg(c, addr);
+        emit(c, VM_ST, b, exp_reg(c, src), 0, 0);
+    }
+}
+
+static void call(VmCompiler *c, const TExp *e, uint16_t dst)
+{
+    uint32_t n = e->u.call.nargs;
+    if (n > VM_MAX_ARGS)
+        fatal("--run: call with more than %u arguments", VM_MAX_ARGS);
+    uint16_t base = (uint16_t)c->scratch;
+    for (uint32_t i = 0; i < n; i++)
+        new_scratch(c);
+    for (uint32_t i = 0; i < n; i++)
+        exp_into(c, e->u.call.args[i], (uint16_t)(base + i));
+    if (e->u.call.func->kind != TE_NAME)
+        fatal("--run: indirect call");
+    Label l = e->u.call.func->u.name;
+    uint32_t f = idmap_get(&c->vm->func_of, l, UINT32_MAX);
+    if (f != UINT32_MAX) {
+        VmIns *i = emit(c, e->flags & TC_TAIL ? VM_TCALL : VM_CALL, dst, base, (int32_t)n, 0);
+        i->fn = &c->vm->funcs[f];
+        return;
+    }
+    const char *name = sym_name(label_sym(l));
+    for (uint32_t k = 0; k < ARRAY_LEN(builtins); k++)
+        if (strcmp(name, builtins[k].name) == 0) {
+            emit(c, VM_RTCALL, dst, base, (int32_t)n, 0)->rt = builtins[k].fn;
+            return;
+        }
+    fatal("--run: unknown function %s", name);
+}
+
+static bool commutes(TBinOp op)
+{
+    return op == T_PLUS || op == T_MUL || op == T_AND || op == T_OR || op == T_XOR;
+}
+
+static void exp_into(VmCompiler *c, const TExp *e, uint16_t dst)
+{
+    int32_t k;
+    switch (e->kind) {
+    case TE_CONST:
+        emit(c, VM_LI, dst, 0, 0, e->u.value);
+        return;
+    case TE_NAME:
+        emit(c, VM_LI, dst, 0, 0, address(c, e->u.name));
+        return;
+    case TE_TEMP:
+        if (reg_of(c, e->u.temp) != dst)
+            emit(c, VM_MOV, dst, reg_of(c, e->u.temp), 0, 0);
+        return;
+    case TE_BINOP: {
+        const TExp *l = e->u.bin.left, *r = e->u.bin.right;
+        if (imm32(r, &k)) {
+            emit(c, VM_ADDI + e->op, dst, exp_reg(c, l), k, 0);
+        } else if (commutes(e->op) && imm32(l, &k)) {
+            emit(c, VM_ADDI + e->op, dst, exp_reg(c, r), k, 0);
+        } else {
+            uint16_t x = exp_reg(c, l);
+            emit(c, VM_ADD + e->op, dst, x, exp_reg(c, r), 0);
+        }
+        return;
+    }
+    case TE_MEM:
+        load(c, e->u.mem, dst);
+        return;
+    case TE_CALL:
+        call(c, e, dst);
+        return;
+    default:
+        fatal("--run: ESEQ left in a canonical tree");
+    }
+}
+
+/* Whether `e` is the length word of array `base`: MEM(base - 8). */
+static bool length_of(const TExp *e, const TExp **base)
+{
+    if (e->kind != TE_MEM)
+        return false;
+    e = e->u.mem;
+    if (e->kind != TE_BINOP || e->op != T_MINUS || e->u.bin.right->kind != TE_CONST ||
+        e->u.bin.right->u.value != FRAME_WORD)
+        return false;
+    *base = e->u.bin.left;
+    return true;
+}
+
+/* Jump to `to` if the condition of CJUMP `s` holds. */
+static void cjump(VmCompiler *c, const TStm *s, Label to)
+{
+    const TExp *l = s->u.cjump.left, *r = s->u.cjump.right, *arr;
+    TRelOp op = (TRelOp)s->op;
+    int32_t k;
+    if (op == T_ULT && length_of(r, &arr)) {
+        uint16_t x = exp_reg(c, l);
+        emit_jump(c, VM_CHKJ, x, exp_reg(c, arr), 0, to);
+    } else if (imm32(r, &k)) {
+        emit_jump(c, VM_JEQI + op, exp_reg(c, l), 0, k, to);
+    } else if (imm32(l, &k)) {
+        emit_jump(c, VM_JEQI + t_commute_rel(op), exp_reg(c, r), 0, k, to);
+    } else {
+        uint16_t x = exp_reg(c, l);
+        emit_jump(c, VM_JEQ + op, x, exp_reg(c, r), 0, to);
+    }
+}
+
+static void stm(VmCompiler *c, const TStm *s)
+{
+    c->scratch = R_NFIXED + c->ntemps;
+    switch (s->kind) {
+    case TS_MOVE:
+        if (s->u.move.dst->kind == TE_TEMP)
+            exp_into(c, s->u.move.src, reg_of(c, s->u.move.dst->u.temp));
+        else if (s->u.move.dst->kind == TE_MEM)
+            store(c, s->u.move.dst->u.mem, s->u.move.src);
+        else
+            fatal("--run: bad MOVE destination");
+        return;
+    case TS_EXP:
+        if (s->u.exp->kind == TE_CALL)
+            call(c, s->u.exp, new_scratch(c));
+        else
+            exp_reg(c, s->u.exp);
+        return;
+    default:
+        return;
+    }
+}
+
+static uint32_t block_of(VmCompiler *c, Label l)
+{
+    uint32_t b = idmap_get(&c->block_of, l, NO_BLOCK);
+    if (b == NO_BLOCK)
+        fatal("--run: jump to a missing label");
+    return b;
+}
+
+/* Whether CJUMP `s` is a bounds check whose true successor starts by
+   loading the element it checks, and is reached from nowhere else. */
+static bool fuses(VmCompiler *c, const TStm *s)
+{
+    const TExp *arr;
+    if (s->op != T_ULT || s->u.cjump.left->kind != TE_TEMP ||
+        !length_of(s->u.cjump.right, &arr) || arr->kind != TE_TEMP ||
+        idmap_get(&c->refs, s->u.cjump.t, 0) != 1)
+        return false;
+    const VmBlock *t = &c->blocks.data[block_of(c, s->u.cjump.t)];
+    if (t->emitted || t->end - t->first < 2)
+        return false;
+    const TStm *ld = c->stms.data[t->first + 1];
+    if (ld->kind != TS_MOVE || ld->u.move.dst->kind != TE_TEMP ||
+        ld->u.move.src->kind != TE_MEM)
+        return false;
+    VmAddr a = split_addr(c, ld->u.move.src->u.mem);
+    return a.base && a.index && a.disp == 0 && a.base->kind == TE_TEMP &&
+           a.index->kind == TE_TEMP && a.base->u.temp == arr->u.temp &&
+           a.index->u.temp == s->u.cjump.left->u.temp;
+}
+
+/* Emit block `b` from its statement `from` on; returns the block it
+   falls into (END_BLOCK past the last, NO_BLOCK if none). */
+static uint32_t emit_block(VmCompiler *c, uint32_t b, uint32_t from)
+{
+    VmBlock *blk = &c->blocks.data[b];
+    blk->emitted = true;
+    if (from == blk->first)
+        idmap_put(&c->label_at, c->stms.data[blk->first]->u.label, c->code.len);
+    uint32_t end = blk->end;
+    const TStm *last = c->stms.data[end - 1];
+    bool term = end - 1 > blk->first && (last->kind == TS_JUMP || last->kind == TS_CJUMP);
+    for (uint32_t i = from > blk->first ? from : blk->first + 1; i < end - term; i++)
+        stm(c, c->stms.data[i]);
+    if (term && last->kind == TS_JUMP) {
+        if (last->u.jump.target->kind != TE_NAME)
+            fatal("--run: computed jump");
+        emit_jump(c, VM_JMP, 0, 0, 0, last->u.jump.target->u.name);
+        return NO_BLOCK;
+    }
+    if (term) {
+        c->scratch = R_NFIXED + c->ntemps;
+        if (fuses(c, last)) {
+            uint32_t t = block_of(c, last->u.cjump.t);
+            const TStm *ld = c->stms.data[c->blocks.data[t].first + 1];
+            VmAddr a = split_addr(c, ld->u.move.src->u.mem);
+            emit_jump(c, VM_CHKLD, reg_of(c, ld->u.move.dst->u.temp), reg_of(c, a.base->u.temp),
+                      reg_of(c, a.index->u.temp), last->u.cjump.f);
+            return emit_block(c, t, c->blocks.data[t].first + 2);
+        }
+        cjump(c, last, last->u.cjump.t);
+        return block_of(c, last->u.cjump.f);
+    }
+    return b + 1 < c->blocks.len ? b + 1 : END_BLOCK;
+}
+
+static void fall_into(VmCompiler *c, uint32_t b)
+{
+    if (b == END_BLOCK)
+        emit(c, VM_RET, 0, 0, 0, 0);
+    else
+        emit_jump(c, VM_JMP, 0, 0, 0, c->stms.data[c->blocks.data[b].first]->u.label);
+}
+
+static void compile_func(Vm *vm, VmFunc *f, const Frag *fr)
+{
+    VmCompiler c = { .vm = vm };
+    flatten(fr->u.proc.body, &c.stms);
+    for (uint32_t i = 0; i < c.stms.len; i++) {
+        const TStm *s = c.stms.data[i];
+        if (s->kind == TS_LABEL) {
+            if (c.blocks.len)
+                c.blocks.data[c.blocks.len - 1].end = i;
+            idmap_put(&c.block_of, s->u.label, c.blocks.len);
+            vec_push(&c.blocks, ((VmBlock){ i, c.stms.len, false }));
+            /* A fall-through into a label counts as a jump to it. */
+            if (i && c.stms.data[i - 1]->kind != TS_JUMP && c.stms.data[i - 1]->kind != TS_CJUMP)
+                note_ref(&c, s->u.label);
+        } else if (!c.blocks.len) {
+            fatal("--run: function body does not start with a label");
+        }
+        note_stm(&c, s);
+    }
+    if (R_NFIXED + c.ntemps >= VM_MAX_REGS)
+        fatal("--run: function needs more than %u registers", VM_MAX_REGS);
+    c.nregs = c.scratch = R_NFIXED + c.ntemps;
+
+    uint32_t pending = NO_BLOCK;
+    for (uint32_t b = 0; b < c.blocks.len; b++) {
+        if (c.blocks.data[b].emitted)
+            continue;
+        if (pending != NO_BLOCK && pending != b)
+            fall_into(&c, pending);
+        pending = emit_block(&c, b, c.blocks.data[b].first);
+    }
+    if (pending != NO_BLOCK)
+        fall_into(&c, pending);
+
+    for (uint32_t i = 0; i < c.fixups.len; i++) {
+        VmIns *ins = &c.code.data[c.fixups.data[i]];
+        uint32_t at = idmap_get(&c.label_at, (Label)ins->k, UINT32_MAX);
+        if (at == UINT32_MAX)
+            fatal("--run: jump to a label with no code");
+        ins->to = &c.code.data[at];
+    }
+    const void *const *handlers = execute(NULL, NULL);
+    for (uint32_t i = 0; i < c.code.len; i++)
+        c.code.data[i].h = handlers[c.code.data[i].op];
+    f->code = c.code.data;
+    f->nregs = c.nregs;
+    f->locals = fr->u.proc.frame->locals;
+
+    vec_free(&c.stms);
+    vec_free(&c.blocks);
+    vec_free(&c.fixups);
+    idmap_free(&c.block_of);
+    idmap_free(&c.refs);
+    idmap_free(&c.regs);
+    idmap_free(&c.label_at);
+}
+
+/* ---- Execution ------------------------------------------------------------ */
+
+
+static noreturn void overflow(void)
+{
+    tiger_flush();
+    fputs("tiger: stack overflow\n", stderr);
+    exit(1);
+}
+
+static int64_t divide(int64_t n, int64_t d)
+{
+    if (d == 0 || (d == -1 && n == INT64_MIN)) {
+        raise(SIGFPE);      /* as idivq would */
+        return n;
+    }
+    return n / d;
+}
+
+/* A frame for `f` below `top`: stack arguments, the saved frame pointer
+   and return address words, the frame slots and the register window. */
+static int64_t *enter(const VmFunc *f, const int64_t *args, uint32_t n, char *top,
+                      int64_t caller_fp)
+{
+    uint32_t nstack = n > FRAME_NARG_REGS ? n - FRAME_NARG_REGS : 0;
+    int64_t *fp = (int64_t *)top - nstack - 2;
+    int64_t *r = (int64_t *)((char *)fp - f->locals) - f->nregs;
+    if ((char *)r < vm_stack_lo)
+        overflow();
+    fp[0] = caller_fp;
+    fp[1] = 0;
+    for (uint32_t k = 0; k < nstack; k++)
+        fp[2 + k] = args[FRAME_NARG_REGS + k];
+    r[R_FP] = (int64_t)fp;
+    for (uint32_t i = 0; i < n && i < FRAME_NARG_REGS; i++)
+        r[R_ARG + i] = args[i];
+    r[R_TOP] = (int64_t)top;
+    return r;
+}
+
+/* Run from `ip` in window `r` until tigermain returns.  With a NULL
+   `ip`, return the handler of each VmOp instead. */
+static const void *const *execute(const VmIns *ip, int64_t *r)
+{
+    static const void *const handlers[] = {
+#define X(op) &&op_##op,
+        VM_OPS(X)
+#undef X
+    };
+    if (!ip)
+        return handlers;
+
+#define NEXT goto *(++ip)->h
+#define GO(t) goto *(ip = (t))->h
+#define M(x) (*(int64_t *)(x))
+#define U(x) ((uint64_t)(x))
+#define A r[ip->a]
+#define B r[ip->b]
+#define C r[ip->c]
+
+    goto *ip->h;
+op_MOV: A = B; NEXT;
+op_LI: A = ip->k; NEXT;
+op_ADD: A = (int64_t)(U(B) + U(C)); NEXT;
+op_SUB: A = (int64_t)(U(B) - U(C)); NEXT;
+op_MUL: A = (int64_t)(U(B) * U(C)); NEXT;
+op_DIV: A = divide(B, C); NEXT;
+op_AND: A = B & C; NEXT;
+op_OR: A = B | C; NEXT;
+op_XOR: A = B ^ C; NEXT;
+op_SHL: A = (int64_t)(U(B) << (C & 63)); NEXT;
+op_SHR: A = (int64_t)(U(B) >> (C & 63)); NEXT;
+op_SAR: A = B >> (C & 63); NEXT;
+op_ADDI: A = (int64_t)(U(B) + U((int64_t)ip->c)); NEXT;
+op_SUBI: A = (int64_t)(U(B) - U((int64_t)ip->c)); NEXT;
+op_MULI: A = (int64_t)(U(B) * U((int64_t)ip->c)); NEXT;
+op_DIVI: A = divide(B, ip->c); NEXT;
+op_ANDI: A = B & ip->c; NEXT;
+op_ORI: A = B | ip->c; NEXT;
+op_XORI: A = B ^ ip->c; NEXT;
+op_SHLI: A = (int64_t)(U(B) << (ip->c & 63)); NEXT;
+op_SHRI: A = (int64_t)(U(B) >> (ip->c & 63)); NEXT;
+op_SARI: A = B >> (ip->c & 63); NEXT;
+op_LD: A = M(B + ip->c); NEXT;
+op_LDX: A = M(B + C * 8 + ip->k); NEXT;
+op_LDA: A = M(ip->k); NEXT;
+op_ST: M(A + ip->c) = B; NEXT;
+op_STX: M(A + C * 8 + ip->k) = B; NEXT;
+op_STA: M(ip->k) = B; NEXT;
+op_JEQ: if (A == B) GO(ip->to); NEXT;
+op_JNE: if (A != B) GO(ip->to); NEXT;
+op_JLT: if (A < B) GO(ip->to); NEXT;
+op_JGT: if (A > B) GO(ip->to); NEXT;
+op_JLE: if (A <= B) GO(ip->to); NEXT;
+op_JGE: if (A >= B) GO(ip->to); NEXT;
+op_JULT: if (U(A) < U(B)) GO(ip->to); NEXT;
+op_JULE: if (U(A) <= U(B)) GO(ip->to); NEXT;
+op_JUGT: if (U(A) > U(B)) GO(ip->to); NEXT;
+op_JUGE: if (U(A) >= U(B)) GO(ip->to); NEXT;
+op_JEQI: if (A == ip->c) GO(ip->to); NEXT;
+op_JNEI: if (A != ip->c) GO(ip->to); NEXT;
+op_JLTI: if (A < ip->c) GO(ip->to); NEXT;
+op_JGTI: if (A > ip->c) GO(ip->to); NEXT;
+op_JLEI: if (A <= ip->c) GO(ip->to); NEXT;
+op_JGEI: if (A >= ip->c) GO(ip->to); NEXT;
+op_JULTI: if (U(A) < U((int64_t)ip->c)) GO(ip->to); NEXT;
+op_JULEI: if (U(A) <= U((int64_t)ip->c)) GO(ip->to); NEXT;
+op_JUGTI: if (U(A) > U((int64_t)ip->c)) GO(ip->to); NEXT;
+op_JUGEI: if (U(A) >= U((int64_t)ip->c)) GO(ip->to); NEXT;
+op_JMP: GO(ip->to);
+op_CHKJ: if (U(A) < U(M(B - FRAME_WORD))) GO(ip->to); NEXT;
+op_CHKLD: {
+        const int64_t *arr = (const int64_t *)B;
+        if (U(C) >= U(arr[-1]))
+            GO(ip->to);
+        A = arr[C];
+        NEXT;
+    }
+op_CALL: {
+        const VmFunc *f = ip->fn;
+        int64_t *w = enter(f, &B, (uint32_t)ip->c, (char *)r, r[R_FP]);
+        w[R_PC] = (int64_t)(ip + 1);
+        w[R_REGS] = (int64_t)r;
+        w[R_DST] = ip->a;
+        r = w;
+        GO(f->code);
+    }
+op_TCALL: {
+        const VmFunc *f = ip->fn;
+        int64_t args[VM_MAX_ARGS];
+        memcpy(args, &B, (size_t)ip->c * sizeof *args);
+        int64_t pc = r[R_PC], regs = r[R_REGS], dst = r[R_DST];
+        int64_t *w = enter(f, args, (uint32_t)ip->c, (char *)r[R_TOP], M(r[R_FP]));
+        w[R_PC] = pc;
+        w[R_REGS] = regs;
+        w[R_DST] = dst;
+        r = w;
+        GO(f->code);
+    }
+op_RTCALL:
+    vm_sp = r;
+    A = ip->rt(&B);
+    NEXT;
+op_RET: {
+        int64_t v = r[R_RV], *caller = (int64_t *)r[R_REGS];
+        if (!caller)
+            return NULL;
+        ip = (const VmIns *)r[R_PC];
+        caller[r[R_DST]] = v;
+        r = caller;
+        goto *ip->h;
+    }
+
+#undef NEXT
+#undef GO
+#undef M
+#undef U
+#undef A
+#undef B
+#undef C
+}
+
+/* Lay out the globals at the top of the stack and the string literals
+   on the heap of the compiler, and give every data label its address. */
+static void layout_data(Vm *vm, Program *p)
+{
+    uint32_t nglobals = 0;
+    for (uint32_t i = 0; i < p->frags.len; i++)
+        nglobals += p->frags.data[i].kind == FRAG_GLOBAL;
+    vm->globals = vm->stack + VM_STACK - (size_t)nglobals * FRAME_WORD;
+    int64_t *g = (int64_t *)vm->globals;
+    for (uint32_t i = 0; i < p->frags.len; i++) {
+        const Frag *f = &p->frags.data[i];
+        if (f->kind == FRAG_GLOBAL) {
+            *g = f->u.global.constant ? f->u.global.value : 0;
+            idmap_put(&vm->addr_of, f->label, vm->addrs.len);
+            vec_push(&vm->addrs, (int64_t)g++);
+        } else if (f->kind == FRAG_STRING) {
+            uint32_t n = sym_len(f->u.string.str);
+            char *s = xmalloc(FRAME_WORD + n + 1);
+            *(int64_t *)s = n;
+            memcpy(s + FRAME_WORD, sym_name(f->u.string.str), n + 1);
+            vec_push(&vm->strings, s);
+            idmap_put(&vm->addr_of, f->label, vm->addrs.len);
+            vec_push(&vm->addrs, (int64_t)(s + FRAME_WORD));
+        }
+    }
+}
+
+void vm_run(Program *p)
+{
+    Vm vm = {0};
+    vm.stack = mmap(NULL, VM_STACK, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (vm.stack == MAP_FAILED)
+        fatal("--run: cannot map the stack");
+    vm_stack_lo = vm.stack;
+    layout_data(&vm, p);
+
+    uint32_t nfuncs = 0;
+    for (uint32_t i = 0; i < p->frags.len; i++)
+        if (p->frags.data[i].kind == FRAG_PROC)
+            idmap_put(&vm.func_of, p->frags.data[i].label, nfuncs++);
+    vm.funcs = xcalloc(nfuncs, sizeof *vm.funcs);
+    for (uint32_t i = 0, k = 0; i < p->frags.len; i++)
+        if (p->frags.data[i].kind == FRAG_PROC)
+            compile_func(&vm, &vm.funcs[k++], &p->frags.data[i]);
+
+    tiger_init(__builtin_frame_address(0));
+    gc_add_stack((void *const *)&vm_sp, vm.stack + VM_STACK);
+    vm_sp = vm.globals;
+    int64_t *r = enter(&vm.funcs[0], NULL, 0, vm.globals, 0);
+    r[R_REGS] = 0;
+    execute(vm.funcs[0].code, r);
+    tiger_flush();
+
+    for (uint32_t f = 0; f < nfuncs; f++)
+        free(vm.funcs[f].code);
+    free(vm.funcs);
+    for (uint32_t i = 0; i < vm.strings.len; i++)
+        free(vm.strings.data[i]);
+    vec_free(&vm.strings);
+    vec_free(&vm.addrs);
+    idmap_free(&vm.func_of);
+    idmap_free(&vm.addr_of);
+    munmap(vm.stack, VM_STACK);
+}
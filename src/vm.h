@@ -0,0 +1,20 @@
+#ifndef TIGER_VM_H
+#define TIGER_VM_H
+
+#include "translate.h"
+
+/*
+ * tigerc --run: an interpreter for a lowered program, which leaves the
+ * assembler and linker out of an edit-run cycle.  Every function's
+ * canonical trees become register bytecode, one register per temp, run
+ * by a direct-threaded dispatch loop that calls the runtime linked into
+ * tigerc.  Frames keep the layout of frame.h on a stack of the VM's own,
+ * so frame slots, static links and stack arguments work unchanged; the
+ * collector scans that stack conservatively.
+ */
+
+/* Run `p` to the end of tigermain().  exit() and runtime errors end
+   the process from inside. */
+void vm_run(Program *p);
+
+#endif
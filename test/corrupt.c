@@ -0,0 +1,46 @@
+/*
+ * Copies a file with about one byte in 200 past the first SKIP
+ * overwritten, the same bytes for the same SEED, for the tests of a
+ * damaged code cache:
+ *
+ *   corrupt IN OUT SKIP SEED
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+int main(int argc, char **argv)
+{
+    if (argc != 5) {
+        fprintf(stderr, "usage: corrupt IN OUT SKIP SEED\n");
+        return 2;
+    }
+    FILE *in = fopen(argv[1], "rb");
+    if (!in) {
+        perror(argv[1]);
+        return 1;
+    }
+    size_t cap = 1 << 16, len = 0, n;
+    unsigned char *buf = malloc(cap);
+    while ((n = fread(buf + len, 1, cap - len, in)) > 0)
+        if ((len += n) == cap)
+            buf = realloc(buf, cap *= 2);
+    fclose(in);
+
+    /* Digits, among others, so that label placeholders get mangled too. */
+    size_t skip = strtoul(argv[3], NULL, 10);
+    unsigned long long x = strtoull(argv[4], NULL, 10) * 0x9e3779b97f4a7c15ull + 1;
+    for (size_t i = skip; i < len; i++) {
+        x = x * 6364136223846793005ull + 1442695040888963407ull;
+        if ((x >> 33) % 200 == 0)
+            buf[i] = (x >> 41) & 1 ? (unsigned char)('0' + (x >> 42) % 10)
+                                   : (unsigned char)(x >> 50);
+    }
+
+    FILE *out = fopen(argv[2], "wb");
+    if (!out || fwrite(buf, 1, len, out) != len || fclose(out) != 0) {
+        perror(argv[2]);
+        return 1;
+    }
+    free(buf);
+    return 0;
+}
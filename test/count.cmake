@@ -0,0 +1,14 @@
+# The output of tigerc must match PATTERN exactly COUNT times.
+# Usage: cmake -DTIGERC=... -DARGS=<;-list> -DPATTERN=... -DCOUNT=... -P count.cmake
+
+execute_process(COMMAND ${TIGERC} ${ARGS}
+  OUTPUT_VARIABLE out ERROR_VARIABLE err RESULT_VARIABLE rc)
+if(NOT rc EQUAL 0)
+  message(FATAL_ERROR "tigerc ${ARGS} failed (${rc}):\n${err}")
+endif()
+
+string(REGEX MATCHALL "${PATTERN}" hits "${out}")
+list(LENGTH hits n)
+if(NOT n EQUAL COUNT)
+  message(FATAL_ERROR "expected ${COUNT} matches of '${PATTERN}', found ${n}:\n${out}")
+endif()
@@ -0,0 +1,10 @@
+# Feed the requests in INPUT to ${TIGERC} --daemon ${FLAGS} and echo its
+# answers for PASS_REGULAR_EXPRESSION checks.
+# Usage: cmake -DTIGERC=... -DINPUT=... [-DFLAGS=...] -P daemon.cmake
+
+execute_process(COMMAND ${TIGERC} --daemon ${FLAGS} INPUT_FILE ${INPUT}
+  OUTPUT_VARIABLE out ERROR_VARIABLE err RESULT_VARIABLE rc)
+message("${out}${err}")
+if(NOT rc EQUAL 0)
+  message(FATAL_ERROR "tigerc --daemon exited with ${rc}")
+endif()
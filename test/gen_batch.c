@@ -0,0 +1,62 @@
+/*
+ * Writes the large declaration-batch programs used by the semant tests:
+ *
+ *   gen_batch chain|cycle|functions|nested N > out.tig
+ *
+ * `nested` is N lets inside one another, each shadowing a rotating set
+ * of type, variable and function names and reading outer ones.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+int main(int argc, char **argv)
+{
+    if (argc != 3) {
+        fprintf(stderr, "usage: gen_batch chain|cycle|functions|nested N\n");
+        return 2;
+    }
+    const char *kind = argv[1];
+    long n = strtol(argv[2], NULL, 10);
+
+    if (strcmp(kind, "chain") == 0) {
+        /* t0 is a record whose field reaches back through n aliases. */
+        printf("let type t0 = {next: t%ld}\n", n);
+        for (long i = 1; i <= n; i++)
+            printf("type t%ld = t%ld\n", i, i - 1);
+        printf("var x: t%ld := nil in x = nil end\n", n);
+    } else if (strcmp(kind, "cycle") == 0) {
+        printf("let\n");
+        for (long i = 1; i <= n; i++)
+            printf("type c%ld = c%ld\n", i, i % n + 1);
+        printf("in 0 end\n");
+    } else if (strcmp(kind, "functions") == 0) {
+        printf("let\n");
+        for (long i = 1; i <= n; i++)
+            printf("function f%ld(n: int): int = if n = 0 then 0 else f%ld(n - 1)\n",
+                   i, i % n + 1);
+        printf("in f1(10) end\n");
+    } else if (strcmp(kind, "nested") == 0) {
+        printf("let type t0 = int\n");
+        for (int k = 0; k < 8; k++)
+            printf("var v%d: t0 := %d\n", k, k);
+        printf("function f0(x: int): int = x\nin\n");
+        for (long i = 1; i <= n; i++) {
+            long k = i % 8;
+            printf("let type t%ld = t%ld\n"
+                   "var v%ld: t%ld := f%ld(v%ld) + 1\n"
+                   "function f%ld(x: t%ld): int = x + v%ld + f0(v%ld)\n"
+                   "in\n",
+                   k, k ? k - 1 : 7,
+                   k, k, i > 1 ? (i - 1) % 8 : 0, (k + 3) % 8,
+                   k, k, k, (k + 5) % 8);
+        }
+        printf("v0 + 0\n");
+        for (long i = 0; i <= n; i++)
+            printf("end\n");
+    } else {
+        fprintf(stderr, "gen_batch: unknown kind '%s'\n", kind);
+        return 2;
+    }
+    return 0;
+}
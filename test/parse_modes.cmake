@@ -0,0 +1,13 @@
+# Both parser drivers must build the same tree.
+# Usage: cmake -DTIGERC=... -DINPUT=... -P parse_modes.cmake
+
+execute_process(COMMAND ${TIGERC} -fparser=recursive --dump-ast ${INPUT}
+  OUTPUT_VARIABLE rec_out ERROR_VARIABLE rec_err RESULT_VARIABLE rec_rc)
+execute_process(COMMAND ${TIGERC} -fparser=explicit --dump-ast ${INPUT}
+  OUTPUT_VARIABLE exp_out ERROR_VARIABLE exp_err RESULT_VARIABLE exp_rc)
+
+if(NOT rec_rc STREQUAL exp_rc OR NOT rec_out STREQUAL exp_out OR NOT rec_err STREQUAL exp_err)
+  message(FATAL_ERROR "parser modes disagree on ${INPUT}:\n"
+    "recursive (${rec_rc}):\n${rec_out}${rec_err}\n"
+    "explicit (${exp_rc}):\n${exp_out}${exp_err}")
+endif()
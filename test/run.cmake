@@ -0,0 +1,30 @@
+# Compile SRC with ${TIGERC} ${FLAGS} into EXE, run it with stdin from
+# INPUT (if set) and the NAME=VALUE settings in ENV (if set) in its
+# environment, and check its output against EXPECT (if set).  The output
+# and any diagnostics are echoed for PASS_REGULAR_EXPRESSION checks.
+# Without EXE, SRC is interpreted by tigerc --run instead.
+
+if(EXE)
+  execute_process(COMMAND ${TIGERC} ${FLAGS} -o ${EXE} ${SRC} RESULT_VARIABLE rc)
+  if(NOT rc EQUAL 0)
+    message(FATAL_ERROR "tigerc exited with ${rc}")
+  endif()
+  set(_run ${EXE})
+else()
+  set(_run ${TIGERC} ${FLAGS} --run ${SRC})
+endif()
+if(INPUT)
+  set(_in INPUT_FILE ${INPUT})
+endif()
+execute_process(COMMAND ${CMAKE_COMMAND} -E env ${ENV} ${_run} ${_in}
+  OUTPUT_VARIABLE out ERROR_VARIABLE err RESULT_VARIABLE rc)
+message("${out}${err}")
+if(NOT rc EQUAL 0)
+  message(FATAL_ERROR "${_run} exited with ${rc}")
+endif()
+if(EXPECT)
+  file(READ ${EXPECT} want)
+  if(NOT out STREQUAL want)
+    message(FATAL_ERROR "output differs from ${EXPECT}")
+  endif()
+endif()